@@ -0,0 +1,771 @@
+/**
+\file contactino_benchmark.cpp
+Benchmark of the contact search and assembly on synthetic scalable contact problems
+
+Each problem is generated for a sequence of mesh densities (10^3, 10^4, ... Gauss points)
+and the library functions are timed separately. The reported time is the minimum over
+the repetitions, in milliseconds.
+
+Problems:
+  cylinder2d - 2D cylinder pressed into a plane (2-node segments, sfd2)
+  blocks3d   - 3D block on a block (8-node quadrilaterals, non-matching meshes)
+  sphere3d   - 3D sphere on a plane (6-node triangles, sfd6)
+  sphere3d-quad4 - 3D sphere on a plane (4-node quadrilaterals, sfd4)
+  ironing2d  - 2D ironing, a punch sliding over a strip with friction
+
+Usage:
+  contactino_benchmark [--problem NAME|all] [--min-gps N] [--max-gps N] [--repeat N]
+                       [--threads N] [--memory-limit GB] [--occupancy T] [--csv]
+
+The bucket grid is tuned by getAutoBucketGridSize to the mean occupancy T (4 by default),
+--occupancy 0 selects buckets of the size of the longest edge (getBucketGridSize).
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <string>
+#include <vector>
+
+#include "contactino.h"
+
+/*! Contact surface of a synthetic problem (the arguments of the library functions) */
+struct ContactProblem {
+  int nsd;                          // Number of Space Dimensions
+  int npd;                          // Number of Parametric Dimensions
+  int nsn;                          // Number of Segment Nodes
+  int ngp;                          // Number of Gauss Points on a segment
+  int nen;                          // Number of Element Nodes (the segments are the elements)
+  int nes;                          // Number of Element Segments
+  std::vector<double> X;            // 2d array (nnod x nsd) of nodal coords
+  std::vector<double> U;            // 2d array (nnod x nsd) of nodal displacements
+  std::vector<int> IEN;             // 2d array (nen x number of elements), 1-based
+  std::vector<int> ISN;             // 2d array (nes x nsn), 1-based
+  std::vector<int> elementID;       // 1-based
+  std::vector<int> segmentID;       // 1-based
+  std::vector<double> H;            // shape functions at Gauss points (nsn x ngp)
+  std::vector<double> dH;           // their derivatives (nsn x npd*ngp)
+  std::vector<double> gw;           // Gauss weights
+  double mu;                        // friction coefficient
+  bool isIroning;                   // the search runs in the displaced configuration X+U
+
+  int numOfNodes() const { return (int)X.size() / nsd; }
+  int numOfSegments() const { return (int)elementID.size(); }
+};
+
+/*! Add a 2D node, returns its 1-based index */
+static int addNode(ContactProblem& p, std::vector<double>& y, double x0, double x1) {
+  p.X.push_back(x0);
+  y.push_back(x1);
+  return (int)p.X.size();
+}
+
+/*! Shape functions of 2-node segments at 2 Gauss points */
+static void setGaussPoints2D(ContactProblem& p) {
+  const double a = 1.0 / sqrt(3.0);
+  const double r[2] = {-a, a};
+  p.ngp = 2;
+  p.H.assign(p.nsn*p.ngp, 0.0);
+  p.dH.assign(p.nsn*p.npd*p.ngp, 0.0);
+  p.gw.assign(p.ngp, 1.0);
+  for (int g = 0; g < p.ngp; ++g) {
+    double H[2];
+    double dH[2];
+    sfd2(H, dH, r[g]);
+    for (int j = 0; j < p.nsn; ++j) {
+      p.H[j*p.ngp + g] = H[j];
+      p.dH[j*p.npd*p.ngp + g] = dH[j];
+    }
+  }
+}
+
+/*! Shape functions of 8-node quadrilaterals (2x2 Gauss points) or 6-node triangles (3 Gauss points) */
+static void setGaussPoints3D(ContactProblem& p) {
+  std::vector<double> r;
+  std::vector<double> s;
+  if (p.nsn == 6) {
+    const double rr[3] = {1.0/6.0, 2.0/3.0, 1.0/6.0};
+    const double ss[3] = {1.0/6.0, 1.0/6.0, 2.0/3.0};
+    r.assign(rr, rr + 3);
+    s.assign(ss, ss + 3);
+    p.gw.assign(3, 1.0/6.0);
+  }
+  else {
+    const double a = 1.0 / sqrt(3.0);
+    const double rr[4] = {-a, a, a, -a};
+    const double ss[4] = {-a, -a, a, a};
+    r.assign(rr, rr + 4);
+    s.assign(ss, ss + 4);
+    p.gw.assign(4, 1.0);
+  }
+  p.ngp = (int)r.size();
+
+  // Batch layout: the k-th entry of the g-th point is at k*ngp + g
+  std::vector<double> H(p.nsn*p.ngp);
+  std::vector<double> dH(p.nsn*p.npd*p.ngp);
+  if (p.nsn == 6) {
+    sfd6Batch(&H[0], &dH[0], &r[0], &s[0], p.ngp);
+  }
+  else if (p.nsn == 4) {
+    sfd4Batch(&H[0], &dH[0], &r[0], &s[0], p.ngp);
+  }
+  else {
+    sfd8Batch(&H[0], &dH[0], &r[0], &s[0], p.ngp);
+  }
+  p.H = H;
+  p.dH.assign(p.nsn*p.npd*p.ngp, 0.0);
+  for (int j = 0; j < p.nsn; ++j) {
+    for (int g = 0; g < p.ngp; ++g) {
+      for (int pdf = 0; pdf < p.npd; ++pdf) {
+        p.dH[j*p.npd*p.ngp + g*p.npd + pdf] = dH[(pdf*p.nsn + j)*p.ngp + g];
+      }
+    }
+  }
+}
+
+/*! Indenter (cylinder or sphere) flattened by the contact with the plane y = 0 (z = 0 in 3D)
+
+The part closer than contactRadius to the axis is pressed into the plane by at most
+penetration, which is a fraction of the segment size, so that the contact zone does not
+shrink with the mesh density. The rest is the circle lifted to join it.
+*/
+struct IndenterProfile {
+  double radius;
+  double contactRadius;
+  double penetration;
+
+  // height above the plane at the distance r from the axis
+  double operator()(double r) const {
+    if (fabs(r) < contactRadius) {
+      return -penetration*(1.0 - r*r / (contactRadius*contactRadius));
+    }
+    return sqrt(radius*radius - contactRadius*contactRadius) - sqrt(radius*radius - r*r);
+  }
+};
+
+/*! 2D plane y = 0 on x in <xmin, xmax> (outward normal +y) and an indenter above it (outward normal -y)
+
+\param m - number of segments of the plane
+\param mc - number of segments of the indenter
+\param axis - x coord of the axis of the indenter
+\param halfAngle - the indenter spans the angles <1.5*pi - halfAngle, 1.5*pi + halfAngle> of its circle
+*/
+static ContactProblem makeIndenterOnPlane(int m, int mc, double xmin, double xmax, double axis, const IndenterProfile& profile, double halfAngle) {
+  ContactProblem p;
+  p.nsd = 2;
+  p.npd = 1;
+  p.nsn = 2;
+  p.nen = 2;
+  p.nes = 1;
+  p.ISN.push_back(1);
+  p.ISN.push_back(2);
+  p.mu = 0.0;
+  p.isIroning = false;
+
+  std::vector<double> y;
+  // Plane, segments in the direction of decreasing x:
+  int previous = addNode(p, y, xmin, 0.0);
+  for (int i = 1; i <= m; ++i) {
+    const int node = addNode(p, y, xmin + (xmax - xmin)*i/m, 0.0);
+    p.IEN.push_back(node);
+    p.IEN.push_back(previous);
+    previous = node;
+  }
+  // Indenter, segments in the direction of increasing x:
+  for (int i = 0; i <= mc; ++i) {
+    const double angle = 1.5*M_PI - halfAngle + 2.0*halfAngle*i/mc;
+    const double r = profile.radius*cos(angle);
+    const int node = addNode(p, y, axis + r, profile(r));
+    if (i > 0) {
+      p.IEN.push_back(previous);
+      p.IEN.push_back(node);
+    }
+    previous = node;
+  }
+  p.X.insert(p.X.end(), y.begin(), y.end());
+
+  for (int e = 0; e < m + mc; ++e) {
+    p.elementID.push_back(e + 1);
+    p.segmentID.push_back(1);
+  }
+  p.U.assign(p.X.size(), 0.0);
+  setGaussPoints2D(p);
+  return p;
+}
+
+/*! Structured quadratic surface mesh of the rectangle <x0, x1> x <y0, y1> with z = surface(x, y)
+
+\param m0, m1 - number of cells in the x and y direction
+\param nsn - 8 for 8-node quadrilaterals, 6 for 6-node triangles (two per cell), 4 for 4-node quadrilaterals (four per cell)
+\param isUpper - the body lies above the surface, so the outward normal points to -z
+*/
+template <class Surface>
+static void addQuadraticSurface(ContactProblem& p, std::vector<double>& y, std::vector<double>& z, int m0, int m1, double x0, double x1, double y0, double y1, bool isUpper, Surface surface) {
+  const int q0 = 2*m0 + 1;
+  const int q1 = 2*m1 + 1;
+  const int offset = (int)p.X.size();
+  for (int b = 0; b < q1; ++b) {
+    for (int a = 0; a < q0; ++a) {
+      const double xx = x0 + (x1 - x0)*a/(q0 - 1);
+      const double yy = y0 + (y1 - y0)*b/(q1 - 1);
+      p.X.push_back(xx);
+      y.push_back(yy);
+      z.push_back(surface(xx, yy));
+    }
+  }
+
+  std::vector<int> c;
+  for (int jb = 0; jb < m1; ++jb) {
+    for (int ja = 0; ja < m0; ++ja) {
+      const int a = 2*ja;
+      const int b = 2*jb;
+      // 1-based node indices of the 3x3 cell nodes:
+      int n[3][3];
+      for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+          n[i][j] = offset + (b + j)*q0 + a + i + 1;
+        }
+      }
+
+      if (p.nsn == 4) {
+        for (int j = 0; j < 2; ++j) {
+          for (int i = 0; i < 2; ++i) {
+            if (!isUpper) {
+              const int cell[4] = {n[i][j], n[i+1][j], n[i+1][j+1], n[i][j+1]};
+              c.assign(cell, cell + 4);
+            }
+            else {
+              const int cell[4] = {n[i][j], n[i][j+1], n[i+1][j+1], n[i+1][j]};
+              c.assign(cell, cell + 4);
+            }
+            p.IEN.insert(p.IEN.end(), c.begin(), c.end());
+            p.elementID.push_back(p.numOfSegments() + 1);
+            p.segmentID.push_back(1);
+          }
+        }
+      }
+      else if (p.nsn == 8) {
+        if (!isUpper) {
+          const int cell[8] = {n[0][0], n[2][0], n[2][2], n[0][2], n[1][0], n[2][1], n[1][2], n[0][1]};
+          c.assign(cell, cell + 8);
+        }
+        else {
+          const int cell[8] = {n[0][0], n[0][2], n[2][2], n[2][0], n[0][1], n[1][2], n[2][1], n[1][0]};
+          c.assign(cell, cell + 8);
+        }
+        p.IEN.insert(p.IEN.end(), c.begin(), c.end());
+        p.elementID.push_back(p.numOfSegments() + 1);
+        p.segmentID.push_back(1);
+      }
+      else {
+        if (!isUpper) {
+          const int cell[12] = {n[0][0], n[2][0], n[2][2], n[1][0], n[2][1], n[1][1],
+                                n[0][0], n[2][2], n[0][2], n[1][1], n[1][2], n[0][1]};
+          c.assign(cell, cell + 12);
+        }
+        else {
+          const int cell[12] = {n[0][0], n[2][2], n[2][0], n[1][1], n[2][1], n[1][0],
+                                n[0][0], n[0][2], n[2][2], n[0][1], n[1][2], n[1][1]};
+          c.assign(cell, cell + 12);
+        }
+        p.IEN.insert(p.IEN.end(), c.begin(), c.end());
+        for (int t = 0; t < 2; ++t) {
+          p.elementID.push_back(p.numOfSegments() + 1);
+          p.segmentID.push_back(1);
+        }
+      }
+    }
+  }
+}
+
+struct FlatSurface {
+  double z;
+  double operator()(double, double) const { return z; }
+};
+
+struct IndenterSurface {
+  double axis[2];
+  IndenterProfile profile;
+  double operator()(double x, double y) const {
+    const double dx = x - axis[0];
+    const double dy = y - axis[1];
+    return profile(sqrt(dx*dx + dy*dy));
+  }
+};
+
+/*! Common part of the 3D problems */
+static ContactProblem makeSurface3D(int nsn) {
+  ContactProblem p;
+  p.nsd = 3;
+  p.npd = 2;
+  p.nsn = nsn;
+  p.nen = nsn;
+  p.nes = 1;
+  for (int j = 0; j < nsn; ++j) {
+    p.ISN.push_back(j + 1);
+  }
+  p.mu = 0.0;
+  p.isIroning = false;
+  return p;
+}
+
+/*! Merge the coordinate columns of a 3D surface */
+static void finishSurface3D(ContactProblem& p, const std::vector<double>& y, const std::vector<double>& z) {
+  p.X.insert(p.X.end(), y.begin(), y.end());
+  p.X.insert(p.X.end(), z.begin(), z.end());
+  p.U.assign(p.X.size(), 0.0);
+  setGaussPoints3D(p);
+}
+
+/*! 2D cylinder (radius 1) pressed into a plane, about 4*m Gauss points */
+static ContactProblem makeCylinderOnPlane(int m) {
+  const IndenterProfile profile = {1.0, 0.3, 0.1*2.0 / m};
+  return makeIndenterOnPlane(m, m, -1.0, 1.0, 0.0, profile, 0.25*M_PI);
+}
+
+/*! 2D ironing - a punch (radius 0.5) pressed into a strip and shifted tangentially, about 2.5*m Gauss points
+
+The Gauss point state of the undeformed configuration X is the last converged state
+(Xi0_m), the search and the assembly run in the configuration X+U with the punch shifted
+by 0.3 of the segment length of the strip, so that both stick and slip states occur.
+*/
+static ContactProblem makeIroning(int m) {
+  const int mc = std::max(2, m / 4);
+  const IndenterProfile profile = {0.5, 0.15, 0.1*4.0 / m};
+  ContactProblem p = makeIndenterOnPlane(m, mc, 0.0, 4.0, 1.0, profile, M_PI / 3.0);
+  p.mu = 0.3;
+  p.isIroning = true;
+
+  const int nnod = p.numOfNodes();
+  for (int a = m + 1; a < nnod; ++a) {
+    p.U[a] = 0.3*4.0 / m;
+  }
+  return p;
+}
+
+/*! 3D block on a block, non-matching meshes of 8-node quadrilaterals, about 8*m^2 Gauss points */
+static ContactProblem makeBlockOnBlock(int m) {
+  ContactProblem p = makeSurface3D(8);
+  std::vector<double> y;
+  std::vector<double> z;
+  FlatSurface lower = {0.0};
+  FlatSurface upper = {-0.1 / m};
+  addQuadraticSurface(p, y, z, m, m, 0.0, 1.0, 0.0, 1.0, false, lower);
+  const int mUpper = std::max(1, m - 1);
+  addQuadraticSurface(p, y, z, mUpper, mUpper, 0.05, 0.95, 0.07, 0.92, true, upper);
+  finishSurface3D(p, y, z);
+  return p;
+}
+
+/*! 3D sphere (radius 1) on a plane, 6-node triangles (about 7.5*m^2 Gauss points) or 4-node quadrilaterals (about 20*m^2 Gauss points) */
+static ContactProblem makeSphereOnPlane(int m, int nsn) {
+  ContactProblem p = makeSurface3D(nsn);
+  std::vector<double> y;
+  std::vector<double> z;
+  FlatSurface plane = {0.0};
+  IndenterSurface sphere;
+  sphere.axis[0] = 0.0;
+  sphere.axis[1] = 0.0;
+  sphere.profile.radius = 1.0;
+  sphere.profile.contactRadius = 0.3;
+  sphere.profile.penetration = 0.1*2.0 / m;
+  addQuadraticSurface(p, y, z, m, m, -1.0, 1.0, -1.0, 1.0, false, plane);
+  const int ms = std::max(1, m / 2);
+  addQuadraticSurface(p, y, z, ms, ms, -0.5, 0.5, -0.5, 0.5, true, sphere);
+  finishSurface3D(p, y, z);
+  return p;
+}
+
+/*! Problem of the given name with approximately numOfGPs Gauss points */
+static bool makeProblem(ContactProblem& p, const std::string& name, double numOfGPs) {
+  if (name == "cylinder2d") {
+    p = makeCylinderOnPlane(std::max(2, (int)(numOfGPs / 4.0)));
+  }
+  else if (name == "ironing2d") {
+    p = makeIroning(std::max(8, (int)(numOfGPs / 2.5)));
+  }
+  else if (name == "blocks3d") {
+    p = makeBlockOnBlock(std::max(2, (int)sqrt(numOfGPs / 8.0)));
+  }
+  else if (name == "sphere3d") {
+    p = makeSphereOnPlane(std::max(2, (int)sqrt(numOfGPs / 7.5)), 6);
+  }
+  else if (name == "sphere3d-quad4") {
+    p = makeSphereOnPlane(std::max(2, (int)sqrt(numOfGPs / 20.0)), 4);
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+static double getTime() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*! Timings of one problem size in milliseconds (negative means not measured) */
+struct BenchmarkResult {
+  int numOfSegments;
+  int numOfGPs;
+  int numOfActive;
+  int numOfCells;       // buckets of the grid
+  double surface;       // getLongestEdgeAndGPs
+  double aabb;          // getAABB
+  double prepare;       // prepareContactSurface (surface + aabb in one pass)
+  double buckets;       // linked lists of buckets (caller side of evaluateContactConstraints)
+  double search;        // evaluateContactConstraints
+  double searchCSR;     // buildBucketGrid + evaluateContactConstraintsCSR
+  double assembly;      // assembleContactResidualAndStiffness
+  double pattern;       // buildContactSparsityPattern (both calls)
+  double assemblyCSR;   // assembleContactResidualAndStiffnessCSR
+  double assemblyBSR;   // assembleContactResidualAndStiffnessBSR
+  double assemblyOp;    // assembleContactResidualAndOperator
+  double apply;         // applyContactStiffness
+};
+
+static BenchmarkResult runBenchmark(ContactProblem& p, int repeat, double memoryLimit, double occupancy) {
+  BenchmarkResult result;
+  const int nsd = p.nsd;
+  const int npd = p.npd;
+  const int nsn = p.nsn;
+  const int ngp = p.ngp;
+  const int nen = p.nen;
+  const int nes = p.nes;
+  const int n = p.numOfSegments();
+  const int nnod = p.numOfNodes();
+  const int neq = nnod*nsd;
+  const int rows = n*ngp;
+  const int numOfCols = nsd + 3*npd + 8;
+  const double epsN = 1e3;
+  const double epsT = 1e3;
+  int* ISN = &p.ISN[0];
+  int* IEN = &p.IEN[0];
+  int* elementID = &p.elementID[0];
+  int* segmentID = &p.segmentID[0];
+
+  result.numOfSegments = n;
+  result.numOfGPs = rows;
+  result.surface = result.aabb = result.prepare = result.buckets = result.search = result.searchCSR = -1.0;
+  result.assembly = result.pattern = result.assemblyCSR = result.assemblyBSR = -1.0;
+  result.assemblyOp = result.apply = -1.0;
+
+  // Configuration of the search:
+  std::vector<double> x(p.X);
+  if (p.isIroning) {
+    for (size_t i = 0; i < x.size(); ++i) {
+      x[i] += p.U[i];
+    }
+  }
+
+  std::vector<double> GPs((size_t)rows*numOfCols, 0.0);
+  double longestEdge = 0.0;
+  for (int k = 0; k < repeat; ++k) {
+    const double start = getTime();
+    getLongestEdgeAndGPs(&longestEdge, &GPs[0], n, nsd, npd, ngp, neq, nsn, nes, nen, elementID, segmentID, ISN, IEN, &p.H[0], &x[0]);
+    const double time = 1e3*(getTime() - start);
+    result.surface = k ? std::min(result.surface, time) : time;
+  }
+
+  double AABBmin[3] = {0.0, 0.0, 0.0};
+  double AABBmax[3] = {0.0, 0.0, 0.0};
+  for (int k = 0; k < repeat; ++k) {
+    const double start = getTime();
+    getAABB(AABBmin, AABBmax, nsd, nnod, &x[0], longestEdge, IEN, ISN, elementID, segmentID, n, nsn, nes, nen, neq);
+    const double time = 1e3*(getTime() - start);
+    result.aabb = k ? std::min(result.aabb, time) : time;
+  }
+
+  for (int k = 0; k < repeat; ++k) {
+    const double start = getTime();
+    prepareContactSurface(&longestEdge, AABBmin, AABBmax, &GPs[0], n, nsd, npd, ngp, neq, nsn, nes, nen, elementID, segmentID, ISN, IEN, &p.H[0], &x[0]);
+    const double time = 1e3*(getTime() - start);
+    result.prepare = k ? std::min(result.prepare, time) : time;
+  }
+
+  int N[3];
+  int numOfCells;
+  if (occupancy > 0.0) {
+    getAutoBucketGridSize(N, &numOfCells, AABBmin, AABBmax, nsd, longestEdge, rows, occupancy);
+  }
+  else {
+    getBucketGridSize(N, &numOfCells, AABBmin, AABBmax, nsd, longestEdge);
+  }
+  result.numOfCells = numOfCells;
+
+  // Ironing - the search in the undeformed configuration gives the last converged state:
+  if (p.isIroning) {
+    std::vector<double> GPs0((size_t)rows*numOfCols, 0.0);
+    std::vector<int> cellStart(numOfCells + 1);
+    std::vector<int> cellGPs(rows);
+    double longestEdge0;
+    getLongestEdgeAndGPs(&longestEdge0, &GPs0[0], n, nsd, npd, ngp, neq, nsn, nes, nen, elementID, segmentID, ISN, IEN, &p.H[0], &p.X[0]);
+    buildBucketGrid(&cellStart[0], &cellGPs[0], &GPs0[0], N, AABBmin, AABBmax, nsd, rows);
+    evaluateContactConstraintsCSR(&GPs0[0], ISN, IEN, N, AABBmin, AABBmax, &cellStart[0], &cellGPs[0], &p.X[0], elementID, segmentID, n, nsn, nsd, npd, ngp, nen, nes, neq, longestEdge0);
+    for (int pdf = 0; pdf < npd; ++pdf) {
+      std::copy(GPs0.begin() + (size_t)(nsd + 3 + pdf)*rows, GPs0.begin() + (size_t)(nsd + 4 + pdf)*rows, GPs.begin() + (size_t)(nsd + 2*npd + 7 + pdf)*rows);
+    }
+  }
+
+  // Buckets as linked lists (the rows of each bucket in ascending order):
+  std::vector<int> head(numOfCells);
+  std::vector<int> next(rows);
+  for (int k = 0; k < repeat; ++k) {
+    const double start = getTime();
+    std::fill(head.begin(), head.end(), -1);
+    for (int v = rows - 1; v >= 0; --v) {
+      int I[3] = {0, 0, 0};
+      for (int sdf = 0; sdf < nsd; ++sdf) {
+        I[sdf] = (int)(N[sdf]*(GPs[(size_t)sdf*rows + v] - AABBmin[sdf]) / (AABBmax[sdf] - AABBmin[sdf]));
+        I[sdf] = std::min(std::max(I[sdf], 0), N[sdf] - 1);
+      }
+      const int Ic = I[2]*N[0]*N[1] + I[1]*N[0] + I[0];
+      next[v] = head[Ic];
+      head[Ic] = v;
+    }
+    const double time = 1e3*(getTime() - start);
+    result.buckets = k ? std::min(result.buckets, time) : time;
+  }
+
+  for (int k = 0; k < repeat; ++k) {
+    const double start = getTime();
+    evaluateContactConstraints(&GPs[0], ISN, IEN, N, AABBmin, AABBmax, &head[0], &next[0], &x[0], elementID, segmentID, n, nsn, nsd, npd, ngp, nen, nes, neq, longestEdge);
+    const double time = 1e3*(getTime() - start);
+    result.search = k ? std::min(result.search, time) : time;
+  }
+
+  {
+    std::vector<int> cellStart(numOfCells + 1);
+    std::vector<int> cellGPs(rows);
+    std::vector<double> GPsCSR(GPs);
+    for (int k = 0; k < repeat; ++k) {
+      const double start = getTime();
+      buildBucketGrid(&cellStart[0], &cellGPs[0], &GPsCSR[0], N, AABBmin, AABBmax, nsd, rows);
+      evaluateContactConstraintsCSR(&GPsCSR[0], ISN, IEN, N, AABBmin, AABBmax, &cellStart[0], &cellGPs[0], &x[0], elementID, segmentID, n, nsn, nsd, npd, ngp, nen, nes, neq, longestEdge);
+      const double time = 1e3*(getTime() - start);
+      result.searchCSR = k ? std::min(result.searchCSR, time) : time;
+    }
+  }
+
+  std::vector<double> activeGPsOld(GPs.begin() + (size_t)(nsd + npd + 3)*rows, GPs.begin() + (size_t)(nsd + npd + 4)*rows);
+  result.numOfActive = 0;
+  for (int v = 0; v < rows; ++v) {
+    result.numOfActive += activeGPsOld[v] != 0.0;
+  }
+
+  // Assembly into triplets (the local arrays Gc_loc and Kc are not assembled):
+  std::vector<double> Gc(neq);
+  {
+    int len = 0;
+    countContactTriplets(&len, &GPs[0], &activeGPsOld[0], nsd, npd, ngp, nsn, rows, epsN, true, rows);
+    if (24.0*len < memoryLimit) {
+      std::vector<double> vals(std::max(len, 1));
+      std::vector<double> rowsOut(std::max(len, 1));
+      std::vector<double> colsOut(std::max(len, 1));
+      for (int k = 0; k < repeat; ++k) {
+        std::vector<double> GPsAssembly(GPs);
+        int lenOut = len;
+        const double start = getTime();
+        assembleContactResidualAndStiffness(NULL, &Gc[0], NULL, &vals[0], &rowsOut[0], &colsOut[0], &lenOut, &GPsAssembly[0], ISN, IEN, &p.X[0], &p.U[0], &p.H[0], &p.dH[0], &p.gw[0], &activeGPsOld[0], neq, nsd, npd, ngp, nes, nsn, nen, rows, epsN, epsT, p.mu, true, true, false, rows);
+        const double time = 1e3*(getTime() - start);
+        result.assembly = k ? std::min(result.assembly, time) : time;
+      }
+    }
+  }
+
+  // Assembly into the CSR matrix:
+  std::vector<int> rowPtr(neq + 1);
+  buildContactSparsityPattern(&rowPtr[0], NULL, &GPs[0], ISN, IEN, &activeGPsOld[0], neq, nsd, npd, ngp, nes, nsn, nen, rows, rows);
+  const int nnz = rowPtr[neq];
+  if (12.0*nnz < memoryLimit) {
+    std::vector<int> colInd(std::max(nnz, 1));
+    std::vector<double> vals(std::max(nnz, 1));
+    for (int k = 0; k < repeat; ++k) {
+      const double start = getTime();
+      buildContactSparsityPattern(&rowPtr[0], NULL, &GPs[0], ISN, IEN, &activeGPsOld[0], neq, nsd, npd, ngp, nes, nsn, nen, rows, rows);
+      buildContactSparsityPattern(&rowPtr[0], &colInd[0], &GPs[0], ISN, IEN, &activeGPsOld[0], neq, nsd, npd, ngp, nes, nsn, nen, rows, rows);
+      const double time = 1e3*(getTime() - start);
+      result.pattern = k ? std::min(result.pattern, time) : time;
+    }
+    for (int k = 0; k < repeat; ++k) {
+      std::vector<double> GPsAssembly(GPs);
+      const double start = getTime();
+      assembleContactResidualAndStiffnessCSR(&Gc[0], &vals[0], &rowPtr[0], &colInd[0], &GPsAssembly[0], ISN, IEN, &p.X[0], &p.U[0], &p.H[0], &p.dH[0], &p.gw[0], &activeGPsOld[0], neq, nsd, npd, ngp, nes, nsn, nen, rows, epsN, epsT, p.mu, true, true, false, rows);
+      const double time = 1e3*(getTime() - start);
+      result.assemblyCSR = k ? std::min(result.assemblyCSR, time) : time;
+    }
+  }
+
+  // Assembly into the BSR matrix of nsd x nsd node blocks:
+  std::vector<int> blockRowPtr(nnod + 1);
+  buildContactBlockSparsityPattern(&blockRowPtr[0], NULL, &GPs[0], ISN, IEN, &activeGPsOld[0], neq, nsd, npd, ngp, nes, nsn, nen, rows, rows);
+  const int nnzb = blockRowPtr[nnod];
+  if ((4.0 + 8.0*nsd*nsd)*nnzb < memoryLimit) {
+    std::vector<int> blockColInd(std::max(nnzb, 1));
+    std::vector<double> blockVals(std::max(nnzb*nsd*nsd, 1));
+    buildContactBlockSparsityPattern(&blockRowPtr[0], &blockColInd[0], &GPs[0], ISN, IEN, &activeGPsOld[0], neq, nsd, npd, ngp, nes, nsn, nen, rows, rows);
+    for (int k = 0; k < repeat; ++k) {
+      std::vector<double> GPsAssembly(GPs);
+      const double start = getTime();
+      assembleContactResidualAndStiffnessBSR(&Gc[0], &blockVals[0], &blockRowPtr[0], &blockColInd[0], &GPsAssembly[0], ISN, IEN, &p.X[0], &p.U[0], &p.H[0], &p.dH[0], &p.gw[0], &activeGPsOld[0], neq, nsd, npd, ngp, nes, nsn, nen, rows, epsN, epsT, p.mu, true, true, false, rows);
+      const double time = 1e3*(getTime() - start);
+      result.assemblyBSR = k ? std::min(result.assemblyBSR, time) : time;
+    }
+  }
+
+  // Matrix-free tangent:
+  ContactOperator* op = createContactOperator();
+  for (int k = 0; k < repeat; ++k) {
+    std::vector<double> GPsAssembly(GPs);
+    const double start = getTime();
+    assembleContactResidualAndOperator(&Gc[0], op, &GPsAssembly[0], ISN, IEN, &p.X[0], &p.U[0], &p.H[0], &p.dH[0], &p.gw[0], &activeGPsOld[0], neq, nsd, npd, ngp, nes, nsn, nen, rows, epsN, epsT, p.mu, true, false, rows);
+    const double time = 1e3*(getTime() - start);
+    result.assemblyOp = k ? std::min(result.assemblyOp, time) : time;
+  }
+  std::vector<double> y(neq, 0.0);
+  for (int k = 0; k < repeat; ++k) {
+    const double start = getTime();
+    applyContactStiffness(&y[0], &p.U[0], op);
+    const double time = 1e3*(getTime() - start);
+    result.apply = k ? std::min(result.apply, time) : time;
+  }
+  destroyContactOperator(op);
+
+  return result;
+}
+
+static void printTime(double time, bool csv) {
+  if (csv) {
+    if (time < 0.0) {
+      printf(",");
+    }
+    else {
+      printf(",%.4f", time);
+    }
+  }
+  else {
+    if (time < 0.0) {
+      printf(" %12s", "-");
+    }
+    else {
+      printf(" %12.3f", time);
+    }
+  }
+}
+
+static void printUsage(const char* program) {
+  printf("Usage: %s [--problem cylinder2d|blocks3d|sphere3d|sphere3d-quad4|ironing2d|all] [--min-gps N] [--max-gps N]\n", program);
+  printf("       [--repeat N] [--threads N] [--memory-limit GB] [--occupancy T] [--csv]\n");
+}
+
+int main(int argc, char** argv) {
+  std::string problem = "all";
+  double minGPs = 1e3;
+  double maxGPs = 1e7;
+  int repeat = 3;
+  int threads = 1;
+  double memoryLimit = 2.0;
+  double occupancy = 4.0;
+  bool csv = false;
+
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool hasValue = i + 1 < argc;
+    if (arg == "--problem" && hasValue) {
+      problem = argv[++i];
+    }
+    else if (arg == "--min-gps" && hasValue) {
+      minGPs = atof(argv[++i]);
+    }
+    else if (arg == "--max-gps" && hasValue) {
+      maxGPs = atof(argv[++i]);
+    }
+    else if (arg == "--repeat" && hasValue) {
+      repeat = std::max(1, atoi(argv[++i]));
+    }
+    else if (arg == "--threads" && hasValue) {
+      threads = atoi(argv[++i]);
+    }
+    else if (arg == "--memory-limit" && hasValue) {
+      memoryLimit = atof(argv[++i]);
+    }
+    else if (arg == "--occupancy" && hasValue) {
+      occupancy = atof(argv[++i]);
+    }
+    else if (arg == "--csv") {
+      csv = true;
+    }
+    else {
+      printUsage(argv[0]);
+      return arg == "--help" ? 0 : 1;
+    }
+  }
+
+  std::vector<std::string> problems;
+  if (problem == "all") {
+    problems.push_back("cylinder2d");
+    problems.push_back("blocks3d");
+    problems.push_back("sphere3d");
+    problems.push_back("sphere3d-quad4");
+    problems.push_back("ironing2d");
+  }
+  else {
+    problems.push_back(problem);
+  }
+
+  setNumberOfThreads(threads);
+
+  const char* columns[] = {"surface", "aabb", "prepare", "buckets", "search", "searchCSR", "assembly", "pattern", "assemblyCSR", "assemblyBSR", "assemblyOp", "apply"};
+  if (csv) {
+    printf("problem,segments,GPs,active,cells");
+    for (size_t c = 0; c < sizeof(columns) / sizeof(columns[0]); ++c) {
+      printf(",%s", columns[c]);
+    }
+    printf("\n");
+  }
+  else {
+    printf("times in ms (minimum of %d runs), %d thread(s)\n", repeat, threads);
+    printf("%-14s %10s %10s %10s %10s", "problem", "segments", "GPs", "active", "cells");
+    for (size_t c = 0; c < sizeof(columns) / sizeof(columns[0]); ++c) {
+      printf(" %12s", columns[c]);
+    }
+    printf("\n");
+  }
+
+  for (size_t k = 0; k < problems.size(); ++k) {
+    for (double numOfGPs = minGPs; numOfGPs <= maxGPs*1.0001; numOfGPs *= 10.0) {
+      ContactProblem p;
+      if (!makeProblem(p, problems[k], numOfGPs)) {
+        fprintf(stderr, "Unknown problem: %s\n", problems[k].c_str());
+        printUsage(argv[0]);
+        return 1;
+      }
+      const BenchmarkResult r = runBenchmark(p, repeat, memoryLimit*1e9, occupancy);
+
+      if (csv) {
+        printf("%s,%d,%d,%d,%d", problems[k].c_str(), r.numOfSegments, r.numOfGPs, r.numOfActive, r.numOfCells);
+      }
+      else {
+        printf("%-14s %10d %10d %10d %10d", problems[k].c_str(), r.numOfSegments, r.numOfGPs, r.numOfActive, r.numOfCells);
+      }
+      printTime(r.surface, csv);
+      printTime(r.aabb, csv);
+      printTime(r.prepare, csv);
+      printTime(r.buckets, csv);
+      printTime(r.search, csv);
+      printTime(r.searchCSR, csv);
+      printTime(r.assembly, csv);
+      printTime(r.pattern, csv);
+      printTime(r.assemblyCSR, csv);
+      printTime(r.assemblyBSR, csv);
+      printTime(r.assemblyOp, csv);
+      printTime(r.apply, csv);
+      printf("\n");
+      fflush(stdout);
+    }
+  }
+  return 0;
+}
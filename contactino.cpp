@@ -1,1544 +1,5843 @@
-/**
-\file contres.cpp
-CONTact RESidual
-*/
-#include <stdio.h>
-#include <stdlib.h>
-#define _USE_MATH_DEFINES
-#include <math.h>
-
-#include <iostream>
-#include <cfloat>
-#include <algorithm>
-
-#include "contactino.h"
-
-/*! Evaluate shape functions and their 1st partial derivatives of 4-node bilinear element
-
-\param r - 1st isoparametric (parent, reference) coordinate
-\param s - 2nd isoparametric coordinate
-
-\return H 1d array (4x1) of shape functions values
-\return dH 2d array (4x2) of 1st partial derivatives of shape functions with respect to r (1st column) and s (2nd column)
-
-*/
-void sfd4(double* H, double* dH, double r, double s) {
-  const double h1 = 0.25*(1-r)*(1-s);
-  const double h2 = 0.25*(1+r)*(1-s);
-  const double h3 = 0.25*(1+r)*(1+s);
-  const double h4 = 0.25*(1-r)*(1+s);
-  /***********************************************/
-  const double h1r = -0.25*(1-s);
-  const double h2r =  0.25*(1-s);
-  const double h3r =  0.25*(s+1);
-  const double h4r = -0.25*(1+s);
-  /***********************************************/
-  const double h1s =  0.25*(r-1);
-  const double h2s = -0.25*(1+r);
-  const double h3s =  0.25*(r+1);
-  const double h4s =  0.25*(1-r);
-  /***********************************************/
-  H[0] = h1;
-  H[1] = h2;
-  H[2] = h3;
-  H[3] = h4;
-
-  dH[0] = h1r;
-  dH[1] = h2r;
-  dH[2] = h3r;
-  dH[3] = h4r;
-
-  dH[4] = h1s;
-  dH[5] = h2s;
-  dH[6] = h3s;
-  dH[7] = h4s;
-}
-
-/*! Evaluate shape functions and their 1st partial derivatives of 8-node (serendipity) quadrilateral element
-
-\param r - 1st isoparametric (parent, reference) coordinate
-\param s - 2nd isoparametric coordinate
-
-\return H 1d array (8x1) of shape functions values
-\return dH 2d array (8x2) of 1st partial derivatives of shape functions with respect to r (1st column) and s (2nd column)
-
-*/
-void sfd8(double* H, double* dH, double r, double s) {
-  const double h5 = 0.5*(1-r*r)*(1-s);
-  const double h6 = 0.5*(1+r)*(1-s*s);
-  const double h7 = 0.5*(1-r*r)*(1+s);
-  const double h8 = 0.5*(1-r)*(1-s*s);
-
-  const double h1 = 0.25*(1-r)*(1-s) - 0.5*h5 - 0.5*h8;
-  const double h2 = 0.25*(1+r)*(1-s) - 0.5*h5 - 0.5*h6;
-  const double h3 = 0.25*(1+r)*(1+s) - 0.5*h6 - 0.5*h7;
-  const double h4 = 0.25*(1-r)*(1+s) - 0.5*h7 - 0.5*h8;
-
-  /***********************************************/
-  const double h5r = -r*(1-s);
-  const double h6r = 0.5*(1-s*s);
-  const double h7r = -r*(1+s);
-  const double h8r = -0.5*(1-s*s);
-
-  const double h1r = -0.25*(1-s) - 0.5*h5r - 0.5*h8r;
-  const double h2r =  0.25*(1-s) - 0.5*h5r - 0.5*h6r;
-  const double h3r =  0.25*(s+1) - 0.5*h6r - 0.5*h7r;
-  const double h4r = -0.25*(1+s) - 0.5*h7r - 0.5*h8r;
-  /***********************************************/
-  const double h5s = -0.5*(1-r*r);
-  const double h6s = -(1+r)*s;
-  const double h7s = 0.5*(1-r*r);
-  const double h8s = -(1-r)*s;
-
-  const double h1s =  0.25*(r-1) - 0.5*h5s - 0.5*h8s;
-  const double h2s = -0.25*(1+r) - 0.5*h5s - 0.5*h6s;
-  const double h3s =  0.25*(r+1) - 0.5*h6s - 0.5*h7s;
-  const double h4s =  0.25*(1-r) - 0.5*h7s - 0.5*h8s;
-  /***********************************************/
-  H[0] = h1;
-  H[1] = h2;
-  H[2] = h3;
-  H[3] = h4;
-  H[4] = h5;
-  H[5] = h6;
-  H[6] = h7;
-  H[7] = h8;
-
-  dH[0] = h1r;
-  dH[1] = h2r;
-  dH[2] = h3r;
-  dH[3] = h4r;
-  dH[4] = h5r;
-  dH[5] = h6r;
-  dH[6] = h7s;
-  dH[7] = h8s;
-
-  dH[8]  = h1s;
-  dH[9]  = h2s;
-  dH[10] = h3s;
-  dH[11] = h4s;
-  dH[12] = h5s;
-  dH[13] = h6s;
-  dH[14] = h7s;
-  dH[15] = h8s;
-}
-
-/*! Evaluate shape functions and their 1st partial derivatives of 6-node (serendipity) triangular element
-
-\param r - 1st isoparametric coordinate
-\param s - 2nd isoparametric coordinate
-
-\return H 1d array (6x1) of shape functions values
-\return dH 2d array (6x2) of 1st partial derivatives of shape functions with respect to r (1st column) and s (2nd column)
-
-*/
-void sfd6(double* H, double* dH, double r, double s) {
-  const double h4 = 4 * r*(1 - r - s);
-  const double h5 = 4 * r*s;
-  const double h6 = 4 * s*(1 - r - s);
-
-  const double h1 = 1 - r - s - 0.5*h4 - 0.5*h6;
-  const double h2 = r - 0.5*h4 - 0.5*h5;
-  const double h3 = s - 0.5*h5 - 0.5*h6;
-  /***********************************************/
-  const double h4r = 4 * (1 - r - s) - 4 * r;
-  const double h5r = 4 * s;
-  const double h6r = -4 * s;
-
-  const double h1r = -1 - 0.5*h4r - 0.5*h6r;
-  const double h2r = 1 - 0.5*h4r - 0.5*h5r;
-  const double h3r = 0 - 0.5*h5r - 0.5*h6r;
-  /***********************************************/
-  const double h4s = -4 * r;
-  const double h5s = 4 * r;
-  const double h6s = 4 * (1 - r - s) - 4 * s;
-
-  const double h1s = -1 - 0.5*h4s - 0.5*h6s;
-  const double h2s = 0 - 0.5*h4s - 0.5*h5s;
-  const double h3s = 1 - 0.5*h5s - 0.5*h6s;
-  /***********************************************/
-  H[0] = h1;
-  H[1] = h2;
-  H[2] = h3;
-  H[3] = h4;
-  H[4] = h5;
-  H[5] = h6;
-
-  dH[0] = h1r;
-  dH[1] = h2r;
-  dH[2] = h3r;
-  dH[3] = h4r;
-  dH[4] = h5r;
-  dH[5] = h6r;
-
-  dH[6] = h1s;
-  dH[7] = h2s;
-  dH[8] = h3s;
-  dH[9] = h4s;
-  dH[10] = h5s;
-  dH[11] = h6s;
-}
-
-/*! Evaluate shape functions and their 1st derivatives of 2-node bar element
-
-\param r - 1st isoparametric coordinate
-
-\return H 1d array (2x1) of shape functions values
-\return dH 1d array (2x1) of 1st derivatives of shape functions with respect to r
-
-*/
-void sfd2(double* H, double* dH, double r) {
-  const double h1 = 0.5*(1 - r);
-  const double h2 = 0.5*(1 + r);
-  /***********************************************/
-  const double h1r = -0.5;
-  const double h2r = 0.5;
-  /***********************************************/
-  H[0] = h1;
-  H[1] = h2;
-
-  dH[0] = h1r;
-  dH[1] = h2r;
-}
-
-/*! Calculate contact residual term (gradient) and contact tangent term (Hessian)
-
-\param len - maximal length of 1d arrays rows,cols, and vals
-\param GPs - 2d array (GPs_len x ??? cols)
-\param ISN - 2d array (nsn*)
-\param IEN -
-\param X -
-\param U -
-\param H -
-\param dH -
-\param gw -
-\param activeGPsOld -
-\param neq - Number of Equations
-\param nsd - Number of Space Dimensions (usually 2 or 3)
-\param npd - Number of Parametric Dimensions (usually 1 or 2) (parametric=reference=parent coordinates)
-\param ngp - Number of GaussPoints on contact segment (segment means face of element)
-\param nes - Number of Element Segments
-\param nsn - Number of Segment Nodes
-\param GPs_len - length of GPs array
-\param epss - penalty parameter (usualy 100*Young's mudulus)
-\param keyContactDetection - if is true, ...
-\param keyAssembleKc - if is true, contact tangent term is assembled only
-
-\return Gc - 1d array
-\return rows - 1d array
-\return cols - 1d array
-\return valc - 1d array
-
-*/
-void assembleContactResidualAndStiffness(double* Gc_loc, double* Gc, double* Kc, double* vals, double* rows, double* cols, int* len, double* GPs, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg)
-{
-
-  int col;
-  int* segmentNodesIDs = new int[nsn];
-  int* segmentNodesIDm = new int[nsn];
-  double* Xs = new double[nsn*nsd];
-  double* Xm = new double[nsn*nsd];
-  double* Us = new double[nsn*nsd];
-  double* Um = new double[nsn*nsd];
-  double* dXs = new double[nsn*npd];
-  double* dxs = new double[nsn*npd];
-  double* dXm = new double[nsn*npd];
-  double* dxm = new double[nsn*npd];
-  double* GAPs = new double[ngp];
-  bool* activeGPs = new bool[ngp];
-  double* Ns = new double[nsn*nsd];
-  double* Nm1 = new double[nsn*nsd];
-  double* Nm2 = new double[nsn*nsd];
-  double* C_Ns = new double[nsn*nsd];
-  double* C_Nm = new double[nsn*nsd];
-  double* C_Ts1 = new double[nsn*nsd];
-  double* C_Tm1 = new double[nsn*nsd];
-  double* C_Nm1 = new double[nsn*nsd];
-  double* C_Pm1 = new double[nsn*nsd];
-  double* C_Ts2 = new double[nsn*nsd];
-  double* C_Tm2 = new double[nsn*nsd];
-  double* C_Nm2 = new double[nsn*nsd];
-  double* C_Pm2 = new double[nsn*nsd];
-  double* Hm = new double[nsn];
-  double* dHm = new double[nsn*npd];
-  double* Xi_m = new double[npd];
-  double* Xi0_m = new double[npd];
-  double* t_T = new double[npd];
-  double* t_T0 = new double[npd];
-
-  int len_guess = *len;
-  *len = 0;
-
-  //int n_seg = GPs_len / ngp;
-
-  double Xp[3];
-  double Xg[3];
-  for (int i = 0; i < 3; ++i) {
-    Xp[i] = 0.0;
-    Xg[i] = 0.0;
-  }
-
-  // Fill Gc_s array by zeros:
-  for (int i = 0; i < neq; ++i) {
-    Gc[i] = 0.0;
-  }
-
-  for (int i = 0; i < nsg; i += ngp) {
-
-    // Fill C_s and C_m arrays by zeros:
-    for (int j = 0; j < nsn*nsd; ++j) {
-      Ns[j]   = 0.0;
-
-      C_Ns[j] = 0.0;
-      C_Nm[j] = 0.0;
-
-      Nm1[j]  = 0.0;
-      C_Ts1[j] = 0.0;
-      C_Tm1[j] = 0.0;
-      C_Nm1[j] = 0.0;
-      C_Pm1[j] = 0.0;
-
-      if(npd == 2) {
-        Nm2[j]   = 0.0;
-        C_Ts2[j] = 0.0;
-        C_Tm2[j] = 0.0;
-        C_Nm2[j] = 0.0;
-        C_Pm2[j] = 0.0;
-      }
-    }
-
-    // slave element index:
-    col = nsd*GPs_len;
-    const int els = (int)GPs[col + i] - 1; // Matlab numbering starts with 1
-
-    // slave segment index:
-    col = (nsd + 1)*GPs_len;
-    const int sgs = (int)GPs[col + i] - 1; // Matlab numbering starts with 1
-
-    // slave segment coords Xs and displacements Us:
-    for (int j = 0; j < nsn; ++j) {
-      col = nes*j;
-      int IENrows = ISN[col + sgs] - 1; // Matlab numbering starts with 1
-      col = nen*els;
-      segmentNodesIDs[j] = IEN[col + IENrows] - 1; // Matlab numbering starts with 1
-      for (int k = 0; k < nsd; ++k) {
-        col = k*(int)(neq / nsd);
-        Xs[k*nsn + j] = X[col + segmentNodesIDs[j]];
-        Us[k*nsn + j] = U[col + segmentNodesIDs[j]];
-      }
-    }
-
-    for (int g = 0; g < ngp; ++g) {
-
-      // Gausspoint gap values and activeGPs:
-      activeGPs[g] = (bool) activeGPsOld[i + g];
-
-      if (!activeGPs[g]) {
-        continue;
-      }
-
-      // master element index:
-      col = (nsd + npd + 4)*GPs_len;
-      const int elm = (int)GPs[col + i + g] - 1; // Matlab numbering starts with 1
-      // master segment index:
-      col = (nsd + npd + 5)*GPs_len;
-      const int sgm = (int)GPs[col + i + g] - 1; // Matlab numbering starts with 1
-
-      // master segment coords Xm and displacements Um:
-      for (int j = 0; j < nsn; ++j) {
-        col = nes*j;
-        int IENrowm = ISN[col + sgm] - 1; // Matlab numbering starts with 1
-        col = nen*elm;
-        segmentNodesIDm[j] = IEN[col + IENrowm] - 1; // Matlab numbering starts with 1
-        for (int k = 0; k < nsd; ++k) {
-          col = k*(int)(neq / nsd);
-          Xm[k*nsn + j] = X[col + segmentNodesIDm[j]];
-          Um[k*nsn + j] = U[col + segmentNodesIDm[j]];
-        }
-      }
-
-      // GPs legend:              Xg     els  sgs   gap    Xi_m  isActive      elm      sgm      isStick      t_T       Xi0_m     t_N0
-      //double* GPs = new double[n*(nsd + 1 +  1  +  1  +  npd  +   1     +     1    +   1     +    1    +    npd   +    npd    + 1];
-      //index of begining           0    nsd nsd+1 nsd+2  nsd+3  nsd+npd+3  nsd+npd+4 nsd+npd+5 nsd+npd+6  nsd+npd+7 nsd+2*npd+7  nsd+3*npd+7 (size = nsd+3*npd+8)
-
-      // Shape function and its derivatives of gausspoint's master segment
-      double r = GPs[(nsd + 3)*GPs_len + i + g];
-      double s = 0.0;
-
-      if (npd == 2) {
-        s = GPs[(nsd + 4)*GPs_len + i + g];
-      }
-
-      switch (nsn) {
-        case 2:
-        sfd2(Hm, dHm, r);
-        break;
-        case 4:
-        sfd4(Hm, dHm, r, s);
-        break;
-        case 6:
-        sfd6(Hm, dHm, r, s);
-        break;
-        case 8:
-        sfd8(Hm, dHm, r, s);
-      }
-
-      // evaluate gausspoint coords:
-      for (int sdf = 0; sdf < nsd; ++sdf) {
-        Xp[sdf] = 0.0;
-        Xg[sdf] = 0.0;
-        for (int k = 0; k < nsn; ++k) {
-          Xp[sdf] += Hm[k] * (Xm[sdf*nsn + k] + Um[sdf*nsn + k]);
-          Xg[sdf] += H[k*ngp + g] * (Xs[sdf*nsn + k] + Us[sdf*nsn + k]);
-        }
-      }
-
-      // if contact detection is on, the new gap is stored in the GP array
-      if (keyContactDetection) {
-        col = (nsd + 2)*GPs_len;
-        GAPs[g] = GPs[col + i + g];
-      }
-      else { // else the new gap is considered as the distance between the Gauss point and its projection onto the master segment:
-        // (sign is determinated later)
-        /////////GAPs[g] =  sqrt( (Xp[0] - Xg[0])*(Xp[0] - Xg[0]) + (Xp[1] - Xg[1])*(Xp[1] - Xg[1]) + (Xp[2] - Xg[2])*(Xp[2] - Xg[2]) );
-        // Note that for both the 2D and the 3D case the same equation is used. This is correct because Xp and Xg are initialized as 1x3 zero arrays.
-
-        col = (nsd + 2)*GPs_len;
-        GAPs[g] = GPs[col + i + g];
-      }
-
-      // Fill dXs arrays by zeros:
-      for (int j = 0; j < nsn*npd; ++j) {
-        dXs[j] = 0.0;
-        dxs[j] = 0.0;
-        dXm[j] = 0.0;
-        dxm[j] = 0.0;
-      }
-
-      // Evaluate tangent vectors:
-      for (int pdf = 0; pdf < npd; ++pdf) {
-        for (int sdf = 0; sdf < nsd; ++sdf) {
-          for (int j = 0; j < nsn; ++j) {
-            col = j*npd*ngp;
-            const double dh = dH[col + g*npd + pdf];
-            dXs[npd*sdf + pdf] += dh*Xs[sdf*nsn + j];
-            dxs[npd*sdf + pdf] += dh*(Xs[sdf*nsn + j] + Us[sdf*nsn + j]);
-            dXm[npd*sdf + pdf] += dHm[j]*Xm[sdf*nsn + j];
-            dxm[npd*sdf + pdf] += dHm[j]*(Xm[sdf*nsn + j] + Um[sdf*nsn + j]);
-          }
-        }
-      }
-
-
-      //       X     Y      Z
-      // r   dxs[0] dxs[2]  dxs[4]
-      // s   dxs[1] dxs[3]  dxs[5]
-
-      // Matric tensor:
-      double mm[4];
-
-      mm[0] = 0.0;
-      mm[1] = 0.0;
-      mm[2] = 0.0;
-      mm[3] = 0.0;
-
-      for (int sdf = 0; sdf < nsd; ++sdf) {
-        mm[0] += dxm[sdf*npd + 0] * dxm[sdf*npd + 0];
-        if(npd == 2) {
-          mm[1] += dxm[sdf*npd + 1] * dxm[sdf*npd + 0];
-          mm[2] += dxm[sdf*npd + 0] * dxm[sdf*npd + 1];
-          mm[3] += dxm[sdf*npd + 1] * dxm[sdf*npd + 1];
-        }
-      }
-
-      // Inverse of matric tensor
-
-      double invmm[4];
-      invmm[0] = 0.0;
-      invmm[1] = 0.0;
-      invmm[2] = 0.0;
-      invmm[3] = 0.0;
-
-      if(npd == 1) {
-        invmm[0] = 1 / mm[0];
-      }
-      else if(npd == 2) {
-        const double invdetmm = 1 / (mm[0]*mm[3] - mm[1]*mm[2]);
-        invmm[0] =  invdetmm * mm[3];
-        invmm[1] = -invdetmm * mm[2];
-        invmm[2] = -invdetmm * mm[1];
-        invmm[3] =  invdetmm * mm[0];
-      }
-
-      // Read frictional variables:
-      for (int pdf = 0; pdf < npd; ++pdf) {
-        Xi_m[pdf]  = GPs[(nsd + 3 + pdf)*GPs_len + i + g];
-        t_T0[pdf]  = GPs[(nsd + npd + 7 + pdf)*GPs_len + i + g];
-        Xi0_m[pdf] = GPs[(nsd + 2*npd + 7 + pdf)*GPs_len + i + g];
-      }
-
-      double t_N0 = GPs[(nsd + 3*npd + 7)*GPs_len + i + g];
-
-      // isStick is not necessary...
-      //const int isStick = (int)GPs[(nsd + npd + 6)*GPs_len + i + g];
-
-      // Evaluate trial tangent traction:
-      for (int r = 0; r < npd; ++r) {
-        t_T[r] = t_T0[r];
-        for (int s = 0; s < npd; ++s) {
-          t_T[r] -= epsT * (Xi_m[s] - Xi0_m[s]);
-        }
-      }
-
-      // Evaluate norm of the trial traction vector:
-      double norm_t_T = 0.0;
-      for (int r = 0; r < npd; ++r) {
-        for (int s = 0; s < npd; ++s) {
-          norm_t_T += t_T[r]*mm[npd*s + r]*t_T[s];
-        }
-      }
-      norm_t_T = sqrt(norm_t_T);
-
-      // Unit vector in the direction of slip:
-      double p_T[2];
-      p_T[1] = 0.0;
-      for (int r = 0; r < npd; ++r) {
-        if(fabs(norm_t_T) > 1e-10) {
-          p_T[r] = t_T[r] / norm_t_T;
-        }
-        else {
-          p_T[r] = 0.0;
-        }
-      }
-
-      // Evaluate normal vector:
-      double Normal_m[3]; // normal to initial master surface
-      double normal_m[3]; // normal to the current master surface
-      double Normal_s[3]; // normal to initial slave surface
-      double normal_s[3]; // normal to the current slave surface
-
-      if (nsd == 2) {
-        Normal_m[0] = dXm[1];
-        Normal_m[1] = -dXm[0];
-        Normal_m[2] = 0.0;
-
-        normal_m[0] = dxm[1];
-        normal_m[1] = -dxm[0];
-        normal_m[2] = 0.0;
-
-        Normal_s[0] = dXs[1];
-        Normal_s[1] = -dXs[0];
-        Normal_s[2] = 0.0;
-
-        normal_s[0] = dxs[1];
-        normal_s[1] = -dxs[0];
-        normal_s[2] = 0.0;
-      }
-      else if (nsd == 3) {
-        //       X     Y      Z
-        // r   dXs[0] dXs[2]  dXs[4]
-        // s   dXs[1] dXs[3]  dXs[5]
-        const double dXm_dr1 = dXm[0];
-        const double dXm_dr2 = dXm[npd + 0];
-        const double dXm_dr3 = dXm[2 * npd + 0];
-        const double dXm_ds1 = dXm[1];
-        const double dXm_ds2 = dXm[npd + 1];
-        const double dXm_ds3 = dXm[2 * npd + 1];
-        Normal_m[0] = dXm_dr2*dXm_ds3 - dXm_dr3*dXm_ds2;
-        Normal_m[1] = dXm_dr3*dXm_ds1 - dXm_dr1*dXm_ds3;
-        Normal_m[2] = dXm_dr1*dXm_ds2 - dXm_dr2*dXm_ds1;
-
-        const double dxm_dr1 = dxm[0];
-        const double dxm_dr2 = dxm[npd + 0];
-        const double dxm_dr3 = dxm[2 * npd + 0];
-        const double dxm_ds1 = dxm[1];
-        const double dxm_ds2 = dxm[npd + 1];
-        const double dxm_ds3 = dxm[2 * npd + 1];
-        normal_m[0] = dxm_dr2*dxm_ds3 - dxm_dr3*dxm_ds2;
-        normal_m[1] = dxm_dr3*dxm_ds1 - dxm_dr1*dxm_ds3;
-        normal_m[2] = dxm_dr1*dxm_ds2 - dxm_dr2*dxm_ds1;
-
-
-        const double dXs_dr1 = dXs[0];
-        const double dXs_dr2 = dXs[npd + 0];
-        const double dXs_dr3 = dXs[2 * npd + 0];
-        const double dXs_ds1 = dXs[1];
-        const double dXs_ds2 = dXs[npd + 1];
-        const double dXs_ds3 = dXs[2 * npd + 1];
-        Normal_s[0] = dXs_dr2*dXs_ds3 - dXs_dr3*dXs_ds2;
-        Normal_s[1] = dXs_dr3*dXs_ds1 - dXs_dr1*dXs_ds3;
-        Normal_s[2] = dXs_dr1*dXs_ds2 - dXs_dr2*dXs_ds1;
-
-        const double dxs_dr1 = dxs[0];
-        const double dxs_dr2 = dxs[npd + 0];
-        const double dxs_dr3 = dxs[2 * npd + 0];
-        const double dxs_ds1 = dxs[1];
-        const double dxs_ds2 = dxs[npd + 1];
-        const double dxs_ds3 = dxs[2 * npd + 1];
-        normal_s[0] = dxs_dr2*dxs_ds3 - dxs_dr3*dxs_ds2;
-        normal_s[1] = dxs_dr3*dxs_ds1 - dxs_dr1*dxs_ds3;
-        normal_s[2] = dxs_dr1*dxs_ds2 - dxs_dr2*dxs_ds1;
-      }
-
-      double jacobian_s = sqrt(Normal_s[0] * Normal_s[0] + Normal_s[1] * Normal_s[1] + Normal_s[2] * Normal_s[2]);
-      if(isAxisymmetric) {
-        jacobian_s *= 2 * M_PI * Xg[0];
-      }
-
-      const double normal_m_length = sqrt(normal_m[0] * normal_m[0] + normal_m[1] * normal_m[1] + normal_m[2] * normal_m[2]);
-      normal_m[0] /= normal_m_length;
-      normal_m[1] /= normal_m_length;
-      normal_m[2] /= normal_m_length;
-
-      const double normal_s_length = sqrt(normal_s[0] * normal_s[0] + normal_s[1] * normal_s[1] + normal_s[2] * normal_s[2]);
-      normal_s[0] /= normal_s_length;
-      normal_s[1] /= normal_s_length;
-      normal_s[2] /= normal_s_length;
-/*
-      if (!keyContactDetection) {
-        const double signGAPs = (Xp[0] - Xg[0])*normal_m[0] + (Xp[1] - Xg[1])*normal_m[1] + (Xp[2] - Xg[2])*normal_m[2];
-        if (signGAPs < 0.0) { // Possitive signGAPs means open gap which is defined as negative GAP.
-          GAPs[g] = -GAPs[g];
-        }
-        GPs[(nsd + 2)*GPs_len + i + g] = GAPs[g];
-      }
-      else { // Change active state only when contact detection is enabled
-
-        if (GAPs[g] < 0.0) {
-          GPs[(nsd + npd + 3)*GPs_len + i + g] = 0; // negative GAP means open gap which means inActive GP
-          continue;
-        } else {
-          GPs[(nsd + npd + 3)*GPs_len + i + g] = 1; // possitive GAP means penetration which means Active GP
-        }
-      }
-*/
-
-  //if (els > 100 && els < 1800) epsN = 1e3;
-
-      double t_N_new = -epsN*GAPs[g];
-
-      double t_N = t_N0 + t_N_new; // normal contact traction component is non-positive, i.e. compression
-      //std::cout << "t_N0 = " << t_N0 << ", t_N_new = " << t_N_new << std::endl;
-
-      if(t_N > 0.0) {
-        t_N = 0.0;
-        //std::cout << "g_N = " << GAPs[g] << ", t_N_g = " << t_N << std::endl;
-        GPs[(nsd + 3*npd + 7)*GPs_len + i + g] = t_N;
-        continue;
-      }
-      GPs[(nsd + 3*npd + 7)*GPs_len + i + g] = t_N;
-
-
-
-      bool isStick = false;
-
-      // Check slip function:
-      if(norm_t_T + mu*t_N  <= 1e-10) {
-        //printf("stick ");
-        isStick = true;
-        for (int pdf = 0; pdf < npd; ++pdf) {
-          GPs[(nsd + npd + 7 + pdf)*GPs_len + i + g] = t_T[pdf];
-        }
-      }
-      else {
-        isStick = false;
-        printf("slip ");
-        for (int pdf = 0; pdf < npd; ++pdf) {
-          if(norm_t_T > 1e-10) {
-            t_T[pdf] = -mu*t_N * p_T[pdf];
-          }
-          else {
-            t_T[pdf] = 0.0;
-          }
-          GPs[(nsd + npd + 7 + pdf)*GPs_len + i + g] = t_T[pdf];
-        }
-      }
-
-      double tau[3];
-      tau[0] = dxm[0];
-      tau[1] = dxm[1];
-      tau[2] = 0.0;
-
-      // evaluate shape functions and contact residual vectors:
-      for (int j = 0; j < nsn; ++j) {
-        const double hs = H[j*ngp + g];
-        const double hm = Hm[j];
-
-        for (int sdf = 0; sdf < nsd; ++sdf) {
-
-          Ns[j*nsd + sdf]   += hs;
-          C_Ns[j*nsd + sdf] += hs*normal_m[sdf];
-          C_Nm[j*nsd + sdf] += hm*normal_m[sdf];
-
-          Nm1[j*nsd + sdf]   += dHm[j];
-          C_Ts1[j*nsd + sdf] += hs*tau[sdf];//dXm[sdf*npd];
-          C_Tm1[j*nsd + sdf] += hm*tau[sdf];//dXm[sdf*npd];
-          C_Nm1[j*nsd + sdf] += dHm[j]*normal_m[sdf];
-          C_Pm1[j*nsd + sdf] += dHm[j]*p_T[0];
-
-          if(npd == 2) {
-            Nm2[j*nsd + sdf]   += dHm[nsn + j];
-            C_Ts2[j*nsd + sdf] += hs*dxm[sdf*npd+1];
-            C_Tm2[j*nsd + sdf] += hm*dxm[sdf*npd+1];
-            C_Nm2[j*nsd + sdf] += dHm[nsn + j]*normal_m[sdf];
-            C_Pm2[j*nsd + sdf] += dHm[nsn + j]*p_T[1];
-          }
-
-          // The negative master normal is used as the slave normal
-          //sstd::cout << t_N << ", " << hs << ", " << normal_m[sdf] << " , " << gw[g] << ", " << jacobian_s << std::endl;
-          Gc[segmentNodesIDs[j] * nsd + sdf]   -= t_N * hs * (-normal_m[sdf]) * gw[g] * jacobian_s;
-          Gc_loc[ (i+g)*(j*nsd + sdf) + i/ngp] -= t_N * hs * (-normal_m[sdf]) * gw[g] * jacobian_s;
-
-          //////////// For MASTER-SLAVE t_N * hm term is needed (loop over GPs tabel goes only over SLAVE GPs)
-          if (GPs_len != nsg) { // This inequality indicates master-slave algorithm
-            Gc[segmentNodesIDm[j] * nsd + sdf]    -= t_N * hm * (normal_m[sdf]) * gw[g] * jacobian_s;
-          }
-
-          // MUSI SE UPRAVIT: Gc_loc[ (i+g)*(j*nsd + sdf) + i/ngp]  = t_N * hm * (-normal_m[sdf]) * gw[g] * jacobian_s;
-
-          /*
-          for (int pdf = 0; pdf < npd; ++pdf) {
-          Gc[segmentNodesIDs[j] * nsd + sdf]   -= t_T[pdf]*hs*tau[sdf] * gw[g] * jacobian_s;
-          Gc_loc[ (i+g)*(j*nsd + sdf) + i/ngp] -= t_T[pdf]*hs*tau[sdf] * gw[g] * jacobian_s;
-        }
-        */
-
-      }
-    }
-
-    if(keyAssembleKc) {
-      for (int j = 0; j < nsn*nsd; ++j) { // loop over cols
-        for (int k = 0; k < nsn*nsd; ++k) { // loop over rows
-
-          // Kc elementu je blokova matice o strukture:
-          // Kc_e = [C_Nm*C_Nm'  C_Nm*C_Ns'
-          //         C_Ns*C_Nm'  C_Ns*C_Ns'];
-          // dimeze: [(nsn*nsd)*(nsn*nsd)  (nsn*nsd)*(nsn*nsd)
-          //          (nsn*nsd)*(nsn*nsd)  (nsn*nsd)*(nsn*nsd)];
-
-          Kc[(i+g)*2*nsn*nsd*k           + (i+g)*(nsn*nsd+j) + i/ngp] = C_Ns[j] * C_Nm[k] * gw[g] * jacobian_s;
-          Kc[(i+g)*2*nsn*nsd*(nsn*nsd+k) + (i+g)*(nsn*nsd+j) + i/ngp] = C_Ns[j] * C_Ns[k] * gw[g] * jacobian_s;
-
-          const int jdof = j%nsd;
-          const int jnode = (j - jdof) / nsd; // row node
-
-          const int kdof = k%nsd;
-          const int knode = (k - kdof) / nsd; // col node
-
-
-          /////////////////// Normal contact /////////////////////////////
-
-          if(fabs(C_Ns[k] * C_Ns[j]) > 1e-50) {
-            cols[*len] = segmentNodesIDs[jnode] * nsd + jdof + 1;
-            rows[*len] = segmentNodesIDs[knode] * nsd + kdof + 1;
-            vals[*len] = epsN * (C_Ns[k] * C_Ns[j]) * gw[g] * jacobian_s;
-            (*len)++;
-            if (*len >= len_guess) printf("Error, len is too small: len = %i.\n", len_guess);
-          }
-
-
-          if(fabs(C_Ns[k] * C_Nm[j]) > 1e-50) {
-            cols[*len] = segmentNodesIDm[jnode] * nsd + jdof + 1;
-            rows[*len] = segmentNodesIDs[knode] * nsd + kdof + 1;
-            vals[*len] = epsN * (-C_Ns[k] * C_Nm[j]) * gw[g] * jacobian_s;
-            (*len)++;
-            if (*len >= len_guess) printf("Error, len is too small: len = %i.\n", len_guess);
-          }
-
-
-        if(fabs(C_Ts1[k] * C_Nm1[j]) > 1e-50) {
-          cols[*len] = segmentNodesIDm[jnode] * nsd + jdof + 1;
-          rows[*len] = segmentNodesIDs[knode] * nsd + kdof + 1;
-          vals[*len] = t_N * invmm[0] * (C_Ts1[k] * C_Nm1[j]) * gw[g] * jacobian_s;
-          (*len)++;
-          if (*len >= len_guess) printf("Error, len is too small: len = %i.\n", len_guess);
-        }
-
-
-        if (GPs_len != nsg) { // This inequality indicates master-slave algorithm
-          //////////// For MASTER-SLAVE C_Nm*C_Nm term is needed (loop over GPs tabel goes only over SLAVE GPs)
-          if(fabs(C_Nm[k] * C_Nm[j]) > 1e-50) {
-            cols[*len] = segmentNodesIDm[jnode] * nsd + jdof + 1;
-            rows[*len] = segmentNodesIDm[knode] * nsd + kdof + 1;
-            vals[*len] = epsN * (C_Nm[k] * C_Nm[j]) * gw[g] * jacobian_s;
-            (*len)++;
-            if (*len >= len_guess) printf("Error, len is too small: len = %i.\n", len_guess);
-          }
-
-          if(fabs(C_Nm[k] * C_Ns[j]) > 1e-50) {
-            cols[*len] = segmentNodesIDs[jnode] * nsd + jdof + 1;
-            rows[*len] = segmentNodesIDm[knode] * nsd + kdof + 1;
-            vals[*len] = epsN * (-C_Nm[k] * C_Ns[j]) * gw[g] * jacobian_s;
-            (*len)++;
-            if (*len >= len_guess) printf("Error, len is too small: len = %i.\n", len_guess);
-          }
-        }
-
-        if(isStick) { ////////////////// stick ///////////////////
-          /*
-          cols[*len] = segmentNodesIDs[jnode] * nsd + jdof + 1;
-          rows[*len] = segmentNodesIDs[knode] * nsd + kdof + 1;
-          vals[*len] = +epsT * invmm[0] *(C_Ts1[k] * C_Ts1[j]) * gw[g] * jacobian_s;
-          (*len)++;
-          if (*len >= len_guess) printf("Error, len is too small: len = %i.\n", len_guess);
-
-          cols[*len] = segmentNodesIDm[jnode] * nsd + jdof + 1;
-          rows[*len] = segmentNodesIDs[knode] * nsd + kdof + 1;
-          vals[*len] = +epsT * invmm[0] *(-C_Ts1[k] * C_Tm1[j]) * gw[g] * jacobian_s;
-          (*len)++;
-          if (*len >= len_guess) printf("Error, len is too small: len = %i.\n", len_guess);
-
-          cols[*len] = segmentNodesIDm[jnode] * nsd + jdof + 1;
-          rows[*len] = segmentNodesIDs[knode] * nsd + kdof + 1;
-          vals[*len] = +epsT * invmm[0] *(-GAPs[g] * C_Ts1[k] * C_Nm1[j]) * gw[g] * jacobian_s;
-          (*len)++;
-          if (*len >= len_guess) printf("Error, len is too small: len = %i.\n", len_guess);
-
-          cols[*len] = segmentNodesIDm[jnode] * nsd + jdof + 1;
-          rows[*len] = segmentNodesIDs[knode] * nsd + kdof + 1;
-          vals[*len] = -t_T[0] * (Ns[k] * Nm1[j]) * gw[g] * jacobian_s;
-          (*len)++;
-          if (*len >= len_guess) printf("Error, len is too small: len = %i.\n", len_guess);
-          */
-        }
-        else { ////////////////////// slip ////////////////////////
-          /*
-          cols[*len] = segmentNodesIDs[jnode] * nsd + jdof + 1;
-          rows[*len] = segmentNodesIDs[knode] * nsd + kdof + 1;
-          vals[*len] = +mu * epsN * p_T[0] * (C_Ts1[k] * C_Ns[j]) * gw[g] * jacobian_s;
-          (*len)++;
-          if (*len >= len_guess) printf("Error, len is too small: len = %i.\n", len_guess);
-
-          cols[*len] = segmentNodesIDm[jnode] * nsd + jdof + 1;
-          rows[*len] = segmentNodesIDs[knode] * nsd + kdof + 1;
-          vals[*len] = +mu * epsN * p_T[0] * (-C_Ts1[k] * C_Nm[j]) * gw[g] * jacobian_s;
-          (*len)++;
-          if (*len >= len_guess) printf("Error, len is too small: len = %i.\n", len_guess);
-
-          cols[*len] = segmentNodesIDm[jnode] * nsd + jdof + 1;
-          rows[*len] = segmentNodesIDs[knode] * nsd + kdof + 1;
-          vals[*len] = +mu * t_N * p_T[0] * p_T[0] * (C_Ts1[k] * C_Pm1[j]) * gw[g] * jacobian_s;
-          (*len)++;
-          if (*len >= len_guess) printf("Error, len is too small: len = %i.\n", len_guess);
-
-          cols[*len] = segmentNodesIDm[jnode] * nsd + jdof + 1;
-          rows[*len] = segmentNodesIDs[knode] * nsd + kdof + 1;
-          vals[*len] = -t_T[0] * (Ns[k] * Nm1[j]) * gw[g] * jacobian_s;
-          (*len)++;
-          if (*len >= len_guess) printf("Error, len is too small: len = %i.\n", len_guess);
-          */
-        }
-      }
-    }
-  }
-
-  // Fill C_m array by zeros:
-  for (int j = 0; j < nsn*nsd; ++j) {
-    Ns[j] = 0.0;
-    C_Ns[j] = 0.0;
-    C_Nm[j] = 0.0;
-
-    Nm1[j] = 0.0;
-    C_Ts1[j] = 0.0;
-    C_Tm1[j] = 0.0;
-    C_Nm1[j] = 0.0;
-    C_Pm1[j] = 0.0;
-
-    if(npd == 2) {
-      Nm2[j] = 0.0;
-      C_Ts2[j] = 0.0;
-      C_Tm2[j] = 0.0;
-      C_Nm2[j] = 0.0;
-      C_Pm2[j] = 0.0;
-    }
-  }
-
-} // loop over gausspoints
-} // loop over GPs rows
-
-delete[] segmentNodesIDs;
-delete[] segmentNodesIDm;
-delete[] Xs;
-delete[] Xm;
-delete[] Us;
-delete[] Um;
-delete[] dXs;
-delete[] dxs;
-delete[] GAPs;
-delete[] activeGPs;
-delete[] Ns;
-delete[] C_Ns;
-delete[] C_Nm;
-delete[] Nm1;
-delete[] C_Ts1;
-delete[] C_Tm1;
-delete[] C_Nm1;
-delete[] C_Pm1;
-
-delete[] C_Ts2;
-delete[] C_Tm2;
-delete[] Nm2;
-delete[] C_Nm2;
-delete[] C_Pm2;
-delete[] Hm;
-delete[] dHm;
-delete[] Xi_m;
-delete[] Xi0_m;
-delete[] t_T;
-delete[] t_T0;
-}
-
-void getLongestEdgeAndGPs(double* longestEdge, double* GPs, int n, int nsd, int npd, int ngp, int neq, int nsn, int nes, int nen, int* elementID, int* segmentID, int* ISN, int* IEN, double* H, double* X) {
-  // GPs legend:              Xg     els  sgs   gap    Xi_m  isActive      elm      sgm      isStick      t_T       Xi0_m     t_N0
-  //double* GPs = new double[n*(nsd + 1 +  1  +  1  +  npd  +   1     +     1    +   1     +    1    +    npd   +    npd    +  1];
-  //index of begining           0    nsd nsd+1 nsd+2  nsd+3  nsd+npd+3  nsd+npd+4 nsd+npd+5 nsd+npd+6  nsd+npd+7 nsd+2*npd+7   (size = nsd+3*npd+8)
-
-  int* segmentNodesID = new int[nsn];
-  double* Xs = new double[nsn*nsd];
-  double* Xg = new double[ngp*nsd];
-  int g = 0;
-  *longestEdge = 0.0;
-
-  for (int e = 0; e < n; ++e) {
-    int el = elementID[e] - 1;
-    int sg = segmentID[e] - 1;
-
-    // segment coords Xs:
-    for (int i = 0; i < nsn; ++i) {
-      const int IENrow = ISN[nes*i + sg] - 1; // Matlab numbering starts with 1
-      segmentNodesID[i] = IEN[nen*el + IENrow] - 1; // Matlab numbering starts with 1
-      for (int j = 0; j < nsd; ++j) {
-        Xs[j*nsn + i] = X[j*(int)(neq / nsd) + segmentNodesID[i]];
-      }
-    }
-
-    // evaluate gausspoint coords:
-    for (int i = 0; i < ngp; ++i) {
-      for (int sdf = 0; sdf < nsd; ++sdf) {
-        Xg[i*nsd + sdf] = 0.0;
-        for (int j = 0; j < nsn; ++j) {
-          Xg[i*nsd + sdf] += H[j*ngp + i] * Xs[sdf*nsn + j];
-        }
-
-        GPs[sdf*n*ngp + g] = Xg[i*nsd + sdf]; // slave gausspoint coords
-        //GPs[(nsd + 3 + sdf)*n*ngp + g] = 0.0; // init master parametric coords Xi_m
-      }
-
-      GPs[(nsd + 0)*n*ngp + g] = el + 1;      // slave element
-      GPs[(nsd + 1)*n*ngp + g] = sg + 1;      // slave segment
-      GPs[(nsd + 2)*n*ngp + g] = -FLT_MAX;    // init gap
-
-      for (int pdf = 0; pdf < npd; ++pdf) {
-        GPs[(nsd + 3 + pdf)*n*ngp + g] = 0.0; // Xi_m
-      }
-
-      GPs[(nsd + npd + 3)*n*ngp + g] = 0;       // init is NO active
-      GPs[(nsd + npd + 4)*n*ngp + g] = 0;       // master element
-      GPs[(nsd + npd + 5)*n*ngp + g] = 0;       // master segment
-      GPs[(nsd + npd + 6)*n*ngp + g] = 0;       // is stick
-
-      for (int pdf = 0; pdf < nsd-1; ++pdf) {
-        GPs[(nsd + npd + 7 + pdf)*n*ngp + g] = 0.0; // tangent traction components
-      }
-      for (int pdf = 0; pdf < nsd-1; ++pdf) {
-        GPs[(nsd + 2*npd + 7 + pdf)*n*ngp + g] = 0.0; // Xi0_m
-      }
-      GPs[(nsd + 3*npd + 7)*n*ngp + g] = 0.0; // t_N0
-      g++;
-    }
-
-    for (int i = 0; i < nsn; ++i) {
-      for (int j = i+1; j < nsn; ++j) {
-        double lengthOfEdge = 0.0;
-        for (int sdf = 0; sdf < nsd; ++sdf) {
-          lengthOfEdge += pow(Xs[sdf*nsn + i] - Xs[sdf*nsn + j ], 2);
-        }
-        *longestEdge = std::max(*longestEdge, sqrt(lengthOfEdge) );
-      }
-    }
-
-  } // loop over elements
-
-  delete[] segmentNodesID;
-  delete[] Xs;
-  delete[] Xg;
-
-}
-
-void getAABB(double* AABBmin, double* AABBmax, int nsd, int nnod, double* X, double longestEdge, int* IEN, int* ISN, int* elementID, int* segmentID, int n, int nsn, int nes, int nen, int neq) {
-
-  int* segmentNodesID = new int[nsn];
-
-  for (int sdf = 0; sdf < nsd; ++sdf) {
-    AABBmin[sdf] = FLT_MAX;
-    AABBmax[sdf] = -FLT_MAX;
-
-    for (int e = 0; e < n; ++e) {
-      int el = elementID[e] - 1;
-      int sg = segmentID[e] - 1;
-
-      // segment coords Xs:
-      for (int i = 0; i < nsn; ++i) {
-        const int IENrow = ISN[nes*i + sg] - 1; // Matlab numbering starts with 1
-        segmentNodesID[i] = IEN[nen*el + IENrow] - 1; // Matlab numbering starts with 1
-        //	for (int sdf = 0; sdf < nsd; ++sdf) {
-        const double x = X[sdf*(int)(neq / nsd) + segmentNodesID[i]];
-        AABBmin[sdf] = std::min(AABBmin[sdf], x);
-        AABBmax[sdf] = std::max(AABBmax[sdf], x);
-        //	}
-      }
-    }
-
-    //for (int sdf = 0; sdf < nsd; ++sdf) {
-    //if ((AABBmax[sdf] - AABBmin[sdf]) < longestEdge) {
-    //  AABBmax[sdf] += 0.5*longestEdge;
-    //  AABBmin[sdf] -= 0.5*longestEdge;
-    //}
-    //}
-  }
-  delete[] segmentNodesID;
-}
-
-/*! Calculate contact residual term (gradient) and contact tangent term (Hessian)
-
-\param GPs - 2d array (GPs_len x ??? cols)
-\param ISN - 2d array (nsn*)
-\param IEN -
-\param N -
-\param AABBmin -
-\param AABBmax -
-\param head -
-\param next -
-\param X - 2d array of contact nodal coordinates
-\param elementID -
-\param segmentID -
-\param n - number of contact segments
-\param nsn - Number of Segment Nodes
-\param nsd - Number of Space Dimensions
-\param npd - Number of Parametric Dimensions
-\param ngp - Number of Gauss Points
-\param nen - Number of Element Nodes
-\param nes - Number of Element Segments
-\param neq - Number of EQuations
-\param longestEdge - length of the longest edge of all contact segments
-
-\return GPs - 1d array
-*/
-void evaluateContactConstraints(double* GPs, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, int* head, int* next, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge) {
-
-  // GPs legend:              Xg     els  sgs   gap    Xi_m  isActive      elm      sgm      isStick      t_T       Xi0_m
-  //double* GPs = new double[n*(nsd + 1 +  1  +  1  +  npd  +   1     +     1    +   1     +    1    +    npd   +    npd    ];
-  //index of begining           0    nsd nsd+1 nsd+2  nsd+3  nsd+npd+3  nsd+npd+4 nsd+npd+5 nsd+npd+6  nsd+npd+7 nsd+2*npd+7  (size = nsd+3*npd+7)
-
-
-  int* segmentNodesID = new int[nsn];
-  double* Xm = new double[nsn*3];
-  double* Xmin = new double[nsd];
-  double* Xmax = new double[nsd];
-  double* Hm = new double[nsn];
-  double* dHm = new double[nsn*npd];
-
-  double Xt[9];
-  double Xc[3];
-
-  for(int i = 0; i < 3; ++i) Xc[i] = 0.0;
-  for(int i = 0; i < 9; ++i) Xt[i] = 0.0;
-  for(int i = 0; i < nsn*3; ++i) Xm[i] = 0.0;
-
-
-  // Number of TRiangles:
-  int ntr = 1;
-  if(nsn == 8) {
-    // If the segment element is a quad then it is subdivided to 4 triangles (with a common vertex Xc in the centre of mass):
-    ntr = 4;
-  }
-
-  // Initialize the gap by MINUS float max value (because negative is OPEN gap:
-  int numOfRows = n*ngp;
-  int colBegin = (nsd + 2) * numOfRows;
-  for (int row = 0; row < numOfRows; ++row) {
-    GPs[colBegin + row] = -FLT_MAX;
-  }
-
-  // Loop over contact segments:
-  for (int e = 0; e < n; ++e) {
-    int el = elementID[e] - 1;
-    int sg = segmentID[e] - 1;
-
-    // segment coords Xm:
-    for (int k = 0; k < nsd; ++k) {
-
-      Xmin[k] = FLT_MAX;
-      Xmax[k] = -FLT_MAX;
-      Xc[k] = 0.0;
-
-      for (int j = 0; j < nsn; ++j) {
-        const int IENrow = ISN[nes*j + sg] - 1; // Matlab numbering starts with 1
-        segmentNodesID[j] = IEN[nen*el + IENrow] - 1; // Matlab numbering starts with 1
-        Xm[k*nsn + j] = X[k*(int)(neq / nsd) + segmentNodesID[j]];
-        Xmin[k] = std::min(Xmin[k], Xm[k*nsn + j]);
-        Xmax[k] = std::max(Xmax[k], Xm[k*nsn + j]);
-        Xc[k] += Xm[k*nsn + j];
-      }
-      Xmin[k] -= 0.5*longestEdge;
-      Xmax[k] += 0.5*longestEdge;
-      Xc[k] /= nsn;
-    }
-
-    // Loop over segment triangles:
-    for (int it = 0; it < ntr; ++it) {
-
-      if(nsd == 3) {
-        // triangle coords Xt:
-        if(ntr == 1) {
-          Xt[0] = Xm[0];
-          Xt[1] = Xm[1];
-          Xt[2] = Xm[2];
-
-          Xt[3] = Xm[nsn];
-          Xt[4] = Xm[nsn+1];
-          Xt[5] = Xm[nsn+2];
-
-          Xt[6] = Xm[2*nsn];
-          Xt[7] = Xm[2*nsn+1];
-          Xt[8] = Xm[2*nsn+2];
-        }
-        else if(ntr == 4) {
-          Xt[0] = Xm[it];
-          Xt[1] = Xm[it+1];
-          Xt[2] = Xc[0];
-
-          Xt[3] = Xm[nsn+it];
-          Xt[4] = Xm[nsn+it+1];
-          Xt[5] = Xc[1];
-
-          Xt[6] = Xm[2*nsn+it];
-          Xt[7] = Xm[2*nsn+it+1];
-          Xt[8] = Xc[2];
-        }
-
-        // Min and Max of the triangle coords:
-        for (int k = 0; k < nsd; ++k) {
-          Xmin[k] = FLT_MAX;
-          Xmax[k] = -FLT_MAX;
-          for (int j = 0; j < 3; ++j) {
-            Xmin[k] = std::min(Xmin[k], Xt[k*3 + j]);
-            Xmax[k] = std::max(Xmax[k], Xt[k*3 + j]);
-          }
-          Xmin[k] -= 0.5*longestEdge;
-          Xmax[k] += 0.5*longestEdge;
-        }
-      }
-
-      int Imin[3];
-      int Imax[3];
-      double normal[3];
-      double t1[3];
-      double t2[3];
-      double t3[3];
-      double Xg[3];
-      double Xp[3];
-
-      Imin[0] = (int)(N[0] * (Xmin[0] - AABBmin[0]) / (AABBmax[0] - AABBmin[0]));
-      Imin[1] = (int)(N[1] * (Xmin[1] - AABBmin[1]) / (AABBmax[1] - AABBmin[1]));
-      Imax[0] = (int)(N[0] * (Xmax[0] - AABBmin[0]) / (AABBmax[0] - AABBmin[0]));
-      Imax[1] = (int)(N[1] * (Xmax[1] - AABBmin[1]) / (AABBmax[1] - AABBmin[1]));
-
-      if (nsd == 2) {
-
-        Imin[2] = 0;
-        Imax[2] = 0;
-
-        t1[0] = Xm[1] - Xm[0];
-        t1[1] = Xm[3] - Xm[2];
-        t1[2] = 0.0;
-
-        normal[0] = t1[1];
-        normal[1] = -t1[0];
-        normal[2] = 0.0;
-      }
-      else if (nsd == 3) {
-
-        Imin[2] = (int)(N[2] * (Xmin[2] - AABBmin[2]) / (AABBmax[2] - AABBmin[2]));
-        Imax[2] = (int)(N[2] * (Xmax[2] - AABBmin[2]) / (AABBmax[2] - AABBmin[2]));
-
-        // Tangent vectors parallel with element edges 1 and 2:
-        // Component: X     Y      Z
-        // Vertex 1:  Xt[0] Xt[3]  Xt[6]
-        // Vertex 2:  Xt[1] Xt[4]  Xt[7]
-        // Vertex 3:  Xt[2] Xt[5]  Xt[8]
-
-        t1[0] = Xt[1] - Xt[0];
-        t1[1] = Xt[4] - Xt[3];
-        t1[2] = Xt[7] - Xt[6];
-
-        t2[0] = Xt[2] - Xt[1];
-        t2[1] = Xt[5] - Xt[4];
-        t2[2] = Xt[8] - Xt[7];
-
-        t3[0] = Xt[0] - Xt[2];
-        t3[1] = Xt[3] - Xt[5];
-        t3[2] = Xt[6] - Xt[8];
-
-        // Normal vector:
-        normal[0] = t1[1] * t2[2] - t1[2] * t2[1];
-        normal[1] = t1[2] * t2[0] - t1[0] * t2[2];
-        normal[2] = t1[0] * t2[1] - t1[1] * t2[0];
-      }
-
-      const double normalLength = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
-      normal[0] /= normalLength;
-      normal[1] /= normalLength;
-      normal[2] /= normalLength;
-
-      for (int sdf = 0; sdf < nsd; ++sdf) {
-        if (Imin[sdf] < 0) {
-          Imin[sdf] = 0;
-        }
-        if (Imax[sdf] < 0) {
-          Imax[sdf] = 0;
-        }
-        if (Imin[sdf] >= N[sdf]) {
-          Imin[sdf] = N[sdf] - 1;
-        }
-        if (Imax[sdf] >= N[sdf]) {
-          Imax[sdf] = N[sdf] - 1;
-        }
-      }
-
-      for (int i2 = Imin[2]; i2 <= Imax[2]; ++i2) {
-        for (int i1 = Imin[1]; i1 <= Imax[1]; ++i1) {
-          for (int i0 = Imin[0]; i0 <= Imax[0]; ++i0) {
-            const int Ic = i2*N[0] * N[1] + i1*N[0] + i0;
-            int v = head[Ic];
-
-            // Contact searching algorithm based on linked lists ( DOI: 10.1007/BF02487690, DOI: 10.1007/s00466-014-1058-5):
-            while (v != -1) {
-              // v sequentially refers to the row in the GPs table of all Gauss points that lie in the "bucket" with the index Ic.
-
-              // Read from table GPs the index of element and the local contact segment index:
-              int els = GPs[nsd*n*ngp + v] -1;            // slave element
-              int sgs = GPs[(nsd + 1)*n*ngp + v] -1;      // slave segment
-
-              // Jump if Gausspoint segment is equal to master segment
-              if (el == els && sg == sgs) {
-                v = next[v];
-                continue;
-              }
-
-              double d;
-
-              // Inside-outside algorithm ( DOI: 10.1002/(SICI)1097-0207(19971015)40:19<3665::AID-NME234>3.0.CO;2-K ):
-              bool isInside = false;
-              if (nsd == 2) {
-                double r[2];
-                d = 0.0;
-                double t1_norm = 0.0;
-                for (int i = 0; i < nsd; ++i) {
-                  Xg[i] = GPs[i*n*ngp + v];
-                  r[i] = Xg[i] - Xm[i*nsn + 0];
-                  d += r[i] * t1[i];
-                  t1_norm += t1[i] * t1[i];
-                }
-                t1_norm = sqrt(t1_norm);
-                d = d / t1_norm;
-
-                // Check if inside edge_1:
-                if (d > 0.0 && d < t1_norm) {
-                  isInside = true;
-                  double sign = 0.0;
-                  double d_aux = d;
-                  d = 0.0;
-                  for (int i = 0; i < nsd; ++i) {
-                    Xp[i] = Xm[i*nsn + 0] + d_aux * t1[i] / t1_norm;
-                    sign -= (Xg[i] - Xp[i])*normal[i]; // negative sign for the OPEN gap!
-                    d += pow(Xg[i] - Xp[i], 2);
-                  }
-                  d = sqrt(d);
-                  if (sign < 0) { // OPEN gap
-                    d *= -1; // because d was distance (non negative number)
-                  }
-                }
-              }
-              else if (nsd == 3) {
-                double r[9];
-                double Q1[3];
-                double Q2[3];
-                double Q3[3];
-                d = 0.0;
-                for (int i = 0; i < nsd; ++i) {
-                  Xg[i] = GPs[i*n*ngp + v];
-                  r[i * 3 + 0] = Xg[i] - Xt[i*3 + 0];
-                  r[i * 3 + 1] = Xg[i] - Xt[i*3 + 1];
-                  r[i * 3 + 2] = Xg[i] - Xt[i*3 + 2];
-                }
-
-                // component:  X    Y    Z
-                // r1:       r[0] r[3] r[6]
-                // r2:       r[1] r[4] r[7]
-                // r3:       r[2] r[5] r[8]
-                Q1[0] = r[3] * t1[2] - r[6] * t1[1];
-                Q1[1] = r[6] * t1[0] - r[0] * t1[2];
-                Q1[2] = r[0] * t1[1] - r[3] * t1[0];
-
-                Q2[0] = r[4] * t2[2] - r[7] * t2[1];
-                Q2[1] = r[7] * t2[0] - r[1] * t2[2];
-                Q2[2] = r[1] * t2[1] - r[4] * t2[0];
-
-                Q3[0] = r[5] * t3[2] - r[8] * t3[1];
-                Q3[1] = r[8] * t3[0] - r[2] * t3[2];
-                Q3[2] = r[2] * t3[1] - r[5] * t3[0];
-
-                const double Q1n = Q1[0] * normal[0] + Q1[1] * normal[1] + Q1[2] * normal[2];
-                const double Q2n = Q2[0] * normal[0] + Q2[1] * normal[1] + Q2[2] * normal[2];
-                const double Q3n = Q3[0] * normal[0] + Q3[1] * normal[1] + Q3[2] * normal[2];
-
-                if (Q1n*Q2n > 0) {
-                  if (Q1n*Q3n > 0) {
-                    isInside = true;
-                    d = r[0] * normal[0] + r[3] * normal[1] + r[6] * normal[2];
-                    for (int i = 0; i < nsd; ++i) {
-                      Xp[i] = Xg[i] - d*normal[i];
-                    }
-                  }
-                }
-              } // else if (nsd = 3)
-
-              if (isInside) {
-
-                // Perform a more accurate search if the current gap
-                // is smaller than the previously detected but not
-                // smaller than the width of the contact zone:
-
-                if (d > GPs[(nsd + 2)*n*ngp + v] && d < 20.0) {
-
-                  // Initial guess of the parametric coordinates on the triangle:
-                  double r_len, r;
-                  double s_len, s;
-                  switch (nsn) { // Number of Segment Nodes
-                    case 2:
-                    // Tangent vectors parallel with element edges 1 and 2:
-                    // Component: X     Y      Z
-                    // Node 1:  Xm[0] Xm[2]  Xm[4]
-                    // Node 2:  Xm[1] Xm[3]  Xm[5]
-
-                    r_len = pow(Xm[1] - Xm[0], 2.0) +
-                    pow(Xm[3] - Xm[2], 2.0) +
-                    pow(Xm[5] - Xm[4], 2.0);
-
-                    r = ((Xp[0] - Xm[0])  * (Xm[1] - Xm[0]) +
-                    (Xp[1] - Xm[2])  * (Xm[3] - Xm[2]) +
-                    (Xp[2] - Xm[4])  * (Xm[5] - Xm[4])) / r_len;
-                    r = 2*r-1;
-                    break;
-                    case 6:
-                    r_len = pow(Xm[1] - Xm[0], 2.0) +
-                    pow(Xm[7] - Xm[6], 2.0) +
-                    pow(Xm[13] - Xm[12], 2.0);
-
-                    s_len = pow(Xm[2] - Xm[0], 2.0) +
-                    pow(Xm[8] - Xm[6], 2.0) +
-                    pow(Xm[14] - Xm[12], 2.0);
-
-                    r = ((Xp[0] - Xm[0])  * (Xm[1] - Xm[0]) +
-                    (Xp[1] - Xm[6])  * (Xm[7] - Xm[6]) +
-                    (Xp[2] - Xm[12]) * (Xm[13] - Xm[12])) / r_len;
-
-                    s = ((Xp[0] - Xm[0])  * (Xm[2] - Xm[0]) +
-                    (Xp[1] - Xm[6])  * (Xm[8] - Xm[6]) +
-                    (Xp[2] - Xm[12]) * (Xm[14] - Xm[12])) / s_len;
-                    break;
-                    case 8:
-                    r_len = pow(Xm[1]  - Xm[0],  2.0) +
-                    pow(Xm[9]  - Xm[8],  2.0) +
-                    pow(Xm[17] - Xm[16], 2.0);
-
-                    s_len = pow(Xm[3]  - Xm[0],  2.0) +
-                    pow(Xm[11] - Xm[8],  2.0) +
-                    pow(Xm[19] - Xm[16], 2.0);
-
-                    r = ((Xp[0] - Xm[0])  * (Xm[1] - Xm[0]) +
-                    (Xp[1] - Xm[8])  * (Xm[9] - Xm[8]) +
-                    (Xp[2] - Xm[16]) * (Xm[17] - Xm[16])) / r_len;
-
-                    r = 2*r-1;
-
-                    s = ((Xp[0] - Xm[0])  * (Xm[3]  - Xm[0]) +
-                    (Xp[1] - Xm[8])  * (Xm[11] - Xm[8]) +
-                    (Xp[2] - Xm[16]) * (Xm[19] - Xm[16])) / s_len;
-
-                    s = 2*s-1;
-                  }
-
-
-                  // Local contact search by Least-square projection method:
-                  double dr_norm;
-                  int niter = 0;
-                  int max_niter = 1000;
-                  do {
-                    switch (nsn) {
-                      case 2:
-                      sfd2(Hm, dHm, r);
-                      break;
-                      case 4:
-                      sfd4(Hm, dHm, r, s);
-                      break;
-                      case 6:
-                      sfd6(Hm, dHm, r, s);
-                      break;
-                      case 8:
-                      sfd8(Hm, dHm, r, s);
-                    }
-
-                    double b1, b2, A11, A22, A12;
-                    A11 = 0.0;
-                    A22 = 0.0;
-                    A12 = 0.0;
-                    b1 = 0.0;
-                    b2 = 0.0;
-                    d = 0.0;
-
-                    double Xp[3];
-                    double dx_dr[3];
-                    double dx_ds[3];
-                    double normal[3];
-
-                    for (int sdf = 0; sdf < nsd; ++sdf) {
-                      Xp[sdf] = 0.0;
-                      dx_dr[sdf] = 0.0;
-                      dx_ds[sdf] = 0.0;
-                      for (int k = 0; k < nsn; ++k) {
-                        Xp[sdf] += Hm[k] * Xm[sdf*nsn + k];
-                        dx_dr[sdf] += dHm[k] * Xm[sdf*nsn + k];
-                        if (npd == 2) {
-                          dx_ds[sdf] += dHm[nsn + k] * Xm[sdf*nsn + k];
-                        }
-                      }
-                    }
-
-                    if(nsd == 2) {
-                      normal[0] = dx_dr[1];
-                      normal[1] = -dx_dr[0];
-                      normal[2] = 0.0;
-                      dx_dr[2] = 0.0;
-                      dx_ds[2] = 0.0;
-                    }
-                    else if (nsd == 3) {
-                      normal[0] = dx_dr[1]*dx_ds[2] - dx_dr[2]*dx_ds[1];
-                      normal[1] = dx_dr[2]*dx_ds[0] - dx_dr[0]*dx_ds[2];
-                      normal[2] = dx_dr[0]*dx_ds[1] - dx_dr[1]*dx_ds[0];
-                    }
-
-                    const double normalLength = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
-                    normal[0] /= normalLength;
-                    normal[1] /= normalLength;
-                    normal[2] /= normalLength;
-
-                    d = 0.0;
-                    for (int sdf = 0; sdf < nsd; ++sdf) {
-                      b1 += dx_dr[sdf]*(Xg[sdf] - Xp[sdf]);
-                      A11 += dx_dr[sdf]*dx_dr[sdf];
-
-                      if (npd == 2) {
-                        b2 += dx_ds[sdf]*(Xg[sdf] - Xp[sdf]);
-                        A22 += dx_ds[sdf]*dx_ds[sdf];
-                        A12 += dx_dr[sdf]*dx_ds[sdf];
-                      }
-
-                      d -= (Xg[sdf] - Xp[sdf]) * normal[sdf];
-                    }
-
-                    double recDetA;
-                    double invA11;
-                    double invA22;
-                    double invA12;
-                    double dr;
-                    double ds;
-
-                    if (npd == 1) {
-                      invA11 = 1 / A11;
-                      dr = invA11*b1;
-                      r += dr;
-                      dr_norm = dr;
-                    }
-
-                    if (npd == 2) {
-                      recDetA = 1 / (A11*A22 - A12*A12);
-                      invA11 = recDetA * A22;
-                      invA22 = recDetA * A11;
-                      invA12 = -recDetA * A12;
-                      dr = invA11*b1 + invA12*b2;
-                      ds = invA12*b1 + invA22*b2;
-
-                      r += dr;
-                      s += ds;
-                      dr_norm = sqrt(dr*dr + ds*ds);
-                    }
-
-                    niter++;
-                  } while (dr_norm > 1e-5 && niter < max_niter);
-
-
-                  if (niter >= max_niter) {
-                    std::cout << "Fatal error: Local contact search do NOT converge." << std::endl;
-                  }
-
-                  if (fabs(r)  > 1 || fabs(s) > 1) {
-                    std::cout << "Fatal error: Local contact search converges to point outside the element." << std::endl;
-                  }
-
-
-                  if (d > GPs[(nsd + 2)*n*ngp + v] && d < 20.0) {
-                    GPs[(nsd       + 2)*n*ngp + v] = d;      // store gap (negative value means open gap)
-
-                  if(d >= -20.0) { // "positive" zero
-                    GPs[(nsd + npd + 3)*n*ngp + v] = 1.0;    // set gausspoint to active state
-                  }
-                  GPs[(nsd + npd + 4)*n*ngp + v] = el + 1; // set master element
-                  GPs[(nsd + npd + 5)*n*ngp + v] = sg + 1; // set master segment
-
-                  // Update Xi_m
-                  GPs[(nsd       + 3)*n*ngp + v] = r;
-                  if (npd == 2) {
-                    GPs[(nsd     + 4)*n*ngp + v] = s;
-                  }
-                }
-
-                /*
-                else {
-                GPs[(nsd + 2)*n*ngp + v] = FLT_MAX;    // init gap
-                for (int pdf = 0; pdf < npd; ++pdf) {
-                GPs[(nsd + 3 + pdf)*n*ngp + v] = 0.0; // Xi_m
-              }
-              GPs[(nsd + npd + 3)*n*ngp + v] = 0;       // init is NO active
-              GPs[(nsd + npd + 4)*n*ngp + v] = 0;       // master element
-              GPs[(nsd + npd + 5)*n*ngp + v] = 0;       // master segment
-              GPs[(nsd + npd + 6)*n*ngp + v] = 0;       // is stick
-
-              for (int pdf = 0; pdf < nsd-1; ++pdf) {
-              GPs[(nsd + npd + 7 + pdf)*n*ngp + v] = 0.0; // tangent traction components
-            }
-            for (int pdf = 0; pdf < nsd-1; ++pdf) {
-            GPs[(nsd + 2*npd + 7 + pdf)*n*ngp + v] = 0.0; // Xi0_m
-          }
-        }
-        */
-
-      } // if d is less then
-
-    } // if projection is inside the segment
-    v = next[v];
-  } // while
-} // i0
-} // i1
-}	// i2
-} // loop over triangles
-} // loop over elements
-
-delete[] segmentNodesID;
-delete[] Xm;
-delete[] Xmin;
-delete[] Xmax;
-delete[] Hm;
-delete[] dHm;
-}
+/**
+\file contres.cpp
+CONTact RESidual
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include <iostream>
+#include <cfloat>
+#include <climits>
+#include <algorithm>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef CONTACTINO_PROFILING
+#include <string.h>
+#include <chrono>
+#endif
+
+#include "contactino.h"
+
+// Number of threads used by the contact search and assembly (1 means the serial run):
+static int numberOfThreads = 1;
+
+/*! Set the number of threads used by the contact search and by assembleContactResidualAndStiffness
+
+\param nthreads - number of threads (nthreads < 1 means all available threads)
+
+Without OpenMP support the library always runs serially.
+*/
+void setNumberOfThreads(int nthreads) {
+#ifdef _OPENMP
+  numberOfThreads = nthreads < 1 ? omp_get_max_threads() : nthreads;
+#else
+  numberOfThreads = 1;
+#endif
+}
+
+// Statistics output of the contact search and assembly (NULL means no statistics):
+static ContactStats* contactStats = NULL;
+
+/*! Set the statistics output of the contact search and assembly
+
+The counts of each subsequent call of the contact search and assembly are added to stats,
+i.e. the caller resets the struct (e.g. by memset) and prints it when needed. Nothing is
+printed by the library.
+
+\param stats - statistics output (NULL switches the statistics off)
+*/
+void setContactStatsOutput(ContactStats* stats) {
+  contactStats = stats;
+}
+
+/*! Add the counts of a thread (or of a call) to the statistics output */
+static void addContactStats(ContactStats* output, const ContactStats& stats) {
+  if (output == NULL) {
+    return;
+  }
+#ifdef _OPENMP
+#pragma omp critical(contactStats)
+#endif
+  {
+    output->numOfActiveGPs += stats.numOfActiveGPs;
+    output->numOfStickGPs += stats.numOfStickGPs;
+    output->numOfSlipGPs += stats.numOfSlipGPs;
+    output->numOfProjections += stats.numOfProjections;
+    output->numOfNewtonIterations += stats.numOfNewtonIterations;
+    output->numOfNotConverged += stats.numOfNotConverged;
+    output->numOfOutsideElement += stats.numOfOutsideElement;
+    output->numOfMissingTriplets += stats.numOfMissingTriplets;
+    output->numOfMissingEntries += stats.numOfMissingEntries;
+  }
+}
+
+#ifdef CONTACTINO_PROFILING
+// Profiles of threads (see getContactProfile), each thread adds only to its own profile:
+static const int maxProfiledThreads = 128;
+static ContactProfile threadProfiles[maxProfiledThreads];
+// Exported functions in the order of their first call (only the function table is used):
+static ContactProfile functionProfile;
+
+static inline ContactProfile& getThreadProfile() {
+#ifdef _OPENMP
+  return threadProfiles[omp_get_thread_num() % maxProfiledThreads];
+#else
+  return threadProfiles[0];
+#endif
+}
+
+static inline double getProfileTime() {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/*! Add the time since start to the phase of the current thread and restart the timer */
+static inline void lapProfileTimer(double& start, int phase) {
+  const double now = getProfileTime();
+  ContactProfile& profile = getThreadProfile();
+  profile.phaseTime[phase] += now - start;
+  profile.phaseCalls[phase]++;
+  start = now;
+}
+
+/*! Add a local projection with niter Newton iterations to the profile of the current thread */
+static inline void addProfileIterations(int niter) {
+  ContactProfile& profile = getThreadProfile();
+  profile.numOfProjections++;
+  profile.numOfNewtonIterations += niter;
+  profile.iterationHistogram[std::min(niter, CONTACT_PROFILE_HISTOGRAM_SIZE - 1)]++;
+}
+
+/*! Index of the exported function in the function table (-1 if the table is full)
+
+Overloads share the entry of their name.
+*/
+static int registerProfiledFunction(const char* name) {
+  int function = -1;
+#ifdef _OPENMP
+#pragma omp critical(contactProfile)
+#endif
+  {
+    for (int k = 0; k < functionProfile.numOfFunctions && function < 0; ++k) {
+      if (strcmp(functionProfile.functionNames[k], name) == 0) {
+        function = k;
+      }
+    }
+    if (function < 0 && functionProfile.numOfFunctions < CONTACT_PROFILE_MAX_FUNCTIONS) {
+      function = functionProfile.numOfFunctions++;
+      strncpy(functionProfile.functionNames[function], name, CONTACT_PROFILE_NAME_LENGTH - 1);
+    }
+  }
+  return function;
+}
+
+/*! Scoped timer of a phase (of the current thread) and/or of an exported function (-1 means none) */
+struct ProfileTimer {
+  int phase;
+  int function;
+  double start;
+
+  ProfileTimer(int phase, int function) : phase(phase), function(function), start(getProfileTime()) {}
+
+  ~ProfileTimer() {
+    const double time = getProfileTime() - start;
+    if (phase >= 0) {
+      ContactProfile& profile = getThreadProfile();
+      profile.phaseTime[phase] += time;
+      profile.phaseCalls[phase]++;
+    }
+    if (function >= 0) {
+#ifdef _OPENMP
+#pragma omp critical(contactProfile)
+#endif
+      {
+        functionProfile.functionTime[function] += time;
+        functionProfile.functionCalls[function]++;
+      }
+    }
+  }
+};
+
+#define CONTACT_PROFILE_CONCAT2(a, b) a##b
+#define CONTACT_PROFILE_CONCAT(a, b) CONTACT_PROFILE_CONCAT2(a, b)
+#define CONTACT_PROFILE_FUNCTION() \
+  static const int profileFunction = registerProfiledFunction(__func__); \
+  ProfileTimer profileFunctionTimer(-1, profileFunction)
+#define CONTACT_PROFILE_PHASE(phase) ProfileTimer CONTACT_PROFILE_CONCAT(profilePhaseTimer, __LINE__)(phase, -1)
+#define CONTACT_PROFILE_START(timer) double timer = getProfileTime()
+#define CONTACT_PROFILE_LAP(timer, phase) lapProfileTimer(timer, phase)
+#define CONTACT_PROFILE_COUNT(counter, value) (getThreadProfile().counter += (value))
+#define CONTACT_PROFILE_MAX(counter, value) (getThreadProfile().counter = std::max(getThreadProfile().counter, (long long)(value)))
+#define CONTACT_PROFILE_ITERATIONS(niter) addProfileIterations(niter)
+#else
+#define CONTACT_PROFILE_FUNCTION()
+#define CONTACT_PROFILE_PHASE(phase)
+#define CONTACT_PROFILE_START(timer)
+#define CONTACT_PROFILE_LAP(timer, phase) ((void)0)
+#define CONTACT_PROFILE_COUNT(counter, value) ((void)0)
+#define CONTACT_PROFILE_MAX(counter, value) ((void)0)
+#define CONTACT_PROFILE_ITERATIONS(niter) ((void)0)
+#endif
+
+/*! Reset the timings and counters of the profiling (see getContactProfile) */
+void resetContactProfile(void) {
+#ifdef CONTACTINO_PROFILING
+  for (int t = 0; t < maxProfiledThreads; ++t) {
+    threadProfiles[t] = ContactProfile();
+  }
+  for (int k = 0; k < CONTACT_PROFILE_MAX_FUNCTIONS; ++k) {
+    functionProfile.functionTime[k] = 0.0;
+    functionProfile.functionCalls[k] = 0;
+  }
+#endif
+}
+
+/*! Timings and counters of the contact search and assembly since the last resetContactProfile
+
+The profiling is compiled in by the CMake option CONTACTINO_ENABLE_PROFILING, otherwise
+the profile is zero. Each thread records its own phase times and counters, so the profile
+of a single thread shows the load imbalance of the multithreaded search and assembly (the
+phase times of the total profile are sums over threads). The function table contains the
+wall times of the exported functions, it is filled in the total profile only.
+
+\param thread - index of the thread (OpenMP thread number), -1 means the total over all threads
+
+\return profile - timings and counters
+\return 1 if the profiling is compiled in, 0 otherwise
+*/
+int getContactProfile(ContactProfile* profile, int thread) {
+  *profile = ContactProfile();
+#ifdef CONTACTINO_PROFILING
+  for (int t = 0; t < maxProfiledThreads; ++t) {
+    if (thread >= 0 && t != thread) {
+      continue;
+    }
+    const ContactProfile& p = threadProfiles[t];
+    for (int k = 0; k < CONTACT_PROFILE_NUM_PHASES; ++k) {
+      profile->phaseTime[k] += p.phaseTime[k];
+      profile->phaseCalls[k] += p.phaseCalls[k];
+    }
+    profile->numOfCellRanges += p.numOfCellRanges;
+    profile->numOfBucketVisits += p.numOfBucketVisits;
+    profile->numOfCandidates += p.numOfCandidates;
+    profile->numOfInsideRejects += p.numOfInsideRejects;
+    profile->numOfProjections += p.numOfProjections;
+    profile->numOfNewtonIterations += p.numOfNewtonIterations;
+    for (int k = 0; k < CONTACT_PROFILE_HISTOGRAM_SIZE; ++k) {
+      profile->iterationHistogram[k] += p.iterationHistogram[k];
+    }
+    profile->bytesWritten += p.bytesWritten;
+    profile->numOfBinnedGPs += p.numOfBinnedGPs;
+    profile->numOfCells += p.numOfCells;
+    profile->numOfEmptyCells += p.numOfEmptyCells;
+    profile->maxBucketSize = std::max(profile->maxBucketSize, p.maxBucketSize);
+  }
+  if (thread < 0) {
+    profile->numOfFunctions = functionProfile.numOfFunctions;
+    for (int k = 0; k < functionProfile.numOfFunctions; ++k) {
+      strncpy(profile->functionNames[k], functionProfile.functionNames[k], CONTACT_PROFILE_NAME_LENGTH);
+      profile->functionTime[k] = functionProfile.functionTime[k];
+      profile->functionCalls[k] = functionProfile.functionCalls[k];
+    }
+  }
+  return 1;
+#else
+  (void)thread;
+  return 0;
+#endif
+}
+
+/*! Number of threads with a nonempty profile, i.e. the valid thread indices of getContactProfile */
+int getContactProfileNumberOfThreads(void) {
+  int numOfThreads = 0;
+#ifdef CONTACTINO_PROFILING
+  for (int t = 0; t < maxProfiledThreads; ++t) {
+    for (int k = 0; k < CONTACT_PROFILE_NUM_PHASES; ++k) {
+      if (threadProfiles[t].phaseCalls[k] > 0) {
+        numOfThreads = t + 1;
+      }
+    }
+  }
+#endif
+  return numOfThreads;
+}
+
+static const char* const contactProfilePhaseNames[CONTACT_PROFILE_NUM_PHASES] = {
+  "surface", "binning", "search", "cellRange", "insideTest", "projection", "pattern", "residual", "stiffness", "merge"
+};
+
+/*! Write the profile (see getContactProfile) into a JSON file
+
+The file contains the total profile ("phases", "counters", "iterationHistogram" and
+"functions") and the phase times and main counters of each thread ("threads"). If the
+profiling is not compiled in, only {"enabled": false} is written.
+
+\param fileName - name of the output file
+
+\return 0 on success, -1 if the file cannot be written
+*/
+int writeContactProfileJSON(const char* fileName) {
+  FILE* file = fopen(fileName, "w");
+  if (file == NULL) {
+    return -1;
+  }
+
+  ContactProfile profile;
+  if (!getContactProfile(&profile, -1)) {
+    fprintf(file, "{\"enabled\": false}\n");
+    return fclose(file) == 0 ? 0 : -1;
+  }
+
+  fprintf(file, "{\n  \"enabled\": true,\n  \"phases\": {");
+  for (int k = 0; k < CONTACT_PROFILE_NUM_PHASES; ++k) {
+    fprintf(file, "%s\n    \"%s\": {\"time\": %.9g, \"calls\": %lld}", k ? "," : "", contactProfilePhaseNames[k], profile.phaseTime[k], profile.phaseCalls[k]);
+  }
+  fprintf(file, "\n  },\n  \"counters\": {\n");
+  fprintf(file, "    \"numOfCellRanges\": %lld,\n", profile.numOfCellRanges);
+  fprintf(file, "    \"numOfBucketVisits\": %lld,\n", profile.numOfBucketVisits);
+  fprintf(file, "    \"numOfCandidates\": %lld,\n", profile.numOfCandidates);
+  fprintf(file, "    \"candidatesPerBucket\": %.9g,\n", profile.numOfBucketVisits > 0 ? (double)profile.numOfCandidates / profile.numOfBucketVisits : 0.0);
+  fprintf(file, "    \"numOfInsideRejects\": %lld,\n", profile.numOfInsideRejects);
+  fprintf(file, "    \"numOfProjections\": %lld,\n", profile.numOfProjections);
+  fprintf(file, "    \"numOfNewtonIterations\": %lld,\n", profile.numOfNewtonIterations);
+  fprintf(file, "    \"bytesWritten\": %lld,\n", profile.bytesWritten);
+  fprintf(file, "    \"numOfBinnedGPs\": %lld,\n", profile.numOfBinnedGPs);
+  fprintf(file, "    \"numOfCells\": %lld,\n", profile.numOfCells);
+  fprintf(file, "    \"numOfEmptyCells\": %lld,\n", profile.numOfEmptyCells);
+  fprintf(file, "    \"maxBucketSize\": %lld\n  },\n", profile.maxBucketSize);
+
+  fprintf(file, "  \"iterationHistogram\": [");
+  for (int k = 0; k < CONTACT_PROFILE_HISTOGRAM_SIZE; ++k) {
+    fprintf(file, "%s%lld", k ? ", " : "", profile.iterationHistogram[k]);
+  }
+  fprintf(file, "],\n  \"functions\": {");
+  for (int k = 0; k < profile.numOfFunctions; ++k) {
+    fprintf(file, "%s\n    \"%s\": {\"time\": %.9g, \"calls\": %lld}", k ? "," : "", profile.functionNames[k], profile.functionTime[k], profile.functionCalls[k]);
+  }
+  fprintf(file, "\n  },\n  \"threads\": [");
+
+  const int numOfThreads = getContactProfileNumberOfThreads();
+  for (int t = 0; t < numOfThreads; ++t) {
+    getContactProfile(&profile, t);
+    fprintf(file, "%s\n    {\"phaseTime\": {", t ? "," : "");
+    for (int k = 0; k < CONTACT_PROFILE_NUM_PHASES; ++k) {
+      fprintf(file, "%s\"%s\": %.9g", k ? ", " : "", contactProfilePhaseNames[k], profile.phaseTime[k]);
+    }
+    fprintf(file, "}, \"numOfCandidates\": %lld, \"numOfProjections\": %lld, \"numOfNewtonIterations\": %lld}", profile.numOfCandidates, profile.numOfProjections, profile.numOfNewtonIterations);
+  }
+  fprintf(file, "\n  ]\n}\n");
+  return fclose(file) == 0 ? 0 : -1;
+}
+
+/*! Evaluate shape functions and their 1st partial derivatives of 4-node bilinear element
+
+\param r - 1st isoparametric (parent, reference) coordinate
+\param s - 2nd isoparametric coordinate
+
+\return H 1d array (4x1) of shape functions values
+\return dH 2d array (4x2) of 1st partial derivatives of shape functions with respect to r (1st column) and s (2nd column)
+
+*/
+void sfd4(double* H, double* dH, double r, double s) {
+  const double h1 = 0.25*(1-r)*(1-s);
+  const double h2 = 0.25*(1+r)*(1-s);
+  const double h3 = 0.25*(1+r)*(1+s);
+  const double h4 = 0.25*(1-r)*(1+s);
+  /***********************************************/
+  const double h1r = -0.25*(1-s);
+  const double h2r =  0.25*(1-s);
+  const double h3r =  0.25*(s+1);
+  const double h4r = -0.25*(1+s);
+  /***********************************************/
+  const double h1s =  0.25*(r-1);
+  const double h2s = -0.25*(1+r);
+  const double h3s =  0.25*(r+1);
+  const double h4s =  0.25*(1-r);
+  /***********************************************/
+  H[0] = h1;
+  H[1] = h2;
+  H[2] = h3;
+  H[3] = h4;
+
+  dH[0] = h1r;
+  dH[1] = h2r;
+  dH[2] = h3r;
+  dH[3] = h4r;
+
+  dH[4] = h1s;
+  dH[5] = h2s;
+  dH[6] = h3s;
+  dH[7] = h4s;
+}
+
+/*! Evaluate shape functions and their 1st partial derivatives of 8-node (serendipity) quadrilateral element
+
+\param r - 1st isoparametric (parent, reference) coordinate
+\param s - 2nd isoparametric coordinate
+
+\return H 1d array (8x1) of shape functions values
+\return dH 2d array (8x2) of 1st partial derivatives of shape functions with respect to r (1st column) and s (2nd column)
+
+*/
+void sfd8(double* H, double* dH, double r, double s) {
+  const double h5 = 0.5*(1-r*r)*(1-s);
+  const double h6 = 0.5*(1+r)*(1-s*s);
+  const double h7 = 0.5*(1-r*r)*(1+s);
+  const double h8 = 0.5*(1-r)*(1-s*s);
+
+  const double h1 = 0.25*(1-r)*(1-s) - 0.5*h5 - 0.5*h8;
+  const double h2 = 0.25*(1+r)*(1-s) - 0.5*h5 - 0.5*h6;
+  const double h3 = 0.25*(1+r)*(1+s) - 0.5*h6 - 0.5*h7;
+  const double h4 = 0.25*(1-r)*(1+s) - 0.5*h7 - 0.5*h8;
+
+  /***********************************************/
+  const double h5r = -r*(1-s);
+  const double h6r = 0.5*(1-s*s);
+  const double h7r = -r*(1+s);
+  const double h8r = -0.5*(1-s*s);
+
+  const double h1r = -0.25*(1-s) - 0.5*h5r - 0.5*h8r;
+  const double h2r =  0.25*(1-s) - 0.5*h5r - 0.5*h6r;
+  const double h3r =  0.25*(s+1) - 0.5*h6r - 0.5*h7r;
+  const double h4r = -0.25*(1+s) - 0.5*h7r - 0.5*h8r;
+  /***********************************************/
+  const double h5s = -0.5*(1-r*r);
+  const double h6s = -(1+r)*s;
+  const double h7s = 0.5*(1-r*r);
+  const double h8s = -(1-r)*s;
+
+  const double h1s =  0.25*(r-1) - 0.5*h5s - 0.5*h8s;
+  const double h2s = -0.25*(1+r) - 0.5*h5s - 0.5*h6s;
+  const double h3s =  0.25*(r+1) - 0.5*h6s - 0.5*h7s;
+  const double h4s =  0.25*(1-r) - 0.5*h7s - 0.5*h8s;
+  /***********************************************/
+  H[0] = h1;
+  H[1] = h2;
+  H[2] = h3;
+  H[3] = h4;
+  H[4] = h5;
+  H[5] = h6;
+  H[6] = h7;
+  H[7] = h8;
+
+  dH[0] = h1r;
+  dH[1] = h2r;
+  dH[2] = h3r;
+  dH[3] = h4r;
+  dH[4] = h5r;
+  dH[5] = h6r;
+  dH[6] = h7r;
+  dH[7] = h8r;
+
+  dH[8]  = h1s;
+  dH[9]  = h2s;
+  dH[10] = h3s;
+  dH[11] = h4s;
+  dH[12] = h5s;
+  dH[13] = h6s;
+  dH[14] = h7s;
+  dH[15] = h8s;
+}
+
+/*! Evaluate shape functions and their 1st partial derivatives of 6-node (serendipity) triangular element
+
+\param r - 1st isoparametric coordinate
+\param s - 2nd isoparametric coordinate
+
+\return H 1d array (6x1) of shape functions values
+\return dH 2d array (6x2) of 1st partial derivatives of shape functions with respect to r (1st column) and s (2nd column)
+
+*/
+void sfd6(double* H, double* dH, double r, double s) {
+  const double h4 = 4 * r*(1 - r - s);
+  const double h5 = 4 * r*s;
+  const double h6 = 4 * s*(1 - r - s);
+
+  const double h1 = 1 - r - s - 0.5*h4 - 0.5*h6;
+  const double h2 = r - 0.5*h4 - 0.5*h5;
+  const double h3 = s - 0.5*h5 - 0.5*h6;
+  /***********************************************/
+  const double h4r = 4 * (1 - r - s) - 4 * r;
+  const double h5r = 4 * s;
+  const double h6r = -4 * s;
+
+  const double h1r = -1 - 0.5*h4r - 0.5*h6r;
+  const double h2r = 1 - 0.5*h4r - 0.5*h5r;
+  const double h3r = 0 - 0.5*h5r - 0.5*h6r;
+  /***********************************************/
+  const double h4s = -4 * r;
+  const double h5s = 4 * r;
+  const double h6s = 4 * (1 - r - s) - 4 * s;
+
+  const double h1s = -1 - 0.5*h4s - 0.5*h6s;
+  const double h2s = 0 - 0.5*h4s - 0.5*h5s;
+  const double h3s = 1 - 0.5*h5s - 0.5*h6s;
+  /***********************************************/
+  H[0] = h1;
+  H[1] = h2;
+  H[2] = h3;
+  H[3] = h4;
+  H[4] = h5;
+  H[5] = h6;
+
+  dH[0] = h1r;
+  dH[1] = h2r;
+  dH[2] = h3r;
+  dH[3] = h4r;
+  dH[4] = h5r;
+  dH[5] = h6r;
+
+  dH[6] = h1s;
+  dH[7] = h2s;
+  dH[8] = h3s;
+  dH[9] = h4s;
+  dH[10] = h5s;
+  dH[11] = h6s;
+}
+
+/*! Evaluate shape functions and their 1st derivatives of 2-node bar element
+
+\param r - 1st isoparametric coordinate
+
+\return H 1d array (2x1) of shape functions values
+\return dH 1d array (2x1) of 1st derivatives of shape functions with respect to r
+
+*/
+void sfd2(double* H, double* dH, double r) {
+  const double h1 = 0.5*(1 - r);
+  const double h2 = 0.5*(1 + r);
+  /***********************************************/
+  const double h1r = -0.5;
+  const double h2r = 0.5;
+  /***********************************************/
+  H[0] = h1;
+  H[1] = h2;
+
+  dH[0] = h1r;
+  dH[1] = h2r;
+}
+
+/*! Evaluate shape functions and their 1st derivatives of 2-node bar element at np points
+
+The same as sfd2 for the points r[p], p = 0, ..., np-1. The results are stored as structure
+of arrays: the k-th entry of H (or dH) of sfd2 at the p-th point is stored in H[k*np + p]
+(or dH[k*np + p]), so that the loop over points is vectorised (SIMD).
+
+\param r - 1d array (np) of 1st isoparametric coordinates
+\param np - number of points
+
+\return H 2d array (2 x np) of shape functions values
+\return dH 2d array (2 x np) of 1st derivatives of shape functions with respect to r
+*/
+void sfd2Batch(double* H, double* dH, const double* r, int np) {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+  for (int p = 0; p < np; ++p) {
+    H[p]        = 0.5*(1 - r[p]);
+    H[np + p]   = 0.5*(1 + r[p]);
+
+    dH[p]       = -0.5;
+    dH[np + p]  = 0.5;
+  }
+}
+
+/*! Evaluate shape functions and their 1st partial derivatives of 4-node quadrilateral element at np points
+
+The same as sfd4 for the points (r[p], s[p]), the layout of H and dH is described at sfd2Batch.
+
+\return H 2d array (4 x np) of shape functions values
+\return dH 2d array (8 x np) of 1st partial derivatives with respect to r (rows 0-3) and s (rows 4-7)
+*/
+void sfd4Batch(double* H, double* dH, const double* r, const double* s, int np) {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+  for (int p = 0; p < np; ++p) {
+    const double rp = r[p];
+    const double sp = s[p];
+
+    H[p]          = 0.25*(1-rp)*(1-sp);
+    H[np + p]     = 0.25*(1+rp)*(1-sp);
+    H[2*np + p]   = 0.25*(1+rp)*(1+sp);
+    H[3*np + p]   = 0.25*(1-rp)*(1+sp);
+
+    dH[p]         = -0.25*(1-sp);
+    dH[np + p]    =  0.25*(1-sp);
+    dH[2*np + p]  =  0.25*(sp+1);
+    dH[3*np + p]  = -0.25*(1+sp);
+
+    dH[4*np + p]  =  0.25*(rp-1);
+    dH[5*np + p]  = -0.25*(1+rp);
+    dH[6*np + p]  =  0.25*(rp+1);
+    dH[7*np + p]  =  0.25*(1-rp);
+  }
+}
+
+/*! Evaluate shape functions and their 1st partial derivatives of 8-node (serendipity) quadrilateral element at np points
+
+The same as sfd8 for the points (r[p], s[p]), the layout of H and dH is described at sfd2Batch.
+
+\return H 2d array (8 x np) of shape functions values
+\return dH 2d array (16 x np) of 1st partial derivatives with respect to r (rows 0-7) and s (rows 8-15)
+*/
+void sfd8Batch(double* H, double* dH, const double* r, const double* s, int np) {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+  for (int p = 0; p < np; ++p) {
+    const double rp = r[p];
+    const double sp = s[p];
+
+    const double h5 = 0.5*(1-rp*rp)*(1-sp);
+    const double h6 = 0.5*(1+rp)*(1-sp*sp);
+    const double h7 = 0.5*(1-rp*rp)*(1+sp);
+    const double h8 = 0.5*(1-rp)*(1-sp*sp);
+
+    const double h5r = -rp*(1-sp);
+    const double h6r = 0.5*(1-sp*sp);
+    const double h7r = -rp*(1+sp);
+    const double h8r = -0.5*(1-sp*sp);
+
+    const double h5s = -0.5*(1-rp*rp);
+    const double h6s = -(1+rp)*sp;
+    const double h7s = 0.5*(1-rp*rp);
+    const double h8s = -(1-rp)*sp;
+
+    H[p]          = 0.25*(1-rp)*(1-sp) - 0.5*h5 - 0.5*h8;
+    H[np + p]     = 0.25*(1+rp)*(1-sp) - 0.5*h5 - 0.5*h6;
+    H[2*np + p]   = 0.25*(1+rp)*(1+sp) - 0.5*h6 - 0.5*h7;
+    H[3*np + p]   = 0.25*(1-rp)*(1+sp) - 0.5*h7 - 0.5*h8;
+    H[4*np + p]   = h5;
+    H[5*np + p]   = h6;
+    H[6*np + p]   = h7;
+    H[7*np + p]   = h8;
+
+    dH[p]         = -0.25*(1-sp) - 0.5*h5r - 0.5*h8r;
+    dH[np + p]    =  0.25*(1-sp) - 0.5*h5r - 0.5*h6r;
+    dH[2*np + p]  =  0.25*(sp+1) - 0.5*h6r - 0.5*h7r;
+    dH[3*np + p]  = -0.25*(1+sp) - 0.5*h7r - 0.5*h8r;
+    dH[4*np + p]  = h5r;
+    dH[5*np + p]  = h6r;
+    dH[6*np + p]  = h7r;
+    dH[7*np + p]  = h8r;
+
+    dH[8*np + p]  =  0.25*(rp-1) - 0.5*h5s - 0.5*h8s;
+    dH[9*np + p]  = -0.25*(1+rp) - 0.5*h5s - 0.5*h6s;
+    dH[10*np + p] =  0.25*(rp+1) - 0.5*h6s - 0.5*h7s;
+    dH[11*np + p] =  0.25*(1-rp) - 0.5*h7s - 0.5*h8s;
+    dH[12*np + p] = h5s;
+    dH[13*np + p] = h6s;
+    dH[14*np + p] = h7s;
+    dH[15*np + p] = h8s;
+  }
+}
+
+/*! Evaluate shape functions and their 1st partial derivatives of 6-node (serendipity) triangular element at np points
+
+The same as sfd6 for the points (r[p], s[p]), the layout of H and dH is described at sfd2Batch.
+
+\return H 2d array (6 x np) of shape functions values
+\return dH 2d array (12 x np) of 1st partial derivatives with respect to r (rows 0-5) and s (rows 6-11)
+*/
+void sfd6Batch(double* H, double* dH, const double* r, const double* s, int np) {
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+  for (int p = 0; p < np; ++p) {
+    const double rp = r[p];
+    const double sp = s[p];
+
+    const double h4 = 4 * rp*(1 - rp - sp);
+    const double h5 = 4 * rp*sp;
+    const double h6 = 4 * sp*(1 - rp - sp);
+
+    const double h4r = 4 * (1 - rp - sp) - 4 * rp;
+    const double h5r = 4 * sp;
+    const double h6r = -4 * sp;
+
+    const double h4s = -4 * rp;
+    const double h5s = 4 * rp;
+    const double h6s = 4 * (1 - rp - sp) - 4 * sp;
+
+    H[p]          = 1 - rp - sp - 0.5*h4 - 0.5*h6;
+    H[np + p]     = rp - 0.5*h4 - 0.5*h5;
+    H[2*np + p]   = sp - 0.5*h5 - 0.5*h6;
+    H[3*np + p]   = h4;
+    H[4*np + p]   = h5;
+    H[5*np + p]   = h6;
+
+    dH[p]         = -1 - 0.5*h4r - 0.5*h6r;
+    dH[np + p]    = 1 - 0.5*h4r - 0.5*h5r;
+    dH[2*np + p]  = 0 - 0.5*h5r - 0.5*h6r;
+    dH[3*np + p]  = h4r;
+    dH[4*np + p]  = h5r;
+    dH[5*np + p]  = h6r;
+
+    dH[6*np + p]  = -1 - 0.5*h4s - 0.5*h6s;
+    dH[7*np + p]  = 0 - 0.5*h4s - 0.5*h5s;
+    dH[8*np + p]  = 1 - 0.5*h5s - 0.5*h6s;
+    dH[9*np + p]  = h4s;
+    dH[10*np + p] = h5s;
+    dH[11*np + p] = h6s;
+  }
+}
+
+/*! Shape functions and their derivatives of a segment with nsn nodes
+
+\param NSN - compile-time nsn (0 means the run-time value)
+*/
+template <int NSN>
+static inline void evaluateShapeFunctions(double* H, double* dH, double r, double s, int nsn) {
+  switch (NSN ? NSN : nsn) {
+    case 2:
+    sfd2(H, dH, r);
+    break;
+    case 4:
+    sfd4(H, dH, r, s);
+    break;
+    case 6:
+    sfd6(H, dH, r, s);
+    break;
+    case 8:
+    sfd8(H, dH, r, s);
+  }
+}
+
+/*! Shape functions and their derivatives of a segment with nsn nodes at np points (see sfd2Batch)
+
+\param NSN - compile-time nsn (0 means the run-time value)
+*/
+template <int NSN>
+static inline void evaluateShapeFunctionsBatch(double* H, double* dH, const double* r, const double* s, int np, int nsn) {
+  switch (NSN ? NSN : nsn) {
+    case 2:
+    sfd2Batch(H, dH, r, np);
+    break;
+    case 4:
+    sfd4Batch(H, dH, r, s, np);
+    break;
+    case 6:
+    sfd6Batch(H, dH, r, s, np);
+    break;
+    case 8:
+    sfd8Batch(H, dH, r, s, np);
+  }
+}
+
+/*! Evaluate 2nd partial derivatives of shape functions of 4-node bilinear element (see sfd4)
+
+\return ddH 2d array (4x3) of 2nd partial derivatives of shape functions with respect to rr (1st column),
+rs (2nd column) and ss (3rd column)
+*/
+static void sfdd4(double* ddH, double, double) {
+  for (int j = 0; j < 4; ++j) {
+    ddH[j] = 0.0;
+    ddH[8 + j] = 0.0;
+  }
+  ddH[4] =  0.25;
+  ddH[5] = -0.25;
+  ddH[6] =  0.25;
+  ddH[7] = -0.25;
+}
+
+/*! Evaluate 2nd partial derivatives of shape functions of 8-node (serendipity) quadrilateral element (see sfd8)
+
+\return ddH 2d array (8x3) of 2nd partial derivatives of shape functions with respect to rr (1st column),
+rs (2nd column) and ss (3rd column)
+*/
+static void sfdd8(double* ddH, double r, double s) {
+  const double h5rr = -(1-s);
+  const double h6rr = 0.0;
+  const double h7rr = -(1+s);
+  const double h8rr = 0.0;
+  /***********************************************/
+  const double h5rs = r;
+  const double h6rs = -s;
+  const double h7rs = -r;
+  const double h8rs = s;
+  /***********************************************/
+  const double h5ss = 0.0;
+  const double h6ss = -(1+r);
+  const double h7ss = 0.0;
+  const double h8ss = -(1-r);
+  /***********************************************/
+  ddH[0] = -0.5*h5rr - 0.5*h8rr;
+  ddH[1] = -0.5*h5rr - 0.5*h6rr;
+  ddH[2] = -0.5*h6rr - 0.5*h7rr;
+  ddH[3] = -0.5*h7rr - 0.5*h8rr;
+  ddH[4] = h5rr;
+  ddH[5] = h6rr;
+  ddH[6] = h7rr;
+  ddH[7] = h8rr;
+
+  ddH[8]  =  0.25 - 0.5*h5rs - 0.5*h8rs;
+  ddH[9]  = -0.25 - 0.5*h5rs - 0.5*h6rs;
+  ddH[10] =  0.25 - 0.5*h6rs - 0.5*h7rs;
+  ddH[11] = -0.25 - 0.5*h7rs - 0.5*h8rs;
+  ddH[12] = h5rs;
+  ddH[13] = h6rs;
+  ddH[14] = h7rs;
+  ddH[15] = h8rs;
+
+  ddH[16] = -0.5*h5ss - 0.5*h8ss;
+  ddH[17] = -0.5*h5ss - 0.5*h6ss;
+  ddH[18] = -0.5*h6ss - 0.5*h7ss;
+  ddH[19] = -0.5*h7ss - 0.5*h8ss;
+  ddH[20] = h5ss;
+  ddH[21] = h6ss;
+  ddH[22] = h7ss;
+  ddH[23] = h8ss;
+}
+
+/*! Evaluate 2nd partial derivatives of shape functions of 6-node triangular element (see sfd6)
+
+\return ddH 2d array (6x3) of 2nd partial derivatives of shape functions with respect to rr (1st column),
+rs (2nd column) and ss (3rd column)
+*/
+static void sfdd6(double* ddH, double, double) {
+  const double h4rr = -8;
+  const double h5rr = 0;
+  const double h6rr = 0;
+  /***********************************************/
+  const double h4rs = -4;
+  const double h5rs = 4;
+  const double h6rs = -4;
+  /***********************************************/
+  const double h4ss = 0;
+  const double h5ss = 0;
+  const double h6ss = -8;
+  /***********************************************/
+  ddH[0] = -0.5*h4rr - 0.5*h6rr;
+  ddH[1] = -0.5*h4rr - 0.5*h5rr;
+  ddH[2] = -0.5*h5rr - 0.5*h6rr;
+  ddH[3] = h4rr;
+  ddH[4] = h5rr;
+  ddH[5] = h6rr;
+
+  ddH[6]  = -0.5*h4rs - 0.5*h6rs;
+  ddH[7]  = -0.5*h4rs - 0.5*h5rs;
+  ddH[8]  = -0.5*h5rs - 0.5*h6rs;
+  ddH[9]  = h4rs;
+  ddH[10] = h5rs;
+  ddH[11] = h6rs;
+
+  ddH[12] = -0.5*h4ss - 0.5*h6ss;
+  ddH[13] = -0.5*h4ss - 0.5*h5ss;
+  ddH[14] = -0.5*h5ss - 0.5*h6ss;
+  ddH[15] = h4ss;
+  ddH[16] = h5ss;
+  ddH[17] = h6ss;
+}
+
+/*! 2nd derivatives of shape functions of a segment with nsn nodes
+
+The derivatives with respect to rr, rs and ss are stored in ddH[k*nsn + j], k = 0, 1, 2
+(only rr for 2-node segments, which have zero 2nd derivatives).
+
+\param NSN - compile-time nsn (0 means the run-time value)
+*/
+template <int NSN>
+static inline void evaluateShapeFunctionsSecondDerivatives(double* ddH, double r, double s, int nsn) {
+  switch (NSN ? NSN : nsn) {
+    case 2:
+    ddH[0] = 0.0;
+    ddH[1] = 0.0;
+    break;
+    case 4:
+    sfdd4(ddH, r, s);
+    break;
+    case 6:
+    sfdd6(ddH, r, s);
+    break;
+    case 8:
+    sfdd8(ddH, r, s);
+  }
+}
+
+/*! View of the Gauss point state stored in the legacy GPs table
+
+IDs are stored as 1-based doubles, the accessors return them 0-based.
+The methods are const, the view does not own the table.
+*/
+struct GaussPointTable {
+  double* GPs;
+  int numOfRows;
+  int nsd;
+  int npd;
+  const double* activeOld; // activeGPsOld of the assembly
+
+  GaussPointTable(double* GPs, int numOfRows, int nsd, int npd, const double* activeOld = NULL)
+    : GPs(GPs), numOfRows(numOfRows), nsd(nsd), npd(npd), activeOld(activeOld) {}
+
+  double x(int sdf, int v) const { return GPs[sdf*numOfRows + v]; }
+  int slaveElement(int v) const { return (int)GPs[nsd*numOfRows + v] - 1; }
+  int slaveSegment(int v) const { return (int)GPs[(nsd + 1)*numOfRows + v] - 1; }
+  double gap(int v) const { return GPs[(nsd + 2)*numOfRows + v]; }
+  void setGap(int v, double gap) const { GPs[(nsd + 2)*numOfRows + v] = gap; }
+  double xi(int pdf, int v) const { return GPs[(nsd + 3 + pdf)*numOfRows + v]; }
+  void setXi(int pdf, int v, double xi) const { GPs[(nsd + 3 + pdf)*numOfRows + v] = xi; }
+  void setActive(int v) const { GPs[(nsd + npd + 3)*numOfRows + v] = 1.0; }
+  int masterElement(int v) const { return (int)GPs[(nsd + npd + 4)*numOfRows + v] - 1; }
+  int masterSegment(int v) const { return (int)GPs[(nsd + npd + 5)*numOfRows + v] - 1; }
+  void setMaster(int v, int el, int sg) const {
+    GPs[(nsd + npd + 4)*numOfRows + v] = el + 1;
+    GPs[(nsd + npd + 5)*numOfRows + v] = sg + 1;
+  }
+  double tangentTraction(int pdf, int v) const { return GPs[(nsd + npd + 7 + pdf)*numOfRows + v]; }
+  void setTangentTraction(int pdf, int v, double t_T) const { GPs[(nsd + npd + 7 + pdf)*numOfRows + v] = t_T; }
+  double xi0(int pdf, int v) const { return GPs[(nsd + 2*npd + 7 + pdf)*numOfRows + v]; }
+  double normalTraction(int v) const { return GPs[(nsd + 3*npd + 7)*numOfRows + v]; }
+  void setNormalTraction(int v, double t_N) const { GPs[(nsd + 3*npd + 7)*numOfRows + v] = t_N; }
+  bool wasActive(int v) const { return (bool)activeOld[v]; }
+};
+
+/*! View of the Gauss point state stored in GaussPointState (the same interface as GaussPointTable) */
+struct GaussPointArrays {
+  double* Xg;
+  const int32_t* els;
+  const int32_t* sgs;
+  double* gapN;
+  double* Xi_m;
+  uint8_t* isActive;
+  int32_t* elm;
+  int32_t* sgm;
+  double* t_T;
+  const double* Xi0_m;
+  double* t_N0;
+  int numOfRows;
+  const uint8_t* activeOld; // activeGPsOld of the assembly
+
+  GaussPointArrays(GaussPointState& state, const uint8_t* activeOld = NULL)
+    : Xg(state.Xg.data()), els(state.els.data()), sgs(state.sgs.data()), gapN(state.gap.data()), Xi_m(state.Xi_m.data()),
+      isActive(state.isActive.data()), elm(state.elm.data()), sgm(state.sgm.data()), t_T(state.t_T.data()),
+      Xi0_m(state.Xi0_m.data()), t_N0(state.t_N0.data()), numOfRows(state.numOfRows), activeOld(activeOld) {}
+
+  double x(int sdf, int v) const { return Xg[sdf*numOfRows + v]; }
+  int slaveElement(int v) const { return els[v]; }
+  int slaveSegment(int v) const { return sgs[v]; }
+  double gap(int v) const { return gapN[v]; }
+  void setGap(int v, double gap) const { gapN[v] = gap; }
+  double xi(int pdf, int v) const { return Xi_m[pdf*numOfRows + v]; }
+  void setXi(int pdf, int v, double xi) const { Xi_m[pdf*numOfRows + v] = xi; }
+  void setActive(int v) const { isActive[v] = 1; }
+  int masterElement(int v) const { return elm[v]; }
+  int masterSegment(int v) const { return sgm[v]; }
+  void setMaster(int v, int el, int sg) const {
+    elm[v] = el;
+    sgm[v] = sg;
+  }
+  double tangentTraction(int pdf, int v) const { return t_T[pdf*numOfRows + v]; }
+  void setTangentTraction(int pdf, int v, double value) const { t_T[pdf*numOfRows + v] = value; }
+  double xi0(int pdf, int v) const { return Xi0_m[pdf*numOfRows + v]; }
+  double normalTraction(int v) const { return t_N0[v]; }
+  void setNormalTraction(int v, double t_N) const { t_N0[v] = t_N; }
+  bool wasActive(int v) const { return activeOld[v] != 0; }
+};
+
+/*! Input data of the contact residual and tangent assembly (see assembleContactResidualAndStiffness) */
+struct ContactAssemblyData {
+  const int* ISN;
+  const int* IEN;
+  const double* X;
+  const double* U;
+  const double* H;
+  const double* dH;
+  const double* gw;
+  int neq;
+  int nsd;
+  int npd;
+  int ngp;
+  int nes;
+  int nsn;
+  int nen;
+  int GPs_len;
+  double epsN;
+  double epsT;
+  double mu;
+  bool keyContactDetection;
+  bool keyAssembleKc;
+  bool isAxisymmetric;
+  int nsg;
+  ContactStats* stats;      // statistics output (see setContactStatsOutput), NULL means no statistics
+};
+
+/*! Assembly output written directly to the arrays of the caller (serial run) */
+struct DirectAssemblyOutput {
+  double* Gc_loc;           // NULL means Gc_loc is not assembled
+  double* Kc;               // NULL means Kc is not assembled
+  double* vals;
+  double* rows;
+  double* cols;
+  int* len;
+  int len_guess;
+
+  void subtractLocalResidual(int index, double value) {
+    if (Gc_loc) {
+      Gc_loc[index] -= value;
+    }
+  }
+
+  void setLocalStiffness(int index, double value) {
+    if (Kc) {
+      Kc[index] = value;
+    }
+  }
+
+  // row and col are 0-based, the output is 1-based (Matlab);
+  // triplets beyond len_guess are only counted
+  void add(int row, int col, double value) {
+    if (*len < len_guess) {
+      cols[*len] = col + 1;
+      rows[*len] = row + 1;
+      vals[*len] = value;
+    }
+    (*len)++;
+  }
+};
+
+/*! Assembly output of a chunk of GPs rows (parallel run)
+
+The triplets are written from the offset of the chunk, the upper bound of the triplets of the
+previous chunks (see countAssembledGaussPoints), and the chunks are moved together afterwards.
+The writes into Gc_loc and Kc are buffered by slices of their index ranges, so that the slices
+are merged in parallel, each one in the order of GPs rows. Nothing is buffered for the arrays
+which are not assembled (no slices).
+*/
+struct ChunkAssemblyOutput {
+  double* vals;             // triplet arrays from the offset of the chunk
+  double* rows;
+  double* cols;
+  int len;                  // number of triplets of the chunk
+  long long residualSliceSize;
+  long long stiffnessSliceSize;
+  std::vector<std::vector<std::pair<int, double> > > localResidual;   // slices of Gc_loc
+  std::vector<std::vector<std::pair<int, double> > > localStiffness;  // slices of Kc
+
+  ChunkAssemblyOutput() : vals(NULL), rows(NULL), cols(NULL), len(0), residualSliceSize(1), stiffnessSliceSize(1) {}
+
+  void subtractLocalResidual(int index, double value) {
+    if (!localResidual.empty()) {
+      const size_t slice = std::min((size_t)(index / residualSliceSize), localResidual.size() - 1);
+      localResidual[slice].push_back(std::make_pair(index, value));
+    }
+  }
+
+  void setLocalStiffness(int index, double value) {
+    if (!localStiffness.empty()) {
+      const size_t slice = std::min((size_t)(index / stiffnessSliceSize), localStiffness.size() - 1);
+      localStiffness[slice].push_back(std::make_pair(index, value));
+    }
+  }
+
+  // row and col are 0-based, the output is 1-based (Matlab);
+  // the chunk has at most its upper bound of triplets
+  void add(int row, int col, double value) {
+    cols[len] = col + 1;
+    rows[len] = row + 1;
+    vals[len] = value;
+    len++;
+  }
+};
+
+/*! Quantities of an active Gauss point needed by the contact tangent (see applyContactStiffness) */
+struct ContactOperatorGP {
+  int nodes[16];      // slave segment nodes followed by master segment nodes (0-based)
+  double hs[8];       // slave shape functions
+  double hm[8];       // master shape functions at the projection
+  double dHm[16];     // derivatives of master shape functions (dHm[pdf*nsn + j])
+  double normal[3];   // unit normal of the current master surface
+  double tau[6];      // tangent vectors of the current master surface (tau[pdf*3 + sdf])
+  double invmm[4];    // inverse of the metric tensor
+  double invA[4];     // inverse of the metric tensor plus the gap times the curvature tensor, (m_ab + g*h_ab)^-1
+  double kappa[6];    // curvature terms of the traction, -t_N*tau^a*h_ab - t_T^a*x_m,ab (kappa[b*3 + sdf])
+  double p_kappa[2];  // curvature terms of the slip direction, p_T^a*p_T^c*tau_c.x_m,ab
+  double p_T[2];      // unit vector in the direction of slip (contravariant components)
+  double p_Tcov[2];   // unit vector in the direction of slip (covariant components)
+  double t_T[2];      // tangential traction (contravariant components)
+  double t_N;         // normal traction
+  double gap;         // normal gap
+  double norm_t_T;    // norm of the trial tangential traction
+  double w;           // Gauss weight times the jacobian of the slave segment
+  bool isStick;
+};
+
+/*! Assembly output that caches the active Gauss points instead of the tangent (see assembleContactResidualAndOperator) */
+struct OperatorAssemblyOutput {
+  std::vector<ContactOperatorGP> gps;
+
+  void subtractLocalResidual(int, double) {}
+
+  void setLocalStiffness(int, double) {}
+
+  void add(int, int, double) {}
+};
+
+/*! Whether the output receives the quantities of Gauss points by cacheGaussPoint */
+template <class Output>
+struct CachesGaussPoints {
+  enum { value = 0 };
+};
+
+template <>
+struct CachesGaussPoints<OperatorAssemblyOutput> {
+  enum { value = 1 };
+};
+
+template <class Output>
+static inline void cacheGaussPoint(Output&, const ContactOperatorGP&) {}
+
+static inline void cacheGaussPoint(OperatorAssemblyOutput& output, const ContactOperatorGP& gp) {
+  output.gps.push_back(gp);
+}
+
+/*! Number of Gauss points of the GPs rows iBegin, ..., iEnd-1 the kernel assembles
+
+The Gauss points are active with the compressive normal traction t_N0 - epsN*gap
+(the kernel releases the others), the geometry is not evaluated.
+*/
+template <class GaussPoints>
+static int countAssembledGaussPoints(const GaussPoints& gps, double epsN, int iBegin, int iEnd) {
+  int numOfAssembled = 0;
+  for (int i = iBegin; i < iEnd; ++i) {
+    if (gps.wasActive(i) && gps.normalTraction(i) - epsN*gps.gap(i) <= 0.0) {
+      numOfAssembled++;
+    }
+  }
+  return numOfAssembled;
+}
+
+/*! Upper bound of the number of tangent entries (triplets) of an assembled Gauss point */
+static inline int getNumberOfTripletsPerGaussPoint(const ContactAssemblyData& data) {
+  const int nsdof = data.nsn*data.nsd;
+  const int isMasterSlave = data.GPs_len != data.nsg; // This inequality indicates master-slave algorithm
+  return (1 + isMasterSlave)*nsdof*2*nsdof;
+}
+
+/*! Assemble contact residual and tangent of the GPs rows iBegin, ..., iEnd-1
+
+\param Gc - residual vector (neq), the contributions are added
+\param output - receives the tangent triplets and the local arrays (Gc_loc, Kc)
+
+The tangent is the consistent linearisation of Gc including the curvature of the master
+segment at the projection (2nd derivatives of the master shape functions). The variation
+of the slave jacobian is neglected.
+
+NSD, NPD and NSN are the compile-time nsd, npd and nsn (0 means the run-time value
+of data), see assembleContactRowsSpecialized.
+*/
+template <int NSD, int NPD, int NSN, class GaussPoints, class Output>
+static void assembleContactRows(const ContactAssemblyData& data, const GaussPoints& gps, int iBegin, int iEnd, double* Gc, Output& output) {
+  const int* ISN = data.ISN;
+  const int* IEN = data.IEN;
+  const double* X = data.X;
+  const double* U = data.U;
+  const double* H = data.H;
+  const double* dH = data.dH;
+  const double* gw = data.gw;
+  const int neq = data.neq;
+  const int nsd = NSD ? NSD : data.nsd;
+  const int npd = NPD ? NPD : data.npd;
+  const int ngp = data.ngp;
+  const int nes = data.nes;
+  const int nsn = NSN ? NSN : data.nsn;
+  const int nen = data.nen;
+  const int GPs_len = data.GPs_len;
+  const double epsN = data.epsN;
+  const double epsT = data.epsT;
+  const double mu = data.mu;
+  const bool keyContactDetection = data.keyContactDetection;
+  const bool keyAssembleKc = data.keyAssembleKc;
+  const bool isAxisymmetric = data.isAxisymmetric;
+  const int nsg = data.nsg;
+
+  // Sizes of the local arrays:
+  enum { MAX_NSN = NSN ? NSN : 8, MAX_NSD = NSD ? NSD : 3, MAX_NPD = NPD ? NPD : 2 };
+
+  // Arrays of all Gauss points of a segment are on the stack up to MAX_NGP Gauss points
+  // (ngp is a run-time value, larger integration rules use the heap):
+  enum { MAX_NGP = 16, NGP_SCRATCH = 3 + MAX_NSN*(1 + MAX_NPD) };
+  double scratchStack[MAX_NGP*NGP_SCRATCH];
+  std::vector<double> scratchHeap;
+  double* scratch = scratchStack;
+  if (ngp > MAX_NGP) {
+    scratchHeap.resize((size_t)ngp*NGP_SCRATCH);
+    scratch = &scratchHeap[0];
+  }
+
+  int col;
+  int segmentNodesIDs[MAX_NSN];
+  int segmentNodesIDm[MAX_NSN];
+  double Xs[MAX_NSN*MAX_NSD];
+  double Xm[MAX_NSN*MAX_NSD];
+  double Us[MAX_NSN*MAX_NSD];
+  double Um[MAX_NSN*MAX_NSD];
+  double dXs[MAX_NSN*MAX_NPD];
+  double dxs[MAX_NSN*MAX_NPD];
+  double dXm[MAX_NSN*MAX_NPD];
+  double dxm[MAX_NSN*MAX_NPD];
+  double* GAPs = scratch;
+  // Master shape functions of all Gauss points of the segment (SoA, see sfd2Batch):
+  double* r_m = GAPs + ngp;
+  double* s_m = r_m + ngp;
+  double* HmBatch = s_m + ngp;
+  double* dHmBatch = HmBatch + MAX_NSN*ngp;
+  double Ns[MAX_NSN*MAX_NSD];
+  double Nm1[MAX_NSN*MAX_NSD];
+  double Nm2[MAX_NSN*MAX_NSD];
+  double C_Ns[MAX_NSN*MAX_NSD];
+  double C_Nm[MAX_NSN*MAX_NSD];
+  double C_Ts1[MAX_NSN*MAX_NSD];
+  double C_Tm1[MAX_NSN*MAX_NSD];
+  double C_Nm1[MAX_NSN*MAX_NSD];
+  double C_Pm1[MAX_NSN*MAX_NSD];
+  double C_Ts2[MAX_NSN*MAX_NSD];
+  double C_Tm2[MAX_NSN*MAX_NSD];
+  double C_Nm2[MAX_NSN*MAX_NSD];
+  double C_Pm2[MAX_NSN*MAX_NSD];
+  double Hm[MAX_NSN];
+  double dHm[MAX_NSN*MAX_NPD];
+  double Xi_m[MAX_NPD];
+  double Xi0_m[MAX_NPD];
+  double t_T[MAX_NPD];
+  double t_T0[MAX_NPD];
+  int colIDs[2*MAX_NSN*MAX_NSD];
+  double dg[2*MAX_NSN*MAX_NSD];
+  double dXi[2*MAX_NPD*MAX_NSN*MAX_NSD];
+  double dt_T[2*MAX_NPD*MAX_NSN*MAX_NSD];
+
+  double Xp[3];
+  double Xg[3];
+  for (int i = 0; i < 3; ++i) {
+    Xp[i] = 0.0;
+    Xg[i] = 0.0;
+  }
+  ContactStats stats = ContactStats();
+
+  for (int i = iBegin; i < iEnd; i += ngp) {
+
+    // Fill C_s and C_m arrays by zeros:
+    for (int j = 0; j < nsn*nsd; ++j) {
+      Ns[j]   = 0.0;
+
+      C_Ns[j] = 0.0;
+      C_Nm[j] = 0.0;
+
+      Nm1[j]  = 0.0;
+      C_Ts1[j] = 0.0;
+      C_Tm1[j] = 0.0;
+      C_Nm1[j] = 0.0;
+      C_Pm1[j] = 0.0;
+
+      if(npd == 2) {
+        Nm2[j]   = 0.0;
+        C_Ts2[j] = 0.0;
+        C_Tm2[j] = 0.0;
+        C_Nm2[j] = 0.0;
+        C_Pm2[j] = 0.0;
+      }
+    }
+
+    // slave element index:
+    const int els = gps.slaveElement(i);
+
+    // slave segment index:
+    const int sgs = gps.slaveSegment(i);
+
+    // slave segment coords Xs and displacements Us:
+    for (int j = 0; j < nsn; ++j) {
+      col = nes*j;
+      int IENrows = ISN[col + sgs] - 1; // Matlab numbering starts with 1
+      col = nen*els;
+      segmentNodesIDs[j] = IEN[col + IENrows] - 1; // Matlab numbering starts with 1
+      for (int k = 0; k < nsd; ++k) {
+        col = k*(int)(neq / nsd);
+        Xs[k*nsn + j] = X[col + segmentNodesIDs[j]];
+        Us[k*nsn + j] = U[col + segmentNodesIDs[j]];
+      }
+    }
+
+    for (int g = 0; g < ngp; ++g) {
+      r_m[g] = gps.xi(0, i + g);
+      s_m[g] = npd == 2 ? gps.xi(1, i + g) : 0.0;
+    }
+    evaluateShapeFunctionsBatch<NSN>(HmBatch, dHmBatch, r_m, s_m, ngp, nsn);
+
+    for (int g = 0; g < ngp; ++g) {
+
+      // Gausspoint gap values and activeGPs:
+      if (!gps.wasActive(i + g)) {
+        continue;
+      }
+      stats.numOfActiveGPs++;
+      CONTACT_PROFILE_START(gpTime);
+
+      // master element index:
+      const int elm = gps.masterElement(i + g);
+      // master segment index:
+      const int sgm = gps.masterSegment(i + g);
+
+      // master segment coords Xm and displacements Um:
+      for (int j = 0; j < nsn; ++j) {
+        col = nes*j;
+        int IENrowm = ISN[col + sgm] - 1; // Matlab numbering starts with 1
+        col = nen*elm;
+        segmentNodesIDm[j] = IEN[col + IENrowm] - 1; // Matlab numbering starts with 1
+        for (int k = 0; k < nsd; ++k) {
+          col = k*(int)(neq / nsd);
+          Xm[k*nsn + j] = X[col + segmentNodesIDm[j]];
+          Um[k*nsn + j] = U[col + segmentNodesIDm[j]];
+        }
+      }
+
+      // GPs legend:              Xg     els  sgs   gap    Xi_m  isActive      elm      sgm      isStick      t_T       Xi0_m     t_N0
+      //double* GPs = new double[n*(nsd + 1 +  1  +  1  +  npd  +   1     +     1    +   1     +    1    +    npd   +    npd    + 1];
+      //index of begining           0    nsd nsd+1 nsd+2  nsd+3  nsd+npd+3  nsd+npd+4 nsd+npd+5 nsd+npd+6  nsd+npd+7 nsd+2*npd+7  nsd+3*npd+7 (size = nsd+3*npd+8)
+
+      // Shape function and its derivatives of gausspoint's master segment
+      for (int k = 0; k < nsn; ++k) {
+        Hm[k] = HmBatch[k*ngp + g];
+      }
+      for (int k = 0; k < nsn*npd; ++k) {
+        dHm[k] = dHmBatch[k*ngp + g];
+      }
+
+      // evaluate gausspoint coords:
+      for (int sdf = 0; sdf < nsd; ++sdf) {
+        Xp[sdf] = 0.0;
+        Xg[sdf] = 0.0;
+        for (int k = 0; k < nsn; ++k) {
+          Xp[sdf] += Hm[k] * (Xm[sdf*nsn + k] + Um[sdf*nsn + k]);
+          Xg[sdf] += H[k*ngp + g] * (Xs[sdf*nsn + k] + Us[sdf*nsn + k]);
+        }
+      }
+
+      // if contact detection is on, the new gap is stored in the GP array
+      if (keyContactDetection) {
+        GAPs[g] = gps.gap(i + g);
+      }
+      else { // else the new gap is considered as the distance between the Gauss point and its projection onto the master segment:
+        // (sign is determinated later)
+        /////////GAPs[g] =  sqrt( (Xp[0] - Xg[0])*(Xp[0] - Xg[0]) + (Xp[1] - Xg[1])*(Xp[1] - Xg[1]) + (Xp[2] - Xg[2])*(Xp[2] - Xg[2]) );
+        // Note that for both the 2D and the 3D case the same equation is used. This is correct because Xp and Xg are initialized as 1x3 zero arrays.
+
+        GAPs[g] = gps.gap(i + g);
+      }
+
+      // Fill dXs arrays by zeros:
+      for (int j = 0; j < nsn*npd; ++j) {
+        dXs[j] = 0.0;
+        dxs[j] = 0.0;
+        dXm[j] = 0.0;
+        dxm[j] = 0.0;
+      }
+
+      // Evaluate tangent vectors:
+      for (int pdf = 0; pdf < npd; ++pdf) {
+        for (int sdf = 0; sdf < nsd; ++sdf) {
+          for (int j = 0; j < nsn; ++j) {
+            col = j*npd*ngp;
+            const double dh = dH[col + g*npd + pdf];
+            dXs[npd*sdf + pdf] += dh*Xs[sdf*nsn + j];
+            dxs[npd*sdf + pdf] += dh*(Xs[sdf*nsn + j] + Us[sdf*nsn + j]);
+            dXm[npd*sdf + pdf] += dHm[pdf*nsn + j]*Xm[sdf*nsn + j];
+            dxm[npd*sdf + pdf] += dHm[pdf*nsn + j]*(Xm[sdf*nsn + j] + Um[sdf*nsn + j]);
+          }
+        }
+      }
+
+
+      //       X     Y      Z
+      // r   dxs[0] dxs[2]  dxs[4]
+      // s   dxs[1] dxs[3]  dxs[5]
+
+      // Matric tensor:
+      double mm[4];
+
+      mm[0] = 0.0;
+      mm[1] = 0.0;
+      mm[2] = 0.0;
+      mm[3] = 0.0;
+
+      for (int sdf = 0; sdf < nsd; ++sdf) {
+        mm[0] += dxm[sdf*npd + 0] * dxm[sdf*npd + 0];
+        if(npd == 2) {
+          mm[1] += dxm[sdf*npd + 1] * dxm[sdf*npd + 0];
+          mm[2] += dxm[sdf*npd + 0] * dxm[sdf*npd + 1];
+          mm[3] += dxm[sdf*npd + 1] * dxm[sdf*npd + 1];
+        }
+      }
+
+      // Inverse of matric tensor
+
+      double invmm[4];
+      invmm[0] = 0.0;
+      invmm[1] = 0.0;
+      invmm[2] = 0.0;
+      invmm[3] = 0.0;
+
+      if(npd == 1) {
+        invmm[0] = 1 / mm[0];
+      }
+      else if(npd == 2) {
+        const double invdetmm = 1 / (mm[0]*mm[3] - mm[1]*mm[2]);
+        invmm[0] =  invdetmm * mm[3];
+        invmm[1] = -invdetmm * mm[2];
+        invmm[2] = -invdetmm * mm[1];
+        invmm[3] =  invdetmm * mm[0];
+      }
+
+      // Read frictional variables:
+      for (int pdf = 0; pdf < npd; ++pdf) {
+        Xi_m[pdf]  = gps.xi(pdf, i + g);
+        t_T0[pdf]  = gps.tangentTraction(pdf, i + g);
+        Xi0_m[pdf] = gps.xi0(pdf, i + g);
+      }
+
+      double t_N0 = gps.normalTraction(i + g);
+
+      // isStick is not necessary...
+      //const int isStick = (int)GPs[(nsd + npd + 6)*GPs_len + i + g];
+
+      // Evaluate trial tangent traction:
+      for (int r = 0; r < npd; ++r) {
+        t_T[r] = t_T0[r] - epsT * (Xi_m[r] - Xi0_m[r]);
+      }
+
+      // Evaluate norm of the trial traction vector:
+      double norm_t_T = 0.0;
+      for (int r = 0; r < npd; ++r) {
+        for (int s = 0; s < npd; ++s) {
+          norm_t_T += t_T[r]*mm[npd*s + r]*t_T[s];
+        }
+      }
+      norm_t_T = sqrt(norm_t_T);
+
+      // Unit vector in the direction of slip:
+      double p_T[2];
+      p_T[1] = 0.0;
+      for (int r = 0; r < npd; ++r) {
+        if(fabs(norm_t_T) > 1e-10) {
+          p_T[r] = t_T[r] / norm_t_T;
+        }
+        else {
+          p_T[r] = 0.0;
+        }
+      }
+
+      // Evaluate normal vector:
+      double Normal_m[3]; // normal to initial master surface
+      double normal_m[3]; // normal to the current master surface
+      double Normal_s[3]; // normal to initial slave surface
+      double normal_s[3]; // normal to the current slave surface
+
+      if (nsd == 2) {
+        Normal_m[0] = dXm[1];
+        Normal_m[1] = -dXm[0];
+        Normal_m[2] = 0.0;
+
+        normal_m[0] = dxm[1];
+        normal_m[1] = -dxm[0];
+        normal_m[2] = 0.0;
+
+        Normal_s[0] = dXs[1];
+        Normal_s[1] = -dXs[0];
+        Normal_s[2] = 0.0;
+
+        normal_s[0] = dxs[1];
+        normal_s[1] = -dxs[0];
+        normal_s[2] = 0.0;
+      }
+      else if (nsd == 3) {
+        //       X     Y      Z
+        // r   dXs[0] dXs[2]  dXs[4]
+        // s   dXs[1] dXs[3]  dXs[5]
+        const double dXm_dr1 = dXm[0];
+        const double dXm_dr2 = dXm[npd + 0];
+        const double dXm_dr3 = dXm[2 * npd + 0];
+        const double dXm_ds1 = dXm[1];
+        const double dXm_ds2 = dXm[npd + 1];
+        const double dXm_ds3 = dXm[2 * npd + 1];
+        Normal_m[0] = dXm_dr2*dXm_ds3 - dXm_dr3*dXm_ds2;
+        Normal_m[1] = dXm_dr3*dXm_ds1 - dXm_dr1*dXm_ds3;
+        Normal_m[2] = dXm_dr1*dXm_ds2 - dXm_dr2*dXm_ds1;
+
+        const double dxm_dr1 = dxm[0];
+        const double dxm_dr2 = dxm[npd + 0];
+        const double dxm_dr3 = dxm[2 * npd + 0];
+        const double dxm_ds1 = dxm[1];
+        const double dxm_ds2 = dxm[npd + 1];
+        const double dxm_ds3 = dxm[2 * npd + 1];
+        normal_m[0] = dxm_dr2*dxm_ds3 - dxm_dr3*dxm_ds2;
+        normal_m[1] = dxm_dr3*dxm_ds1 - dxm_dr1*dxm_ds3;
+        normal_m[2] = dxm_dr1*dxm_ds2 - dxm_dr2*dxm_ds1;
+
+
+        const double dXs_dr1 = dXs[0];
+        const double dXs_dr2 = dXs[npd + 0];
+        const double dXs_dr3 = dXs[2 * npd + 0];
+        const double dXs_ds1 = dXs[1];
+        const double dXs_ds2 = dXs[npd + 1];
+        const double dXs_ds3 = dXs[2 * npd + 1];
+        Normal_s[0] = dXs_dr2*dXs_ds3 - dXs_dr3*dXs_ds2;
+        Normal_s[1] = dXs_dr3*dXs_ds1 - dXs_dr1*dXs_ds3;
+        Normal_s[2] = dXs_dr1*dXs_ds2 - dXs_dr2*dXs_ds1;
+
+        const double dxs_dr1 = dxs[0];
+        const double dxs_dr2 = dxs[npd + 0];
+        const double dxs_dr3 = dxs[2 * npd + 0];
+        const double dxs_ds1 = dxs[1];
+        const double dxs_ds2 = dxs[npd + 1];
+        const double dxs_ds3 = dxs[2 * npd + 1];
+        normal_s[0] = dxs_dr2*dxs_ds3 - dxs_dr3*dxs_ds2;
+        normal_s[1] = dxs_dr3*dxs_ds1 - dxs_dr1*dxs_ds3;
+        normal_s[2] = dxs_dr1*dxs_ds2 - dxs_dr2*dxs_ds1;
+      }
+
+      double jacobian_s = sqrt(Normal_s[0] * Normal_s[0] + Normal_s[1] * Normal_s[1] + Normal_s[2] * Normal_s[2]);
+      if(isAxisymmetric) {
+        jacobian_s *= 2 * M_PI * Xg[0];
+      }
+
+      const double normal_m_length = sqrt(normal_m[0] * normal_m[0] + normal_m[1] * normal_m[1] + normal_m[2] * normal_m[2]);
+      normal_m[0] /= normal_m_length;
+      normal_m[1] /= normal_m_length;
+      normal_m[2] /= normal_m_length;
+
+      const double normal_s_length = sqrt(normal_s[0] * normal_s[0] + normal_s[1] * normal_s[1] + normal_s[2] * normal_s[2]);
+      normal_s[0] /= normal_s_length;
+      normal_s[1] /= normal_s_length;
+      normal_s[2] /= normal_s_length;
+/*
+      if (!keyContactDetection) {
+        const double signGAPs = (Xp[0] - Xg[0])*normal_m[0] + (Xp[1] - Xg[1])*normal_m[1] + (Xp[2] - Xg[2])*normal_m[2];
+        if (signGAPs < 0.0) { // Possitive signGAPs means open gap which is defined as negative GAP.
+          GAPs[g] = -GAPs[g];
+        }
+        GPs[(nsd + 2)*GPs_len + i + g] = GAPs[g];
+      }
+      else { // Change active state only when contact detection is enabled
+
+        if (GAPs[g] < 0.0) {
+          GPs[(nsd + npd + 3)*GPs_len + i + g] = 0; // negative GAP means open gap which means inActive GP
+          continue;
+        } else {
+          GPs[(nsd + npd + 3)*GPs_len + i + g] = 1; // possitive GAP means penetration which means Active GP
+        }
+      }
+*/
+
+  //if (els > 100 && els < 1800) epsN = 1e3;
+
+      double t_N_new = -epsN*GAPs[g];
+
+      double t_N = t_N0 + t_N_new; // normal contact traction component is non-positive, i.e. compression
+      //std::cout << "t_N0 = " << t_N0 << ", t_N_new = " << t_N_new << std::endl;
+
+      if(t_N > 0.0) {
+        t_N = 0.0;
+        //std::cout << "g_N = " << GAPs[g] << ", t_N_g = " << t_N << std::endl;
+        gps.setNormalTraction(i + g, t_N);
+        continue;
+      }
+      gps.setNormalTraction(i + g, t_N);
+
+
+
+      bool isStick = false;
+
+      // Check slip function (frictionless contact, mu = 0, is always slip with t_T = 0):
+      if(mu > 0.0 && norm_t_T + mu*t_N  <= 1e-10) {
+        //printf("stick ");
+        isStick = true;
+        stats.numOfStickGPs++;
+        for (int pdf = 0; pdf < npd; ++pdf) {
+          gps.setTangentTraction(pdf, i + g, t_T[pdf]);
+        }
+      }
+      else {
+        isStick = false;
+        stats.numOfSlipGPs++;
+        for (int pdf = 0; pdf < npd; ++pdf) {
+          if(norm_t_T > 1e-10) {
+            t_T[pdf] = -mu*t_N * p_T[pdf];
+          }
+          else {
+            t_T[pdf] = 0.0;
+          }
+          gps.setTangentTraction(pdf, i + g, t_T[pdf]);
+        }
+      }
+
+      // Tangential contact traction t_T^a*tau_a and unit vector p_T^a*tau_a in the direction of slip:
+      double t_Tvec[3];
+      double p_Tvec[3];
+      for (int sdf = 0; sdf < 3; ++sdf) {
+        t_Tvec[sdf] = 0.0;
+        p_Tvec[sdf] = 0.0;
+      }
+      for (int sdf = 0; sdf < nsd; ++sdf) {
+        for (int pdf = 0; pdf < npd; ++pdf) {
+          t_Tvec[sdf] += t_T[pdf]*dxm[sdf*npd + pdf];
+          p_Tvec[sdf] += p_T[pdf]*dxm[sdf*npd + pdf];
+        }
+      }
+
+      // evaluate shape functions and contact residual vectors:
+      for (int j = 0; j < nsn; ++j) {
+        const double hs = H[j*ngp + g];
+        const double hm = Hm[j];
+
+        for (int sdf = 0; sdf < nsd; ++sdf) {
+
+          Ns[j*nsd + sdf]   += hs;
+          C_Ns[j*nsd + sdf] += hs*normal_m[sdf];
+          C_Nm[j*nsd + sdf] += hm*normal_m[sdf];
+
+          Nm1[j*nsd + sdf]   += dHm[j];
+          C_Ts1[j*nsd + sdf] += hs*dxm[sdf*npd];
+          C_Tm1[j*nsd + sdf] += hm*dxm[sdf*npd];
+          C_Nm1[j*nsd + sdf] += dHm[j]*normal_m[sdf];
+          C_Pm1[j*nsd + sdf] += dHm[j]*p_T[0]*p_Tvec[sdf];
+
+          if(npd == 2) {
+            Nm2[j*nsd + sdf]   += dHm[nsn + j];
+            C_Ts2[j*nsd + sdf] += hs*dxm[sdf*npd+1];
+            C_Tm2[j*nsd + sdf] += hm*dxm[sdf*npd+1];
+            C_Nm2[j*nsd + sdf] += dHm[nsn + j]*normal_m[sdf];
+            C_Pm2[j*nsd + sdf] += dHm[nsn + j]*p_T[1]*p_Tvec[sdf];
+          }
+
+          // The negative master normal is used as the slave normal
+          //sstd::cout << t_N << ", " << hs << ", " << normal_m[sdf] << " , " << gw[g] << ", " << jacobian_s << std::endl;
+          Gc[segmentNodesIDs[j] * nsd + sdf]   -= t_N * hs * (-normal_m[sdf]) * gw[g] * jacobian_s;
+          output.subtractLocalResidual((i+g)*(j*nsd + sdf) + i/ngp, t_N * hs * (-normal_m[sdf]) * gw[g] * jacobian_s);
+
+          // Tangential (frictional) traction acts against the master tangent vectors:
+          Gc[segmentNodesIDs[j] * nsd + sdf]   -= t_Tvec[sdf] * hs * gw[g] * jacobian_s;
+          output.subtractLocalResidual((i+g)*(j*nsd + sdf) + i/ngp, t_Tvec[sdf] * hs * gw[g] * jacobian_s);
+
+          //////////// For MASTER-SLAVE t_N * hm term is needed (loop over GPs tabel goes only over SLAVE GPs)
+          if (GPs_len != nsg) { // This inequality indicates master-slave algorithm
+            Gc[segmentNodesIDm[j] * nsd + sdf]    -= t_N * hm * (normal_m[sdf]) * gw[g] * jacobian_s;
+            Gc[segmentNodesIDm[j] * nsd + sdf]    += t_Tvec[sdf] * hm * gw[g] * jacobian_s;
+          }
+
+          // MUSI SE UPRAVIT: Gc_loc[ (i+g)*(j*nsd + sdf) + i/ngp]  = t_N * hm * (-normal_m[sdf]) * gw[g] * jacobian_s;
+        }
+      }
+
+      // Covariant components of the unit vector in the direction of slip:
+      double p_Tcov[2];
+      p_Tcov[1] = 0.0;
+      for (int r = 0; r < npd; ++r) {
+        p_Tcov[r] = 0.0;
+        for (int s = 0; s < npd; ++s) {
+          p_Tcov[r] += mm[npd*r + s]*p_T[s];
+        }
+      }
+
+      // Curvature of the master segment at the projection, x_m,ab = ddHm_ab*xm, h_ab = n.x_m,ab:
+      //   A_ab      = m_ab + g*h_ab
+      //   kappa_b   = -t_N*tau^a*h_ab - t_T^a*x_m,ab
+      //   p_kappa_b = p_T^a*p_T^c*tau_c.x_m,ab
+      double invA[4] = {0.0, 0.0, 0.0, 0.0};
+      double kappa[2*MAX_NSD];
+      double p_kappa[2] = {0.0, 0.0};
+      if (keyAssembleKc || CachesGaussPoints<Output>::value) {
+        double ddHm[3*MAX_NSN];
+        evaluateShapeFunctionsSecondDerivatives<NSN>(ddHm, r_m[g], s_m[g], nsn);
+
+        // x_m,ab is stored in ddxm[(a + b)*nsd + sdf], i.e. the rows are rr, rs and ss:
+        double ddxm[3*MAX_NSD];
+        for (int k = 0; k < 2*npd - 1; ++k) {
+          for (int sdf = 0; sdf < nsd; ++sdf) {
+            ddxm[k*nsd + sdf] = 0.0;
+            for (int j = 0; j < nsn; ++j) {
+              ddxm[k*nsd + sdf] += ddHm[k*nsn + j]*(Xm[sdf*nsn + j] + Um[sdf*nsn + j]);
+            }
+          }
+        }
+
+        double hh[4];
+        double A[4];
+        for (int a = 0; a < npd; ++a) {
+          for (int b = 0; b < npd; ++b) {
+            hh[a*npd + b] = 0.0;
+            for (int sdf = 0; sdf < nsd; ++sdf) {
+              hh[a*npd + b] += normal_m[sdf]*ddxm[(a + b)*nsd + sdf];
+            }
+            A[a*npd + b] = mm[a*npd + b] + GAPs[g]*hh[a*npd + b];
+          }
+        }
+        if(npd == 1) {
+          invA[0] = 1 / A[0];
+        }
+        else if(npd == 2) {
+          const double invdetA = 1 / (A[0]*A[3] - A[1]*A[2]);
+          invA[0] =  invdetA * A[3];
+          invA[1] = -invdetA * A[2];
+          invA[2] = -invdetA * A[1];
+          invA[3] =  invdetA * A[0];
+        }
+
+        for (int b = 0; b < npd; ++b) {
+          for (int sdf = 0; sdf < nsd; ++sdf) {
+            double& kappa_b = kappa[b*nsd + sdf];
+            kappa_b = 0.0;
+            for (int a = 0; a < npd; ++a) {
+              double tauContra = 0.0; // contravariant tangent vector m^ac*tau_c
+              for (int r = 0; r < npd; ++r) {
+                tauContra += invmm[a*npd + r]*dxm[sdf*npd + r];
+              }
+              kappa_b -= t_N*tauContra*hh[a*npd + b] + t_T[a]*ddxm[(a + b)*nsd + sdf];
+              p_kappa[b] += p_T[a]*p_Tvec[sdf]*ddxm[(a + b)*nsd + sdf];
+            }
+          }
+        }
+      }
+
+      // Quantities of the Gauss point for the matrix-free tangent (see applyContactStiffness):
+      if (CachesGaussPoints<Output>::value) {
+        ContactOperatorGP cached;
+        for (int j = 0; j < nsn; ++j) {
+          cached.nodes[j] = segmentNodesIDs[j];
+          cached.nodes[nsn + j] = segmentNodesIDm[j];
+          cached.hs[j] = H[j*ngp + g];
+          cached.hm[j] = Hm[j];
+        }
+        for (int k = 0; k < nsn*npd; ++k) {
+          cached.dHm[k] = dHm[k];
+        }
+        for (int sdf = 0; sdf < 3; ++sdf) {
+          cached.normal[sdf] = normal_m[sdf];
+          for (int pdf = 0; pdf < npd; ++pdf) {
+            cached.tau[pdf*3 + sdf] = sdf < nsd ? dxm[sdf*npd + pdf] : 0.0;
+          }
+        }
+        for (int k = 0; k < 4; ++k) {
+          cached.invmm[k] = invmm[k];
+          cached.invA[k] = invA[k];
+        }
+        for (int pdf = 0; pdf < npd; ++pdf) {
+          for (int sdf = 0; sdf < 3; ++sdf) {
+            cached.kappa[pdf*3 + sdf] = sdf < nsd ? kappa[pdf*nsd + sdf] : 0.0;
+          }
+          cached.p_kappa[pdf] = p_kappa[pdf];
+          cached.p_T[pdf] = p_T[pdf];
+          cached.p_Tcov[pdf] = p_Tcov[pdf];
+          cached.t_T[pdf] = t_T[pdf];
+        }
+        cached.t_N = t_N;
+        cached.gap = GAPs[g];
+        cached.norm_t_T = norm_t_T;
+        cached.w = gw[g] * jacobian_s;
+        cached.isStick = isStick;
+        cacheGaussPoint(output, cached);
+      }
+
+    CONTACT_PROFILE_LAP(gpTime, CONTACT_PHASE_RESIDUAL);
+    if(keyAssembleKc) {
+      for (int j = 0; j < nsn*nsd; ++j) { // loop over cols
+        for (int k = 0; k < nsn*nsd; ++k) { // loop over rows
+
+          // Kc elementu je blokova matice o strukture:
+          // Kc_e = [C_Nm*C_Nm'  C_Nm*C_Ns'
+          //         C_Ns*C_Nm'  C_Ns*C_Ns'];
+          // dimeze: [(nsn*nsd)*(nsn*nsd)  (nsn*nsd)*(nsn*nsd)
+          //          (nsn*nsd)*(nsn*nsd)  (nsn*nsd)*(nsn*nsd)];
+
+          output.setLocalStiffness((i+g)*2*nsn*nsd*k           + (i+g)*(nsn*nsd+j) + i/ngp, C_Ns[j] * C_Nm[k] * gw[g] * jacobian_s);
+          output.setLocalStiffness((i+g)*2*nsn*nsd*(nsn*nsd+k) + (i+g)*(nsn*nsd+j) + i/ngp, C_Ns[j] * C_Ns[k] * gw[g] * jacobian_s);
+        }
+      }
+
+      const int nsdof = nsn*nsd;
+      const double* C_Ts[2] = {C_Ts1, C_Ts2};
+      const double* C_Tm[2] = {C_Tm1, C_Tm2};
+      const double* C_Nma[2] = {C_Nm1, C_Nm2};
+      const double* Nm[2] = {Nm1, Nm2};
+
+      // Columns of the GP tangent are the slave segment DOFs followed by the master segment DOFs:
+      for (int j = 0; j < nsdof; ++j) {
+        colIDs[j] = segmentNodesIDs[j / nsd] * nsd + j % nsd;
+        colIDs[nsdof + j] = segmentNodesIDm[j / nsd] * nsd + j % nsd;
+      }
+
+      // Linearisation of the gap and of the master convective coords of the projection:
+      //   dg    = -C_Ns.du_s + C_Nm.du_m
+      //   dXi^a = A^ab*(C_Tsb.du_s - C_Tmb.du_m - g*C_Nmb.du_m)
+      for (int j = 0; j < nsdof; ++j) {
+        dg[j] = -C_Ns[j];
+        dg[nsdof + j] = C_Nm[j];
+        for (int pdf = 0; pdf < npd; ++pdf) {
+          double* dXi_a = &dXi[pdf*2*nsdof];
+          dXi_a[j] = 0.0;
+          dXi_a[nsdof + j] = 0.0;
+          for (int r = 0; r < npd; ++r) {
+            dXi_a[j] += invA[pdf*npd + r] * C_Ts[r][j];
+            dXi_a[nsdof + j] -= invA[pdf*npd + r] * (C_Tm[r][j] + GAPs[g] * C_Nma[r][j]);
+          }
+        }
+      }
+
+      // Linearisation of the tangential traction:
+      //   stick: dt_T^a = -epsT*dXi^a
+      //   slip:  dt_T^a = -mu*(dt_N*p^a + t_N*dp^a), p^a = t_T^a/|t_T| of the trial traction
+      for (int c = 0; c < 2*nsdof; ++c) {
+        double p_dXi = 0.0;
+        double p_kappa_dXi = 0.0;
+        for (int r = 0; r < npd; ++r) {
+          p_dXi += p_Tcov[r]*dXi[r*2*nsdof + c];
+          p_kappa_dXi += p_kappa[r]*dXi[r*2*nsdof + c];
+        }
+        for (int pdf = 0; pdf < npd; ++pdf) {
+          double& dt = dt_T[pdf*2*nsdof + c];
+          if(isStick) {
+            dt = -epsT*dXi[pdf*2*nsdof + c];
+          }
+          else if(norm_t_T > 1e-10) {
+            dt = mu*epsN*p_T[pdf]*dg[c] + mu*t_N*epsT/norm_t_T*(dXi[pdf*2*nsdof + c] - p_T[pdf]*p_dXi)
+               + mu*t_N*p_T[pdf]*p_kappa_dXi;
+            if (c >= nsdof) {
+              dt += mu*t_N*p_T[pdf]*(C_Pm1[c - nsdof] + (npd == 2 ? C_Pm2[c - nsdof] : 0.0));
+            }
+          }
+          else {
+            dt = 0.0;
+          }
+        }
+      }
+
+      // Slave rows:
+      //   Gc_s = (t_N*C_Ns - t_T^a*C_Tsa)*w
+      for (int k = 0; k < nsdof; ++k) { // loop over rows
+        const int kdof = k%nsd;
+        const int row = colIDs[k];
+
+        // Contravariant tangent vectors C_Ts^a = m^ab*C_Tsb:
+        double C_TsContra[2];
+        for (int pdf = 0; pdf < npd; ++pdf) {
+          C_TsContra[pdf] = 0.0;
+          for (int r = 0; r < npd; ++r) {
+            C_TsContra[pdf] += invmm[pdf*npd + r] * C_Ts[r][k];
+          }
+        }
+
+        for (int c = 0; c < 2*nsdof; ++c) { // loop over cols
+          /////////////////// Normal contact /////////////////////////////
+          double val = -epsN * C_Ns[k] * dg[c];
+
+          ////////////////// Tangential contact (stick or slip) //////////
+          for (int pdf = 0; pdf < npd; ++pdf) {
+            val -= C_Ts[pdf][k] * dt_T[pdf*2*nsdof + c];
+          }
+
+          // Curvature of the master segment:
+          for (int pdf = 0; pdf < npd; ++pdf) {
+            val += Ns[k] * kappa[pdf*nsd + kdof] * dXi[pdf*2*nsdof + c];
+          }
+
+          // Rotation of the master normal and tangent vectors:
+          if (c >= nsdof) {
+            const int j = c - nsdof;
+            for (int pdf = 0; pdf < npd; ++pdf) {
+              val -= t_N * C_TsContra[pdf] * C_Nma[pdf][j];
+              if (j%nsd == kdof) {
+                val -= t_T[pdf] * Ns[k] * Nm[pdf][j];
+              }
+            }
+          }
+
+          if(fabs(val) > 1e-50) {
+            output.add(row, colIDs[c], val * gw[g] * jacobian_s);
+          }
+        }
+      }
+
+      //////////// For MASTER-SLAVE the master rows are needed (loop over GPs tabel goes only over SLAVE GPs)
+      //   Gc_m = (-t_N*C_Nm + t_T^a*C_Tma)*w
+      if (GPs_len != nsg) { // This inequality indicates master-slave algorithm
+        for (int k = 0; k < nsdof; ++k) { // loop over rows
+          const int kdof = k%nsd;
+          const int knode = k / nsd;
+          const int row = colIDs[nsdof + k];
+
+          double C_TmContra[2];
+          double C_Em[2]; // master shape function derivatives times the master traction
+          for (int pdf = 0; pdf < npd; ++pdf) {
+            C_TmContra[pdf] = 0.0;
+            for (int r = 0; r < npd; ++r) {
+              C_TmContra[pdf] += invmm[pdf*npd + r] * C_Tm[r][k];
+            }
+            C_Em[pdf] = Nm[pdf][k] * (t_Tvec[kdof] - t_N*normal_m[kdof]);
+          }
+
+          for (int c = 0; c < 2*nsdof; ++c) { // loop over cols
+            double val = epsN * C_Nm[k] * dg[c];
+
+            for (int pdf = 0; pdf < npd; ++pdf) {
+              val += C_Em[pdf] * dXi[pdf*2*nsdof + c] + C_Tm[pdf][k] * dt_T[pdf*2*nsdof + c];
+              val -= Hm[knode] * kappa[pdf*nsd + kdof] * dXi[pdf*2*nsdof + c];
+            }
+
+            if (c >= nsdof) {
+              const int j = c - nsdof;
+              for (int pdf = 0; pdf < npd; ++pdf) {
+                val += t_N * C_TmContra[pdf] * C_Nma[pdf][j];
+                if (j%nsd == kdof) {
+                  val += t_T[pdf] * Hm[knode] * Nm[pdf][j];
+                }
+              }
+            }
+
+            if(fabs(val) > 1e-50) {
+              output.add(row, colIDs[c], val * gw[g] * jacobian_s);
+            }
+          }
+        }
+      }
+    }
+  CONTACT_PROFILE_LAP(gpTime, CONTACT_PHASE_STIFFNESS);
+
+  // Fill C_m array by zeros:
+  for (int j = 0; j < nsn*nsd; ++j) {
+    Ns[j] = 0.0;
+    C_Ns[j] = 0.0;
+    C_Nm[j] = 0.0;
+
+    Nm1[j] = 0.0;
+    C_Ts1[j] = 0.0;
+    C_Tm1[j] = 0.0;
+    C_Nm1[j] = 0.0;
+    C_Pm1[j] = 0.0;
+
+    if(npd == 2) {
+      Nm2[j] = 0.0;
+      C_Ts2[j] = 0.0;
+      C_Tm2[j] = 0.0;
+      C_Nm2[j] = 0.0;
+      C_Pm2[j] = 0.0;
+    }
+  }
+
+} // loop over gausspoints
+} // loop over GPs rows
+
+addContactStats(data.stats, stats);
+}
+
+/*! Assemble contact residual and tangent of the GPs rows iBegin, ..., iEnd-1 by the specialised kernel
+
+The kernels with compile-time sizes (fixed-size local arrays, constant loop bounds) are
+instantiated for 2D linear segments, 3D 8-node quadrilaterals and 3D 6-node triangles;
+other segments use the generic kernel. The number of Gauss points stays a run-time value,
+it depends on the integration rule of the caller and it only bounds the outer loop.
+*/
+template <class GaussPoints, class Output>
+static void assembleContactRowsSpecialized(const ContactAssemblyData& data, const GaussPoints& gps, int iBegin, int iEnd, double* Gc, Output& output) {
+  typedef void (*Kernel)(const ContactAssemblyData&, const GaussPoints&, int, int, double*, Output&);
+  struct KernelEntry {
+    int nsd;
+    int npd;
+    int nsn;
+    Kernel kernel;
+  };
+  static const KernelEntry kernels[] = {
+    {2, 1, 2, &assembleContactRows<2, 1, 2, GaussPoints, Output>},
+    {3, 2, 8, &assembleContactRows<3, 2, 8, GaussPoints, Output>},
+    {3, 2, 4, &assembleContactRows<3, 2, 4, GaussPoints, Output>},
+    {3, 2, 6, &assembleContactRows<3, 2, 6, GaussPoints, Output>}
+  };
+
+  for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); ++k) {
+    if (kernels[k].nsd == data.nsd && kernels[k].npd == data.npd && kernels[k].nsn == data.nsn) {
+      kernels[k].kernel(data, gps, iBegin, iEnd, Gc, output);
+      return;
+    }
+  }
+  assembleContactRows<0, 0, 0>(data, gps, iBegin, iEnd, Gc, output);
+}
+
+/*! Fill the input data of the contact assembly, the parameters are those of assembleContactResidualAndStiffness */
+static ContactAssemblyData getContactAssemblyData(const int* ISN, const int* IEN, const double* X, const double* U, const double* H, const double* dH, const double* gw, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg)
+{
+  ContactAssemblyData data;
+  data.ISN = ISN;
+  data.IEN = IEN;
+  data.X = X;
+  data.U = U;
+  data.H = H;
+  data.dH = dH;
+  data.gw = gw;
+  data.neq = neq;
+  data.nsd = nsd;
+  data.npd = npd;
+  data.ngp = ngp;
+  data.nes = nes;
+  data.nsn = nsn;
+  data.nen = nen;
+  data.GPs_len = GPs_len;
+  data.epsN = epsN;
+  data.epsT = epsT;
+  data.mu = mu;
+  data.keyContactDetection = keyContactDetection;
+  data.keyAssembleKc = keyAssembleKc;
+  data.isAxisymmetric = isAxisymmetric;
+  data.nsg = nsg;
+  data.stats = contactStats;
+
+  return data;
+}
+
+/*! Number of chunks of the GPs rows assembled in parallel (see assembleContactRowsInParallel) */
+static int getNumberOfChunks(int nsg, int ngp) {
+  const int numOfBlocks = (nsg + ngp - 1) / ngp;
+  return std::max(1, std::min(numOfBlocks, 8*numberOfThreads));
+}
+
+/*! GPs rows iBegin, ..., iEnd-1 of the c-th chunk (whole segments, the last one may end with nsg) */
+static void getChunkRows(int* iBegin, int* iEnd, int c, int numOfChunks, int nsg, int ngp) {
+  const int numOfBlocks = (nsg + ngp - 1) / ngp;
+  *iBegin = (int)((long long)numOfBlocks*c / numOfChunks)*ngp;
+  *iEnd = std::min(nsg, (int)((long long)numOfBlocks*(c + 1) / numOfChunks)*ngp);
+}
+
+/*! Assemble all GPs rows by numberOfThreads threads
+
+The GPs rows are split to chunks (whole segments), each chunk has its own output and
+each thread its own residual vector. The threads are assigned to chunks statically and
+the residual vectors are summed in the order of threads, so the result does not depend
+on the scheduling.
+
+\param Gc - residual vector (neq)
+\param outputs - outputs of the chunks in the order of GPs rows (see getNumberOfChunks)
+*/
+template <class GaussPoints, class Output>
+static void assembleContactRowsInParallel(const ContactAssemblyData& data, const GaussPoints& gps, double* Gc, std::vector<Output>& outputs)
+{
+  const int neq = data.neq;
+  const int ngp = data.ngp;
+  const int nsg = data.nsg;
+
+  const int numOfChunks = (int)outputs.size();
+  // Residual vectors of all threads are zeroed here, OpenMP may start fewer threads
+  // than numberOfThreads (OMP_THREAD_LIMIT, nested parallel regions):
+  std::vector<double> threadGc((size_t)numberOfThreads*neq, 0.0);
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(numberOfThreads)
+#endif
+  {
+#ifdef _OPENMP
+    double* Gc_t = &threadGc[(size_t)omp_get_thread_num()*neq];
+#else
+    double* Gc_t = &threadGc[0];
+#endif
+
+#ifdef _OPENMP
+#pragma omp for schedule(static, 1)
+#endif
+    for (int c = 0; c < numOfChunks; ++c) {
+      int iBegin;
+      int iEnd;
+      getChunkRows(&iBegin, &iEnd, c, numOfChunks, nsg, ngp);
+      assembleContactRowsSpecialized(data, gps, iBegin, iEnd, Gc_t, outputs[c]);
+    }
+  }
+
+  // Reduction of the residual vector:
+  CONTACT_PROFILE_START(mergeTime);
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(numberOfThreads) schedule(static)
+#endif
+  for (int i = 0; i < neq; ++i) {
+    double sum = 0.0;
+    for (int t = 0; t < numberOfThreads; ++t) {
+      sum += threadGc[(size_t)t*neq + i];
+    }
+    Gc[i] = sum;
+  }
+  CONTACT_PROFILE_LAP(mergeTime, CONTACT_PHASE_MERGE);
+}
+
+/*! Largest index written into Gc_loc and Kc by assembleContactResidualAndStiffness (plus one) */
+static void getLocalArraySizes(long long* sizeGc_loc, long long* sizeKc, int nsg, int ngp, int nsn, int nsd) {
+  const long long numOfRows = (nsg + ngp - 1) / ngp * ngp; // whole segments
+  const long long m = nsn*nsd;
+  *sizeGc_loc = (numOfRows - 1)*(m - 1) + (numOfRows - 1) / ngp + 1;
+  *sizeKc = (numOfRows - 1)*(2*m*(2*m - 1) + 2*m - 1) + (numOfRows - 1) / ngp + 1;
+}
+
+/*! Calculate contact residual term (gradient) and contact tangent term (Hessian)
+
+\param len - length of 1d arrays rows, cols and vals (see countContactTriplets)
+\param GPs - 2d array (GPs_len x ??? cols)
+\param ISN - 2d array (nsn*)
+\param IEN -
+\param X -
+\param U -
+\param H -
+\param dH -
+\param gw -
+\param activeGPsOld -
+\param neq - Number of Equations
+\param nsd - Number of Space Dimensions (usually 2 or 3)
+\param npd - Number of Parametric Dimensions (usually 1 or 2) (parametric=reference=parent coordinates)
+\param ngp - Number of GaussPoints on contact segment (segment means face of element)
+\param nes - Number of Element Segments
+\param nsn - Number of Segment Nodes
+\param GPs_len - length of GPs array
+\param epss - penalty parameter (usualy 100*Young's mudulus)
+\param keyContactDetection - if is true, ...
+\param keyAssembleKc - if is true, contact tangent term is assembled only
+
+\return Gc - 1d array
+\return rows - 1d array
+\return cols - 1d array
+\return valc - 1d array
+
+Gc_loc and Kc may be NULL, then they are not assembled.
+
+Segments are assembled in parallel when more threads are set (see setNumberOfThreads),
+each thread with its own triplet buffers and residual vector. The triplets are merged
+in the order of GPs rows, so rows, cols and vals are the same as in the serial run;
+Gc differs only by the order of summation. Gc_loc and Kc are merged by slices of their
+index ranges in parallel, each slice in the order of GPs rows.
+
+The triplets are never written beyond the length of rows, cols and vals; on return len
+is the number of triplets of the tangent, i.e. if it is larger than the given length,
+the tangent is incomplete (see numOfMissingTriplets of ContactStats).
+*/
+void assembleContactResidualAndStiffness(double* Gc_loc, double* Gc, double* Kc, double* vals, double* rows, double* cols, int* len, double* GPs, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg)
+{
+  CONTACT_PROFILE_FUNCTION();
+  const ContactAssemblyData data = getContactAssemblyData(ISN, IEN, X, U, H, dH, gw, neq, nsd, npd, ngp, nes, nsn, nen, GPs_len, epsN, epsT, mu, keyContactDetection, keyAssembleKc, isAxisymmetric, nsg);
+  const GaussPointTable gps(GPs, GPs_len, nsd, npd, activeGPsOld);
+
+  int len_guess = *len;
+  *len = 0;
+
+  // Fill Gc_s array by zeros:
+  for (int i = 0; i < neq; ++i) {
+    Gc[i] = 0.0;
+  }
+
+  if (numberOfThreads == 1) {
+    DirectAssemblyOutput output;
+    output.Gc_loc = Gc_loc;
+    output.Kc = Kc;
+    output.vals = vals;
+    output.rows = rows;
+    output.cols = cols;
+    output.len = len;
+    output.len_guess = len_guess;
+
+    assembleContactRowsSpecialized(data, gps, 0, nsg, Gc, output);
+    if (*len > len_guess) {
+      ContactStats stats = ContactStats();
+      stats.numOfMissingTriplets = *len - len_guess; // len is too small
+      addContactStats(data.stats, stats);
+    }
+    CONTACT_PROFILE_COUNT(bytesWritten, (long long)(neq + 3*std::min(*len, len_guess))*sizeof(double));
+    return;
+  }
+
+  // Multithreaded run - the triplets of each chunk are written from the upper bound of the
+  // triplets of the previous chunks and moved together afterwards, so they are in the same
+  // order as in the serial run:
+  const int numOfChunks = getNumberOfChunks(nsg, ngp);
+  const int numOfTripletsPerGP = keyAssembleKc ? getNumberOfTripletsPerGaussPoint(data) : 0;
+  std::vector<int> numOfAssembled(numOfChunks);
+  std::vector<long long> bound(numOfChunks + 1, 0);
+  for (int c = 0; c < numOfChunks; ++c) {
+    int iBegin;
+    int iEnd;
+    getChunkRows(&iBegin, &iEnd, c, numOfChunks, nsg, ngp);
+    const int rowsEnd = iBegin + (iEnd - iBegin + ngp - 1) / ngp * ngp; // the kernel processes whole segments
+    numOfAssembled[c] = countAssembledGaussPoints(gps, epsN, iBegin, rowsEnd);
+    bound[c + 1] = bound[c] + (long long)numOfAssembled[c]*numOfTripletsPerGP;
+  }
+
+  // The triplets are written into rows, cols and vals if they are not shorter than the upper
+  // bound (see countContactTriplets), otherwise into temporary arrays:
+  double* valsOut = vals;
+  double* rowsOut = rows;
+  double* colsOut = cols;
+  std::vector<double> tripletBuffer;
+  if (bound[numOfChunks] > len_guess) {
+    tripletBuffer.resize(3*bound[numOfChunks]);
+    valsOut = &tripletBuffer[0];
+    rowsOut = valsOut + bound[numOfChunks];
+    colsOut = rowsOut + bound[numOfChunks];
+  }
+
+  const int numOfSlices = numberOfThreads;
+  long long sizeGc_loc;
+  long long sizeKc;
+  getLocalArraySizes(&sizeGc_loc, &sizeKc, nsg, ngp, nsn, nsd);
+  std::vector<ChunkAssemblyOutput> outputs(numOfChunks);
+  for (int c = 0; c < numOfChunks; ++c) {
+    ChunkAssemblyOutput& output = outputs[c];
+    output.vals = valsOut + bound[c];
+    output.rows = rowsOut + bound[c];
+    output.cols = colsOut + bound[c];
+    output.residualSliceSize = (sizeGc_loc + numOfSlices - 1) / numOfSlices;
+    output.stiffnessSliceSize = (sizeKc + numOfSlices - 1) / numOfSlices;
+    output.localResidual.resize(Gc_loc ? numOfSlices : 0);
+    output.localStiffness.resize(Kc ? numOfSlices : 0);
+    for (int k = 0; k < numOfSlices; ++k) {
+      if (Gc_loc) {
+        output.localResidual[k].reserve(2*nsn*nsd*numOfAssembled[c] / numOfSlices + 1);
+      }
+      if (Kc && keyAssembleKc) {
+        output.localStiffness[k].reserve(2*nsn*nsd*nsn*nsd*numOfAssembled[c] / numOfSlices + 1);
+      }
+    }
+  }
+  assembleContactRowsInParallel(data, gps, Gc, outputs);
+
+  // Move the triplets of the chunks together (the offsets do not exceed the upper bounds):
+  CONTACT_PROFILE_START(mergeTime);
+  *len = 0;
+  for (int c = 0; c < numOfChunks; ++c) {
+    const ChunkAssemblyOutput& output = outputs[c];
+    if (*len != bound[c]) {
+      std::copy(output.vals, output.vals + output.len, valsOut + *len);
+      std::copy(output.rows, output.rows + output.len, rowsOut + *len);
+      std::copy(output.cols, output.cols + output.len, colsOut + *len);
+    }
+    *len += output.len;
+  }
+  if (!tripletBuffer.empty()) {
+    const int numOfCopied = std::min(*len, len_guess);
+    std::copy(valsOut, valsOut + numOfCopied, vals);
+    std::copy(rowsOut, rowsOut + numOfCopied, rows);
+    std::copy(colsOut, colsOut + numOfCopied, cols);
+  }
+  if (*len > len_guess) {
+    ContactStats stats = ContactStats();
+    stats.numOfMissingTriplets = *len - len_guess; // len is too small
+    addContactStats(data.stats, stats);
+  }
+
+  // The slices of Gc_loc and Kc do not overlap, each one is merged in the order of chunks:
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(numberOfThreads) schedule(static, 1)
+#endif
+  for (int k = 0; k < numOfSlices; ++k) {
+    for (int c = 0; c < numOfChunks; ++c) {
+      const ChunkAssemblyOutput& output = outputs[c];
+      if (Gc_loc) {
+        const std::vector<std::pair<int, double> >& localResidual = output.localResidual[k];
+        for (size_t p = 0; p < localResidual.size(); ++p) {
+          Gc_loc[localResidual[p].first] -= localResidual[p].second;
+        }
+      }
+      if (Kc) {
+        const std::vector<std::pair<int, double> >& localStiffness = output.localStiffness[k];
+        for (size_t p = 0; p < localStiffness.size(); ++p) {
+          Kc[localStiffness[p].first] = localStiffness[p].second;
+        }
+      }
+    }
+  }
+  CONTACT_PROFILE_LAP(mergeTime, CONTACT_PHASE_MERGE);
+  CONTACT_PROFILE_COUNT(bytesWritten, (long long)(neq + 3*std::min(*len, len_guess))*sizeof(double));
+}
+
+/*! Upper bound of the number of triplets assembleContactResidualAndStiffness generates for the current state
+
+Only the active rows of the GPs table are walked: each Gauss point in contact (active with
+the compressive normal traction t_N0 - epsN*gap, the kernel releases the others) generates at
+most nsn*nsd x 2*nsn*nsd triplets of the slave rows and, in the master-slave algorithm, as
+many triplets of the master rows. Neither the geometry nor the tangential tractions are
+evaluated and GPs is not changed. The arrays rows, cols and vals allocated to len are
+therefore never too short; the assembly returns the actual number of triplets in len, which
+is smaller only by the vanishing entries of the tangent.
+
+\param GPs, activeGPsOld, nsd, npd, ngp, nsn, GPs_len, epsN, keyAssembleKc, nsg - see assembleContactResidualAndStiffness
+
+\return len - upper bound of the number of triplets
+*/
+void countContactTriplets(int* len, double* GPs, double* activeGPsOld, int nsd, int npd, int ngp, int nsn, int GPs_len, double epsN, bool keyAssembleKc, int nsg)
+{
+  CONTACT_PROFILE_FUNCTION();
+  *len = 0;
+  if (!keyAssembleKc) {
+    return;
+  }
+
+  const GaussPointTable gps(GPs, GPs_len, nsd, npd, activeGPsOld);
+  const int nsdof = nsn*nsd;
+  const int isMasterSlave = GPs_len != nsg; // This inequality indicates master-slave algorithm
+  const int numOfTripletsPerGP = (1 + isMasterSlave)*nsdof*2*nsdof;
+
+  // The kernel processes whole segments, i.e. the GPs rows up to the multiple of ngp:
+  const int numOfRows = (nsg + ngp - 1) / ngp * ngp;
+  *len = countAssembledGaussPoints(gps, epsN, 0, numOfRows)*numOfTripletsPerGP;
+}
+
+/*! Position of the entry (row, col) in a CSR matrix (-1 if it is not in the pattern) */
+static inline int findCSREntry(const int* rowPtr, const int* colInd, int row, int col) {
+  const int* first = colInd + rowPtr[row];
+  const int* last = colInd + rowPtr[row + 1];
+  const int* p = std::lower_bound(first, last, col);
+  return (p != last && *p == col) ? (int)(p - colInd) : -1;
+}
+
+/*! Assembly output added directly to the values of a CSR matrix (serial run) */
+struct CSRAssemblyOutput {
+  const int* rowPtr;
+  const int* colInd;
+  double* vals;
+  int numOfMissing;
+
+  void subtractLocalResidual(int, double) {}
+
+  void setLocalStiffness(int, double) {}
+
+  void add(int row, int col, double value) {
+    const int p = findCSREntry(rowPtr, colInd, row, col);
+    if (p < 0) {
+      numOfMissing++;
+      return;
+    }
+    vals[p] += value;
+  }
+};
+
+/*! Assembly output buffered by a thread as positions in a CSR matrix (parallel run) */
+struct BufferedCSRAssemblyOutput {
+  const int* rowPtr;
+  const int* colInd;
+  std::vector<int> positions;
+  std::vector<double> vals;
+  int numOfMissing;
+
+  BufferedCSRAssemblyOutput() : rowPtr(NULL), colInd(NULL), numOfMissing(0) {}
+
+  void subtractLocalResidual(int, double) {}
+
+  void setLocalStiffness(int, double) {}
+
+  void add(int row, int col, double value) {
+    const int p = findCSREntry(rowPtr, colInd, row, col);
+    if (p < 0) {
+      numOfMissing++;
+      return;
+    }
+    positions.push_back(p);
+    vals.push_back(value);
+  }
+};
+
+/*! Assembly output added directly to the nsd x nsd blocks of a BSR matrix (serial run) */
+struct BSRAssemblyOutput {
+  const int* blockRowPtr;
+  const int* blockColInd;
+  double* blockVals;
+  int nsd;
+  int numOfMissing;
+
+  void subtractLocalResidual(int, double) {}
+
+  void setLocalStiffness(int, double) {}
+
+  void add(int row, int col, double value) {
+    const int p = findCSREntry(blockRowPtr, blockColInd, row / nsd, col / nsd);
+    if (p < 0) {
+      numOfMissing++;
+      return;
+    }
+    blockVals[(p*nsd + row % nsd)*nsd + col % nsd] += value;
+  }
+};
+
+/*! Assembly output buffered by a thread as positions in the blocks of a BSR matrix (parallel run) */
+struct BufferedBSRAssemblyOutput {
+  const int* blockRowPtr;
+  const int* blockColInd;
+  int nsd;
+  std::vector<int> positions;
+  std::vector<double> vals;
+  int numOfMissing;
+
+  BufferedBSRAssemblyOutput() : blockRowPtr(NULL), blockColInd(NULL), nsd(1), numOfMissing(0) {}
+
+  void subtractLocalResidual(int, double) {}
+
+  void setLocalStiffness(int, double) {}
+
+  void add(int row, int col, double value) {
+    const int p = findCSREntry(blockRowPtr, blockColInd, row / nsd, col / nsd);
+    if (p < 0) {
+      numOfMissing++;
+      return;
+    }
+    positions.push_back((p*nsd + row % nsd)*nsd + col % nsd);
+    vals.push_back(value);
+  }
+};
+
+/*! Sparsity pattern of the contact tangent (see buildContactSparsityPattern), of nsd x nsd node blocks if isBlock */
+template <class GaussPoints>
+static void buildContactPattern(int* rowPtr, int* colInd, const GaussPoints& gps, const int* ISN, const int* IEN, int neq, int nsd, int ngp, int nes, int nsn, int nen, int GPs_len, int nsg, bool isBlock)
+{
+  CONTACT_PROFILE_PHASE(CONTACT_PHASE_PATTERN);
+  const int nnod = neq / nsd;
+  // Master segment nodes add rows to the tangent only in the master-slave algorithm:
+  const int numOfRowNodes = (GPs_len != nsg) ? 2*nsn : nsn;
+
+  // Groups of coupled nodes - slave segment nodes followed by master segment nodes,
+  // one group for each distinct master segment of the slave segment:
+  std::vector<int> groupNodes;
+  std::vector<int> masters;
+  for (int i = 0; i < nsg; i += ngp) {
+    const int els = gps.slaveElement(i);
+    const int sgs = gps.slaveSegment(i);
+
+    masters.clear();
+    for (int g = 0; g < ngp && i + g < nsg; ++g) {
+      if (!gps.wasActive(i + g)) {
+        continue;
+      }
+      const int elm = gps.masterElement(i + g);
+      const int sgm = gps.masterSegment(i + g);
+      const int key = elm*nes + sgm;
+      if (std::find(masters.begin(), masters.end(), key) != masters.end()) {
+        continue;
+      }
+      masters.push_back(key);
+
+      for (int j = 0; j < nsn; ++j) {
+        groupNodes.push_back(IEN[nen*els + ISN[nes*j + sgs] - 1] - 1); // Matlab numbering starts with 1
+      }
+      for (int j = 0; j < nsn; ++j) {
+        groupNodes.push_back(IEN[nen*elm + ISN[nes*j + sgm] - 1] - 1); // Matlab numbering starts with 1
+      }
+    }
+  }
+  const int numOfGroups = (int)groupNodes.size() / (2*nsn);
+
+  // Groups of each row node:
+  std::vector<int> nodeStart(nnod + 1, 0);
+  for (int e = 0; e < numOfGroups; ++e) {
+    for (int j = 0; j < numOfRowNodes; ++j) {
+      nodeStart[groupNodes[2*nsn*e + j] + 1]++;
+    }
+  }
+  for (int a = 0; a < nnod; ++a) {
+    nodeStart[a + 1] += nodeStart[a];
+  }
+  std::vector<int> nodeGroups(nodeStart[nnod]);
+  std::vector<int> pos(nodeStart.begin(), nodeStart.end() - 1);
+  for (int e = 0; e < numOfGroups; ++e) {
+    for (int j = 0; j < numOfRowNodes; ++j) {
+      nodeGroups[pos[groupNodes[2*nsn*e + j]]++] = e;
+    }
+  }
+
+  // Rows of the a-th node couple all DOFs of the nodes of its groups:
+  std::vector<int> marker(nnod, -1);
+  std::vector<int> colNodes;
+  rowPtr[0] = 0;
+  for (int a = 0; a < nnod; ++a) {
+    colNodes.clear();
+    for (int p = nodeStart[a]; p < nodeStart[a + 1]; ++p) {
+      const int* nodes = &groupNodes[2*nsn*nodeGroups[p]];
+      for (int j = 0; j < 2*nsn; ++j) {
+        if (marker[nodes[j]] != a) {
+          marker[nodes[j]] = a;
+          colNodes.push_back(nodes[j]);
+        }
+      }
+    }
+    std::sort(colNodes.begin(), colNodes.end());
+
+    if (isBlock) {
+      rowPtr[a + 1] = rowPtr[a] + (int)colNodes.size();
+      if (colInd != NULL) {
+        std::copy(colNodes.begin(), colNodes.end(), colInd + rowPtr[a]);
+      }
+      continue;
+    }
+
+    const int rowLength = nsd*(int)colNodes.size();
+    for (int kdof = 0; kdof < nsd; ++kdof) {
+      const int row = a*nsd + kdof;
+      rowPtr[row + 1] = rowPtr[row] + rowLength;
+      if (colInd != NULL) {
+        for (size_t c = 0; c < colNodes.size(); ++c) {
+          for (int jdof = 0; jdof < nsd; ++jdof) {
+            colInd[rowPtr[row] + nsd*c + jdof] = colNodes[c]*nsd + jdof;
+          }
+        }
+      }
+    }
+  }
+  if (isBlock) {
+    CONTACT_PROFILE_COUNT(bytesWritten, (long long)(nnod + 1 + (colInd != NULL ? rowPtr[nnod] : 0))*sizeof(int));
+    return;
+  }
+  for (int row = nnod*nsd; row < neq; ++row) {
+    rowPtr[row + 1] = rowPtr[row];
+  }
+  CONTACT_PROFILE_COUNT(bytesWritten, (long long)(neq + 1 + (colInd != NULL ? rowPtr[neq] : 0))*sizeof(int));
+}
+
+/*! Sparsity pattern (CSR) of the contact tangent for the current active set
+
+Each active Gauss point (activeGPsOld) couples the DOFs of its slave segment with the
+DOFs of its master segment (elm, sgm columns of the GPs table). The pattern contains
+all entries assembleContactResidualAndStiffnessCSR can add for this active set and
+master assignment, so it has to be rebuilt only when one of them changes. Indices are
+0-based and the columns of each row are sorted in ascending order. If colInd is NULL,
+only rowPtr is evaluated, so that the caller can allocate colInd (of length rowPtr[neq])
+and call the function again.
+
+\param GPs, ISN, IEN, activeGPsOld, neq, nsd, npd, ngp, nes, nsn, nen, GPs_len, nsg - see assembleContactResidualAndStiffness
+
+\return rowPtr - 1d array (neq+1) of row offsets
+\return colInd - 1d array (rowPtr[neq]) of column indices
+*/
+void buildContactSparsityPattern(int* rowPtr, int* colInd, double* GPs, int* ISN, int* IEN, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, int nsg)
+{
+  CONTACT_PROFILE_FUNCTION();
+  buildContactPattern(rowPtr, colInd, GaussPointTable(GPs, GPs_len, nsd, npd, activeGPsOld), ISN, IEN, neq, nsd, ngp, nes, nsn, nen, GPs_len, nsg, false);
+}
+
+/*! The same as buildContactSparsityPattern with the typed Gauss point state (C++ API), npd is not needed */
+void buildContactSparsityPattern(int* rowPtr, int* colInd, GaussPointState& state, int* ISN, int* IEN, const uint8_t* activeGPsOld, int neq, int nsd, int ngp, int nes, int nsn, int nen, int GPs_len, int nsg)
+{
+  CONTACT_PROFILE_FUNCTION();
+  buildContactPattern(rowPtr, colInd, GaussPointArrays(state, activeGPsOld), ISN, IEN, neq, nsd, ngp, nes, nsn, nen, GPs_len, nsg, false);
+}
+
+/*! Assemble contact residual and tangent into the values of a sparse matrix with a fixed pattern
+
+\param numOfVals - length of vals
+\param output - output of the serial run, adds into vals
+\param prototype - output of a thread of the parallel run, buffers the positions in vals
+*/
+template <class GaussPoints, class Output, class BufferedOutput>
+static void assembleContactIntoPattern(const ContactAssemblyData& data, const GaussPoints& gps, double* Gc, double* vals, int numOfVals, Output& output, const BufferedOutput& prototype)
+{
+  const int neq = data.neq;
+  const int nsg = data.nsg;
+
+  for (int i = 0; i < neq; ++i) {
+    Gc[i] = 0.0;
+  }
+  for (int p = 0; p < numOfVals; ++p) {
+    vals[p] = 0.0;
+  }
+
+  int numOfMissing = 0;
+  if (numberOfThreads == 1) {
+    assembleContactRowsSpecialized(data, gps, 0, nsg, Gc, output);
+    numOfMissing = output.numOfMissing;
+  }
+  else {
+    std::vector<BufferedOutput> outputs(getNumberOfChunks(nsg, data.ngp), prototype);
+    assembleContactRowsInParallel(data, gps, Gc, outputs);
+
+    // The values are summed in the order of GPs rows as in the serial run:
+    CONTACT_PROFILE_START(mergeTime);
+    for (size_t c = 0; c < outputs.size(); ++c) {
+      const BufferedOutput& output = outputs[c];
+      for (size_t p = 0; p < output.vals.size(); ++p) {
+        vals[output.positions[p]] += output.vals[p];
+      }
+      numOfMissing += output.numOfMissing;
+    }
+    CONTACT_PROFILE_LAP(mergeTime, CONTACT_PHASE_MERGE);
+  }
+  CONTACT_PROFILE_COUNT(bytesWritten, (long long)(neq + numOfVals)*sizeof(double));
+
+  if (numOfMissing > 0) {
+    ContactStats stats = ContactStats();
+    stats.numOfMissingEntries = numOfMissing; // entries of the contact tangent which are not in the sparsity pattern
+    addContactStats(data.stats, stats);
+  }
+}
+
+/*! Assemble contact residual and tangent into a CSR matrix (see assembleContactResidualAndStiffnessCSR) */
+template <class GaussPoints>
+static void assembleContactCSR(const ContactAssemblyData& data, const GaussPoints& gps, double* Gc, double* vals, const int* rowPtr, const int* colInd)
+{
+  CSRAssemblyOutput output;
+  output.rowPtr = rowPtr;
+  output.colInd = colInd;
+  output.vals = vals;
+  output.numOfMissing = 0;
+
+  BufferedCSRAssemblyOutput prototype;
+  prototype.rowPtr = rowPtr;
+  prototype.colInd = colInd;
+
+  assembleContactIntoPattern(data, gps, Gc, vals, rowPtr[data.neq], output, prototype);
+}
+
+/*! Assemble contact residual and tangent into a BSR matrix (see assembleContactResidualAndStiffnessBSR) */
+template <class GaussPoints>
+static void assembleContactBSR(const ContactAssemblyData& data, const GaussPoints& gps, double* Gc, double* blockVals, const int* blockRowPtr, const int* blockColInd)
+{
+  const int nsd = data.nsd;
+
+  BSRAssemblyOutput output;
+  output.blockRowPtr = blockRowPtr;
+  output.blockColInd = blockColInd;
+  output.blockVals = blockVals;
+  output.nsd = nsd;
+  output.numOfMissing = 0;
+
+  BufferedBSRAssemblyOutput prototype;
+  prototype.blockRowPtr = blockRowPtr;
+  prototype.blockColInd = blockColInd;
+  prototype.nsd = nsd;
+
+  assembleContactIntoPattern(data, gps, Gc, blockVals, blockRowPtr[data.neq / nsd]*nsd*nsd, output, prototype);
+}
+
+/*! Calculate contact residual and contact tangent, the tangent is added into a CSR matrix
+
+This is the numeric counterpart of buildContactSparsityPattern. Contributions with equal
+indices are summed directly into vals, so no triplets are generated. Arrays Gc_loc and Kc
+of assembleContactResidualAndStiffness are not evaluated.
+
+\param rowPtr, colInd - sparsity pattern from buildContactSparsityPattern
+\param GPs, ISN, IEN, X, U, H, dH, gw, activeGPsOld, neq, nsd, npd, ngp, nes, nsn, nen,
+       GPs_len, epsN, epsT, mu, keyContactDetection, keyAssembleKc, isAxisymmetric, nsg - see assembleContactResidualAndStiffness
+
+\return Gc - 1d array (neq)
+\return vals - 1d array (rowPtr[neq]) of values of the contact tangent
+*/
+void assembleContactResidualAndStiffnessCSR(double* Gc, double* vals, int* rowPtr, int* colInd, double* GPs, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg)
+{
+  CONTACT_PROFILE_FUNCTION();
+  const ContactAssemblyData data = getContactAssemblyData(ISN, IEN, X, U, H, dH, gw, neq, nsd, npd, ngp, nes, nsn, nen, GPs_len, epsN, epsT, mu, keyContactDetection, keyAssembleKc, isAxisymmetric, nsg);
+  assembleContactCSR(data, GaussPointTable(GPs, GPs_len, nsd, npd, activeGPsOld), Gc, vals, rowPtr, colInd);
+}
+
+/*! The same as assembleContactResidualAndStiffnessCSR with the typed Gauss point state (C++ API) */
+void assembleContactResidualAndStiffnessCSR(double* Gc, double* vals, int* rowPtr, int* colInd, GaussPointState& state, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, const uint8_t* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg)
+{
+  CONTACT_PROFILE_FUNCTION();
+  const ContactAssemblyData data = getContactAssemblyData(ISN, IEN, X, U, H, dH, gw, neq, nsd, npd, ngp, nes, nsn, nen, GPs_len, epsN, epsT, mu, keyContactDetection, keyAssembleKc, isAxisymmetric, nsg);
+  assembleContactCSR(data, GaussPointArrays(state, activeGPsOld), Gc, vals, rowPtr, colInd);
+}
+
+/*! Sparsity pattern (BSR) of the contact tangent of nsd x nsd node blocks for the current active set
+
+The block counterpart of buildContactSparsityPattern: rows and columns are nodes, each entry
+is the nsd x nsd block coupling the DOFs of two nodes. Indices are 0-based and the columns of
+each block row are sorted in ascending order. If blockColInd is NULL, only blockRowPtr is
+evaluated, so that the caller can allocate blockColInd (of length blockRowPtr[neq/nsd]) and
+call the function again.
+
+\param GPs, ISN, IEN, activeGPsOld, neq, nsd, npd, ngp, nes, nsn, nen, GPs_len, nsg - see assembleContactResidualAndStiffness
+
+\return blockRowPtr - 1d array (neq/nsd + 1) of block row offsets
+\return blockColInd - 1d array (blockRowPtr[neq/nsd]) of block column (node) indices
+*/
+void buildContactBlockSparsityPattern(int* blockRowPtr, int* blockColInd, double* GPs, int* ISN, int* IEN, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, int nsg)
+{
+  CONTACT_PROFILE_FUNCTION();
+  buildContactPattern(blockRowPtr, blockColInd, GaussPointTable(GPs, GPs_len, nsd, npd, activeGPsOld), ISN, IEN, neq, nsd, ngp, nes, nsn, nen, GPs_len, nsg, true);
+}
+
+/*! Calculate contact residual and contact tangent, the tangent is added into a BSR matrix
+
+The same as assembleContactResidualAndStiffnessCSR with the pattern of nsd x nsd node blocks
+from buildContactBlockSparsityPattern, so that the indices take nsd^2 times less memory and
+block-aware solvers can use the tangent directly.
+
+\param blockRowPtr, blockColInd - sparsity pattern from buildContactBlockSparsityPattern
+\param GPs, ISN, IEN, X, U, H, dH, gw, activeGPsOld, neq, nsd, npd, ngp, nes, nsn, nen,
+       GPs_len, epsN, epsT, mu, keyContactDetection, keyAssembleKc, isAxisymmetric, nsg - see assembleContactResidualAndStiffness
+
+\return Gc - 1d array (neq)
+\return blockVals - 1d array (blockRowPtr[neq/nsd]*nsd*nsd) of blocks of the contact tangent, each block
+         is stored row-major, i.e. blockVals[(p*nsd + kdof)*nsd + jdof] is the entry of the kdof-th DOF
+         of the block row node and the jdof-th DOF of the node blockColInd[p]
+*/
+void assembleContactResidualAndStiffnessBSR(double* Gc, double* blockVals, int* blockRowPtr, int* blockColInd, double* GPs, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg)
+{
+  CONTACT_PROFILE_FUNCTION();
+  const ContactAssemblyData data = getContactAssemblyData(ISN, IEN, X, U, H, dH, gw, neq, nsd, npd, ngp, nes, nsn, nen, GPs_len, epsN, epsT, mu, keyContactDetection, keyAssembleKc, isAxisymmetric, nsg);
+  assembleContactBSR(data, GaussPointTable(GPs, GPs_len, nsd, npd, activeGPsOld), Gc, blockVals, blockRowPtr, blockColInd);
+}
+
+/*! Contact tangent as a linear operator (see assembleContactResidualAndOperator) */
+struct ContactOperator {
+  int neq;                              // Number of Equations
+  int nsd;                              // Number of Space Dimensions
+  int npd;                              // Number of Parametric Dimensions
+  int nsn;                              // Number of Segment Nodes
+  double epsN;
+  double epsT;
+  double mu;
+  bool isMasterSlave;                   // master rows are assembled (GPs_len != nsg)
+  std::vector<ContactOperatorGP> gps;   // active Gauss points in the order of GPs rows
+};
+
+/*! Create an empty contact operator
+
+\return handle to the operator, which has to be released by destroyContactOperator
+*/
+ContactOperator* createContactOperator(void) {
+  CONTACT_PROFILE_FUNCTION();
+  ContactOperator* op = new ContactOperator();
+  op->neq = 0;
+  op->nsd = 0;
+  op->npd = 0;
+  op->nsn = 0;
+  op->epsN = 0.0;
+  op->epsT = 0.0;
+  op->mu = 0.0;
+  op->isMasterSlave = false;
+  return op;
+}
+
+/*! Release the contact operator created by createContactOperator */
+void destroyContactOperator(ContactOperator* op) {
+  CONTACT_PROFILE_FUNCTION();
+  delete op;
+}
+
+/*! Calculate contact residual and store the contact tangent as a linear operator
+
+The same as assembleContactResidualAndStiffness, but instead of the triplets of the tangent
+the quantities of the active Gauss points evaluated for the residual (normal and tangent
+vectors, shape functions, tractions, gw*jacobian_s) are stored in op, so that the tangent
+can be applied to vectors by applyContactStiffness without assembling it. Arrays Gc_loc
+and Kc of assembleContactResidualAndStiffness are not evaluated.
+
+\param op - operator from createContactOperator, its previous state is replaced
+\param GPs, ISN, IEN, X, U, H, dH, gw, activeGPsOld, neq, nsd, npd, ngp, nes, nsn, nen,
+       GPs_len, epsN, epsT, mu, keyContactDetection, isAxisymmetric, nsg - see assembleContactResidualAndStiffness
+
+\return Gc - 1d array (neq)
+*/
+void assembleContactResidualAndOperator(double* Gc, ContactOperator* op, double* GPs, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool isAxisymmetric, int nsg)
+{
+  CONTACT_PROFILE_FUNCTION();
+  const ContactAssemblyData data = getContactAssemblyData(ISN, IEN, X, U, H, dH, gw, neq, nsd, npd, ngp, nes, nsn, nen, GPs_len, epsN, epsT, mu, keyContactDetection, false, isAxisymmetric, nsg);
+  const GaussPointTable gps(GPs, GPs_len, nsd, npd, activeGPsOld);
+
+  op->neq = neq;
+  op->nsd = nsd;
+  op->npd = npd;
+  op->nsn = nsn;
+  op->epsN = epsN;
+  op->epsT = epsT;
+  op->mu = mu;
+  op->isMasterSlave = GPs_len != nsg; // This inequality indicates master-slave algorithm
+  op->gps.clear();
+
+  if (numberOfThreads == 1) {
+    for (int i = 0; i < neq; ++i) {
+      Gc[i] = 0.0;
+    }
+    OperatorAssemblyOutput output;
+    output.gps.swap(op->gps); // reuses the memory of the previous state
+    assembleContactRowsSpecialized(data, gps, 0, nsg, Gc, output);
+    op->gps.swap(output.gps);
+    return;
+  }
+
+  // Multithreaded run - the chunks are merged in the order of GPs rows:
+  std::vector<OperatorAssemblyOutput> outputs(getNumberOfChunks(nsg, ngp));
+  assembleContactRowsInParallel(data, gps, Gc, outputs);
+  for (size_t c = 0; c < outputs.size(); ++c) {
+    op->gps.insert(op->gps.end(), outputs[c].gps.begin(), outputs[c].gps.end());
+  }
+}
+
+/*! Add the product of the contact tangent and a vector, y += Kc*v
+
+Kc is the tangent assembleContactResidualAndStiffness would assemble for the state stored
+by assembleContactResidualAndOperator. Each Gauss point contributes its rank-limited block
+(normal, tangential and rotation terms) evaluated from the node values of v, so the cost is
+linear in the number of active Gauss points and no matrix is stored.
+
+\param v - 1d array (neq)
+\param op - operator from assembleContactResidualAndOperator
+
+\return y - 1d array (neq), the product is added
+*/
+void applyContactStiffness(double* y, double* v, ContactOperator* op) {
+  CONTACT_PROFILE_FUNCTION();
+  const int nsd = op->nsd;
+  const int npd = op->npd;
+  const int nsn = op->nsn;
+  const double epsN = op->epsN;
+  const double epsT = op->epsT;
+  const double mu = op->mu;
+
+  for (size_t q = 0; q < op->gps.size(); ++q) {
+    const ContactOperatorGP& gp = op->gps[q];
+    const int* nodes_s = gp.nodes;
+    const int* nodes_m = gp.nodes + nsn;
+    const double* n = gp.normal;
+
+    // Interpolation of v on the slave (a_s) and on the master (a_m) segment
+    // and its derivatives along the master segment (b_a):
+    double a_s[3] = {0.0, 0.0, 0.0};
+    double a_m[3] = {0.0, 0.0, 0.0};
+    double b[2][3] = {{0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}};
+    for (int j = 0; j < nsn; ++j) {
+      for (int sdf = 0; sdf < nsd; ++sdf) {
+        const double vs = v[nodes_s[j]*nsd + sdf];
+        const double vm = v[nodes_m[j]*nsd + sdf];
+        a_s[sdf] += gp.hs[j]*vs;
+        a_m[sdf] += gp.hm[j]*vm;
+        for (int pdf = 0; pdf < npd; ++pdf) {
+          b[pdf][sdf] += gp.dHm[pdf*nsn + j]*vm;
+        }
+      }
+    }
+
+    // Linearised gap dg.v and convective coords dXi^a.v (see assembleContactRows):
+    double dg = 0.0;
+    double nb[2] = {0.0, 0.0};    // C_Nma.v
+    double tb[2] = {0.0, 0.0};    // C_Tsa.v_s - C_Tma.v_m - g*C_Nma.v_m
+    for (int sdf = 0; sdf < nsd; ++sdf) {
+      dg += n[sdf]*(a_m[sdf] - a_s[sdf]);
+      for (int pdf = 0; pdf < npd; ++pdf) {
+        nb[pdf] += n[sdf]*b[pdf][sdf];
+        tb[pdf] += gp.tau[pdf*3 + sdf]*(a_s[sdf] - a_m[sdf]);
+      }
+    }
+    double dXi[2] = {0.0, 0.0};
+    for (int pdf = 0; pdf < npd; ++pdf) {
+      for (int r = 0; r < npd; ++r) {
+        dXi[pdf] += gp.invA[pdf*npd + r]*(tb[r] - gp.gap*nb[r]);
+      }
+    }
+
+    // Linearised tangential traction dt_T^a.v:
+    double dt[2] = {0.0, 0.0};
+    if (gp.isStick) {
+      for (int pdf = 0; pdf < npd; ++pdf) {
+        dt[pdf] = -epsT*dXi[pdf];
+      }
+    }
+    else if (gp.norm_t_T > 1e-10) {
+      double p_dXi = 0.0;
+      double C_Pm = 0.0;
+      for (int r = 0; r < npd; ++r) {
+        p_dXi += gp.p_Tcov[r]*dXi[r];
+        C_Pm += gp.p_kappa[r]*dXi[r];
+        for (int sdf = 0; sdf < nsd; ++sdf) {
+          double p_Tvec = 0.0;
+          for (int s = 0; s < npd; ++s) {
+            p_Tvec += gp.p_T[s]*gp.tau[s*3 + sdf];
+          }
+          C_Pm += gp.p_T[r]*p_Tvec*b[r][sdf];
+        }
+      }
+      for (int pdf = 0; pdf < npd; ++pdf) {
+        dt[pdf] = mu*epsN*gp.p_T[pdf]*dg + mu*gp.t_N*epsT/gp.norm_t_T*(dXi[pdf] - gp.p_T[pdf]*p_dXi)
+                + mu*gp.t_N*gp.p_T[pdf]*C_Pm;
+      }
+    }
+
+    // Slave rows per unit slave shape function:
+    //   r_s = -epsN*n*dg - tau_a*dt_T^a - t_N*tau^a*(C_Nma.v) - t_T^a*b_a + kappa_a*dXi^a
+    double r_s[3];
+    double T[3]; // tangential traction minus the normal traction, t_T^a*tau_a - t_N*n
+    for (int sdf = 0; sdf < nsd; ++sdf) {
+      r_s[sdf] = -epsN*n[sdf]*dg;
+      T[sdf] = -gp.t_N*n[sdf];
+      for (int pdf = 0; pdf < npd; ++pdf) {
+        double tauContra = 0.0; // contravariant tangent vector m^ab*tau_b
+        for (int r = 0; r < npd; ++r) {
+          tauContra += gp.invmm[pdf*npd + r]*gp.tau[r*3 + sdf];
+        }
+        r_s[sdf] -= gp.tau[pdf*3 + sdf]*dt[pdf] + gp.t_N*tauContra*nb[pdf] + gp.t_T[pdf]*b[pdf][sdf];
+        r_s[sdf] += gp.kappa[pdf*3 + sdf]*dXi[pdf];
+        T[sdf] += gp.t_T[pdf]*gp.tau[pdf*3 + sdf];
+      }
+    }
+
+    for (int j = 0; j < nsn; ++j) {
+      for (int sdf = 0; sdf < nsd; ++sdf) {
+        y[nodes_s[j]*nsd + sdf] += gp.w*gp.hs[j]*r_s[sdf];
+      }
+    }
+
+    //////////// For MASTER-SLAVE the master rows are needed (loop over GPs tabel goes only over SLAVE GPs)
+    //   r_m = -hm*r_s + dHm_a*(t_T^a*tau_a - t_N*n)*dXi^a
+    if (op->isMasterSlave) {
+      for (int j = 0; j < nsn; ++j) {
+        double dHm_dXi = 0.0;
+        for (int pdf = 0; pdf < npd; ++pdf) {
+          dHm_dXi += gp.dHm[pdf*nsn + j]*dXi[pdf];
+        }
+        for (int sdf = 0; sdf < nsd; ++sdf) {
+          y[nodes_m[j]*nsd + sdf] += gp.w*(-gp.hm[j]*r_s[sdf] + T[sdf]*dHm_dXi);
+        }
+      }
+    }
+  }
+}
+
+void getLongestEdgeAndGPs(double* longestEdge, double* GPs, int n, int nsd, int npd, int ngp, int neq, int nsn, int nes, int nen, int* elementID, int* segmentID, int* ISN, int* IEN, double* H, double* X) {
+  CONTACT_PROFILE_FUNCTION();
+  CONTACT_PROFILE_PHASE(CONTACT_PHASE_SURFACE);
+  // GPs legend:              Xg     els  sgs   gap    Xi_m  isActive      elm      sgm      isStick      t_T       Xi0_m     t_N0
+  //double* GPs = new double[n*(nsd + 1 +  1  +  1  +  npd  +   1     +     1    +   1     +    1    +    npd   +    npd    +  1];
+  //index of begining           0    nsd nsd+1 nsd+2  nsd+3  nsd+npd+3  nsd+npd+4 nsd+npd+5 nsd+npd+6  nsd+npd+7 nsd+2*npd+7   (size = nsd+3*npd+8)
+
+  int* segmentNodesID = new int[nsn];
+  double* Xs = new double[nsn*nsd];
+  double* Xg = new double[ngp*nsd];
+  int g = 0;
+  *longestEdge = 0.0;
+
+  for (int e = 0; e < n; ++e) {
+    int el = elementID[e] - 1;
+    int sg = segmentID[e] - 1;
+
+    // segment coords Xs:
+    for (int i = 0; i < nsn; ++i) {
+      const int IENrow = ISN[nes*i + sg] - 1; // Matlab numbering starts with 1
+      segmentNodesID[i] = IEN[nen*el + IENrow] - 1; // Matlab numbering starts with 1
+      for (int j = 0; j < nsd; ++j) {
+        Xs[j*nsn + i] = X[j*(int)(neq / nsd) + segmentNodesID[i]];
+      }
+    }
+
+    // evaluate gausspoint coords:
+    for (int i = 0; i < ngp; ++i) {
+      for (int sdf = 0; sdf < nsd; ++sdf) {
+        Xg[i*nsd + sdf] = 0.0;
+        for (int j = 0; j < nsn; ++j) {
+          Xg[i*nsd + sdf] += H[j*ngp + i] * Xs[sdf*nsn + j];
+        }
+
+        GPs[sdf*n*ngp + g] = Xg[i*nsd + sdf]; // slave gausspoint coords
+        //GPs[(nsd + 3 + sdf)*n*ngp + g] = 0.0; // init master parametric coords Xi_m
+      }
+
+      GPs[(nsd + 0)*n*ngp + g] = el + 1;      // slave element
+      GPs[(nsd + 1)*n*ngp + g] = sg + 1;      // slave segment
+      GPs[(nsd + 2)*n*ngp + g] = -FLT_MAX;    // init gap
+
+      for (int pdf = 0; pdf < npd; ++pdf) {
+        GPs[(nsd + 3 + pdf)*n*ngp + g] = 0.0; // Xi_m
+      }
+
+      GPs[(nsd + npd + 3)*n*ngp + g] = 0;       // init is NO active
+      GPs[(nsd + npd + 4)*n*ngp + g] = 0;       // master element
+      GPs[(nsd + npd + 5)*n*ngp + g] = 0;       // master segment
+      GPs[(nsd + npd + 6)*n*ngp + g] = 0;       // is stick
+
+      for (int pdf = 0; pdf < nsd-1; ++pdf) {
+        GPs[(nsd + npd + 7 + pdf)*n*ngp + g] = 0.0; // tangent traction components
+      }
+      for (int pdf = 0; pdf < nsd-1; ++pdf) {
+        GPs[(nsd + 2*npd + 7 + pdf)*n*ngp + g] = 0.0; // Xi0_m
+      }
+      GPs[(nsd + 3*npd + 7)*n*ngp + g] = 0.0; // t_N0
+      g++;
+    }
+
+    for (int i = 0; i < nsn; ++i) {
+      for (int j = i+1; j < nsn; ++j) {
+        double lengthOfEdge = 0.0;
+        for (int sdf = 0; sdf < nsd; ++sdf) {
+          lengthOfEdge += pow(Xs[sdf*nsn + i] - Xs[sdf*nsn + j ], 2);
+        }
+        *longestEdge = std::max(*longestEdge, sqrt(lengthOfEdge) );
+      }
+    }
+
+  } // loop over elements
+
+  delete[] segmentNodesID;
+  delete[] Xs;
+  delete[] Xg;
+
+}
+
+/*! Convert the legacy GPs table to the typed Gauss point state
+
+IDs are converted to 0-based numbering (-1 means no master segment).
+
+\param GPs - 2d array (numOfRows x (nsd + 3*npd + 8)), see getLongestEdgeAndGPs
+\param numOfRows - number of rows of the GPs table
+\param nsd - Number of Space Dimensions
+\param npd - Number of Parametric Dimensions
+
+\return state - Gauss point state
+*/
+void convertGPsToState(GaussPointState& state, const double* GPs, int numOfRows, int nsd, int npd) {
+  CONTACT_PROFILE_FUNCTION();
+  state.numOfRows = numOfRows;
+  state.nsd = nsd;
+  state.npd = npd;
+  state.Xg.assign(GPs, GPs + nsd*numOfRows);
+  state.els.resize(numOfRows);
+  state.sgs.resize(numOfRows);
+  state.gap.assign(GPs + (nsd + 2)*numOfRows, GPs + (nsd + 3)*numOfRows);
+  state.Xi_m.assign(GPs + (nsd + 3)*numOfRows, GPs + (nsd + npd + 3)*numOfRows);
+  state.isActive.resize(numOfRows);
+  state.elm.resize(numOfRows);
+  state.sgm.resize(numOfRows);
+  state.isStick.resize(numOfRows);
+  state.t_T.assign(GPs + (nsd + npd + 7)*numOfRows, GPs + (nsd + 2*npd + 7)*numOfRows);
+  state.Xi0_m.assign(GPs + (nsd + 2*npd + 7)*numOfRows, GPs + (nsd + 3*npd + 7)*numOfRows);
+  state.t_N0.assign(GPs + (nsd + 3*npd + 7)*numOfRows, GPs + (nsd + 3*npd + 8)*numOfRows);
+
+  for (int v = 0; v < numOfRows; ++v) {
+    state.els[v] = (int32_t)GPs[nsd*numOfRows + v] - 1;            // Matlab numbering starts with 1
+    state.sgs[v] = (int32_t)GPs[(nsd + 1)*numOfRows + v] - 1;      // Matlab numbering starts with 1
+    state.isActive[v] = GPs[(nsd + npd + 3)*numOfRows + v] != 0.0;
+    state.elm[v] = (int32_t)GPs[(nsd + npd + 4)*numOfRows + v] - 1; // Matlab numbering starts with 1
+    state.sgm[v] = (int32_t)GPs[(nsd + npd + 5)*numOfRows + v] - 1; // Matlab numbering starts with 1
+    state.isStick[v] = GPs[(nsd + npd + 6)*numOfRows + v] != 0.0;
+  }
+}
+
+/*! Convert the typed Gauss point state back to the legacy GPs table
+
+\param state - Gauss point state
+
+\return GPs - 2d array (state.numOfRows x (nsd + 3*npd + 8))
+*/
+void convertStateToGPs(double* GPs, const GaussPointState& state) {
+  CONTACT_PROFILE_FUNCTION();
+  const int numOfRows = state.numOfRows;
+  const int nsd = state.nsd;
+  const int npd = state.npd;
+
+  std::copy(state.Xg.begin(), state.Xg.end(), GPs);
+  std::copy(state.gap.begin(), state.gap.end(), GPs + (nsd + 2)*numOfRows);
+  std::copy(state.Xi_m.begin(), state.Xi_m.end(), GPs + (nsd + 3)*numOfRows);
+  std::copy(state.t_T.begin(), state.t_T.end(), GPs + (nsd + npd + 7)*numOfRows);
+  std::copy(state.Xi0_m.begin(), state.Xi0_m.end(), GPs + (nsd + 2*npd + 7)*numOfRows);
+  std::copy(state.t_N0.begin(), state.t_N0.end(), GPs + (nsd + 3*npd + 7)*numOfRows);
+
+  for (int v = 0; v < numOfRows; ++v) {
+    GPs[nsd*numOfRows + v] = state.els[v] + 1;            // Matlab numbering starts with 1
+    GPs[(nsd + 1)*numOfRows + v] = state.sgs[v] + 1;      // Matlab numbering starts with 1
+    GPs[(nsd + npd + 3)*numOfRows + v] = state.isActive[v];
+    GPs[(nsd + npd + 4)*numOfRows + v] = state.elm[v] + 1; // Matlab numbering starts with 1
+    GPs[(nsd + npd + 5)*numOfRows + v] = state.sgm[v] + 1; // Matlab numbering starts with 1
+    GPs[(nsd + npd + 6)*numOfRows + v] = state.isStick[v];
+  }
+}
+
+void getAABB(double* AABBmin, double* AABBmax, int nsd, int nnod, double* X, double longestEdge, int* IEN, int* ISN, int* elementID, int* segmentID, int n, int nsn, int nes, int nen, int neq) {
+  CONTACT_PROFILE_FUNCTION();
+  CONTACT_PROFILE_PHASE(CONTACT_PHASE_SURFACE);
+
+  int* segmentNodesID = new int[nsn];
+
+  for (int sdf = 0; sdf < nsd; ++sdf) {
+    AABBmin[sdf] = FLT_MAX;
+    AABBmax[sdf] = -FLT_MAX;
+
+    for (int e = 0; e < n; ++e) {
+      int el = elementID[e] - 1;
+      int sg = segmentID[e] - 1;
+
+      // segment coords Xs:
+      for (int i = 0; i < nsn; ++i) {
+        const int IENrow = ISN[nes*i + sg] - 1; // Matlab numbering starts with 1
+        segmentNodesID[i] = IEN[nen*el + IENrow] - 1; // Matlab numbering starts with 1
+        //	for (int sdf = 0; sdf < nsd; ++sdf) {
+        const double x = X[sdf*(int)(neq / nsd) + segmentNodesID[i]];
+        AABBmin[sdf] = std::min(AABBmin[sdf], x);
+        AABBmax[sdf] = std::max(AABBmax[sdf], x);
+        //	}
+      }
+    }
+
+    //for (int sdf = 0; sdf < nsd; ++sdf) {
+    //if ((AABBmax[sdf] - AABBmin[sdf]) < longestEdge) {
+    //  AABBmax[sdf] += 0.5*longestEdge;
+    //  AABBmin[sdf] -= 0.5*longestEdge;
+    //}
+    //}
+  }
+  delete[] segmentNodesID;
+}
+
+/*! Nodes of contact segments given by the connectivity (ISN, IEN, elementID, segmentID) */
+struct ConnectivitySegmentNodes {
+  const int* ISN;
+  const int* IEN;
+  const int* elementID;
+  const int* segmentID;
+  int nes;
+  int nen;
+
+  int operator()(int e, int j) const {
+    const int el = elementID[e] - 1; // Matlab numbering starts with 1
+    const int sg = segmentID[e] - 1; // Matlab numbering starts with 1
+    return IEN[nen*el + ISN[nes*j + sg] - 1] - 1; // Matlab numbering starts with 1
+  }
+};
+
+/*! Initialization of the GPs table rows of a segment (see getLongestEdgeAndGPs) */
+struct GaussPointTableInit {
+  double* GPs;
+  const int* elementID;
+  const int* segmentID;
+  int numOfRows;
+  int nsd;
+  int npd;
+  int ngp;
+
+  void operator()(int e) const {
+    for (int g = e*ngp; g < (e + 1)*ngp; ++g) {
+      GPs[(nsd + 0)*numOfRows + g] = elementID[e];  // slave element
+      GPs[(nsd + 1)*numOfRows + g] = segmentID[e];  // slave segment
+      GPs[(nsd + 2)*numOfRows + g] = -FLT_MAX;      // init gap
+      // Xi_m, isActive, elm, sgm, isStick, t_T, Xi0_m, t_N0:
+      for (int col = nsd + 3; col < nsd + 3*npd + 8; ++col) {
+        GPs[col*numOfRows + g] = 0.0;
+      }
+    }
+  }
+};
+
+/*! No initialization of Gauss point rows (only the coords are evaluated) */
+struct NoGaussPointInit {
+  void operator()(int) const {
+  }
+};
+
+/*! Gauss point coords, longest edge and bounding box of the contact surface in one pass over the segments
+
+\param nodes - functor, nodes(e, j) is the 0-based node j of the segment e
+\param init - functor, init(e) initializes the other cols of the Gauss points of the segment e
+\param Xg - 2d array (n*ngp x nsd) of Gauss point coords, i.e. the first nsd cols of the GPs table
+*/
+template <class SegmentNodes, class RowInit>
+static void evaluateSurfaceGeometry(double* longestEdge, double* AABBmin, double* AABBmax, double* Xg, const SegmentNodes& nodes, const RowInit& init, const double* X, const double* H, int n, int nsn, int nsd, int ngp, int nnod) {
+  CONTACT_PROFILE_PHASE(CONTACT_PHASE_SURFACE);
+  const int numOfRows = n*ngp;
+  double longestEdge2 = 0.0;
+  for (int sdf = 0; sdf < nsd; ++sdf) {
+    AABBmin[sdf] = FLT_MAX;
+    AABBmax[sdf] = -FLT_MAX;
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(numberOfThreads)
+#endif
+  {
+    double Xs[3*8];
+    double Xmin[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+    double Xmax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+    double edge2 = 0.0;
+
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+    for (int e = 0; e < n; ++e) {
+      for (int j = 0; j < nsn; ++j) {
+        const int a = nodes(e, j);
+        for (int sdf = 0; sdf < nsd; ++sdf) {
+          const double x = X[sdf*nnod + a];
+          Xs[sdf*nsn + j] = x;
+          Xmin[sdf] = std::min(Xmin[sdf], x);
+          Xmax[sdf] = std::max(Xmax[sdf], x);
+        }
+      }
+
+      for (int sdf = 0; sdf < nsd; ++sdf) {
+        for (int i = 0; i < ngp; ++i) {
+          double Xgi = 0.0;
+          for (int j = 0; j < nsn; ++j) {
+            Xgi += H[j*ngp + i] * Xs[sdf*nsn + j];
+          }
+          Xg[sdf*numOfRows + e*ngp + i] = Xgi;
+        }
+      }
+      init(e);
+
+      // (squared lengths, the square root is taken once for the longest one)
+      for (int i = 0; i < nsn; ++i) {
+        for (int j = i+1; j < nsn; ++j) {
+          double lengthOfEdge2 = 0.0;
+          for (int sdf = 0; sdf < nsd; ++sdf) {
+            const double dx = Xs[sdf*nsn + i] - Xs[sdf*nsn + j];
+            lengthOfEdge2 += dx*dx;
+          }
+          edge2 = std::max(edge2, lengthOfEdge2);
+        }
+      }
+    }
+
+#ifdef _OPENMP
+#pragma omp critical(surfaceGeometry)
+#endif
+    {
+      longestEdge2 = std::max(longestEdge2, edge2);
+      for (int sdf = 0; sdf < nsd; ++sdf) {
+        AABBmin[sdf] = std::min(AABBmin[sdf], Xmin[sdf]);
+        AABBmax[sdf] = std::max(AABBmax[sdf], Xmax[sdf]);
+      }
+    }
+  }
+  *longestEdge = sqrt(longestEdge2);
+}
+
+/*! Prepare the contact surface for the search: getLongestEdgeAndGPs and getAABB in one pass
+
+The connectivity of each segment is resolved once and the Gauss point coords, the
+initialization of the GPs table, the longest edge and the bounding box are evaluated
+from the same segment coords. The results are the same as of getLongestEdgeAndGPs
+followed by getAABB. The segments are processed in parallel (see setNumberOfThreads).
+
+\param n, nsd, npd, ngp, neq, nsn, nes, nen, elementID, segmentID, ISN, IEN, H, X - see getLongestEdgeAndGPs
+
+\return longestEdge - the longest distance between two nodes of a segment
+\return AABBmin - minimal coords (nsd) of the axis-aligned bounding box of the contact surface
+\return AABBmax - maximal coords (nsd) of the axis-aligned bounding box of the contact surface
+\return GPs - 2d array (n*ngp x (nsd + 3*npd + 8)), see getLongestEdgeAndGPs
+*/
+void prepareContactSurface(double* longestEdge, double* AABBmin, double* AABBmax, double* GPs, int n, int nsd, int npd, int ngp, int neq, int nsn, int nes, int nen, int* elementID, int* segmentID, int* ISN, int* IEN, double* H, double* X) {
+  CONTACT_PROFILE_FUNCTION();
+  ConnectivitySegmentNodes nodes;
+  nodes.ISN = ISN;
+  nodes.IEN = IEN;
+  nodes.elementID = elementID;
+  nodes.segmentID = segmentID;
+  nodes.nes = nes;
+  nodes.nen = nen;
+
+  GaussPointTableInit init;
+  init.GPs = GPs;
+  init.elementID = elementID;
+  init.segmentID = segmentID;
+  init.numOfRows = n*ngp;
+  init.nsd = nsd;
+  init.npd = npd;
+  init.ngp = ngp;
+
+  evaluateSurfaceGeometry(longestEdge, AABBmin, AABBmax, GPs, nodes, init, X, H, n, nsn, nsd, ngp, neq / nsd);
+}
+
+/*! Master segment (or one triangle of the master segment in 3D) as seen by the contact search */
+struct MasterFacet {
+  int el;             // master element (0-based)
+  int sg;             // master segment (0-based)
+  int e;              // master contact segment (row of elementID and segmentID)
+  double Xm[3*8];     // segment node coords, Xm[k*nsn + j] (the 3rd row is zero in 2D)
+  double Xc[3];       // centre of mass of the segment
+  double Xt[9];       // triangle vertex coords, Xt[k*3 + j] (3D only)
+  double t1[3];       // tangent vectors parallel with the triangle edges
+  double t2[3];
+  double t3[3];
+  double normal[3];   // unit normal
+  double Xmin[3];     // bounding box extended by 0.5*longestEdge
+  double Xmax[3];
+  const struct SearchExclusion* exclusion; // masters excluded by the search (see getSearchExclusion), NULL means none
+};
+
+/*! Number of triangles the master segment is subdivided to by the 3D search */
+static int getNumberOfTriangles(int nsn) {
+  if(nsn == 4 || nsn == 8) {
+    // If the segment element is a quad (4 or 8 nodes) then it is subdivided to 4 triangles (with a common vertex Xc in the centre of mass):
+    return 4;
+  }
+  return 1;
+}
+
+/*! Read master segment coords, its centre of mass and its bounding box extended by 0.5*longestEdge
+
+\param f - master facet to be filled
+\param e - index of the contact segment (row of elementID and segmentID)
+*/
+static void setMasterSegment(MasterFacet& f, int e, const int* ISN, const int* IEN, const double* X, const int* elementID, const int* segmentID, int nsn, int nsd, int nen, int nes, int neq, double longestEdge) {
+  f.el = elementID[e] - 1;
+  f.sg = segmentID[e] - 1;
+  f.e = e;
+
+  for (int i = nsd*nsn; i < 3*nsn; ++i) f.Xm[i] = 0.0;
+  for (int k = nsd; k < 3; ++k) f.Xc[k] = 0.0;
+
+  for (int k = 0; k < nsd; ++k) {
+    f.Xmin[k] = FLT_MAX;
+    f.Xmax[k] = -FLT_MAX;
+    f.Xc[k] = 0.0;
+
+    for (int j = 0; j < nsn; ++j) {
+      const int IENrow = ISN[nes*j + f.sg] - 1; // Matlab numbering starts with 1
+      const int node = IEN[nen*f.el + IENrow] - 1; // Matlab numbering starts with 1
+      f.Xm[k*nsn + j] = X[k*(int)(neq / nsd) + node];
+      f.Xmin[k] = std::min(f.Xmin[k], f.Xm[k*nsn + j]);
+      f.Xmax[k] = std::max(f.Xmax[k], f.Xm[k*nsn + j]);
+      f.Xc[k] += f.Xm[k*nsn + j];
+    }
+    f.Xmin[k] -= 0.5*longestEdge;
+    f.Xmax[k] += 0.5*longestEdge;
+    f.Xc[k] /= nsn;
+  }
+}
+
+/*! Set the it-th triangle of the master segment: its coords, bounding box, edge tangents and unit normal
+
+In 2D the segment itself is used.
+*/
+static void setMasterTriangle(MasterFacet& f, int it, int nsn, int nsd, double longestEdge) {
+  const double* Xm = f.Xm;
+  double* Xt = f.Xt;
+
+  if (nsd == 2) {
+    f.t1[0] = Xm[1] - Xm[0];
+    f.t1[1] = Xm[3] - Xm[2];
+    f.t1[2] = 0.0;
+
+    f.normal[0] = f.t1[1];
+    f.normal[1] = -f.t1[0];
+    f.normal[2] = 0.0;
+  }
+  else if (nsd == 3) {
+    // triangle coords Xt:
+    if(getNumberOfTriangles(nsn) == 1) {
+      Xt[0] = Xm[0];
+      Xt[1] = Xm[1];
+      Xt[2] = Xm[2];
+
+      Xt[3] = Xm[nsn];
+      Xt[4] = Xm[nsn+1];
+      Xt[5] = Xm[nsn+2];
+
+      Xt[6] = Xm[2*nsn];
+      Xt[7] = Xm[2*nsn+1];
+      Xt[8] = Xm[2*nsn+2];
+    }
+    else {
+      // The it-th edge of the quad joins the corner nodes it and (it+1)%4 (the midside nodes of the 8-node quad follow the corners):
+      const int next = (it + 1) % 4;
+      Xt[0] = Xm[it];
+      Xt[1] = Xm[next];
+      Xt[2] = f.Xc[0];
+
+      Xt[3] = Xm[nsn+it];
+      Xt[4] = Xm[nsn+next];
+      Xt[5] = f.Xc[1];
+
+      Xt[6] = Xm[2*nsn+it];
+      Xt[7] = Xm[2*nsn+next];
+      Xt[8] = f.Xc[2];
+    }
+
+    // Min and Max of the triangle coords:
+    for (int k = 0; k < nsd; ++k) {
+      f.Xmin[k] = FLT_MAX;
+      f.Xmax[k] = -FLT_MAX;
+      for (int j = 0; j < 3; ++j) {
+        f.Xmin[k] = std::min(f.Xmin[k], Xt[k*3 + j]);
+        f.Xmax[k] = std::max(f.Xmax[k], Xt[k*3 + j]);
+      }
+      f.Xmin[k] -= 0.5*longestEdge;
+      f.Xmax[k] += 0.5*longestEdge;
+    }
+
+    // Tangent vectors parallel with element edges 1 and 2:
+    // Component: X     Y      Z
+    // Vertex 1:  Xt[0] Xt[3]  Xt[6]
+    // Vertex 2:  Xt[1] Xt[4]  Xt[7]
+    // Vertex 3:  Xt[2] Xt[5]  Xt[8]
+
+    f.t1[0] = Xt[1] - Xt[0];
+    f.t1[1] = Xt[4] - Xt[3];
+    f.t1[2] = Xt[7] - Xt[6];
+
+    f.t2[0] = Xt[2] - Xt[1];
+    f.t2[1] = Xt[5] - Xt[4];
+    f.t2[2] = Xt[8] - Xt[7];
+
+    f.t3[0] = Xt[0] - Xt[2];
+    f.t3[1] = Xt[3] - Xt[5];
+    f.t3[2] = Xt[6] - Xt[8];
+
+    // Normal vector:
+    f.normal[0] = f.t1[1] * f.t2[2] - f.t1[2] * f.t2[1];
+    f.normal[1] = f.t1[2] * f.t2[0] - f.t1[0] * f.t2[2];
+    f.normal[2] = f.t1[0] * f.t2[1] - f.t1[1] * f.t2[0];
+  }
+
+  const double normalLength = sqrt(f.normal[0] * f.normal[0] + f.normal[1] * f.normal[1] + f.normal[2] * f.normal[2]);
+  f.normal[0] /= normalLength;
+  f.normal[1] /= normalLength;
+  f.normal[2] /= normalLength;
+}
+
+/*! Bucket coordinate of x in one direction of the grid, clamped to <0, N-1>
+
+A degenerate extent (e.g. a planar surface with AABBmax == AABBmin) has a single layer of buckets.
+*/
+static inline int getCellCoord(double x, int N, double AABBmin, double AABBmax) {
+  const double extent = AABBmax - AABBmin;
+  if (!(extent > 0.0)) {
+    return 0;
+  }
+  // (clamped before the conversion, so that points far outside the grid do not overflow int)
+  const double I = N * (x - AABBmin) / extent;
+  if (!(I > 0.0)) {
+    return 0;
+  }
+  if (I >= N) {
+    return N - 1;
+  }
+  return (int)I;
+}
+
+/*! Index of the bucket (grid cell) containing the point Xg */
+static int getCellIndex(const double* Xg, const int* N, const double* AABBmin, const double* AABBmax, int nsd) {
+  int I[3];
+  I[2] = 0;
+  for (int sdf = 0; sdf < nsd; ++sdf) {
+    I[sdf] = getCellCoord(Xg[sdf], N[sdf], AABBmin[sdf], AABBmax[sdf]);
+  }
+  return I[2]*N[0] * N[1] + I[1]*N[0] + I[0];
+}
+
+/*! Range of buckets overlapped by the box <Xmin, Xmax> */
+static void getCellRange(int* Imin, int* Imax, const double* Xmin, const double* Xmax, const int* N, const double* AABBmin, const double* AABBmax, int nsd) {
+  CONTACT_PROFILE_PHASE(CONTACT_PHASE_CELL_RANGE);
+  Imin[2] = 0;
+  Imax[2] = 0;
+  for (int sdf = 0; sdf < nsd; ++sdf) {
+    Imin[sdf] = getCellCoord(Xmin[sdf], N[sdf], AABBmin[sdf], AABBmax[sdf]);
+    Imax[sdf] = getCellCoord(Xmax[sdf], N[sdf], AABBmin[sdf], AABBmax[sdf]);
+  }
+  CONTACT_PROFILE_COUNT(numOfCellRanges, 1);
+  CONTACT_PROFILE_COUNT(numOfBucketVisits, (long long)(Imax[0] - Imin[0] + 1)*(Imax[1] - Imin[1] + 1)*(Imax[2] - Imin[2] + 1));
+}
+
+/*! Projection of Xg onto the master facet, the inside-outside test is not evaluated (see isInsideMasterFacet)
+
+\param Xg - Gauss point coords
+
+\return d - signed distance of Xg from the facet (negative value means open gap)
+\return Xp - projection of Xg onto the facet
+
+NSD, NSN - compile-time nsd and nsn (0 means the run-time value)
+*/
+template <int NSD = 0, int NSN = 0>
+static void projectOntoMasterFacet(double* d, double* Xp, const double* Xg, const MasterFacet& f, int nsn, int nsd) {
+  nsd = NSD ? NSD : nsd;
+  nsn = NSN ? NSN : nsn;
+  const double* Xm = f.Xm;
+  const double* Xt = f.Xt;
+  const double* t1 = f.t1;
+  const double* normal = f.normal;
+
+  if (nsd == 2) {
+    double d_aux = 0.0;
+    double t1_norm = 0.0;
+    for (int i = 0; i < nsd; ++i) {
+      d_aux += (Xg[i] - Xm[i*nsn + 0]) * t1[i];
+      t1_norm += t1[i] * t1[i];
+    }
+    t1_norm = sqrt(t1_norm);
+    d_aux = d_aux / t1_norm;
+
+    double sign = 0.0;
+    *d = 0.0;
+    for (int i = 0; i < nsd; ++i) {
+      Xp[i] = Xm[i*nsn + 0] + d_aux * t1[i] / t1_norm;
+      sign -= (Xg[i] - Xp[i])*normal[i]; // negative sign for the OPEN gap!
+      *d += pow(Xg[i] - Xp[i], 2);
+    }
+    *d = sqrt(*d);
+    if (sign < 0) { // OPEN gap
+      *d *= -1; // because d was distance (non negative number)
+    }
+  }
+  else if (nsd == 3) {
+    *d = (Xg[0] - Xt[0]) * normal[0] + (Xg[1] - Xt[3]) * normal[1] + (Xg[2] - Xt[6]) * normal[2];
+    for (int i = 0; i < nsd; ++i) {
+      Xp[i] = Xg[i] - *d*normal[i];
+    }
+  }
+}
+
+/*! Inside-outside algorithm ( DOI: 10.1002/(SICI)1097-0207(19971015)40:19<3665::AID-NME234>3.0.CO;2-K )
+
+\param Xg - Gauss point coords
+
+\return true if the projection of Xg lies inside the master facet
+\return d - signed distance of Xg from the facet (negative value means open gap)
+\return Xp - projection of Xg onto the facet
+
+NSD, NSN - compile-time nsd and nsn (0 means the run-time value)
+*/
+template <int NSD = 0, int NSN = 0>
+static bool isInsideMasterFacet(double* d, double* Xp, const double* Xg, const MasterFacet& f, int nsn, int nsd) {
+  nsd = NSD ? NSD : nsd;
+  nsn = NSN ? NSN : nsn;
+  const double* Xm = f.Xm;
+  const double* Xt = f.Xt;
+  const double* t1 = f.t1;
+  const double* t2 = f.t2;
+  const double* t3 = f.t3;
+  const double* normal = f.normal;
+
+  bool isInside = false;
+  if (nsd == 2) {
+    double r[2];
+    *d = 0.0;
+    double t1_norm = 0.0;
+    for (int i = 0; i < nsd; ++i) {
+      r[i] = Xg[i] - Xm[i*nsn + 0];
+      *d += r[i] * t1[i];
+      t1_norm += t1[i] * t1[i];
+    }
+    t1_norm = sqrt(t1_norm);
+    *d = *d / t1_norm;
+
+    // Check if inside edge_1:
+    if (*d > 0.0 && *d < t1_norm) {
+      isInside = true;
+      projectOntoMasterFacet<NSD, NSN>(d, Xp, Xg, f, nsn, nsd);
+    }
+  }
+  else if (nsd == 3) {
+    double r[9];
+    double Q1[3];
+    double Q2[3];
+    double Q3[3];
+    *d = 0.0;
+    for (int i = 0; i < nsd; ++i) {
+      r[i * 3 + 0] = Xg[i] - Xt[i*3 + 0];
+      r[i * 3 + 1] = Xg[i] - Xt[i*3 + 1];
+      r[i * 3 + 2] = Xg[i] - Xt[i*3 + 2];
+    }
+
+    // component:  X    Y    Z
+    // r1:       r[0] r[3] r[6]
+    // r2:       r[1] r[4] r[7]
+    // r3:       r[2] r[5] r[8]
+    Q1[0] = r[3] * t1[2] - r[6] * t1[1];
+    Q1[1] = r[6] * t1[0] - r[0] * t1[2];
+    Q1[2] = r[0] * t1[1] - r[3] * t1[0];
+
+    Q2[0] = r[4] * t2[2] - r[7] * t2[1];
+    Q2[1] = r[7] * t2[0] - r[1] * t2[2];
+    Q2[2] = r[1] * t2[1] - r[4] * t2[0];
+
+    Q3[0] = r[5] * t3[2] - r[8] * t3[1];
+    Q3[1] = r[8] * t3[0] - r[2] * t3[2];
+    Q3[2] = r[2] * t3[1] - r[5] * t3[0];
+
+    const double Q1n = Q1[0] * normal[0] + Q1[1] * normal[1] + Q1[2] * normal[2];
+    const double Q2n = Q2[0] * normal[0] + Q2[1] * normal[1] + Q2[2] * normal[2];
+    const double Q3n = Q3[0] * normal[0] + Q3[1] * normal[1] + Q3[2] * normal[2];
+
+    if (Q1n*Q2n > 0) {
+      if (Q1n*Q3n > 0) {
+        isInside = true;
+        projectOntoMasterFacet<NSD, NSN>(d, Xp, Xg, f, nsn, nsd);
+      }
+    }
+  }
+  return isInside;
+}
+
+// Parameters of the local contact search (see setProjectionParameters):
+static int projectionMaxIterations = 50;
+static double projectionTolerance = 1e-5;
+static double projectionMaxStep = 0.5;
+
+/*! Set parameters of the local contact search (Newton projection onto master segments)
+
+\param maxIterations - maximal number of Newton iterations
+\param tolerance - tolerance of the norm of the parametric coords increment
+\param maxStep - maximal norm of the parametric coords increment in one iteration (trust region)
+*/
+void setProjectionParameters(int maxIterations, double tolerance, double maxStep) {
+  projectionMaxIterations = maxIterations;
+  projectionTolerance = tolerance;
+  projectionMaxStep = maxStep;
+}
+
+/*! Exact projection onto an affine master segment
+
+A segment is affine if its geometry is x = X0 + r*a + s*b, i.e. a 2-node segment, a 6-node
+triangle with straight edges and midside nodes in the middle of the edges, or a 4/8-node
+parallelogram (with midside nodes in the middle of the edges). Then the least-square
+projection is the solution of a linear system and no Newton iterations are needed.
+
+\return false if the segment is not affine
+*/
+template <int NSD = 0, int NSN = 0>
+static bool projectOntoAffineSegment(double* r_out, double* s_out, double* d_out, const double* Xg, const double* Xm, int nsn, int nsd) {
+  nsd = NSD ? NSD : nsd;
+  nsn = NSN ? NSN : nsn;
+  double X0[3], a[3], b[3], dev[3];
+  double devNorm = 0.0;
+  double aNorm = 0.0;
+
+  for (int k = 0; k < 3; ++k) {
+    const double* x = Xm + k*nsn;
+    X0[k] = a[k] = b[k] = dev[k] = 0.0;
+    if (k >= nsd) {
+      continue;
+    }
+    switch (nsn) {
+      case 2:
+      X0[k] = 0.5*(x[0] + x[1]);
+      a[k]  = 0.5*(x[1] - x[0]);
+      break;
+      case 6:
+      X0[k] = x[0];
+      a[k]  = x[1] - x[0];
+      b[k]  = x[2] - x[0];
+      dev[k] = fabs(x[3] - 0.5*(x[0] + x[1])) + fabs(x[4] - 0.5*(x[1] + x[2])) + fabs(x[5] - 0.5*(x[2] + x[0]));
+      break;
+      case 4:
+      case 8:
+      X0[k] = 0.25*( x[0] + x[1] + x[2] + x[3]);
+      a[k]  = 0.25*(-x[0] + x[1] + x[2] - x[3]);
+      b[k]  = 0.25*(-x[0] - x[1] + x[2] + x[3]);
+      dev[k] = fabs(x[0] - x[1] + x[2] - x[3]);
+      if (nsn == 8) {
+        dev[k] += fabs(x[4] - 0.5*(x[0] + x[1])) + fabs(x[5] - 0.5*(x[1] + x[2])) + fabs(x[6] - 0.5*(x[2] + x[3])) + fabs(x[7] - 0.5*(x[3] + x[0]));
+      }
+      break;
+      default:
+      return false;
+    }
+    devNorm += dev[k];
+    aNorm += fabs(a[k]) + fabs(b[k]);
+  }
+
+  if (devNorm > 1e-10*aNorm) {
+    return false;
+  }
+
+  double r = 0.0;
+  double s = 0.0;
+  double normal[3];
+
+  if (nsn == 2) {
+    double A11 = 0.0;
+    double b1 = 0.0;
+    for (int k = 0; k < nsd; ++k) {
+      A11 += a[k]*a[k];
+      b1 += a[k]*(Xg[k] - X0[k]);
+    }
+    r = b1 / A11;
+
+    normal[0] = a[1];
+    normal[1] = -a[0];
+    normal[2] = 0.0;
+  }
+  else {
+    double A11 = 0.0, A12 = 0.0, A22 = 0.0, b1 = 0.0, b2 = 0.0;
+    for (int k = 0; k < nsd; ++k) {
+      A11 += a[k]*a[k];
+      A12 += a[k]*b[k];
+      A22 += b[k]*b[k];
+      b1 += a[k]*(Xg[k] - X0[k]);
+      b2 += b[k]*(Xg[k] - X0[k]);
+    }
+    const double recDetA = 1 / (A11*A22 - A12*A12);
+    r = recDetA*( A22*b1 - A12*b2);
+    s = recDetA*(-A12*b1 + A11*b2);
+
+    normal[0] = a[1]*b[2] - a[2]*b[1];
+    normal[1] = a[2]*b[0] - a[0]*b[2];
+    normal[2] = a[0]*b[1] - a[1]*b[0];
+  }
+
+  const double normalLength = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+  double d = 0.0;
+  for (int k = 0; k < nsd; ++k) {
+    const double Xp = X0[k] + r*a[k] + s*b[k];
+    d -= (Xg[k] - Xp) * normal[k] / normalLength;
+  }
+
+  *r_out = r;
+  *s_out = s;
+  *d_out = d;
+  return true;
+}
+
+/*! Whether the parametric coords r, s are outside the master segment with nsn nodes
+
+Triangles (3 or 6 nodes) are r, s >= 0, r + s <= 1, the other segments are -1 <= r, s <= 1.
+*/
+static inline bool isOutsideMasterSegment(double r, double s, int nsn) {
+  if (nsn == 3 || nsn == 6) {
+    return r < 0.0 || s < 0.0 || r + s > 1.0;
+  }
+  return fabs(r) > 1 || fabs(s) > 1;
+}
+
+/*! Local contact search by Least-square projection method
+
+Affine segments are projected exactly (see projectOntoAffineSegment), otherwise the
+safeguarded Newton method is used: the increment of the parametric coords is limited
+by the trust region radius and the number of iterations by the iteration budget (see
+setProjectionParameters).
+
+\param Xg - Gauss point coords
+\param Xp - projection of Xg onto the master triangle (used for the initial guess)
+\param Xm - master segment coords
+\param Xi0 - initial guess of the parametric coords (warm start), NULL means the guess from Xp
+\param Hm - work array (nsn)
+\param dHm - work array (nsn*npd)
+
+\return r, s - parametric coords of the projection of Xg onto the master segment
+\return d - signed distance of Xg from the master segment (negative value means open gap)
+
+NSD, NPD, NSN - compile-time nsd, npd and nsn (0 means the run-time value)
+*/
+template <int NSD = 0, int NPD = 0, int NSN = 0>
+static void projectOntoMasterSegment(double* r_out, double* s_out, double* d_out, const double* Xg, const double* Xp0, const double* Xm, const double* Xi0, double* Hm, double* dHm, int nsn, int nsd, int npd, ContactStats& stats) {
+  CONTACT_PROFILE_PHASE(CONTACT_PHASE_PROJECTION);
+  nsd = NSD ? NSD : nsd;
+  npd = NPD ? NPD : npd;
+  nsn = NSN ? NSN : nsn;
+  stats.numOfProjections++;
+
+  if (projectOntoAffineSegment<NSD, NSN>(r_out, s_out, d_out, Xg, Xm, nsn, nsd)) {
+    if (isOutsideMasterSegment(*r_out, *s_out, nsn)) {
+      stats.numOfOutsideElement++; // converges to point outside the element
+    }
+    CONTACT_PROFILE_ITERATIONS(0);
+    return;
+  }
+
+  // Initial guess of the parametric coordinates on the triangle:
+  const double* Xp = Xp0;
+  double r_len, r = 0.0;
+  double s_len, s = 0.0;
+  double d = 0.0;
+  if (Xi0) {
+    r = Xi0[0];
+    s = npd == 2 ? Xi0[1] : 0.0;
+  }
+  else {
+    switch (nsn) { // Number of Segment Nodes
+      case 2:
+      // Tangent vectors parallel with element edges 1 and 2:
+      // Component: X     Y      Z
+      // Node 1:  Xm[0] Xm[2]  Xm[4]
+      // Node 2:  Xm[1] Xm[3]  Xm[5]
+
+      r_len = pow(Xm[1] - Xm[0], 2.0) +
+      pow(Xm[3] - Xm[2], 2.0) +
+      pow(Xm[5] - Xm[4], 2.0);
+
+      r = ((Xp[0] - Xm[0])  * (Xm[1] - Xm[0]) +
+      (Xp[1] - Xm[2])  * (Xm[3] - Xm[2]) +
+      (Xp[2] - Xm[4])  * (Xm[5] - Xm[4])) / r_len;
+      r = 2*r-1;
+      break;
+      case 6:
+      r_len = pow(Xm[1] - Xm[0], 2.0) +
+      pow(Xm[7] - Xm[6], 2.0) +
+      pow(Xm[13] - Xm[12], 2.0);
+
+      s_len = pow(Xm[2] - Xm[0], 2.0) +
+      pow(Xm[8] - Xm[6], 2.0) +
+      pow(Xm[14] - Xm[12], 2.0);
+
+      r = ((Xp[0] - Xm[0])  * (Xm[1] - Xm[0]) +
+      (Xp[1] - Xm[6])  * (Xm[7] - Xm[6]) +
+      (Xp[2] - Xm[12]) * (Xm[13] - Xm[12])) / r_len;
+
+      s = ((Xp[0] - Xm[0])  * (Xm[2] - Xm[0]) +
+      (Xp[1] - Xm[6])  * (Xm[8] - Xm[6]) +
+      (Xp[2] - Xm[12]) * (Xm[14] - Xm[12])) / s_len;
+      break;
+      case 4:
+      case 8:
+      // Node 1 is r = s = -1, node 2 is r = 1 and node 4 is s = 1 (the corner nodes are the first 4 of the 8-node quad):
+      r_len = pow(Xm[1]  - Xm[0],  2.0) +
+      pow(Xm[nsn+1]  - Xm[nsn],  2.0) +
+      pow(Xm[2*nsn+1] - Xm[2*nsn], 2.0);
+
+      s_len = pow(Xm[3]  - Xm[0],  2.0) +
+      pow(Xm[nsn+3] - Xm[nsn],  2.0) +
+      pow(Xm[2*nsn+3] - Xm[2*nsn], 2.0);
+
+      r = ((Xp[0] - Xm[0])  * (Xm[1] - Xm[0]) +
+      (Xp[1] - Xm[nsn])  * (Xm[nsn+1] - Xm[nsn]) +
+      (Xp[2] - Xm[2*nsn]) * (Xm[2*nsn+1] - Xm[2*nsn])) / r_len;
+
+      r = 2*r-1;
+
+      s = ((Xp[0] - Xm[0])  * (Xm[3]  - Xm[0]) +
+      (Xp[1] - Xm[nsn])  * (Xm[nsn+3] - Xm[nsn]) +
+      (Xp[2] - Xm[2*nsn]) * (Xm[2*nsn+3] - Xm[2*nsn])) / s_len;
+
+      s = 2*s-1;
+    }
+  }
+
+  double dr_norm;
+  int niter = 0;
+  const int max_niter = projectionMaxIterations;
+  do {
+    evaluateShapeFunctions<NSN>(Hm, dHm, r, s, nsn);
+
+    double b1, b2, A11, A22, A12;
+    A11 = 0.0;
+    A22 = 0.0;
+    A12 = 0.0;
+    b1 = 0.0;
+    b2 = 0.0;
+    d = 0.0;
+
+    double Xp[3];
+    double dx_dr[3];
+    double dx_ds[3];
+    double normal[3];
+
+    for (int sdf = 0; sdf < nsd; ++sdf) {
+      Xp[sdf] = 0.0;
+      dx_dr[sdf] = 0.0;
+      dx_ds[sdf] = 0.0;
+      for (int k = 0; k < nsn; ++k) {
+        Xp[sdf] += Hm[k] * Xm[sdf*nsn + k];
+        dx_dr[sdf] += dHm[k] * Xm[sdf*nsn + k];
+        if (npd == 2) {
+          dx_ds[sdf] += dHm[nsn + k] * Xm[sdf*nsn + k];
+        }
+      }
+    }
+
+    if(nsd == 2) {
+      normal[0] = dx_dr[1];
+      normal[1] = -dx_dr[0];
+      normal[2] = 0.0;
+      dx_dr[2] = 0.0;
+      dx_ds[2] = 0.0;
+    }
+    else if (nsd == 3) {
+      normal[0] = dx_dr[1]*dx_ds[2] - dx_dr[2]*dx_ds[1];
+      normal[1] = dx_dr[2]*dx_ds[0] - dx_dr[0]*dx_ds[2];
+      normal[2] = dx_dr[0]*dx_ds[1] - dx_dr[1]*dx_ds[0];
+    }
+
+    const double normalLength = sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+    normal[0] /= normalLength;
+    normal[1] /= normalLength;
+    normal[2] /= normalLength;
+
+    d = 0.0;
+    for (int sdf = 0; sdf < nsd; ++sdf) {
+      b1 += dx_dr[sdf]*(Xg[sdf] - Xp[sdf]);
+      A11 += dx_dr[sdf]*dx_dr[sdf];
+
+      if (npd == 2) {
+        b2 += dx_ds[sdf]*(Xg[sdf] - Xp[sdf]);
+        A22 += dx_ds[sdf]*dx_ds[sdf];
+        A12 += dx_dr[sdf]*dx_ds[sdf];
+      }
+
+      d -= (Xg[sdf] - Xp[sdf]) * normal[sdf];
+    }
+
+    double recDetA;
+    double invA11;
+    double invA22;
+    double invA12;
+    double dr;
+    double ds;
+
+    if (npd == 1) {
+      invA11 = 1 / A11;
+      dr = invA11*b1;
+      ds = 0.0;
+    }
+
+    if (npd == 2) {
+      recDetA = 1 / (A11*A22 - A12*A12);
+      invA11 = recDetA * A22;
+      invA22 = recDetA * A11;
+      invA12 = -recDetA * A12;
+      dr = invA11*b1 + invA12*b2;
+      ds = invA12*b1 + invA22*b2;
+    }
+
+    // Trust region - limit the step length:
+    dr_norm = sqrt(dr*dr + ds*ds);
+    if (dr_norm > projectionMaxStep) {
+      dr *= projectionMaxStep / dr_norm;
+      ds *= projectionMaxStep / dr_norm;
+    }
+    r += dr;
+    s += ds;
+
+    niter++;
+  } while (dr_norm > projectionTolerance && niter < max_niter);
+
+
+  stats.numOfNewtonIterations += niter;
+  CONTACT_PROFILE_ITERATIONS(niter);
+  if (niter >= max_niter && dr_norm > projectionTolerance) {
+    stats.numOfNotConverged++;   // local contact search does NOT converge
+  }
+
+  if (isOutsideMasterSegment(r, s, nsn)) {
+    stats.numOfOutsideElement++; // converges to point outside the element
+  }
+
+  *r_out = r;
+  *s_out = s;
+  *d_out = d;
+}
+
+/*! Master segments excluded from the search of Gauss points (see setContactSearchExclusion) */
+struct SearchExclusion {
+  const int* adjStart;
+  const int* adj;
+  const int* bodyID;
+  int n;              // number of contact segments the arrays belong to
+  int ngp;
+};
+
+static SearchExclusion searchExclusion = {NULL, NULL, NULL, 0, 1};
+
+/*! Set master segments which are skipped by the contact search of each Gauss point
+
+Besides its own segment, a Gauss point skips the neighbouring segments of its segment
+(sharing a node, see buildSegmentAdjacency) and, if bodyID is given, all segments of
+the same body. The pairs are rejected before the inside-outside test and the projection,
+so the neighbours of self-contact models do not produce spurious near-zero gaps and the
+segments of one body are not tested against each other in the two-body contact.
+
+Contact segments are rows e of elementID and segmentID, the Gauss points of the e-th segment
+are rows e*ngp, ..., (e+1)*ngp-1 of the GPs table (see getLongestEdgeAndGPs). The arrays are
+not copied, they have to be valid until the exclusion is switched off (all arrays NULL).
+The exclusion applies only to the searches with the same n and ngp, the other searches
+(e.g. of another mesh) ignore it.
+
+\param adjStart, adj - segment adjacency (see buildSegmentAdjacency), NULL means no exclusion of neighbours
+\param bodyID - 1d array (n) of body (or surface) IDs of contact segments, NULL means no exclusion of bodies
+\param n - number of contact segments
+\param ngp - Number of Gauss Points of a segment
+*/
+void setContactSearchExclusion(int* adjStart, int* adj, int* bodyID, int n, int ngp) {
+  searchExclusion.adjStart = adj ? adjStart : NULL;
+  searchExclusion.adj = adj;
+  searchExclusion.bodyID = bodyID;
+  searchExclusion.n = n;
+  searchExclusion.ngp = std::max(1, ngp);
+}
+
+/*! Exclusion of master segments for the search of n segments with ngp Gauss points (NULL means none, see setContactSearchExclusion) */
+static const SearchExclusion* getSearchExclusion(int n, int ngp) {
+  if (searchExclusion.adjStart == NULL && searchExclusion.bodyID == NULL) {
+    return NULL;
+  }
+  if (searchExclusion.n != n || searchExclusion.ngp != ngp) {
+    return NULL;
+  }
+  return &searchExclusion;
+}
+
+/*! True if the master facet is excluded from the search of the Gauss point in the v-th row (see setContactSearchExclusion) */
+static inline bool isExcludedMaster(int v, const MasterFacet& f) {
+  const SearchExclusion* exclusion = f.exclusion;
+  if (exclusion == NULL) {
+    return false;
+  }
+  const int es = v / exclusion->ngp;
+  if (exclusion->bodyID && exclusion->bodyID[es] == exclusion->bodyID[f.e]) {
+    return true;
+  }
+  return exclusion->adjStart && std::binary_search(exclusion->adj + exclusion->adjStart[es], exclusion->adj + exclusion->adjStart[es + 1], f.e);
+}
+
+/*! Test the Gauss point in the v-th row against the master facet and store the closest master found so far
+
+\param gps - Gauss point state (GaussPointTable or GaussPointArrays)
+\param isPrefiltered - the Gauss point already passed the inside-outside test (see selectInsideCandidates),
+                       so only its projection onto the facet is evaluated
+
+NSD, NPD, NSN - compile-time nsd, npd and nsn (0 means the run-time value)
+*/
+template <int NSD = 0, int NPD = 0, int NSN = 0, class GaussPoints>
+static void searchGaussPoint(const GaussPoints& gps, int v, const MasterFacet& f, double* Hm, double* dHm, int nsn, int nsd, int npd, ContactStats& stats, bool isPrefiltered = false) {
+  nsd = NSD ? NSD : nsd;
+  npd = NPD ? NPD : npd;
+  nsn = NSN ? NSN : nsn;
+
+  // Read the index of element and the local contact segment index:
+  const int els = gps.slaveElement(v);      // slave element
+  const int sgs = gps.slaveSegment(v);      // slave segment
+
+  // Jump if Gausspoint segment is equal to master segment (or if the master is excluded):
+  if (f.el == els && f.sg == sgs) {
+    return;
+  }
+  if (isExcludedMaster(v, f)) {
+    return;
+  }
+
+  double Xg[3];
+  double Xp[3];
+  double d;
+  Xg[2] = 0.0;
+  Xp[2] = 0.0;
+  for (int i = 0; i < nsd; ++i) {
+    Xg[i] = gps.x(i, v);
+  }
+
+  if (isPrefiltered) {
+    projectOntoMasterFacet<NSD, NSN>(&d, Xp, Xg, f, nsn, nsd);
+  }
+  else if (!isInsideMasterFacet<NSD, NSN>(&d, Xp, Xg, f, nsn, nsd)) {
+    CONTACT_PROFILE_COUNT(numOfInsideRejects, 1);
+    return;
+  }
+
+  // Perform a more accurate search if the current gap
+  // is smaller than the previously detected but not
+  // smaller than the width of the contact zone:
+  if (d > gps.gap(v) && d < 20.0) {
+    // Warm start from the stored parametric coords if the master segment is the previous one:
+    double Xi0[2];
+    const double* warmStart = NULL;
+    if (gps.masterElement(v) == f.el && gps.masterSegment(v) == f.sg) {
+      Xi0[0] = gps.xi(0, v);
+      Xi0[1] = npd == 2 ? gps.xi(1, v) : 0.0;
+      warmStart = Xi0;
+    }
+
+    double r, s;
+    projectOntoMasterSegment<NSD, NPD, NSN>(&r, &s, &d, Xg, Xp, f.Xm, warmStart, Hm, dHm, nsn, nsd, npd, stats);
+
+    if (d > gps.gap(v) && d < 20.0) {
+      gps.setGap(v, d);                // store gap (negative value means open gap)
+
+      if(d >= -20.0) { // "positive" zero
+        gps.setActive(v);              // set gausspoint to active state
+      }
+      gps.setMaster(v, f.el, f.sg);    // set master element and segment
+
+      // Update Xi_m
+      gps.setXi(0, v, r);
+      if (npd == 2) {
+        gps.setXi(1, v, s);
+      }
+    }
+  }
+}
+
+/*! Test the Gauss point in the v-th row of the GPs table against the master facet (see above)
+
+\param numOfRows - number of rows of the GPs table
+*/
+static void searchGaussPoint(double* GPs, int v, int numOfRows, const MasterFacet& f, double* Hm, double* dHm, int nsn, int nsd, int npd, ContactStats& stats) {
+  searchGaussPoint(GaussPointTable(GPs, numOfRows, nsd, npd), v, f, Hm, dHm, nsn, nsd, npd, stats);
+}
+
+/*! Buckets stored as linked lists (head, next) built by the caller */
+struct LinkedListBuckets {
+  const int* head;
+  const int* next;
+
+  template <class Visitor>
+  void visit(int Ic, Visitor& visitor) const {
+    for (int v = head[Ic]; v != -1; v = next[v]) {
+      CONTACT_PROFILE_COUNT(numOfCandidates, 1);
+      visitor(v);
+    }
+  }
+};
+
+/*! Buckets stored in the compressed (CSR) layout built by buildBucketGrid */
+struct CompressedBuckets {
+  const int* cellStart;
+  const int* cellGPs;
+
+  template <class Visitor>
+  void visit(int Ic, Visitor& visitor) const {
+    CONTACT_PROFILE_COUNT(numOfCandidates, cellStart[Ic + 1] - cellStart[Ic]);
+    for (int p = cellStart[Ic]; p < cellStart[Ic + 1]; ++p) {
+      visitor(cellGPs[p]);
+    }
+  }
+};
+
+// Number of bucket entries tested at once by selectInsideCandidates:
+static const int prefilterChunkSize = 64;
+
+/*! Inside-outside test of the bucket entries p = begin, ..., end-1 against the master facet
+
+Vectorised counterpart of the test of isInsideMasterFacet (the same expressions), the coords
+are read from the bucket-sorted array cellXg (see gatherBucketCoords). At most
+prefilterChunkSize entries can be tested at once.
+
+\param cellXg - 2d array (numOfEntries x nsd) of Gauss point coords sorted by buckets
+\param numOfEntries - number of rows of cellXg
+
+\return inside - 1d array of entries p which passed the test (in ascending order)
+\return number of entries which passed the test
+*/
+static int selectInsideCandidates(int* inside, const double* cellXg, int numOfEntries, int begin, int end, const MasterFacet& f, int nsn, int nsd) {
+  CONTACT_PROFILE_PHASE(CONTACT_PHASE_INSIDE_TEST);
+  unsigned char mask[prefilterChunkSize];
+  const int num = end - begin;
+  const double* x = cellXg + begin;
+  const double* y = cellXg + numOfEntries + begin;
+
+  if (nsd == 2) {
+    const double* Xm = f.Xm;
+    const double* t1 = f.t1;
+    const double t1_norm = sqrt(t1[0] * t1[0] + t1[1] * t1[1]);
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (int p = 0; p < num; ++p) {
+      const double d = ((x[p] - Xm[0]) * t1[0] + (y[p] - Xm[nsn]) * t1[1]) / t1_norm;
+      mask[p] = (d > 0.0) & (d < t1_norm);
+    }
+  }
+  else {
+    const double* z = cellXg + 2*numOfEntries + begin;
+    const double* Xt = f.Xt;
+    const double* t1 = f.t1;
+    const double* t2 = f.t2;
+    const double* t3 = f.t3;
+    const double* normal = f.normal;
+#ifdef _OPENMP
+#pragma omp simd
+#endif
+    for (int p = 0; p < num; ++p) {
+      const double r0 = x[p] - Xt[0];
+      const double r1 = x[p] - Xt[1];
+      const double r2 = x[p] - Xt[2];
+      const double r3 = y[p] - Xt[3];
+      const double r4 = y[p] - Xt[4];
+      const double r5 = y[p] - Xt[5];
+      const double r6 = z[p] - Xt[6];
+      const double r7 = z[p] - Xt[7];
+      const double r8 = z[p] - Xt[8];
+
+      const double Q1n = (r3 * t1[2] - r6 * t1[1]) * normal[0] + (r6 * t1[0] - r0 * t1[2]) * normal[1] + (r0 * t1[1] - r3 * t1[0]) * normal[2];
+      const double Q2n = (r4 * t2[2] - r7 * t2[1]) * normal[0] + (r7 * t2[0] - r1 * t2[2]) * normal[1] + (r1 * t2[1] - r4 * t2[0]) * normal[2];
+      const double Q3n = (r5 * t3[2] - r8 * t3[1]) * normal[0] + (r8 * t3[0] - r2 * t3[2]) * normal[1] + (r2 * t3[1] - r5 * t3[0]) * normal[2];
+      mask[p] = (Q1n*Q2n > 0) & (Q1n*Q3n > 0);
+    }
+  }
+
+  // Compaction of the mask:
+  int numOfInside = 0;
+  for (int p = 0; p < num; ++p) {
+    inside[numOfInside] = begin + p;
+    numOfInside += mask[p];
+  }
+  CONTACT_PROFILE_COUNT(numOfInsideRejects, num - numOfInside);
+  return numOfInside;
+}
+
+/*! Buckets in the compressed layout with the bucket-sorted Gauss point coords
+
+Before the visitor (the projection) is called, all Gauss points of the bucket are tested
+against the current master facet of the visitor by selectInsideCandidates, so only the
+Gauss points inside the facet are visited (by visitInside, which does not repeat the test).
+Most of the Gauss points of overlapped buckets fail this test.
+*/
+struct PrefilteredBuckets {
+  const int* cellStart;
+  const int* cellGPs;
+  const double* cellXg;   // see gatherBucketCoords
+  int numOfEntries;       // number of rows of cellXg, i.e. cellStart[numOfCells]
+
+  template <class Visitor>
+  void visit(int Ic, Visitor& visitor) const {
+    int inside[prefilterChunkSize];
+    CONTACT_PROFILE_COUNT(numOfCandidates, cellStart[Ic + 1] - cellStart[Ic]);
+    for (int begin = cellStart[Ic]; begin < cellStart[Ic + 1]; begin += prefilterChunkSize) {
+      const int end = std::min(cellStart[Ic + 1], begin + prefilterChunkSize);
+      const int numOfInside = selectInsideCandidates(inside, cellXg, numOfEntries, begin, end, *visitor.f, visitor.nsn, visitor.nsd);
+      for (int k = 0; k < numOfInside; ++k) {
+        visitor.visitInside(cellGPs[inside[k]]);
+      }
+    }
+  }
+};
+
+/*! Gauss point coords in the order of buckets for PrefilteredBuckets
+
+\return cellXg - 2d array (numOfEntries x nsd), cellXg[sdf*numOfEntries + p] is the coord of the GP cellGPs[p]
+*/
+template <class GaussPoints>
+static void gatherBucketCoords(double* cellXg, const int* cellGPs, int numOfEntries, const GaussPoints& gps, int nsd) {
+  CONTACT_PROFILE_PHASE(CONTACT_PHASE_BINNING);
+  for (int sdf = 0; sdf < nsd; ++sdf) {
+    for (int p = 0; p < numOfEntries; ++p) {
+      cellXg[sdf*numOfEntries + p] = gps.x(sdf, cellGPs[p]);
+    }
+  }
+}
+
+/*! Gauss point visitor of the master-centric search */
+template <int NSD, int NPD, int NSN, class GaussPoints>
+struct GaussPointSearch {
+  const GaussPoints* gps;
+  const MasterFacet* f;
+  double* Hm;
+  double* dHm;
+  int nsn;
+  int nsd;
+  int npd;
+  ContactStats stats;
+
+  void operator()(int v) {
+    searchGaussPoint<NSD, NPD, NSN>(*gps, v, *f, Hm, dHm, nsn, nsd, npd, stats);
+  }
+
+  // The Gauss point passed the inside-outside test (see PrefilteredBuckets):
+  void visitInside(int v) {
+    searchGaussPoint<NSD, NPD, NSN>(*gps, v, *f, Hm, dHm, nsn, nsd, npd, stats, true);
+  }
+};
+
+/*! Gauss point visitor collecting (GP row, master triangle) pairs which pass the inside-outside test */
+template <int NSD, int NSN, class GaussPoints>
+struct CandidateCollector {
+  const GaussPoints* gps;
+  const MasterFacet* f;
+  int facet;                                  // index of the master triangle: e*ntr + it
+  std::vector<std::pair<int, int> >* pairs;   // (GPs row, facet)
+  int nsn;
+  int nsd;
+
+  void operator()(int v) {
+    const int els = gps->slaveElement(v);      // slave element
+    const int sgs = gps->slaveSegment(v);      // slave segment
+    if ((f->el == els && f->sg == sgs) || isExcludedMaster(v, *f)) {
+      return;
+    }
+
+    double Xg[3];
+    double Xp[3];
+    double d;
+    Xg[2] = 0.0;
+    for (int i = 0; i < nsd; ++i) {
+      Xg[i] = gps->x(i, v);
+    }
+    if (isInsideMasterFacet<NSD, NSN>(&d, Xp, Xg, *f, nsn, nsd)) {
+      pairs->push_back(std::make_pair(v, facet));
+    }
+    else {
+      CONTACT_PROFILE_COUNT(numOfInsideRejects, 1);
+    }
+  }
+
+  // The Gauss point passed the inside-outside test (see PrefilteredBuckets):
+  void visitInside(int v) {
+    const int els = gps->slaveElement(v);      // slave element
+    const int sgs = gps->slaveSegment(v);      // slave segment
+    if ((f->el == els && f->sg == sgs) || isExcludedMaster(v, *f)) {
+      return;
+    }
+    pairs->push_back(std::make_pair(v, facet));
+  }
+};
+
+/*! Multithreaded variant of searchMasterSegments
+
+The search runs in two phases:
+1) master triangles are distributed over threads and each thread collects the
+   (GP row, master triangle) pairs which pass the inside-outside test,
+2) the pairs are sorted by GP rows and each GP row is processed by exactly one
+   thread, which tests its master triangles in the same order as the serial
+   search (ascending segment, then triangle).
+Hence there are no write races in the GPs table and the result (including the
+"closest master wins" rule) is identical to the serial run.
+*/
+template <int NSD, int NPD, int NSN, class GaussPoints, class Buckets>
+static void searchMasterSegmentsInParallel(const GaussPoints& gps, const Buckets& buckets, const int* ISN, const int* IEN, const int* N, const double* AABBmin, const double* AABBmax, const double* X, const int* elementID, const int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge) {
+  const int numOfRows = n*ngp;
+  const int ntr = getNumberOfTriangles(nsn);
+
+  std::vector<std::vector<std::pair<int, int> > > threadPairs(numberOfThreads);
+
+  // 1st phase - broad phase and inside-outside test over master triangles:
+#ifdef _OPENMP
+#pragma omp parallel num_threads(numberOfThreads)
+#endif
+  {
+    CONTACT_PROFILE_PHASE(CONTACT_PHASE_SEARCH);
+#ifdef _OPENMP
+    std::vector<std::pair<int, int> >& pairs = threadPairs[omp_get_thread_num()];
+#else
+    std::vector<std::pair<int, int> >& pairs = threadPairs[0];
+#endif
+    MasterFacet f;
+    f.exclusion = getSearchExclusion(n, ngp);
+
+    CandidateCollector<NSD, NSN, GaussPoints> visitor;
+    visitor.gps = &gps;
+    visitor.f = &f;
+    visitor.pairs = &pairs;
+    visitor.nsn = nsn;
+    visitor.nsd = nsd;
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 16)
+#endif
+    for (int e = 0; e < n; ++e) {
+      setMasterSegment(f, e, ISN, IEN, X, elementID, segmentID, nsn, nsd, nen, nes, neq, longestEdge);
+
+      for (int it = 0; it < ntr; ++it) {
+        setMasterTriangle(f, it, nsn, nsd, longestEdge);
+        visitor.facet = e*ntr + it;
+
+        int Imin[3];
+        int Imax[3];
+        getCellRange(Imin, Imax, f.Xmin, f.Xmax, N, AABBmin, AABBmax, nsd);
+
+        for (int i2 = Imin[2]; i2 <= Imax[2]; ++i2) {
+          for (int i1 = Imin[1]; i1 <= Imax[1]; ++i1) {
+            for (int i0 = Imin[0]; i0 <= Imax[0]; ++i0) {
+              buckets.visit(i2*N[0] * N[1] + i1*N[0] + i0, visitor);
+            }
+          }
+        }
+      }
+    }
+  }
+
+  // Sort the pairs by GP rows (counting sort):
+  int* pairStart = new int[numOfRows + 1];
+  for (int v = 0; v <= numOfRows; ++v) {
+    pairStart[v] = 0;
+  }
+  int numOfPairs = 0;
+  for (int t = 0; t < numberOfThreads; ++t) {
+    for (size_t p = 0; p < threadPairs[t].size(); ++p) {
+      pairStart[threadPairs[t][p].first + 1]++;
+    }
+    numOfPairs += (int)threadPairs[t].size();
+  }
+  for (int v = 0; v < numOfRows; ++v) {
+    pairStart[v + 1] += pairStart[v];
+  }
+  int* pairFacets = new int[numOfPairs];
+  int* cursor = new int[numOfRows];
+  for (int v = 0; v < numOfRows; ++v) {
+    cursor[v] = pairStart[v];
+  }
+  for (int t = 0; t < numberOfThreads; ++t) {
+    for (size_t p = 0; p < threadPairs[t].size(); ++p) {
+      pairFacets[cursor[threadPairs[t][p].first]++] = threadPairs[t][p].second;
+    }
+    std::vector<std::pair<int, int> >().swap(threadPairs[t]);
+  }
+  delete[] cursor;
+
+  // 2nd phase - local projection, each GP row is owned by one thread:
+#ifdef _OPENMP
+#pragma omp parallel num_threads(numberOfThreads)
+#endif
+  {
+    CONTACT_PROFILE_PHASE(CONTACT_PHASE_SEARCH);
+    double* Hm = new double[nsn];
+    double* dHm = new double[nsn*npd];
+    MasterFacet f;
+    f.exclusion = getSearchExclusion(n, ngp);
+    int lastSegment = -1;
+    ContactStats stats = ContactStats();
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 256)
+#endif
+    for (int v = 0; v < numOfRows; ++v) {
+      std::sort(pairFacets + pairStart[v], pairFacets + pairStart[v + 1]);
+
+      for (int p = pairStart[v]; p < pairStart[v + 1]; ++p) {
+        const int e = pairFacets[p] / ntr;
+        if (e != lastSegment) {
+          setMasterSegment(f, e, ISN, IEN, X, elementID, segmentID, nsn, nsd, nen, nes, neq, longestEdge);
+          lastSegment = e;
+        }
+        setMasterTriangle(f, pairFacets[p] % ntr, nsn, nsd, longestEdge);
+        searchGaussPoint<NSD, NPD, NSN>(gps, v, f, Hm, dHm, nsn, nsd, npd, stats);
+      }
+    }
+
+    addContactStats(contactStats, stats);
+    delete[] Hm;
+    delete[] dHm;
+  }
+
+  delete[] pairStart;
+  delete[] pairFacets;
+}
+
+/*! Loop over master segments (and their triangles) and test Gauss points of all overlapped buckets
+
+NSD, NPD, NSN - compile-time nsd, npd and nsn (0 means the run-time value), see searchMasterSegmentsSpecialized
+*/
+template <int NSD, int NPD, int NSN, class GaussPoints, class Buckets>
+static void searchMasterSegments(const GaussPoints& gps, const Buckets& buckets, const int* ISN, const int* IEN, const int* N, const double* AABBmin, const double* AABBmax, const double* X, const int* elementID, const int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge) {
+
+  // GPs legend:              Xg     els  sgs   gap    Xi_m  isActive      elm      sgm      isStick      t_T       Xi0_m
+  //double* GPs = new double[n*(nsd + 1 +  1  +  1  +  npd  +   1     +     1    +   1     +    1    +    npd   +    npd    ];
+  //index of begining           0    nsd nsd+1 nsd+2  nsd+3  nsd+npd+3  nsd+npd+4 nsd+npd+5 nsd+npd+6  nsd+npd+7 nsd+2*npd+7  (size = nsd+3*npd+7)
+
+  // Initialize the gap by MINUS float max value (because negative is OPEN gap:
+  int numOfRows = n*ngp;
+  for (int row = 0; row < numOfRows; ++row) {
+    gps.setGap(row, -FLT_MAX);
+  }
+
+  if (numberOfThreads > 1) {
+    searchMasterSegmentsInParallel<NSD, NPD, NSN>(gps, buckets, ISN, IEN, N, AABBmin, AABBmax, X, elementID, segmentID, n, nsn, nsd, npd, ngp, nen, nes, neq, longestEdge);
+    return;
+  }
+  CONTACT_PROFILE_PHASE(CONTACT_PHASE_SEARCH);
+
+  double* Hm = new double[nsn];
+  double* dHm = new double[nsn*npd];
+
+  MasterFacet f;
+  f.exclusion = getSearchExclusion(n, ngp);
+
+  // Number of TRiangles:
+  const int ntr = getNumberOfTriangles(nsn);
+
+  GaussPointSearch<NSD, NPD, NSN, GaussPoints> visitor;
+  visitor.gps = &gps;
+  visitor.f = &f;
+  visitor.Hm = Hm;
+  visitor.dHm = dHm;
+  visitor.nsn = nsn;
+  visitor.nsd = nsd;
+  visitor.npd = npd;
+  visitor.stats = ContactStats();
+
+  // Loop over contact segments:
+  for (int e = 0; e < n; ++e) {
+    setMasterSegment(f, e, ISN, IEN, X, elementID, segmentID, nsn, nsd, nen, nes, neq, longestEdge);
+
+    // Loop over segment triangles:
+    for (int it = 0; it < ntr; ++it) {
+      setMasterTriangle(f, it, nsn, nsd, longestEdge);
+
+      int Imin[3];
+      int Imax[3];
+      getCellRange(Imin, Imax, f.Xmin, f.Xmax, N, AABBmin, AABBmax, nsd);
+
+      for (int i2 = Imin[2]; i2 <= Imax[2]; ++i2) {
+        for (int i1 = Imin[1]; i1 <= Imax[1]; ++i1) {
+          for (int i0 = Imin[0]; i0 <= Imax[0]; ++i0) {
+            const int Ic = i2*N[0] * N[1] + i1*N[0] + i0;
+
+            // Contact searching algorithm based on buckets ( DOI: 10.1007/BF02487690, DOI: 10.1007/s00466-014-1058-5):
+            // v sequentially refers to the row in the GPs table of all Gauss points that lie in the "bucket" with the index Ic.
+            buckets.visit(Ic, visitor);
+          } // i0
+        } // i1
+      } // i2
+    } // loop over triangles
+  } // loop over elements
+
+  addContactStats(contactStats, visitor.stats);
+  delete[] Hm;
+  delete[] dHm;
+}
+
+/*! Master-centric search by the specialised kernel
+
+As in assembleContactRowsSpecialized, the search with compile-time sizes is instantiated
+for 2D linear segments, 3D 8-node quadrilaterals and 3D 6-node triangles; other segments
+use the generic search.
+*/
+template <class GaussPoints, class Buckets>
+static void searchMasterSegmentsSpecialized(const GaussPoints& gps, const Buckets& buckets, const int* ISN, const int* IEN, const int* N, const double* AABBmin, const double* AABBmax, const double* X, const int* elementID, const int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge) {
+  typedef void (*Search)(const GaussPoints&, const Buckets&, const int*, const int*, const int*, const double*, const double*, const double*, const int*, const int*, int, int, int, int, int, int, int, int, double);
+  struct SearchEntry {
+    int nsd;
+    int npd;
+    int nsn;
+    Search search;
+  };
+  static const SearchEntry searches[] = {
+    {2, 1, 2, &searchMasterSegments<2, 1, 2, GaussPoints, Buckets>},
+    {3, 2, 8, &searchMasterSegments<3, 2, 8, GaussPoints, Buckets>},
+    {3, 2, 4, &searchMasterSegments<3, 2, 4, GaussPoints, Buckets>},
+    {3, 2, 6, &searchMasterSegments<3, 2, 6, GaussPoints, Buckets>}
+  };
+
+  for (size_t k = 0; k < sizeof(searches) / sizeof(searches[0]); ++k) {
+    if (searches[k].nsd == nsd && searches[k].npd == npd && searches[k].nsn == nsn) {
+      searches[k].search(gps, buckets, ISN, IEN, N, AABBmin, AABBmax, X, elementID, segmentID, n, nsn, nsd, npd, ngp, nen, nes, neq, longestEdge);
+      return;
+    }
+  }
+  searchMasterSegments<0, 0, 0>(gps, buckets, ISN, IEN, N, AABBmin, AABBmax, X, elementID, segmentID, n, nsn, nsd, npd, ngp, nen, nes, neq, longestEdge);
+}
+
+/*! Find the closest master segment for all Gauss points using buckets stored as linked lists
+
+\param GPs - 2d array (GPs_len x ??? cols)
+\param ISN - 2d array (nsn*)
+\param IEN -
+\param N - number of buckets in each direction
+\param AABBmin - minimal coords of the axis-aligned bounding box of the contact surface
+\param AABBmax - maximal coords of the axis-aligned bounding box of the contact surface
+\param head - index of the first GPs row in each bucket (-1 for an empty bucket)
+\param next - index of the next GPs row in the same bucket (-1 at the end of the list)
+\param X - 2d array of contact nodal coordinates
+\param elementID -
+\param segmentID -
+\param n - number of contact segments
+\param nsn - Number of Segment Nodes
+\param nsd - Number of Space Dimensions
+\param npd - Number of Parametric Dimensions
+\param ngp - Number of Gauss Points
+\param nen - Number of Element Nodes
+\param nes - Number of Element Segments
+\param neq - Number of EQuations
+\param longestEdge - length of the longest edge of all contact segments
+
+\return GPs - 1d array
+*/
+void evaluateContactConstraints(double* GPs, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, int* head, int* next, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge) {
+  CONTACT_PROFILE_FUNCTION();
+  LinkedListBuckets buckets;
+  buckets.head = head;
+  buckets.next = next;
+
+  searchMasterSegmentsSpecialized(GaussPointTable(GPs, n*ngp, nsd, npd), buckets, ISN, IEN, N, AABBmin, AABBmax, X, elementID, segmentID, n, nsn, nsd, npd, ngp, nen, nes, neq, longestEdge);
+}
+
+/*! Number of buckets of the grid with approximately cubic cells of the given size
+
+\param AABBmin - minimal coords of the axis-aligned bounding box (see getAABB)
+\param AABBmax - maximal coords of the axis-aligned bounding box (see getAABB)
+\param nsd - Number of Space Dimensions
+\param cellSize - requested edge length of a bucket (usually longestEdge)
+
+\return N - 1d array (3x1) of the number of buckets in each direction
+\return numOfCells - total number of buckets, i.e. N[0]*N[1]*N[2]
+*/
+void getBucketGridSize(int* N, int* numOfCells, double* AABBmin, double* AABBmax, int nsd, double cellSize) {
+  CONTACT_PROFILE_FUNCTION();
+  N[2] = 1;
+  for (int sdf = 0; sdf < nsd; ++sdf) {
+    N[sdf] = 1;
+    if (cellSize > 0.0) {
+      N[sdf] = std::max(1, (int)((AABBmax[sdf] - AABBmin[sdf]) / cellSize));
+    }
+  }
+  *numOfCells = N[0]*N[1]*N[2];
+}
+
+// Default mean number of Gauss points per non-empty bucket of getAutoBucketGridSize:
+static const double defaultBucketOccupancy = 4.0;
+// Upper bound of the number of buckets per Gauss point of getAutoBucketGridSize:
+static const double maxBucketsPerGaussPoint = 16.0;
+
+/*! Number of buckets of the grid tuned to the given mean occupancy of non-empty buckets
+
+Gauss points lie on surfaces, i.e. only a layer of buckets along the contact surfaces is
+occupied. The surface area is estimated by two surfaces (slave and master) spanning the
+largest extents of the bounding box, and the cell size is chosen so that the occupied
+buckets contain targetOccupancy Gauss points on average. The cell size is bounded from below
+by 0.5*longestEdge (smaller buckets only add visits to the search of a master segment, which
+is extended by 0.5*longestEdge) and the number of buckets is bounded by
+maxBucketsPerGaussPoint*numOfGPs (otherwise it grows quadratically with the number of
+segments in 2D). Directions of a degenerate extent (e.g. a planar surface) get a single bucket.
+
+\param AABBmin - minimal coords of the axis-aligned bounding box (see getAABB)
+\param AABBmax - maximal coords of the axis-aligned bounding box (see getAABB)
+\param nsd - Number of Space Dimensions
+\param longestEdge - longest edge of contact segments (see getLongestEdgeAndGPs)
+\param numOfGPs - number of Gauss points to be sorted into buckets (number of rows of the GPs table)
+\param targetOccupancy - mean number of Gauss points per non-empty bucket (targetOccupancy <= 0 means the default value 4)
+
+\return N - 1d array (3x1) of the number of buckets in each direction
+\return numOfCells - total number of buckets, i.e. N[0]*N[1]*N[2]
+*/
+void getAutoBucketGridSize(int* N, int* numOfCells, double* AABBmin, double* AABBmax, int nsd, double longestEdge, int numOfGPs, double targetOccupancy) {
+  CONTACT_PROFILE_FUNCTION();
+  if (targetOccupancy <= 0.0) {
+    targetOccupancy = defaultBucketOccupancy;
+  }
+
+  // Extents in descending order (degenerate ones are skipped):
+  double extent[3];
+  int numOfExtents = 0;
+  double maxExtent = 0.0;
+  for (int sdf = 0; sdf < nsd; ++sdf) {
+    maxExtent = std::max(maxExtent, AABBmax[sdf] - AABBmin[sdf]);
+  }
+  for (int sdf = 0; sdf < nsd; ++sdf) {
+    const double e = AABBmax[sdf] - AABBmin[sdf];
+    if (e > 1e-12*maxExtent) {
+      extent[numOfExtents++] = e;
+    }
+  }
+  std::sort(extent, extent + numOfExtents);
+  std::reverse(extent, extent + numOfExtents);
+
+  double cellSize = 0.0;
+  if (numOfExtents > 0 && numOfGPs > 0) {
+    // Surface dimension (a surface in a box of a lower dimension fills it):
+    const int dim = std::max(1, std::min(nsd - 1, numOfExtents));
+    double area = 2.0;
+    for (int k = 0; k < dim; ++k) {
+      area *= extent[k];
+    }
+    cellSize = pow(targetOccupancy * area / numOfGPs, 1.0 / dim);
+    cellSize = std::max(cellSize, 0.5*longestEdge);
+
+    // Bound the total number of buckets (cells of the size of the extent are counted as one):
+    const double maxCells = std::min((double)INT_MAX - 1, std::max(1.0, maxBucketsPerGaussPoint*numOfGPs));
+    double cells = 1.0;
+    int numOfSplit = 0;
+    for (int k = 0; k < numOfExtents; ++k) {
+      if (extent[k] > cellSize) {
+        cells *= extent[k] / cellSize;
+        numOfSplit++;
+      }
+    }
+    if (cells > maxCells) {
+      cellSize *= pow(cells / maxCells, 1.0 / numOfSplit);
+    }
+  }
+
+  N[2] = 1;
+  for (int sdf = 0; sdf < nsd; ++sdf) {
+    N[sdf] = 1;
+    const double e = AABBmax[sdf] - AABBmin[sdf];
+    if (cellSize > 0.0 && e > 1e-12*maxExtent) {
+      N[sdf] = std::max(1, (int)(e / cellSize));
+    }
+  }
+  *numOfCells = N[0]*N[1]*N[2];
+}
+
+/*! Sort the given rows of the Gauss point state into buckets (counting sort)
+
+\param searchRows - rows to be sorted (NULL means all rows)
+\param numOfSearchRows - number of rows to be sorted
+*/
+template <class GaussPoints>
+static void sortGaussPointsIntoBuckets(int* cellStart, int* cellGPs, const GaussPoints& gps, const int* searchRows, int numOfSearchRows, const int* N, const double* AABBmin, const double* AABBmax, int nsd) {
+  CONTACT_PROFILE_PHASE(CONTACT_PHASE_BINNING);
+  const int numOfCells = N[0]*N[1]*(nsd == 3 ? N[2] : 1);
+  double Xg[3];
+
+  for (int Ic = 0; Ic <= numOfCells; ++Ic) {
+    cellStart[Ic] = 0;
+  }
+
+  // Count Gauss points in buckets:
+  for (int i = 0; i < numOfSearchRows; ++i) {
+    const int v = searchRows ? searchRows[i] : i;
+    for (int sdf = 0; sdf < nsd; ++sdf) {
+      Xg[sdf] = gps.x(sdf, v);
+    }
+    cellStart[getCellIndex(Xg, N, AABBmin, AABBmax, nsd) + 1]++;
+  }
+
+#ifdef CONTACTINO_PROFILING
+  CONTACT_PROFILE_COUNT(numOfBinnedGPs, numOfSearchRows);
+  CONTACT_PROFILE_COUNT(numOfCells, numOfCells);
+  for (int Ic = 0; Ic < numOfCells; ++Ic) {
+    CONTACT_PROFILE_COUNT(numOfEmptyCells, cellStart[Ic + 1] == 0);
+    CONTACT_PROFILE_MAX(maxBucketSize, cellStart[Ic + 1]);
+  }
+#endif
+
+  for (int Ic = 0; Ic < numOfCells; ++Ic) {
+    cellStart[Ic + 1] += cellStart[Ic];
+  }
+
+  // Scatter Gauss points (cellStart[Ic] is used as the insertion cursor and it is shifted back then):
+  for (int i = 0; i < numOfSearchRows; ++i) {
+    const int v = searchRows ? searchRows[i] : i;
+    for (int sdf = 0; sdf < nsd; ++sdf) {
+      Xg[sdf] = gps.x(sdf, v);
+    }
+    cellGPs[cellStart[getCellIndex(Xg, N, AABBmin, AABBmax, nsd)]++] = v;
+  }
+
+  for (int Ic = numOfCells; Ic > 0; --Ic) {
+    cellStart[Ic] = cellStart[Ic - 1];
+  }
+  cellStart[0] = 0;
+}
+
+/*! Sort Gauss points into buckets (counting sort, O(numOfRows))
+
+The result is a compressed (CSR) layout: Gauss points of the bucket Ic are stored
+in cellGPs[cellStart[Ic]], ..., cellGPs[cellStart[Ic+1]-1] in ascending order of
+their rows in the GPs table.
+
+\param GPs - 2d array (numOfRows x ??? cols), Gauss point coords in the first nsd cols
+\param N - number of buckets in each direction (see getBucketGridSize or getAutoBucketGridSize)
+\param AABBmin - minimal coords of the axis-aligned bounding box (see getAABB)
+\param AABBmax - maximal coords of the axis-aligned bounding box (see getAABB)
+\param nsd - Number of Space Dimensions
+\param numOfRows - number of rows of the GPs table
+
+\return cellStart - 1d array (N[0]*N[1]*N[2]+1) of offsets of buckets in cellGPs
+\return cellGPs - 1d array (numOfRows) of GPs rows sorted by buckets
+*/
+void buildBucketGrid(int* cellStart, int* cellGPs, double* GPs, int* N, double* AABBmin, double* AABBmax, int nsd, int numOfRows) {
+  CONTACT_PROFILE_FUNCTION();
+  // (only the coords are read, so npd is not needed)
+  sortGaussPointsIntoBuckets(cellStart, cellGPs, GaussPointTable(GPs, numOfRows, nsd, 0), NULL, numOfRows, N, AABBmin, AABBmax, nsd);
+}
+
+/*! The same as buildBucketGrid with the typed Gauss point state (C++ API) */
+void buildBucketGrid(int* cellStart, int* cellGPs, GaussPointState& state, int* N, double* AABBmin, double* AABBmax) {
+  CONTACT_PROFILE_FUNCTION();
+  sortGaussPointsIntoBuckets(cellStart, cellGPs, GaussPointArrays(state), NULL, state.numOfRows, N, AABBmin, AABBmax, state.nsd);
+}
+
+/*! Find the closest master segment for all Gauss points using buckets in the compressed layout
+
+The same as evaluateContactConstraints but the buckets are given by cellStart and cellGPs (see buildBucketGrid).
+The Gauss points of each overlapped bucket are tested against the master triangle in bulk
+(see PrefilteredBuckets) and only those inside it are projected.
+*/
+void evaluateContactConstraintsCSR(double* GPs, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, int* cellStart, int* cellGPs, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge) {
+  CONTACT_PROFILE_FUNCTION();
+  const GaussPointTable gps(GPs, n*ngp, nsd, npd);
+  const int numOfEntries = cellStart[N[0]*N[1]*(nsd == 3 ? N[2] : 1)];
+  std::vector<double> cellXg((size_t)nsd*numOfEntries);
+  gatherBucketCoords(cellXg.data(), cellGPs, numOfEntries, gps, nsd);
+
+  PrefilteredBuckets buckets;
+  buckets.cellStart = cellStart;
+  buckets.cellGPs = cellGPs;
+  buckets.cellXg = cellXg.data();
+  buckets.numOfEntries = numOfEntries;
+
+  searchMasterSegmentsSpecialized(gps, buckets, ISN, IEN, N, AABBmin, AABBmax, X, elementID, segmentID, n, nsn, nsd, npd, ngp, nen, nes, neq, longestEdge);
+}
+
+/*! The same as evaluateContactConstraintsCSR with the typed Gauss point state (C++ API) */
+void evaluateContactConstraintsCSR(GaussPointState& state, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, int* cellStart, int* cellGPs, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge) {
+  CONTACT_PROFILE_FUNCTION();
+  const GaussPointArrays gps(state);
+  const int numOfEntries = cellStart[N[0]*N[1]*(nsd == 3 ? N[2] : 1)];
+  std::vector<double> cellXg((size_t)nsd*numOfEntries);
+  gatherBucketCoords(cellXg.data(), cellGPs, numOfEntries, gps, nsd);
+
+  PrefilteredBuckets buckets;
+  buckets.cellStart = cellStart;
+  buckets.cellGPs = cellGPs;
+  buckets.cellXg = cellXg.data();
+  buckets.numOfEntries = numOfEntries;
+
+  searchMasterSegmentsSpecialized(gps, buckets, ISN, IEN, N, AABBmin, AABBmax, X, elementID, segmentID, n, nsn, nsd, npd, ngp, nen, nes, neq, longestEdge);
+}
+
+/*! Slave-centric search for the given rows of the GPs table (see evaluateContactConstraintsSlaveCentric)
+
+\param searchRows - rows of the GPs table to be searched (NULL means all rows)
+\param numOfSearchRows - number of rows to be searched
+*/
+static void searchGaussPointsSlaveCentric(double* GPs, const int* searchRows, int numOfSearchRows, const int* ISN, const int* IEN, const int* N, const double* AABBmin, const double* AABBmax, const double* X, const int* elementID, const int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge) {
+  const int numOfRows = n*ngp;
+  const int ntr = getNumberOfTriangles(nsn);
+  const int numOfFacets = n*ntr;
+  const int numOfCells = N[0]*N[1]*(nsd == 3 ? N[2] : 1);
+
+  // Initialize the gap by MINUS float max value (because negative is OPEN gap:
+  int colBegin = (nsd + 2) * numOfRows;
+  for (int i = 0; i < numOfSearchRows; ++i) {
+    GPs[colBegin + (searchRows ? searchRows[i] : i)] = -FLT_MAX;
+  }
+
+  // Gauss point buckets:
+  int* cellStart = new int[numOfCells + 1];
+  int* cellGPs = new int[numOfSearchRows];
+  sortGaussPointsIntoBuckets(cellStart, cellGPs, GaussPointTable(GPs, numOfRows, nsd, npd), searchRows, numOfSearchRows, N, AABBmin, AABBmax, nsd);
+
+  // Ranges of buckets overlapped by master triangles:
+  int* facetRange = new int[6*numOfFacets];
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(numberOfThreads) schedule(static)
+#endif
+  for (int e = 0; e < n; ++e) {
+    MasterFacet f;
+    setMasterSegment(f, e, ISN, IEN, X, elementID, segmentID, nsn, nsd, nen, nes, neq, longestEdge);
+    for (int it = 0; it < ntr; ++it) {
+      setMasterTriangle(f, it, nsn, nsd, longestEdge);
+      int* range = facetRange + 6*(e*ntr + it);
+      getCellRange(range, range + 3, f.Xmin, f.Xmax, N, AABBmin, AABBmax, nsd);
+    }
+  }
+
+  // Master triangle buckets (counting sort, triangles of each bucket in ascending order):
+  CONTACT_PROFILE_START(binningTime);
+  int* facetStart = new int[numOfCells + 1];
+  for (int Ic = 0; Ic <= numOfCells; ++Ic) {
+    facetStart[Ic] = 0;
+  }
+  for (int ifc = 0; ifc < numOfFacets; ++ifc) {
+    const int* Imin = facetRange + 6*ifc;
+    const int* Imax = Imin + 3;
+    for (int i2 = Imin[2]; i2 <= Imax[2]; ++i2) {
+      for (int i1 = Imin[1]; i1 <= Imax[1]; ++i1) {
+        for (int i0 = Imin[0]; i0 <= Imax[0]; ++i0) {
+          facetStart[i2*N[0] * N[1] + i1*N[0] + i0 + 1]++;
+        }
+      }
+    }
+  }
+  for (int Ic = 0; Ic < numOfCells; ++Ic) {
+    facetStart[Ic + 1] += facetStart[Ic];
+  }
+  int* cellFacets = new int[facetStart[numOfCells]];
+  for (int ifc = 0; ifc < numOfFacets; ++ifc) {
+    const int* Imin = facetRange + 6*ifc;
+    const int* Imax = Imin + 3;
+    for (int i2 = Imin[2]; i2 <= Imax[2]; ++i2) {
+      for (int i1 = Imin[1]; i1 <= Imax[1]; ++i1) {
+        for (int i0 = Imin[0]; i0 <= Imax[0]; ++i0) {
+          cellFacets[facetStart[i2*N[0] * N[1] + i1*N[0] + i0]++] = ifc;
+        }
+      }
+    }
+  }
+  for (int Ic = numOfCells; Ic > 0; --Ic) {
+    facetStart[Ic] = facetStart[Ic - 1];
+  }
+  facetStart[0] = 0;
+  delete[] facetRange;
+  CONTACT_PROFILE_LAP(binningTime, CONTACT_PHASE_BINNING);
+
+  // Loop over buckets, each Gauss point queries master triangles of its bucket:
+#ifdef _OPENMP
+#pragma omp parallel num_threads(numberOfThreads)
+#endif
+  {
+    CONTACT_PROFILE_PHASE(CONTACT_PHASE_SEARCH);
+    double* Hm = new double[nsn];
+    double* dHm = new double[nsn*npd];
+    MasterFacet f;
+    f.exclusion = getSearchExclusion(n, ngp);
+    int lastSegment = -1;
+    ContactStats stats = ContactStats();
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 16)
+#endif
+    for (int Ic = 0; Ic < numOfCells; ++Ic) {
+      if (cellStart[Ic] == cellStart[Ic + 1]) {
+        continue;
+      }
+      for (int p = facetStart[Ic]; p < facetStart[Ic + 1]; ++p) {
+        const int e = cellFacets[p] / ntr;
+        if (e != lastSegment) {
+          setMasterSegment(f, e, ISN, IEN, X, elementID, segmentID, nsn, nsd, nen, nes, neq, longestEdge);
+          lastSegment = e;
+        }
+        setMasterTriangle(f, cellFacets[p] % ntr, nsn, nsd, longestEdge);
+
+        CONTACT_PROFILE_COUNT(numOfCandidates, cellStart[Ic + 1] - cellStart[Ic]);
+        for (int q = cellStart[Ic]; q < cellStart[Ic + 1]; ++q) {
+          searchGaussPoint(GPs, cellGPs[q], numOfRows, f, Hm, dHm, nsn, nsd, npd, stats);
+        }
+      }
+    }
+
+    addContactStats(contactStats, stats);
+    delete[] Hm;
+    delete[] dHm;
+  }
+
+  delete[] cellStart;
+  delete[] cellGPs;
+  delete[] facetStart;
+  delete[] cellFacets;
+}
+
+/*! Find the closest master segment for all Gauss points by the slave-centric search
+
+Unlike evaluateContactConstraints, which loops over master segments and scans
+Gauss points of the overlapped buckets, here the master triangles are sorted
+into the bucket grid and each Gauss point queries the master triangles of its
+bucket. Gauss points are processed bucket by bucket so that the geometry of
+a master triangle is evaluated once per bucket. Each row of the GPs table is
+updated by exactly one thread (see setNumberOfThreads) and the master
+triangles are tested in the same order as in the master-centric search, so
+both searches give identical results.
+
+The arguments are the same as for evaluateContactConstraints, but no
+Gauss point buckets (head, next) are needed.
+*/
+void evaluateContactConstraintsSlaveCentric(double* GPs, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge) {
+  CONTACT_PROFILE_FUNCTION();
+  searchGaussPointsSlaveCentric(GPs, NULL, n*ngp, ISN, IEN, N, AABBmin, AABBmax, X, elementID, segmentID, n, nsn, nsd, npd, ngp, nen, nes, neq, longestEdge);
+}
+
+/*! Node of the bounding volume hierarchy over master triangles */
+struct BVHNode {
+  double Xmin[3];
+  double Xmax[3];
+  int right;        // index of the right child (the left child immediately follows its parent)
+  int first;        // index of the first triangle in ContactBVH::facets (leaf only)
+  int count;        // number of triangles (0 for an inner node)
+};
+
+/*! Bounding volume hierarchy over master triangles (see createContactBVH) */
+struct ContactBVH {
+  int n;                        // number of contact segments
+  int nsn;                      // Number of Segment Nodes
+  int nsd;                      // Number of Space Dimensions
+  std::vector<BVHNode> nodes;   // nodes in depth-first order
+  std::vector<int> facets;      // master triangles (e*ntr + it) sorted by leaves
+  std::vector<double> boxes;    // bounding boxes of master triangles (Xmin[3], Xmax[3])
+  std::vector<double> radius;   // extension of the boxes of each segment (see getFacetBoxes)
+  std::vector<int> adjStart;    // segment adjacency (see buildSegmentAdjacency)
+  std::vector<int> adj;
+};
+
+// Maximal number of triangles in a leaf of the BVH:
+static const int maxTrianglesInLeaf = 4;
+
+/*! Evaluate bounding boxes of all master triangles
+
+Each box is extended by one half of the longest edge of its own segment and of its
+neighbours (not of the longest edge of the whole contact surface), so that small segments
+get tight boxes, while the boxes do not shrink abruptly at the transitions of a graded mesh.
+*/
+static void getFacetBoxes(ContactBVH* bvh, const int* ISN, const int* IEN, const double* X, const int* elementID, const int* segmentID, int nen, int nes, int neq) {
+  const int n = bvh->n;
+  const int nsn = bvh->nsn;
+  const int nsd = bvh->nsd;
+  const int ntr = getNumberOfTriangles(nsn);
+  bvh->boxes.resize(6*n*ntr);
+  double* boxes = &bvh->boxes[0];
+
+  bvh->radius.resize(n);
+  double* radius = n > 0 ? &bvh->radius[0] : NULL;
+
+  // Half of the longest edge of each segment:
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(numberOfThreads) schedule(static)
+#endif
+  for (int e = 0; e < n; ++e) {
+    MasterFacet f;
+    setMasterSegment(f, e, ISN, IEN, X, elementID, segmentID, nsn, nsd, nen, nes, neq, 0.0);
+
+    double segmentEdge = 0.0;
+    for (int i = 0; i < nsn; ++i) {
+      for (int j = i+1; j < nsn; ++j) {
+        double lengthOfEdge = 0.0;
+        for (int sdf = 0; sdf < nsd; ++sdf) {
+          lengthOfEdge += (f.Xm[sdf*nsn + i] - f.Xm[sdf*nsn + j])*(f.Xm[sdf*nsn + i] - f.Xm[sdf*nsn + j]);
+        }
+        segmentEdge = std::max(segmentEdge, lengthOfEdge);
+      }
+    }
+    radius[e] = 0.5*sqrt(segmentEdge);
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(numberOfThreads) schedule(static)
+#endif
+  for (int e = 0; e < n; ++e) {
+    double extension = radius[e];
+    for (int p = bvh->adjStart[e]; p < bvh->adjStart[e + 1]; ++p) {
+      extension = std::max(extension, radius[bvh->adj[p]]);
+    }
+
+    MasterFacet f;
+    setMasterSegment(f, e, ISN, IEN, X, elementID, segmentID, nsn, nsd, nen, nes, neq, 0.0);
+    for (int it = 0; it < ntr; ++it) {
+      setMasterTriangle(f, it, nsn, nsd, 0.0);
+      double* box = boxes + 6*(e*ntr + it);
+      for (int k = 0; k < 3; ++k) {
+        box[k]     = k < nsd ? f.Xmin[k] - extension : 0.0;
+        box[3 + k] = k < nsd ? f.Xmax[k] + extension : 0.0;
+      }
+    }
+  }
+}
+
+/*! Recursively build the BVH over triangles facets[begin..end) by median splits, returns the node index */
+static int buildBVHNode(ContactBVH* bvh, int begin, int end) {
+  const int node = (int)bvh->nodes.size();
+  bvh->nodes.push_back(BVHNode());
+  const double* boxes = &bvh->boxes[0];
+  int* facets = &bvh->facets[0];
+
+  if (end - begin <= maxTrianglesInLeaf) {
+    bvh->nodes[node].first = begin;
+    bvh->nodes[node].count = end - begin;
+    bvh->nodes[node].right = -1;
+    return node;
+  }
+
+  // Split by the median along the longest extent of the triangle centroids:
+  double Cmin[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+  double Cmax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+  for (int i = begin; i < end; ++i) {
+    const double* box = boxes + 6*facets[i];
+    for (int k = 0; k < 3; ++k) {
+      Cmin[k] = std::min(Cmin[k], box[k] + box[3 + k]);
+      Cmax[k] = std::max(Cmax[k], box[k] + box[3 + k]);
+    }
+  }
+  int axis = 0;
+  for (int k = 1; k < 3; ++k) {
+    if (Cmax[k] - Cmin[k] > Cmax[axis] - Cmin[axis]) {
+      axis = k;
+    }
+  }
+
+  const int middle = begin + (end - begin) / 2;
+  std::nth_element(facets + begin, facets + middle, facets + end, [boxes, axis](int a, int b) {
+    const double ca = boxes[6*a + axis] + boxes[6*a + 3 + axis];
+    const double cb = boxes[6*b + axis] + boxes[6*b + 3 + axis];
+    return ca < cb || (ca == cb && a < b);
+  });
+
+  bvh->nodes[node].first = -1;
+  bvh->nodes[node].count = 0;
+  buildBVHNode(bvh, begin, middle);
+  const int right = buildBVHNode(bvh, middle, end);
+  bvh->nodes[node].right = right;
+  return node;
+}
+
+/*! Evaluate boxes of BVH nodes bottom-up from the boxes of master triangles */
+static void refitBVHNodes(ContactBVH* bvh) {
+  const double* boxes = &bvh->boxes[0];
+  for (int node = (int)bvh->nodes.size() - 1; node >= 0; --node) {
+    BVHNode& b = bvh->nodes[node];
+    for (int k = 0; k < 3; ++k) {
+      b.Xmin[k] = FLT_MAX;
+      b.Xmax[k] = -FLT_MAX;
+    }
+    if (b.count > 0) {
+      for (int i = b.first; i < b.first + b.count; ++i) {
+        const double* box = boxes + 6*bvh->facets[i];
+        for (int k = 0; k < 3; ++k) {
+          b.Xmin[k] = std::min(b.Xmin[k], box[k]);
+          b.Xmax[k] = std::max(b.Xmax[k], box[3 + k]);
+        }
+      }
+    }
+    else {
+      // children have larger indices, so they are already refitted:
+      const BVHNode& left = bvh->nodes[node + 1];
+      const BVHNode& right = bvh->nodes[b.right];
+      for (int k = 0; k < 3; ++k) {
+        b.Xmin[k] = std::min(left.Xmin[k], right.Xmin[k]);
+        b.Xmax[k] = std::max(left.Xmax[k], right.Xmax[k]);
+      }
+    }
+  }
+}
+
+/*! Build the bounding volume hierarchy (BVH) over master segments and their triangles
+
+The BVH is an alternative broad phase to the uniform bucket grid. It adapts to
+strongly graded meshes because the box of each master triangle is extended by
+one half of the longest edge of its own segment and its neighbours only (see
+evaluateContactConstraintsBVH for the consequence). When only the nodal
+coords change (e.g. X+U between iterations), use refitContactBVH instead of
+building a new hierarchy.
+
+\param ISN, IEN, X, elementID, segmentID, n, nsn, nsd, nen, nes, neq - see evaluateContactConstraints
+
+\return handle to the BVH, which has to be released by destroyContactBVH
+*/
+ContactBVH* createContactBVH(int* ISN, int* IEN, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int nen, int nes, int neq) {
+  CONTACT_PROFILE_FUNCTION();
+  CONTACT_PROFILE_PHASE(CONTACT_PHASE_BINNING);
+  ContactBVH* bvh = new ContactBVH;
+  bvh->n = n;
+  bvh->nsn = nsn;
+  bvh->nsd = nsd;
+
+  bvh->adjStart.resize(n + 1);
+  buildSegmentAdjacency(&bvh->adjStart[0], NULL, ISN, IEN, elementID, segmentID, n, nsn, nen, nes, neq / nsd);
+  bvh->adj.resize(bvh->adjStart[n] + 1);
+  buildSegmentAdjacency(&bvh->adjStart[0], &bvh->adj[0], ISN, IEN, elementID, segmentID, n, nsn, nen, nes, neq / nsd);
+
+  const int numOfFacets = n*getNumberOfTriangles(nsn);
+  getFacetBoxes(bvh, ISN, IEN, X, elementID, segmentID, nen, nes, neq);
+
+  bvh->facets.resize(numOfFacets);
+  for (int i = 0; i < numOfFacets; ++i) {
+    bvh->facets[i] = i;
+  }
+  bvh->nodes.reserve(2*(numOfFacets / maxTrianglesInLeaf + 1));
+  if (numOfFacets > 0) {
+    buildBVHNode(bvh, 0, numOfFacets);
+  }
+  refitBVHNodes(bvh);
+  return bvh;
+}
+
+/*! Update boxes of the BVH for new nodal coords X while keeping its topology
+
+\param bvh - handle returned by createContactBVH (for the same contact segments)
+*/
+void refitContactBVH(ContactBVH* bvh, int* ISN, int* IEN, double* X, int* elementID, int* segmentID, int nen, int nes, int neq) {
+  CONTACT_PROFILE_FUNCTION();
+  CONTACT_PROFILE_PHASE(CONTACT_PHASE_BINNING);
+  getFacetBoxes(bvh, ISN, IEN, X, elementID, segmentID, nen, nes, neq);
+  refitBVHNodes(bvh);
+}
+
+/*! Release the BVH created by createContactBVH */
+void destroyContactBVH(ContactBVH* bvh) {
+  CONTACT_PROFILE_FUNCTION();
+  delete bvh;
+}
+
+/*! Find the closest master segment for all Gauss points using the BVH broad phase
+
+Each Gauss point traverses the BVH, the master triangles whose boxes contain the
+Gauss point are tested in ascending order (as in the other searches) and each
+row of the GPs table is updated by exactly one thread (see setNumberOfThreads).
+
+The boxes are extended by one half of the longest edge of the master segment and
+its neighbours, not of the whole contact surface as in the bucket searches (which
+round the boxes up to whole buckets, too). A Gauss point that penetrates a master
+segment deeper than this local radius is not found, so for deep penetrations of
+segments smaller than the longest edge the active set may be smaller than that of
+evaluateContactConstraintsCSR. Use the bucket searches if such penetrations are
+expected.
+
+\param bvh - handle returned by createContactBVH (or refitContactBVH) for the coords X
+\param GPs, ISN, IEN, X, elementID, segmentID, n, nsn, nsd, npd, ngp, nen, nes, neq - see evaluateContactConstraints
+*/
+void evaluateContactConstraintsBVH(double* GPs, ContactBVH* bvh, int* ISN, int* IEN, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq) {
+  CONTACT_PROFILE_FUNCTION();
+  const int numOfRows = n*ngp;
+  const int ntr = getNumberOfTriangles(nsn);
+
+  // Initialize the gap by MINUS float max value (because negative is OPEN gap:
+  int colBegin = (nsd + 2) * numOfRows;
+  for (int row = 0; row < numOfRows; ++row) {
+    GPs[colBegin + row] = -FLT_MAX;
+  }
+
+  if (bvh->nodes.empty()) {
+    return;
+  }
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(numberOfThreads)
+#endif
+  {
+    CONTACT_PROFILE_PHASE(CONTACT_PHASE_SEARCH);
+    double* Hm = new double[nsn];
+    double* dHm = new double[nsn*npd];
+    MasterFacet f;
+    f.exclusion = getSearchExclusion(n, ngp);
+    std::vector<int> stack;
+    std::vector<int> candidates;
+    ContactStats stats = ContactStats();
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 256)
+#endif
+    for (int v = 0; v < numOfRows; ++v) {
+      double Xg[3];
+      Xg[2] = 0.0;
+      for (int sdf = 0; sdf < nsd; ++sdf) {
+        Xg[sdf] = GPs[sdf*numOfRows + v];
+      }
+
+      candidates.clear();
+      stack.clear();
+      stack.push_back(0);
+      while (!stack.empty()) {
+        const BVHNode& b = bvh->nodes[stack.back()];
+        const int node = stack.back();
+        stack.pop_back();
+
+        bool isInside = true;
+        for (int k = 0; k < nsd; ++k) {
+          if (Xg[k] < b.Xmin[k] || Xg[k] > b.Xmax[k]) {
+            isInside = false;
+          }
+        }
+        if (!isInside) {
+          continue;
+        }
+
+        if (b.count > 0) {
+          for (int i = b.first; i < b.first + b.count; ++i) {
+            const double* box = &bvh->boxes[6*bvh->facets[i]];
+            bool isInsideBox = true;
+            for (int k = 0; k < nsd; ++k) {
+              if (Xg[k] < box[k] || Xg[k] > box[3 + k]) {
+                isInsideBox = false;
+              }
+            }
+            if (isInsideBox) {
+              candidates.push_back(bvh->facets[i]);
+            }
+          }
+        }
+        else {
+          stack.push_back(b.right);
+          stack.push_back(node + 1);
+        }
+      }
+
+      std::sort(candidates.begin(), candidates.end());
+      CONTACT_PROFILE_COUNT(numOfCandidates, (long long)candidates.size());
+      int lastSegment = -1;
+      for (size_t p = 0; p < candidates.size(); ++p) {
+        const int e = candidates[p] / ntr;
+        if (e != lastSegment) {
+          setMasterSegment(f, e, ISN, IEN, X, elementID, segmentID, nsn, nsd, nen, nes, neq, 0.0);
+          lastSegment = e;
+        }
+        setMasterTriangle(f, candidates[p] % ntr, nsn, nsd, 0.0);
+        searchGaussPoint(GPs, v, numOfRows, f, Hm, dHm, nsn, nsd, npd, stats);
+      }
+    }
+
+    addContactStats(contactStats, stats);
+    delete[] Hm;
+    delete[] dHm;
+  }
+}
+
+/*! Update Gauss point coords (first nsd cols of the GPs table) for new nodal coords X
+
+Unlike getLongestEdgeAndGPs, the other cols of the GPs table (gaps, master segments,
+parametric coords, tractions, ...) are kept, so that the history of the contact
+search is preserved (see evaluateContactConstraintsIncremental).
+
+\param GPs - 2d array (n*ngp x ??? cols)
+\param X - 2d array of nodal coordinates (usually X+U)
+\param n, nsd, ngp, neq, nsn, nes, nen, elementID, segmentID, ISN, IEN, H - see getLongestEdgeAndGPs
+*/
+void updateGaussPointCoords(double* GPs, int n, int nsd, int ngp, int neq, int nsn, int nes, int nen, int* elementID, int* segmentID, int* ISN, int* IEN, double* H, double* X) {
+  CONTACT_PROFILE_FUNCTION();
+  CONTACT_PROFILE_PHASE(CONTACT_PHASE_SURFACE);
+  const int numOfRows = n*ngp;
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(numberOfThreads) schedule(static)
+#endif
+  for (int e = 0; e < n; ++e) {
+    MasterFacet f;
+    setMasterSegment(f, e, ISN, IEN, X, elementID, segmentID, nsn, nsd, nen, nes, neq, 0.0);
+    for (int i = 0; i < ngp; ++i) {
+      for (int sdf = 0; sdf < nsd; ++sdf) {
+        double Xg = 0.0;
+        for (int j = 0; j < nsn; ++j) {
+          Xg += H[j*ngp + i] * f.Xm[sdf*nsn + j];
+        }
+        GPs[sdf*numOfRows + e*ngp + i] = Xg;
+      }
+    }
+  }
+}
+
+/*! Lists of contact segments sharing at least one node with each contact segment
+
+The neighbours of the e-th segment are stored in adj[adjStart[e]], ..., adj[adjStart[e+1]-1]
+in ascending order (the segment itself is not included). If adj is NULL, only adjStart is
+evaluated, so that the caller can allocate adj (of length adjStart[n]) and call the
+function again.
+
+\param ISN, IEN, elementID, segmentID, n, nsn, nen, nes - see evaluateContactConstraints
+\param nnod - number of nodes
+
+\return adjStart - 1d array (n+1) of offsets
+\return adj - 1d array (adjStart[n]) of neighbouring segments (0-based rows of elementID, segmentID)
+*/
+void buildSegmentAdjacency(int* adjStart, int* adj, int* ISN, int* IEN, int* elementID, int* segmentID, int n, int nsn, int nen, int nes, int nnod) {
+  CONTACT_PROFILE_FUNCTION();
+  CONTACT_PROFILE_PHASE(CONTACT_PHASE_SURFACE);
+  // Segment nodes:
+  int* segmentNodes = new int[n*nsn];
+  for (int e = 0; e < n; ++e) {
+    const int el = elementID[e] - 1;
+    const int sg = segmentID[e] - 1;
+    for (int j = 0; j < nsn; ++j) {
+      const int IENrow = ISN[nes*j + sg] - 1; // Matlab numbering starts with 1
+      segmentNodes[e*nsn + j] = IEN[nen*el + IENrow] - 1; // Matlab numbering starts with 1
+    }
+  }
+
+  // Segments of each node (counting sort):
+  int* nodeStart = new int[nnod + 1];
+  for (int i = 0; i <= nnod; ++i) {
+    nodeStart[i] = 0;
+  }
+  for (int i = 0; i < n*nsn; ++i) {
+    nodeStart[segmentNodes[i] + 1]++;
+  }
+  for (int i = 0; i < nnod; ++i) {
+    nodeStart[i + 1] += nodeStart[i];
+  }
+  int* nodeSegments = new int[n*nsn];
+  for (int i = 0; i < n*nsn; ++i) {
+    nodeSegments[nodeStart[segmentNodes[i]]++] = i / nsn;
+  }
+  for (int i = nnod; i > 0; --i) {
+    nodeStart[i] = nodeStart[i - 1];
+  }
+  nodeStart[0] = 0;
+
+  std::vector<int> neighbours;
+  adjStart[0] = 0;
+  for (int e = 0; e < n; ++e) {
+    neighbours.clear();
+    for (int j = 0; j < nsn; ++j) {
+      const int node = segmentNodes[e*nsn + j];
+      for (int p = nodeStart[node]; p < nodeStart[node + 1]; ++p) {
+        if (nodeSegments[p] != e) {
+          neighbours.push_back(nodeSegments[p]);
+        }
+      }
+    }
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+
+    if (adj) {
+      for (size_t p = 0; p < neighbours.size(); ++p) {
+        adj[adjStart[e] + p] = neighbours[p];
+      }
+    }
+    adjStart[e + 1] = adjStart[e] + (int)neighbours.size();
+  }
+
+  delete[] segmentNodes;
+  delete[] nodeStart;
+  delete[] nodeSegments;
+}
+
+/*! Find the row of elementID and segmentID of the segment (el, sg), returns -1 if the segment is not a contact segment
+
+\param keys - sorted pairs (el*nes + sg, row)
+*/
+static int findContactSegment(const std::vector<std::pair<long long, int> >& keys, int el, int sg, int nes) {
+  const long long key = (long long)el*nes + sg;
+  std::vector<std::pair<long long, int> >::const_iterator it = std::lower_bound(keys.begin(), keys.end(), std::make_pair(key, -1));
+  if (it == keys.end() || it->first != key) {
+    return -1;
+  }
+  return it->second;
+}
+
+/*! Incremental (temporally coherent) contact search
+
+Each Gauss point which has a master segment from the previous search (elm, sgm cols of
+the GPs table) is first projected onto this master segment and its neighbours (see
+buildSegmentAdjacency) only. The full search (see evaluateContactConstraintsSlaveCentric)
+is performed only for Gauss points
+- without a master segment,
+- whose projection left the previous master segment and all its neighbours,
+- which moved more than skin since their last full search (Verlet-skin style).
+
+The Gauss point coords in the GPs table have to be updated without resetting its other
+cols (see updateGaussPointCoords).
+
+\param Xg0 - 2d array (n*ngp x nsd) of Gauss point coords at their last full search,
+             updated for the Gauss points searched fully by this call (fill it by FLT_MAX
+             to force the full search of all Gauss points)
+\param adjStart, adj - segment adjacency (see buildSegmentAdjacency)
+\param skin - maximal displacement of a Gauss point without the full search (skin <= 0 means the full search of all Gauss points)
+\param GPs, ISN, IEN, N, AABBmin, AABBmax, X, elementID, segmentID, n, nsn, nsd, npd, ngp, nen, nes, neq, longestEdge - see evaluateContactConstraints
+*/
+void evaluateContactConstraintsIncremental(double* GPs, double* Xg0, int* adjStart, int* adj, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge, double skin) {
+  CONTACT_PROFILE_FUNCTION();
+  const int numOfRows = n*ngp;
+  const int ntr = getNumberOfTriangles(nsn);
+
+  std::vector<std::pair<long long, int> > keys(n);
+  for (int e = 0; e < n; ++e) {
+    keys[e] = std::make_pair((long long)(elementID[e] - 1)*nes + segmentID[e] - 1, e);
+  }
+  std::sort(keys.begin(), keys.end());
+
+  char* isFullSearch = new char[numOfRows];
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(numberOfThreads)
+#endif
+  {
+    CONTACT_PROFILE_PHASE(CONTACT_PHASE_SEARCH);
+    double* Hm = new double[nsn];
+    double* dHm = new double[nsn*npd];
+    MasterFacet f;
+    f.exclusion = getSearchExclusion(n, ngp);
+    std::vector<int> segments;
+    ContactStats stats = ContactStats();
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 256)
+#endif
+    for (int v = 0; v < numOfRows; ++v) {
+      isFullSearch[v] = 1;
+
+      const int elm = (int)GPs[(nsd + npd + 4)*numOfRows + v] - 1; // Matlab numbering starts with 1
+      const int sgm = (int)GPs[(nsd + npd + 5)*numOfRows + v] - 1; // Matlab numbering starts with 1
+      if (elm < 0 || skin <= 0.0) {
+        continue;
+      }
+
+      double displacement = 0.0;
+      for (int sdf = 0; sdf < nsd; ++sdf) {
+        const double dX = GPs[sdf*numOfRows + v] - Xg0[sdf*numOfRows + v];
+        displacement += dX*dX;
+      }
+      if (!(displacement <= skin*skin)) {
+        continue;
+      }
+
+      const int e0 = findContactSegment(keys, elm, sgm, nes);
+      if (e0 < 0) {
+        continue;
+      }
+
+      // The previous master segment and its neighbours in ascending order:
+      segments.assign(adj + adjStart[e0], adj + adjStart[e0 + 1]);
+      segments.insert(std::lower_bound(segments.begin(), segments.end(), e0), e0);
+
+      GPs[(nsd + 2)*numOfRows + v] = -FLT_MAX;
+      CONTACT_PROFILE_COUNT(numOfCandidates, (long long)segments.size()*ntr);
+      for (size_t p = 0; p < segments.size(); ++p) {
+        setMasterSegment(f, segments[p], ISN, IEN, X, elementID, segmentID, nsn, nsd, nen, nes, neq, longestEdge);
+        for (int it = 0; it < ntr; ++it) {
+          setMasterTriangle(f, it, nsn, nsd, longestEdge);
+          searchGaussPoint(GPs, v, numOfRows, f, Hm, dHm, nsn, nsd, npd, stats);
+        }
+      }
+
+      if (GPs[(nsd + 2)*numOfRows + v] > -FLT_MAX) {
+        isFullSearch[v] = 0;
+      }
+    }
+
+    addContactStats(contactStats, stats);
+    delete[] Hm;
+    delete[] dHm;
+  }
+
+  // Full search of the remaining Gauss points:
+  std::vector<int> searchRows;
+  for (int v = 0; v < numOfRows; ++v) {
+    if (isFullSearch[v]) {
+      searchRows.push_back(v);
+      for (int sdf = 0; sdf < nsd; ++sdf) {
+        Xg0[sdf*numOfRows + v] = GPs[sdf*numOfRows + v];
+      }
+    }
+  }
+  delete[] isFullSearch;
+
+  if (!searchRows.empty()) {
+    searchGaussPointsSlaveCentric(GPs, &searchRows[0], (int)searchRows.size(), ISN, IEN, N, AABBmin, AABBmax, X, elementID, segmentID, n, nsn, nsd, npd, ngp, nen, nes, neq, longestEdge);
+  }
+}
+
+/*! Persistent data of the contact evaluation (see createContactContext)
+
+Contact segments are numbered by their rows e of elementID and segmentID. The Gauss
+point state of the context refers to segments by these rows (els = e, sgs = 0), so
+the shared search and assembly kernels read the segment nodes through the trivial
+connectivity segmentISN (1 x nsn) and segmentIEN (n x nsn) instead of ISN and IEN.
+*/
+struct ContactContext {
+  int n;                                          // number of contact segments
+  int nsn;                                        // Number of Segment Nodes
+  int nsd;                                        // Number of Space Dimensions
+  int npd;                                        // Number of Parametric Dimensions
+  int ngp;                                        // Number of Gauss Points of a segment
+  int nes;                                        // Number of Element Segments (of ISN)
+  int neq;                                        // Number of EQuations
+  std::vector<int> elementID;                     // 1-based, as given
+  std::vector<int> segmentID;                     // 1-based, as given
+  std::vector<std::pair<long long, int> > keys;   // sorted pairs (el*nes + sg, e), see findContactSegment
+  std::vector<int> segmentNodes;                  // 0-based nodes of segments, segmentNodes[e*nsn + j]
+  std::vector<int> segmentISN;                    // connectivity of the kernels (1-based)
+  std::vector<int> segmentIEN;
+  std::vector<int> segmentElementID;
+  std::vector<int> segmentSegmentID;
+  std::vector<double> H;                          // shape functions at Gauss points (nsn x ngp)
+  std::vector<double> dH;                         // their derivatives (nsn x npd*ngp)
+  std::vector<double> gw;                         // Gauss weights (ngp)
+  GaussPointState state;
+  double longestEdge;
+  double AABBmin[3];
+  double AABBmax[3];
+  int N[3];                                       // number of buckets in each direction
+  std::vector<int> cellStart;                     // bucket grid (see buildBucketGrid)
+  std::vector<int> cellGPs;
+  std::vector<double> cellXg;                     // bucket-sorted Gauss point coords (see gatherBucketCoords)
+  std::vector<double> x;                          // scratch: current nodal coords X+U (neq)
+  std::vector<uint8_t> activeOld;                 // scratch: activeGPsOld of the assembly
+  // Contact of the previous updateContactContextSparsityPattern and its tangent pattern:
+  std::vector<uint8_t> previousActive;
+  std::vector<int> previousMaster;                // master segments of the Gauss points (-1 if inactive)
+  std::vector<long long> pairs;                   // coupled segments (see getContactContextPairs)
+  std::vector<int> rowPtr;                        // empty if there is no pattern yet
+  std::vector<int> colInd;
+  int patternNsg;
+};
+
+/*! Create the context of the contact evaluation for the given contact segments
+
+The context resolves the segment nodes once and keeps the bucket grid, the scratch
+arrays and the Gauss point state between calls, so that updateContactContext and
+assembleContactResidualAndStiffnessContext need only the current nodal coords and
+displacements. The Gauss point state is initialized as by getLongestEdgeAndGPs.
+
+\param ISN, IEN, elementID, segmentID, n, nsn, nsd, npd, ngp, nen, nes, neq - see evaluateContactConstraints
+\param H, dH, gw - shape functions, their derivatives and weights at Gauss points (see assembleContactResidualAndStiffness)
+
+\return handle to the context, which has to be released by destroyContactContext
+*/
+ContactContext* createContactContext(int* ISN, int* IEN, int* elementID, int* segmentID, double* H, double* dH, double* gw, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq) {
+  CONTACT_PROFILE_FUNCTION();
+  ContactContext* ctx = new ContactContext;
+  ctx->n = n;
+  ctx->nsn = nsn;
+  ctx->nsd = nsd;
+  ctx->npd = npd;
+  ctx->ngp = ngp;
+  ctx->nes = nes;
+  ctx->neq = neq;
+  ctx->elementID.assign(elementID, elementID + n);
+  ctx->segmentID.assign(segmentID, segmentID + n);
+  ctx->H.assign(H, H + nsn*ngp);
+  ctx->dH.assign(dH, dH + nsn*npd*ngp);
+  ctx->gw.assign(gw, gw + ngp);
+
+  ctx->keys.resize(n);
+  ctx->segmentNodes.resize(n*nsn);
+  ctx->segmentIEN.resize(n*nsn);
+  ctx->segmentElementID.resize(n);
+  ctx->segmentSegmentID.assign(n, 1);
+  for (int e = 0; e < n; ++e) {
+    const int el = elementID[e] - 1; // Matlab numbering starts with 1
+    const int sg = segmentID[e] - 1; // Matlab numbering starts with 1
+    ctx->keys[e] = std::make_pair((long long)el*nes + sg, e);
+    for (int j = 0; j < nsn; ++j) {
+      ctx->segmentNodes[e*nsn + j] = IEN[nen*el + ISN[nes*j + sg] - 1] - 1; // Matlab numbering starts with 1
+      ctx->segmentIEN[e*nsn + j] = ctx->segmentNodes[e*nsn + j] + 1;
+    }
+    ctx->segmentElementID[e] = e + 1;
+  }
+  std::sort(ctx->keys.begin(), ctx->keys.end());
+  ctx->segmentISN.resize(nsn);
+  for (int j = 0; j < nsn; ++j) {
+    ctx->segmentISN[j] = j + 1;
+  }
+
+  // Gauss point state (see getLongestEdgeAndGPs):
+  const int numOfRows = n*ngp;
+  GaussPointState& state = ctx->state;
+  state.numOfRows = numOfRows;
+  state.nsd = nsd;
+  state.npd = npd;
+  state.Xg.assign(nsd*numOfRows, 0.0);
+  state.els.resize(numOfRows);
+  state.sgs.assign(numOfRows, 0);
+  state.gap.assign(numOfRows, -FLT_MAX);
+  state.Xi_m.assign(npd*numOfRows, 0.0);
+  state.isActive.assign(numOfRows, 0);
+  state.elm.assign(numOfRows, -1);
+  state.sgm.assign(numOfRows, -1);
+  state.isStick.assign(numOfRows, 0);
+  state.t_T.assign(npd*numOfRows, 0.0);
+  state.Xi0_m.assign(npd*numOfRows, 0.0);
+  state.t_N0.assign(numOfRows, 0.0);
+  for (int v = 0; v < numOfRows; ++v) {
+    state.els[v] = v / ngp;
+  }
+
+  ctx->longestEdge = 0.0;
+  for (int k = 0; k < 3; ++k) {
+    ctx->AABBmin[k] = 0.0;
+    ctx->AABBmax[k] = 0.0;
+    ctx->N[k] = 1;
+  }
+  ctx->cellGPs.resize(numOfRows);
+  ctx->cellXg.resize(nsd*numOfRows);
+  ctx->x.resize(neq);
+  ctx->activeOld.resize(numOfRows);
+  ctx->patternNsg = 0;
+  return ctx;
+}
+
+/*! Release the context created by createContactContext */
+void destroyContactContext(ContactContext* ctx) {
+  CONTACT_PROFILE_FUNCTION();
+  delete ctx;
+}
+
+/*! Pre-resolved nodes of contact segments of the context, nodes[e*nsn + j] */
+struct ContextSegmentNodes {
+  const int* nodes;
+  int nsn;
+
+  int operator()(int e, int j) const {
+    return nodes[e*nsn + j];
+  }
+};
+
+/*! Gauss point coords, longest edge and bounding box of the contact surface for the current coords ctx->x
+
+The same as updateGaussPointCoords, getLongestEdgeAndGPs and getAABB in one pass over
+the pre-resolved segment nodes (see evaluateSurfaceGeometry).
+*/
+static void updateContactContextGeometry(ContactContext* ctx) {
+  ContextSegmentNodes nodes;
+  nodes.nodes = &ctx->segmentNodes[0];
+  nodes.nsn = ctx->nsn;
+
+  for (int sdf = ctx->nsd; sdf < 3; ++sdf) {
+    ctx->AABBmin[sdf] = 0.0;
+    ctx->AABBmax[sdf] = 0.0;
+  }
+  evaluateSurfaceGeometry(&ctx->longestEdge, ctx->AABBmin, ctx->AABBmax, &ctx->state.Xg[0], nodes, NoGaussPointInit(), &ctx->x[0], &ctx->H[0], ctx->n, ctx->nsn, ctx->nsd, ctx->ngp, ctx->neq / ctx->nsd);
+}
+
+/*! Update the context for new nodal coords and find the closest master segment for all Gauss points
+
+The Gauss point coords, the longest edge, the bounding box and the bucket grid (see getAutoBucketGridSize) are evaluated
+for the current coords X+U and the master-centric search (see evaluateContactConstraintsCSR)
+is performed. The active set and the gaps are evaluated again, the other cols of the Gauss
+point state (master segments, parametric coords, tractions, ...) are kept, so the search is
+warm started from the previous master segments. The arrays of the context are reallocated
+only when the bucket grid grows.
+
+\param ctx - handle returned by createContactContext
+\param X - 2d array of nodal coordinates
+\param U - 2d array of nodal displacements (NULL means zero displacements)
+*/
+void updateContactContext(ContactContext* ctx, double* X, double* U) {
+  CONTACT_PROFILE_FUNCTION();
+  const int neq = ctx->neq;
+  const int nsd = ctx->nsd;
+  for (int i = 0; i < neq; ++i) {
+    ctx->x[i] = U ? X[i] + U[i] : X[i];
+  }
+
+  updateContactContextGeometry(ctx);
+
+  int numOfCells;
+  getAutoBucketGridSize(ctx->N, &numOfCells, ctx->AABBmin, ctx->AABBmax, nsd, ctx->longestEdge, ctx->state.numOfRows, 0.0);
+  ctx->cellStart.resize(numOfCells + 1);
+
+  GaussPointState& state = ctx->state;
+  std::fill(state.isActive.begin(), state.isActive.end(), 0);
+  const GaussPointArrays gps(state);
+  sortGaussPointsIntoBuckets(&ctx->cellStart[0], &ctx->cellGPs[0], gps, NULL, state.numOfRows, ctx->N, ctx->AABBmin, ctx->AABBmax, nsd);
+
+  gatherBucketCoords(&ctx->cellXg[0], &ctx->cellGPs[0], state.numOfRows, gps, nsd);
+
+  PrefilteredBuckets buckets;
+  buckets.cellStart = &ctx->cellStart[0];
+  buckets.cellGPs = &ctx->cellGPs[0];
+  buckets.cellXg = &ctx->cellXg[0];
+  buckets.numOfEntries = state.numOfRows;
+  searchMasterSegmentsSpecialized(gps, buckets, &ctx->segmentISN[0], &ctx->segmentIEN[0], ctx->N, ctx->AABBmin, ctx->AABBmax, &ctx->x[0], &ctx->segmentElementID[0], &ctx->segmentSegmentID[0], ctx->n, ctx->nsn, nsd, ctx->npd, ctx->ngp, ctx->nsn, 1, neq, ctx->longestEdge);
+}
+
+/*! Active set of the assembly: activeGPsOld (see assembleContactResidualAndStiffness) or the current one if it is NULL */
+static const uint8_t* getContactContextActiveSet(ContactContext* ctx, const double* activeGPsOld) {
+  if (activeGPsOld == NULL) {
+    return &ctx->state.isActive[0];
+  }
+  for (int v = 0; v < ctx->state.numOfRows; ++v) {
+    ctx->activeOld[v] = activeGPsOld[v] != 0.0;
+  }
+  return &ctx->activeOld[0];
+}
+
+/*! Sparsity pattern (CSR) of the contact tangent for the current state of the context
+
+\param ctx - handle returned by createContactContext
+\param activeGPsOld - 1d array (n*ngp), NULL means the active set of the last updateContactContext
+\param nsg - see assembleContactResidualAndStiffness
+
+\return rowPtr, colInd - see buildContactSparsityPattern
+*/
+void buildContactContextSparsityPattern(int* rowPtr, int* colInd, ContactContext* ctx, double* activeGPsOld, int nsg) {
+  CONTACT_PROFILE_FUNCTION();
+  const GaussPointArrays gps(ctx->state, getContactContextActiveSet(ctx, activeGPsOld));
+  buildContactPattern(rowPtr, colInd, gps, &ctx->segmentISN[0], &ctx->segmentIEN[0], ctx->neq, ctx->nsd, ctx->ngp, 1, ctx->nsn, ctx->nsn, ctx->state.numOfRows, nsg, false);
+}
+
+/*! Pairs (slave segment)*n + (master segment) coupled by active Gauss points of the rows below nsg, sorted
+
+The sparsity pattern of the contact tangent depends only on these pairs (see buildContactPattern).
+*/
+static void getContactContextPairs(std::vector<long long>& pairs, const ContactContext* ctx, const uint8_t* active, int nsg) {
+  const GaussPointState& state = ctx->state;
+  pairs.clear();
+  for (int v = 0; v < nsg; ++v) {
+    if (active[v] && state.elm[v] >= 0) {
+      pairs.push_back((long long)state.els[v]*ctx->n + state.elm[v]);
+    }
+  }
+  std::sort(pairs.begin(), pairs.end());
+  pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+}
+
+/*! Detect changes of the contact since the previous call and update the sparsity pattern kept by the context
+
+The active set and the master segments of the slave Gauss points (rows below nsg) are
+compared with those of the previous call, all flags are set when nsg changes. The pattern is rebuilt only when the coupled pairs of slave and master segments
+change, otherwise the pattern (and so the positions of values of the tangent) stays the same,
+so that the symbolic factorization of the system matrix can be reused. If no flag is returned,
+the contact tangent differs from the previous one only by the values (e.g. the numeric
+factorization can be kept for modified Newton steps).
+
+\param ctx - handle returned by createContactContext
+\param activeGPsOld - 1d array (n*ngp), NULL means the active set of the last updateContactContext
+\param nsg - see assembleContactResidualAndStiffness
+
+\return nnz - number of entries of the pattern, see getContactContextSparsityPattern
+\return bit flags ContactChangeFlags (all are set by the first call)
+*/
+int updateContactContextSparsityPattern(int* nnz, ContactContext* ctx, double* activeGPsOld, int nsg) {
+  CONTACT_PROFILE_FUNCTION();
+  GaussPointState& state = ctx->state;
+  const int numOfRows = state.numOfRows;
+  const uint8_t* active = getContactContextActiveSet(ctx, activeGPsOld);
+
+  // Only the slave rows below nsg contribute to the tangent (see getContactContextPairs):
+  int changes = CONTACT_CHANGE_NONE;
+  if (ctx->rowPtr.empty() || nsg != ctx->patternNsg) {
+    changes = CONTACT_CHANGE_ACTIVE_SET | CONTACT_CHANGE_PAIRS;
+    ctx->previousActive.resize(numOfRows);
+    ctx->previousMaster.resize(numOfRows);
+  }
+  else {
+    for (int v = 0; v < nsg; ++v) {
+      if ((active[v] != 0) != (ctx->previousActive[v] != 0)) {
+        changes |= CONTACT_CHANGE_ACTIVE_SET;
+      }
+      else if (active[v] && state.elm[v] != ctx->previousMaster[v]) {
+        changes |= CONTACT_CHANGE_PAIRS;
+      }
+    }
+  }
+  for (int v = 0; v < nsg; ++v) {
+    ctx->previousActive[v] = active[v] != 0;
+    ctx->previousMaster[v] = active[v] ? state.elm[v] : -1;
+  }
+
+  std::vector<long long> pairs;
+  getContactContextPairs(pairs, ctx, active, nsg);
+  if (ctx->rowPtr.empty() || nsg != ctx->patternNsg || pairs != ctx->pairs) {
+    const GaussPointArrays gps(state, active);
+    ctx->rowPtr.resize(ctx->neq + 1);
+    buildContactPattern(&ctx->rowPtr[0], NULL, gps, &ctx->segmentISN[0], &ctx->segmentIEN[0], ctx->neq, ctx->nsd, ctx->ngp, 1, ctx->nsn, ctx->nsn, numOfRows, nsg, false);
+    ctx->colInd.resize(ctx->rowPtr[ctx->neq]);
+    buildContactPattern(&ctx->rowPtr[0], ctx->colInd.empty() ? NULL : &ctx->colInd[0], gps, &ctx->segmentISN[0], &ctx->segmentIEN[0], ctx->neq, ctx->nsd, ctx->ngp, 1, ctx->nsn, ctx->nsn, numOfRows, nsg, false);
+    ctx->pairs.swap(pairs);
+    ctx->patternNsg = nsg;
+    changes |= CONTACT_CHANGE_PATTERN;
+  }
+
+  *nnz = ctx->rowPtr[ctx->neq];
+  return changes;
+}
+
+/*! Copy the sparsity pattern kept by the context (see updateContactContextSparsityPattern)
+
+\param ctx - handle returned by createContactContext
+
+\return rowPtr - 1d array (neq + 1), see buildContactSparsityPattern
+\return colInd - 1d array (nnz)
+*/
+void getContactContextSparsityPattern(int* rowPtr, int* colInd, ContactContext* ctx) {
+  CONTACT_PROFILE_FUNCTION();
+  if (ctx->rowPtr.empty()) {
+    return;
+  }
+  std::copy(ctx->rowPtr.begin(), ctx->rowPtr.end(), rowPtr);
+  std::copy(ctx->colInd.begin(), ctx->colInd.end(), colInd);
+}
+
+/*! Calculate contact residual and contact tangent for the current state of the context
+
+The same as assembleContactResidualAndStiffnessCSR, the connectivity, the shape functions
+and the Gauss point state are taken from the context.
+
+\param ctx - handle returned by createContactContext
+\param rowPtr, colInd - sparsity pattern from buildContactContextSparsityPattern (or getContactContextSparsityPattern)
+\param X, U - nodal coordinates and displacements
+\param activeGPsOld - 1d array (n*ngp), NULL means the active set of the last updateContactContext
+\param epsN, epsT, mu, keyContactDetection, keyAssembleKc, isAxisymmetric, nsg - see assembleContactResidualAndStiffness
+
+\return Gc - 1d array (neq)
+\return vals - 1d array (rowPtr[neq]) of values of the contact tangent
+*/
+void assembleContactResidualAndStiffnessContext(double* Gc, double* vals, int* rowPtr, int* colInd, ContactContext* ctx, double* X, double* U, double* activeGPsOld, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg)
+{
+  CONTACT_PROFILE_FUNCTION();
+  const ContactAssemblyData data = getContactAssemblyData(&ctx->segmentISN[0], &ctx->segmentIEN[0], X, U, &ctx->H[0], &ctx->dH[0], &ctx->gw[0], ctx->neq, ctx->nsd, ctx->npd, ctx->ngp, 1, ctx->nsn, ctx->nsn, ctx->state.numOfRows, epsN, epsT, mu, keyContactDetection, keyAssembleKc, isAxisymmetric, nsg);
+  assembleContactCSR(data, GaussPointArrays(ctx->state, getContactContextActiveSet(ctx, activeGPsOld)), Gc, vals, rowPtr, colInd);
+}
+
+/*! Copy the Gauss point state of the context to the GPs table (see getLongestEdgeAndGPs)
+
+\param ctx - handle returned by createContactContext
+
+\return GPs - 2d array (n*ngp x (nsd + 3*npd + 8))
+*/
+void getContactContextGPs(double* GPs, ContactContext* ctx) {
+  CONTACT_PROFILE_FUNCTION();
+  const GaussPointState& state = ctx->state;
+  const int numOfRows = state.numOfRows;
+  const int nsd = ctx->nsd;
+  const int npd = ctx->npd;
+
+  convertStateToGPs(GPs, state);
+
+  // Rows of contact segments to element and segment IDs:
+  for (int v = 0; v < numOfRows; ++v) {
+    const int e = state.els[v];
+    GPs[nsd*numOfRows + v] = ctx->elementID[e];
+    GPs[(nsd + 1)*numOfRows + v] = ctx->segmentID[e];
+    const int em = state.elm[v];
+    GPs[(nsd + npd + 4)*numOfRows + v] = em >= 0 ? ctx->elementID[em] : 0;
+    GPs[(nsd + npd + 5)*numOfRows + v] = em >= 0 ? ctx->segmentID[em] : 0;
+  }
+}
+
+/*! Replace the Gauss point state of the context by the GPs table (e.g. a saved converged state)
+
+\param ctx - handle returned by createContactContext
+\param GPs - 2d array (n*ngp x (nsd + 3*npd + 8)) of the same contact segments, see getContactContextGPs
+*/
+void setContactContextGPs(ContactContext* ctx, double* GPs) {
+  CONTACT_PROFILE_FUNCTION();
+  GaussPointState& state = ctx->state;
+  convertGPsToState(state, GPs, ctx->n*ctx->ngp, ctx->nsd, ctx->npd);
+
+  // Element and segment IDs to rows of contact segments:
+  for (int v = 0; v < state.numOfRows; ++v) {
+    state.els[v] = v / ctx->ngp;
+    state.sgs[v] = 0;
+    state.elm[v] = state.elm[v] >= 0 ? findContactSegment(ctx->keys, state.elm[v], state.sgm[v], ctx->nes) : -1;
+    state.sgm[v] = state.elm[v] >= 0 ? 0 : -1;
+  }
+}
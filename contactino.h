@@ -1,31 +1,235 @@
-//contactino.h
-#ifndef contactino_H
-#define contactino_H
-
-#ifdef __cplusplus
-	extern "C" {  // only need to export C interface if used by C++ source code
-#endif
-
-#ifdef _WIN32
-    void __declspec(dllexport) sfd2(double* H, double* dH, double r);
-    void __declspec(dllexport) sfd4(double* H, double* dH, double r, double s);
-	void __declspec(dllexport) sfd6(double* H, double* dH, double r, double s);
-	void __declspec(dllexport) getAABB(double* AABBmin, double* AABBmax, int nsd, int nnod, double* X, double longestEdge, int* IEN, int* ISN, int* elementID, int* segmentID, int n, int nsn, int nes, int nen, int neq);
-    void __declspec(dllexport) assembleContactResidualAndStiffness(double* Gc_loc, double* Gc, double* Kc, double* vals, double* rows, double* cols, int* len, double* GPs, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg);
-	void __declspec(dllexport) getLongestEdgeAndGPs(double* longestEdge, double* GPs, int n, int nsd, int npd, int ngp, int neq, int nsn, int nes, int nen, int* elementID, int* segmentID, int* ISN, int* IEN, double* H, double* X);
-	void __declspec(dllexport) evaluateContactConstraints(double* GPs, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, int* head, int* next, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge);
-#else
-	void sfd2(double* H, double* dH, double r);
-    void sfd4(double* H, double* dH, double r, double s);
-    void sfd6(double* H, double* dH, double r, double s);
-	void getAABB(double* AABBmin, double* AABBmax, int nsd, int nnod, double* X, double longestEdge, int* IEN, int* ISN, int* elementID, int* segmentID, int n, int nsn, int nes, int nen, int neq);
-	void assembleContactResidualAndStiffness(double* Gc_loc, double* Gc, double* Kc, double* vals, double* rows, double* cols, int* len, double* GPs, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg);
-	void getLongestEdgeAndGPs(double* longestEdge, double* GPs, int n, int nsd, int npd, int ngp, int neq, int nsn, int nes, int nen, int* elementID, int* segmentID, int* ISN, int* IEN, double* H, double* X);
-	void evaluateContactConstraints(double* GPs, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, int* head, int* next, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge);
-#endif
-
-#ifdef __cplusplus
-}
-#endif
-
-#endif  // CONTACTINO_H
+//contactino.h
+#ifndef contactino_H
+#define contactino_H
+
+#ifdef __cplusplus
+	extern "C" {  // only need to export C interface if used by C++ source code
+#endif
+
+	typedef struct ContactBVH ContactBVH;
+	typedef struct ContactContext ContactContext;
+	typedef struct ContactOperator ContactOperator;
+
+	/*! Statistics of the contact search and assembly (see setContactStatsOutput) */
+	typedef struct ContactStats {
+		int numOfActiveGPs;               // active Gauss points assembled (activeGPsOld)
+		int numOfStickGPs;                // active Gauss points in the stick state
+		int numOfSlipGPs;                 // active Gauss points in the slip state
+		int numOfProjections;             // local projections onto master segments
+		long long numOfNewtonIterations;  // Newton iterations of all projections
+		int numOfNotConverged;            // projections which did not converge
+		int numOfOutsideElement;          // projections outside the master segment
+		int numOfMissingTriplets;         // triplets which did not fit into rows, cols and vals
+		int numOfMissingEntries;          // tangent entries which are not in the CSR pattern
+	} ContactStats;
+
+	/*! Phases of the contact search and assembly measured by the profiling (see getContactProfile)
+
+	The phases nest, e.g. CONTACT_PHASE_CELL_RANGE, CONTACT_PHASE_INSIDE_TEST and
+	CONTACT_PHASE_PROJECTION are parts of CONTACT_PHASE_SEARCH.
+	*/
+	enum ContactProfilePhase {
+		CONTACT_PHASE_SURFACE = 0,        // Gauss point coords, longest edge and bounding box
+		CONTACT_PHASE_BINNING,            // sorting Gauss points (or master triangles) into buckets, BVH build
+		CONTACT_PHASE_SEARCH,             // loops of the contact search (per thread)
+		CONTACT_PHASE_CELL_RANGE,         // bucket ranges of master triangles
+		CONTACT_PHASE_INSIDE_TEST,        // bulk inside-outside tests of buckets (see evaluateContactConstraintsCSR)
+		CONTACT_PHASE_PROJECTION,         // local projections onto master segments
+		CONTACT_PHASE_PATTERN,            // sparsity pattern of the contact tangent
+		CONTACT_PHASE_RESIDUAL,           // kinematics, tractions and residual of active Gauss points
+		CONTACT_PHASE_STIFFNESS,          // tangent entries of active Gauss points
+		CONTACT_PHASE_MERGE,              // merging the outputs of threads
+		CONTACT_PROFILE_NUM_PHASES
+	};
+
+	/*! Changes of the contact since the previous call of updateContactContextSparsityPattern (bit flags) */
+	enum ContactChangeFlags {
+		CONTACT_CHANGE_NONE = 0,
+		CONTACT_CHANGE_ACTIVE_SET = 1,    // some Gauss points became active or inactive
+		CONTACT_CHANGE_PAIRS = 2,         // some Gauss points active in both calls changed their master segment
+		CONTACT_CHANGE_PATTERN = 4        // the sparsity pattern of the contact tangent was rebuilt
+	};
+
+#define CONTACT_PROFILE_HISTOGRAM_SIZE 16
+#define CONTACT_PROFILE_MAX_FUNCTIONS 64
+#define CONTACT_PROFILE_NAME_LENGTH 64
+
+	/*! Timings and counters of the contact search and assembly (see getContactProfile)
+
+	The profiling is compiled in only if the library is built with CONTACTINO_ENABLE_PROFILING,
+	times are wall times in seconds.
+	*/
+	typedef struct ContactProfile {
+		double phaseTime[CONTACT_PROFILE_NUM_PHASES];
+		long long phaseCalls[CONTACT_PROFILE_NUM_PHASES];
+		long long numOfCellRanges;        // bucket ranges evaluated (master triangles)
+		long long numOfBucketVisits;      // buckets overlapped by master triangles
+		long long numOfCandidates;        // Gauss points of visited buckets (or of visited facets)
+		long long numOfInsideRejects;     // candidates rejected by the inside-outside test
+		long long numOfProjections;       // local projections onto master segments
+		long long numOfNewtonIterations;  // Newton iterations of all projections
+		long long iterationHistogram[CONTACT_PROFILE_HISTOGRAM_SIZE]; // projections by the number of iterations (the last bin includes more iterations)
+		long long bytesWritten;           // bytes written to the output arrays (Gc, triplets, CSR values and pattern)
+		long long numOfBinnedGPs;         // Gauss points sorted into buckets
+		long long numOfCells;             // buckets of all sorts
+		long long numOfEmptyCells;        // empty buckets of all sorts
+		long long maxBucketSize;          // the largest bucket
+		int numOfFunctions;               // exported functions called (total profile only)
+		char functionNames[CONTACT_PROFILE_MAX_FUNCTIONS][CONTACT_PROFILE_NAME_LENGTH];
+		double functionTime[CONTACT_PROFILE_MAX_FUNCTIONS];
+		long long functionCalls[CONTACT_PROFILE_MAX_FUNCTIONS];
+	} ContactProfile;
+
+#ifdef _WIN32
+    void __declspec(dllexport) sfd2(double* H, double* dH, double r);
+    void __declspec(dllexport) sfd4(double* H, double* dH, double r, double s);
+	void __declspec(dllexport) sfd6(double* H, double* dH, double r, double s);
+	void __declspec(dllexport) sfd8(double* H, double* dH, double r, double s);
+	void __declspec(dllexport) sfd2Batch(double* H, double* dH, const double* r, int np);
+	void __declspec(dllexport) sfd4Batch(double* H, double* dH, const double* r, const double* s, int np);
+	void __declspec(dllexport) sfd6Batch(double* H, double* dH, const double* r, const double* s, int np);
+	void __declspec(dllexport) sfd8Batch(double* H, double* dH, const double* r, const double* s, int np);
+	void __declspec(dllexport) getAABB(double* AABBmin, double* AABBmax, int nsd, int nnod, double* X, double longestEdge, int* IEN, int* ISN, int* elementID, int* segmentID, int n, int nsn, int nes, int nen, int neq);
+	void __declspec(dllexport) prepareContactSurface(double* longestEdge, double* AABBmin, double* AABBmax, double* GPs, int n, int nsd, int npd, int ngp, int neq, int nsn, int nes, int nen, int* elementID, int* segmentID, int* ISN, int* IEN, double* H, double* X);
+    void __declspec(dllexport) assembleContactResidualAndStiffness(double* Gc_loc, double* Gc, double* Kc, double* vals, double* rows, double* cols, int* len, double* GPs, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg);
+    void __declspec(dllexport) countContactTriplets(int* len, double* GPs, double* activeGPsOld, int nsd, int npd, int ngp, int nsn, int GPs_len, double epsN, bool keyAssembleKc, int nsg);
+    void __declspec(dllexport) buildContactSparsityPattern(int* rowPtr, int* colInd, double* GPs, int* ISN, int* IEN, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, int nsg);
+    void __declspec(dllexport) assembleContactResidualAndStiffnessCSR(double* Gc, double* vals, int* rowPtr, int* colInd, double* GPs, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg);
+    void __declspec(dllexport) buildContactBlockSparsityPattern(int* blockRowPtr, int* blockColInd, double* GPs, int* ISN, int* IEN, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, int nsg);
+    void __declspec(dllexport) assembleContactResidualAndStiffnessBSR(double* Gc, double* blockVals, int* blockRowPtr, int* blockColInd, double* GPs, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg);
+    ContactOperator* __declspec(dllexport) createContactOperator(void);
+    void __declspec(dllexport) destroyContactOperator(ContactOperator* op);
+    void __declspec(dllexport) assembleContactResidualAndOperator(double* Gc, ContactOperator* op, double* GPs, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool isAxisymmetric, int nsg);
+    void __declspec(dllexport) applyContactStiffness(double* y, double* v, ContactOperator* op);
+	void __declspec(dllexport) getLongestEdgeAndGPs(double* longestEdge, double* GPs, int n, int nsd, int npd, int ngp, int neq, int nsn, int nes, int nen, int* elementID, int* segmentID, int* ISN, int* IEN, double* H, double* X);
+	void __declspec(dllexport) evaluateContactConstraints(double* GPs, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, int* head, int* next, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge);
+	void __declspec(dllexport) getBucketGridSize(int* N, int* numOfCells, double* AABBmin, double* AABBmax, int nsd, double cellSize);
+	void __declspec(dllexport) getAutoBucketGridSize(int* N, int* numOfCells, double* AABBmin, double* AABBmax, int nsd, double longestEdge, int numOfGPs, double targetOccupancy);
+	void __declspec(dllexport) buildBucketGrid(int* cellStart, int* cellGPs, double* GPs, int* N, double* AABBmin, double* AABBmax, int nsd, int numOfRows);
+	void __declspec(dllexport) evaluateContactConstraintsCSR(double* GPs, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, int* cellStart, int* cellGPs, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge);
+	void __declspec(dllexport) setNumberOfThreads(int nthreads);
+	void __declspec(dllexport) setContactStatsOutput(ContactStats* stats);
+	void __declspec(dllexport) resetContactProfile(void);
+	int __declspec(dllexport) getContactProfile(ContactProfile* profile, int thread);
+	int __declspec(dllexport) getContactProfileNumberOfThreads(void);
+	int __declspec(dllexport) writeContactProfileJSON(const char* fileName);
+	void __declspec(dllexport) setProjectionParameters(int maxIterations, double tolerance, double maxStep);
+	void __declspec(dllexport) setContactSearchExclusion(int* adjStart, int* adj, int* bodyID, int n, int ngp);
+	void __declspec(dllexport) evaluateContactConstraintsSlaveCentric(double* GPs, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge);
+	ContactBVH* __declspec(dllexport) createContactBVH(int* ISN, int* IEN, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int nen, int nes, int neq);
+	void __declspec(dllexport) refitContactBVH(ContactBVH* bvh, int* ISN, int* IEN, double* X, int* elementID, int* segmentID, int nen, int nes, int neq);
+	void __declspec(dllexport) destroyContactBVH(ContactBVH* bvh);
+	void __declspec(dllexport) evaluateContactConstraintsBVH(double* GPs, ContactBVH* bvh, int* ISN, int* IEN, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq);
+	void __declspec(dllexport) updateGaussPointCoords(double* GPs, int n, int nsd, int ngp, int neq, int nsn, int nes, int nen, int* elementID, int* segmentID, int* ISN, int* IEN, double* H, double* X);
+	void __declspec(dllexport) buildSegmentAdjacency(int* adjStart, int* adj, int* ISN, int* IEN, int* elementID, int* segmentID, int n, int nsn, int nen, int nes, int nnod);
+	void __declspec(dllexport) evaluateContactConstraintsIncremental(double* GPs, double* Xg0, int* adjStart, int* adj, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge, double skin);
+	ContactContext* __declspec(dllexport) createContactContext(int* ISN, int* IEN, int* elementID, int* segmentID, double* H, double* dH, double* gw, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq);
+	void __declspec(dllexport) updateContactContext(ContactContext* ctx, double* X, double* U);
+	void __declspec(dllexport) destroyContactContext(ContactContext* ctx);
+	void __declspec(dllexport) buildContactContextSparsityPattern(int* rowPtr, int* colInd, ContactContext* ctx, double* activeGPsOld, int nsg);
+	int __declspec(dllexport) updateContactContextSparsityPattern(int* nnz, ContactContext* ctx, double* activeGPsOld, int nsg);
+	void __declspec(dllexport) getContactContextSparsityPattern(int* rowPtr, int* colInd, ContactContext* ctx);
+	void __declspec(dllexport) assembleContactResidualAndStiffnessContext(double* Gc, double* vals, int* rowPtr, int* colInd, ContactContext* ctx, double* X, double* U, double* activeGPsOld, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg);
+	void __declspec(dllexport) getContactContextGPs(double* GPs, ContactContext* ctx);
+	void __declspec(dllexport) setContactContextGPs(ContactContext* ctx, double* GPs);
+#else
+	void sfd2(double* H, double* dH, double r);
+    void sfd4(double* H, double* dH, double r, double s);
+    void sfd6(double* H, double* dH, double r, double s);
+    void sfd8(double* H, double* dH, double r, double s);
+	void sfd2Batch(double* H, double* dH, const double* r, int np);
+	void sfd4Batch(double* H, double* dH, const double* r, const double* s, int np);
+	void sfd6Batch(double* H, double* dH, const double* r, const double* s, int np);
+	void sfd8Batch(double* H, double* dH, const double* r, const double* s, int np);
+	void getAABB(double* AABBmin, double* AABBmax, int nsd, int nnod, double* X, double longestEdge, int* IEN, int* ISN, int* elementID, int* segmentID, int n, int nsn, int nes, int nen, int neq);
+	void prepareContactSurface(double* longestEdge, double* AABBmin, double* AABBmax, double* GPs, int n, int nsd, int npd, int ngp, int neq, int nsn, int nes, int nen, int* elementID, int* segmentID, int* ISN, int* IEN, double* H, double* X);
+	void assembleContactResidualAndStiffness(double* Gc_loc, double* Gc, double* Kc, double* vals, double* rows, double* cols, int* len, double* GPs, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg);
+	void countContactTriplets(int* len, double* GPs, double* activeGPsOld, int nsd, int npd, int ngp, int nsn, int GPs_len, double epsN, bool keyAssembleKc, int nsg);
+	void buildContactSparsityPattern(int* rowPtr, int* colInd, double* GPs, int* ISN, int* IEN, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, int nsg);
+	void assembleContactResidualAndStiffnessCSR(double* Gc, double* vals, int* rowPtr, int* colInd, double* GPs, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg);
+	void buildContactBlockSparsityPattern(int* blockRowPtr, int* blockColInd, double* GPs, int* ISN, int* IEN, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, int nsg);
+	void assembleContactResidualAndStiffnessBSR(double* Gc, double* blockVals, int* blockRowPtr, int* blockColInd, double* GPs, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg);
+	ContactOperator* createContactOperator(void);
+	void destroyContactOperator(ContactOperator* op);
+	void assembleContactResidualAndOperator(double* Gc, ContactOperator* op, double* GPs, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, double* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool isAxisymmetric, int nsg);
+	void applyContactStiffness(double* y, double* v, ContactOperator* op);
+	void getLongestEdgeAndGPs(double* longestEdge, double* GPs, int n, int nsd, int npd, int ngp, int neq, int nsn, int nes, int nen, int* elementID, int* segmentID, int* ISN, int* IEN, double* H, double* X);
+	void evaluateContactConstraints(double* GPs, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, int* head, int* next, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge);
+	void getBucketGridSize(int* N, int* numOfCells, double* AABBmin, double* AABBmax, int nsd, double cellSize);
+	void getAutoBucketGridSize(int* N, int* numOfCells, double* AABBmin, double* AABBmax, int nsd, double longestEdge, int numOfGPs, double targetOccupancy);
+	void buildBucketGrid(int* cellStart, int* cellGPs, double* GPs, int* N, double* AABBmin, double* AABBmax, int nsd, int numOfRows);
+	void evaluateContactConstraintsCSR(double* GPs, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, int* cellStart, int* cellGPs, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge);
+	void setNumberOfThreads(int nthreads);
+	void setContactStatsOutput(ContactStats* stats);
+	void resetContactProfile(void);
+	int getContactProfile(ContactProfile* profile, int thread);
+	int getContactProfileNumberOfThreads(void);
+	int writeContactProfileJSON(const char* fileName);
+	void setProjectionParameters(int maxIterations, double tolerance, double maxStep);
+	void setContactSearchExclusion(int* adjStart, int* adj, int* bodyID, int n, int ngp);
+	void evaluateContactConstraintsSlaveCentric(double* GPs, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge);
+	ContactBVH* createContactBVH(int* ISN, int* IEN, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int nen, int nes, int neq);
+	void refitContactBVH(ContactBVH* bvh, int* ISN, int* IEN, double* X, int* elementID, int* segmentID, int nen, int nes, int neq);
+	void destroyContactBVH(ContactBVH* bvh);
+	void evaluateContactConstraintsBVH(double* GPs, ContactBVH* bvh, int* ISN, int* IEN, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq);
+	void updateGaussPointCoords(double* GPs, int n, int nsd, int ngp, int neq, int nsn, int nes, int nen, int* elementID, int* segmentID, int* ISN, int* IEN, double* H, double* X);
+	void buildSegmentAdjacency(int* adjStart, int* adj, int* ISN, int* IEN, int* elementID, int* segmentID, int n, int nsn, int nen, int nes, int nnod);
+	void evaluateContactConstraintsIncremental(double* GPs, double* Xg0, int* adjStart, int* adj, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge, double skin);
+	ContactContext* createContactContext(int* ISN, int* IEN, int* elementID, int* segmentID, double* H, double* dH, double* gw, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq);
+	void updateContactContext(ContactContext* ctx, double* X, double* U);
+	void destroyContactContext(ContactContext* ctx);
+	void buildContactContextSparsityPattern(int* rowPtr, int* colInd, ContactContext* ctx, double* activeGPsOld, int nsg);
+	int updateContactContextSparsityPattern(int* nnz, ContactContext* ctx, double* activeGPsOld, int nsg);
+	void getContactContextSparsityPattern(int* rowPtr, int* colInd, ContactContext* ctx);
+	void assembleContactResidualAndStiffnessContext(double* Gc, double* vals, int* rowPtr, int* colInd, ContactContext* ctx, double* X, double* U, double* activeGPsOld, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg);
+	void getContactContextGPs(double* GPs, ContactContext* ctx);
+	void setContactContextGPs(ContactContext* ctx, double* GPs);
+#endif
+
+#ifdef __cplusplus
+}
+
+#include <vector>
+#include <stdint.h>
+
+	/*! Gauss point state as structure of arrays (typed counterpart of the GPs table)
+
+	IDs are 0-based (-1 means no master segment), 2d arrays are column-major, e.g.
+	Xg[sdf*numOfRows + v] is the sdf-th coordinate of the Gauss point in the v-th row.
+	*/
+	struct GaussPointState {
+		int numOfRows;
+		int nsd;
+		int npd;
+		std::vector<double> Xg;         // slave gausspoint coords (nsd cols)
+		std::vector<int32_t> els;       // slave element
+		std::vector<int32_t> sgs;       // slave segment
+		std::vector<double> gap;        // gap (negative value means open gap)
+		std::vector<double> Xi_m;       // master parametric coords (npd cols)
+		std::vector<uint8_t> isActive;
+		std::vector<int32_t> elm;       // master element
+		std::vector<int32_t> sgm;       // master segment
+		std::vector<uint8_t> isStick;
+		std::vector<double> t_T;        // tangent traction components (npd cols)
+		std::vector<double> Xi0_m;      // master parametric coords of the last converged state (npd cols)
+		std::vector<double> t_N0;       // normal traction
+	};
+
+#ifdef _WIN32
+	void __declspec(dllexport) convertGPsToState(GaussPointState& state, const double* GPs, int numOfRows, int nsd, int npd);
+	void __declspec(dllexport) convertStateToGPs(double* GPs, const GaussPointState& state);
+	void __declspec(dllexport) buildBucketGrid(int* cellStart, int* cellGPs, GaussPointState& state, int* N, double* AABBmin, double* AABBmax);
+	void __declspec(dllexport) evaluateContactConstraintsCSR(GaussPointState& state, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, int* cellStart, int* cellGPs, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge);
+	void __declspec(dllexport) buildContactSparsityPattern(int* rowPtr, int* colInd, GaussPointState& state, int* ISN, int* IEN, const uint8_t* activeGPsOld, int neq, int nsd, int ngp, int nes, int nsn, int nen, int GPs_len, int nsg);
+	void __declspec(dllexport) assembleContactResidualAndStiffnessCSR(double* Gc, double* vals, int* rowPtr, int* colInd, GaussPointState& state, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, const uint8_t* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg);
+#else
+	void convertGPsToState(GaussPointState& state, const double* GPs, int numOfRows, int nsd, int npd);
+	void convertStateToGPs(double* GPs, const GaussPointState& state);
+	void buildBucketGrid(int* cellStart, int* cellGPs, GaussPointState& state, int* N, double* AABBmin, double* AABBmax);
+	void evaluateContactConstraintsCSR(GaussPointState& state, int* ISN, int* IEN, int* N, double* AABBmin, double* AABBmax, int* cellStart, int* cellGPs, double* X, int* elementID, int* segmentID, int n, int nsn, int nsd, int npd, int ngp, int nen, int nes, int neq, double longestEdge);
+	void buildContactSparsityPattern(int* rowPtr, int* colInd, GaussPointState& state, int* ISN, int* IEN, const uint8_t* activeGPsOld, int neq, int nsd, int ngp, int nes, int nsn, int nen, int GPs_len, int nsg);
+	void assembleContactResidualAndStiffnessCSR(double* Gc, double* vals, int* rowPtr, int* colInd, GaussPointState& state, int* ISN, int* IEN, double* X, double* U, double* H, double* dH, double* gw, const uint8_t* activeGPsOld, int neq, int nsd, int npd, int ngp, int nes, int nsn, int nen, int GPs_len, double epsN, double epsT, double mu, bool keyContactDetection, bool keyAssembleKc, bool isAxisymmetric, int nsg);
+#endif
+#endif
+
+#endif  // CONTACTINO_H
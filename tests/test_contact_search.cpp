@@ -0,0 +1,388 @@
+/**
+\file test_contact_search.cpp
+Test of the contact search
+
+A wavy upper surface (body 1) is pressed into a flat lower surface (body 0).
+
+All searches (evaluateContactConstraintsCSR at 1 and more threads, the master-centric search
+with linked-list buckets, the slave-centric, BVH and incremental searches and the search of
+the context) have to give the same active set, master segments and gaps.
+
+For the exclusion of master segments, the lower surface starts with a short tail segment
+that dips below its neighbour, so that some of its Gauss points penetrate a neighbouring
+segment of the same body. The exclusion (setContactSearchExclusion) has to reject the
+neighbours and the segments of the same body, and has to be ignored by a search of another
+mesh.
+
+Usage:
+  test_contact_search
+
+Returns 0 when all checks pass, 1 otherwise.
+*/
+#include <stdio.h>
+#include <math.h>
+#include <float.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "contactino.h"
+
+/*! Contact surfaces of 2-node segments */
+struct Mesh {
+  int n;                        // number of segments
+  int nsd;
+  int npd;
+  int nsn;
+  int ngp;
+  int nen;
+  int nes;
+  int neq;
+  std::vector<double> X;        // nodal coords (nnod x nsd)
+  std::vector<int> ISN;
+  std::vector<int> IEN;
+  std::vector<int> elementID;
+  std::vector<int> segmentID;
+  std::vector<int> bodyID;
+  std::vector<double> H;
+  std::vector<double> dH;
+  std::vector<double> gw;
+
+  int numOfNodes() const {
+    return (int)X.size() / nsd;
+  }
+  int numOfRows() const {
+    return n*ngp;
+  }
+  int numOfCols() const {
+    return nsd + 3*npd + 8;
+  }
+};
+
+/*! 2D: flat lower surface y = 0 of m1 segments (with the tail segment if hasTail) and upper surface of m2 segments with the wave amplitude */
+static Mesh makeMesh(int m1, int m2, bool hasTail, double amplitude) {
+  Mesh m;
+  m.nsd = 2;
+  m.npd = 1;
+  m.nsn = 2;
+  m.ngp = 2;
+  m.nen = 2;
+  m.nes = 1;
+  std::vector<double> x;
+  std::vector<double> y;
+  for (int i = 0; i <= m1; ++i) {
+    x.push_back((double)i / m1);
+    y.push_back(0.0);
+  }
+  if (hasTail) {
+    x.push_back(1.0 - 3.0 / m1);
+    y.push_back(-0.005);
+  }
+  const int offset = (int)x.size();
+  for (int i = 0; i <= m2; ++i) {
+    const double xi = 0.05 + 0.9*i / m2;
+    x.push_back(xi);
+    y.push_back(-0.002 + amplitude*sin(7*xi));
+  }
+  m.X = x;
+  m.X.insert(m.X.end(), y.begin(), y.end());
+  m.neq = (int)m.X.size();
+  m.ISN.push_back(1);
+  m.ISN.push_back(2);
+
+  // The lower surface faces +y, the upper one -y:
+  int el = 0;
+  if (hasTail) {
+    m.IEN.push_back(m1 + 2);
+    m.IEN.push_back(m1 + 1);
+    m.elementID.push_back(++el);
+    m.segmentID.push_back(1);
+    m.bodyID.push_back(0);
+  }
+  for (int i = m1 - 1; i >= 0; --i) {
+    m.IEN.push_back(i + 2);
+    m.IEN.push_back(i + 1);
+    m.elementID.push_back(++el);
+    m.segmentID.push_back(1);
+    m.bodyID.push_back(0);
+  }
+  for (int i = 0; i < m2; ++i) {
+    m.IEN.push_back(offset + i + 1);
+    m.IEN.push_back(offset + i + 2);
+    m.elementID.push_back(++el);
+    m.segmentID.push_back(1);
+    m.bodyID.push_back(1);
+  }
+  m.n = (int)m.elementID.size();
+
+  const double a = 1 / sqrt(3.0);
+  const double r[2] = {-a, a};
+  m.H.assign(m.nsn*m.ngp, 0.0);
+  m.dH.assign(m.nsn*m.npd*m.ngp, 0.0);
+  m.gw.assign(m.ngp, 1.0);
+  for (int g = 0; g < m.ngp; ++g) {
+    double H[2];
+    double dH[2];
+    sfd2(H, dH, r[g]);
+    for (int j = 0; j < m.nsn; ++j) {
+      m.H[j*m.ngp + g] = H[j];
+      m.dH[j*m.ngp + g] = dH[j];
+    }
+  }
+  return m;
+}
+
+/*! GPs table of the contact search by evaluateContactConstraintsCSR (slaveCentric false) or evaluateContactConstraintsSlaveCentric */
+static std::vector<double> searchContact(Mesh& m, bool slaveCentric) {
+  const int numOfRows = m.numOfRows();
+  std::vector<double> GPs((size_t)numOfRows*m.numOfCols(), 0.0);
+  double longestEdge;
+  double AABBmin[3] = {0.0, 0.0, 0.0};
+  double AABBmax[3] = {0.0, 0.0, 0.0};
+  prepareContactSurface(&longestEdge, AABBmin, AABBmax, &GPs[0], m.n, m.nsd, m.npd, m.ngp, m.neq, m.nsn, m.nes, m.nen, &m.elementID[0], &m.segmentID[0], &m.ISN[0], &m.IEN[0], &m.H[0], &m.X[0]);
+  int N[3];
+  int numOfCells;
+  getAutoBucketGridSize(N, &numOfCells, AABBmin, AABBmax, m.nsd, longestEdge, numOfRows, 0);
+
+  if (slaveCentric) {
+    evaluateContactConstraintsSlaveCentric(&GPs[0], &m.ISN[0], &m.IEN[0], N, AABBmin, AABBmax, &m.X[0], &m.elementID[0], &m.segmentID[0], m.n, m.nsn, m.nsd, m.npd, m.ngp, m.nen, m.nes, m.neq, longestEdge);
+  }
+  else {
+    std::vector<int> cellStart(numOfCells + 1);
+    std::vector<int> cellGPs(numOfRows);
+    buildBucketGrid(&cellStart[0], &cellGPs[0], &GPs[0], N, AABBmin, AABBmax, m.nsd, numOfRows);
+    evaluateContactConstraintsCSR(&GPs[0], &m.ISN[0], &m.IEN[0], N, AABBmin, AABBmax, &cellStart[0], &cellGPs[0], &m.X[0], &m.elementID[0], &m.segmentID[0], m.n, m.nsn, m.nsd, m.npd, m.ngp, m.nen, m.nes, m.neq, longestEdge);
+  }
+  return GPs;
+}
+
+/*! Active Gauss points whose master segment is a neighbour of the slave segment, of the same body and of another body */
+struct MasterCounts {
+  int neighbours;
+  int sameBody;
+  int otherBody;
+};
+
+static MasterCounts countMasters(const Mesh& m, const std::vector<double>& GPs, const std::vector<int>& adjStart, const std::vector<int>& adj) {
+  const int numOfRows = m.numOfRows();
+  const int nsd = m.nsd;
+  const int npd = m.npd;
+  MasterCounts counts = {0, 0, 0};
+  for (int v = 0; v < numOfRows; ++v) {
+    if (GPs[(nsd + npd + 3)*numOfRows + v] != 1.0) {
+      continue;
+    }
+    const int es = v / m.ngp;
+    const int elm = (int)GPs[(nsd + npd + 4)*numOfRows + v];
+    const int em = (int)(std::find(m.elementID.begin(), m.elementID.end(), elm) - m.elementID.begin());
+    if (std::binary_search(adj.begin() + adjStart[es], adj.begin() + adjStart[es + 1], em)) {
+      counts.neighbours++;
+    }
+    if (m.bodyID[es] == m.bodyID[em]) {
+      counts.sameBody++;
+    }
+    else {
+      counts.otherBody++;
+    }
+  }
+  return counts;
+}
+
+static int numOfFailures = 0;
+
+static void check(bool condition, const char* name, const char* what) {
+  if (!condition) {
+    printf("FAILED %s: %s\n", name, what);
+    numOfFailures++;
+  }
+}
+
+static void testExclusion(const char* name, bool slaveCentric, int numOfThreads) {
+  setNumberOfThreads(numOfThreads);
+  Mesh m = makeMesh(60, 50, true, 0.01);
+  std::vector<int> adjStart(m.n + 1);
+  buildSegmentAdjacency(&adjStart[0], NULL, &m.ISN[0], &m.IEN[0], &m.elementID[0], &m.segmentID[0], m.n, m.nsn, m.nen, m.nes, m.numOfNodes());
+  std::vector<int> adj(adjStart[m.n] + 1);
+  buildSegmentAdjacency(&adjStart[0], &adj[0], &m.ISN[0], &m.IEN[0], &m.elementID[0], &m.segmentID[0], m.n, m.nsn, m.nen, m.nes, m.numOfNodes());
+
+  const MasterCounts none = countMasters(m, searchContact(m, slaveCentric), adjStart, adj);
+  check(none.neighbours > 0, name, "no neighbouring master without the exclusion");
+  check(none.otherBody > 0, name, "no master of the other body without the exclusion");
+
+  setContactSearchExclusion(&adjStart[0], &adj[0], NULL, m.n, m.ngp);
+  const MasterCounts neighbours = countMasters(m, searchContact(m, slaveCentric), adjStart, adj);
+  check(neighbours.neighbours == 0, name, "neighbouring master not excluded");
+  check(neighbours.otherBody == none.otherBody, name, "masters of the other body changed by the exclusion of neighbours");
+
+  setContactSearchExclusion(NULL, NULL, &m.bodyID[0], m.n, m.ngp);
+  const MasterCounts bodies = countMasters(m, searchContact(m, slaveCentric), adjStart, adj);
+  check(bodies.sameBody == 0, name, "master of the same body not excluded");
+  check(bodies.otherBody == none.otherBody, name, "masters of the other body changed by the exclusion of bodies");
+
+  // A search of another mesh (without the tail segment) ignores the exclusion:
+  Mesh other = makeMesh(60, 50, false, 0.01);
+  setContactSearchExclusion(NULL, NULL, NULL, 0, 1);
+  const std::vector<double> expected = searchContact(other, slaveCentric);
+  setContactSearchExclusion(&adjStart[0], &adj[0], &m.bodyID[0], m.n, m.ngp);
+  const std::vector<double> GPs = searchContact(other, slaveCentric);
+  setContactSearchExclusion(NULL, NULL, NULL, 0, 1);
+  check(GPs == expected, name, "exclusion applied to another mesh");
+
+  setNumberOfThreads(1);
+
+  printf("%-24s neighbours %2d/%2d  same body %2d/%2d  other body %2d\n", name, none.neighbours, neighbours.neighbours, none.sameBody, bodies.sameBody, none.otherBody);
+}
+
+/*! Search engines compared by testEngines */
+enum SearchEngine {
+  SEARCH_CSR,
+  SEARCH_LINKED_LIST,
+  SEARCH_SLAVE_CENTRIC,
+  SEARCH_BVH,
+  SEARCH_INCREMENTAL,
+  SEARCH_CONTEXT
+};
+
+/*! GPs table of the search of the mesh with the nodal coords X (the mesh coords are the previous state of the incremental search) */
+static std::vector<double> searchContact(Mesh& m, std::vector<double>& X, SearchEngine engine) {
+  const int nsd = m.nsd;
+  const int npd = m.npd;
+  const int numOfRows = m.numOfRows();
+  if (engine == SEARCH_CONTEXT) {
+    std::vector<double> GPs((size_t)numOfRows*m.numOfCols(), 0.0);
+    ContactContext* ctx = createContactContext(&m.ISN[0], &m.IEN[0], &m.elementID[0], &m.segmentID[0], &m.H[0], &m.dH[0], &m.gw[0], m.n, m.nsn, nsd, npd, m.ngp, m.nen, m.nes, m.neq);
+    updateContactContext(ctx, &X[0], NULL);
+    getContactContextGPs(&GPs[0], ctx);
+    destroyContactContext(ctx);
+    return GPs;
+  }
+  if (engine == SEARCH_CSR || engine == SEARCH_SLAVE_CENTRIC) {
+    Mesh current = m;
+    current.X = X;
+    return searchContact(current, engine == SEARCH_SLAVE_CENTRIC);
+  }
+
+  std::vector<double> GPs((size_t)numOfRows*m.numOfCols(), 0.0);
+  double longestEdge;
+  double AABBmin[3] = {0.0, 0.0, 0.0};
+  double AABBmax[3] = {0.0, 0.0, 0.0};
+  int N[3];
+  int numOfCells;
+  if (engine == SEARCH_INCREMENTAL) {
+    // The previous state is searched fully, then the Gauss points are moved to the coords X:
+    std::vector<int> adjStart(m.n + 1);
+    buildSegmentAdjacency(&adjStart[0], NULL, &m.ISN[0], &m.IEN[0], &m.elementID[0], &m.segmentID[0], m.n, m.nsn, m.nen, m.nes, m.numOfNodes());
+    std::vector<int> adj(adjStart[m.n] + 1);
+    buildSegmentAdjacency(&adjStart[0], &adj[0], &m.ISN[0], &m.IEN[0], &m.elementID[0], &m.segmentID[0], m.n, m.nsn, m.nen, m.nes, m.numOfNodes());
+    std::vector<double> Xg0((size_t)numOfRows*nsd, FLT_MAX);
+    prepareContactSurface(&longestEdge, AABBmin, AABBmax, &GPs[0], m.n, nsd, npd, m.ngp, m.neq, m.nsn, m.nes, m.nen, &m.elementID[0], &m.segmentID[0], &m.ISN[0], &m.IEN[0], &m.H[0], &m.X[0]);
+    getAutoBucketGridSize(N, &numOfCells, AABBmin, AABBmax, nsd, longestEdge, numOfRows, 0);
+    evaluateContactConstraintsIncremental(&GPs[0], &Xg0[0], &adjStart[0], &adj[0], &m.ISN[0], &m.IEN[0], N, AABBmin, AABBmax, &m.X[0], &m.elementID[0], &m.segmentID[0], m.n, m.nsn, nsd, npd, m.ngp, m.nen, m.nes, m.neq, longestEdge, 0.1*longestEdge);
+
+    std::vector<double> Xg(GPs);
+    prepareContactSurface(&longestEdge, AABBmin, AABBmax, &Xg[0], m.n, nsd, npd, m.ngp, m.neq, m.nsn, m.nes, m.nen, &m.elementID[0], &m.segmentID[0], &m.ISN[0], &m.IEN[0], &m.H[0], &X[0]);
+    updateGaussPointCoords(&GPs[0], m.n, nsd, m.ngp, m.neq, m.nsn, m.nes, m.nen, &m.elementID[0], &m.segmentID[0], &m.ISN[0], &m.IEN[0], &m.H[0], &X[0]);
+    getAutoBucketGridSize(N, &numOfCells, AABBmin, AABBmax, nsd, longestEdge, numOfRows, 0);
+    evaluateContactConstraintsIncremental(&GPs[0], &Xg0[0], &adjStart[0], &adj[0], &m.ISN[0], &m.IEN[0], N, AABBmin, AABBmax, &X[0], &m.elementID[0], &m.segmentID[0], m.n, m.nsn, nsd, npd, m.ngp, m.nen, m.nes, m.neq, longestEdge, 0.1*longestEdge);
+    return GPs;
+  }
+
+  prepareContactSurface(&longestEdge, AABBmin, AABBmax, &GPs[0], m.n, nsd, npd, m.ngp, m.neq, m.nsn, m.nes, m.nen, &m.elementID[0], &m.segmentID[0], &m.ISN[0], &m.IEN[0], &m.H[0], &X[0]);
+  if (engine == SEARCH_BVH) {
+    ContactBVH* bvh = createContactBVH(&m.ISN[0], &m.IEN[0], &X[0], &m.elementID[0], &m.segmentID[0], m.n, m.nsn, nsd, m.nen, m.nes, m.neq);
+    evaluateContactConstraintsBVH(&GPs[0], bvh, &m.ISN[0], &m.IEN[0], &X[0], &m.elementID[0], &m.segmentID[0], m.n, m.nsn, nsd, npd, m.ngp, m.nen, m.nes, m.neq);
+    destroyContactBVH(bvh);
+    return GPs;
+  }
+
+  // Buckets as linked lists (the rows of each bucket in ascending order):
+  getAutoBucketGridSize(N, &numOfCells, AABBmin, AABBmax, nsd, longestEdge, numOfRows, 0);
+  std::vector<int> head(numOfCells, -1);
+  std::vector<int> next(numOfRows);
+  for (int v = numOfRows - 1; v >= 0; --v) {
+    int I[3] = {0, 0, 0};
+    for (int sdf = 0; sdf < nsd; ++sdf) {
+      I[sdf] = (int)(N[sdf]*(GPs[sdf*numOfRows + v] - AABBmin[sdf]) / (AABBmax[sdf] - AABBmin[sdf]));
+      I[sdf] = std::min(std::max(I[sdf], 0), N[sdf] - 1);
+    }
+    const int Ic = I[2]*N[0]*N[1] + I[1]*N[0] + I[0];
+    next[v] = head[Ic];
+    head[Ic] = v;
+  }
+  evaluateContactConstraints(&GPs[0], &m.ISN[0], &m.IEN[0], N, AABBmin, AABBmax, &head[0], &next[0], &X[0], &m.elementID[0], &m.segmentID[0], m.n, m.nsn, nsd, npd, m.ngp, m.nen, m.nes, m.neq, longestEdge);
+  return GPs;
+}
+
+/*! Number of Gauss points whose active flag, master segment or gap (if active) differ */
+static int countDifferences(const Mesh& m, const std::vector<double>& GPs, const std::vector<double>& expected) {
+  const int numOfRows = m.numOfRows();
+  const int nsd = m.nsd;
+  const int npd = m.npd;
+  int numOfDifferences = 0;
+  for (int v = 0; v < numOfRows; ++v) {
+    const double isActive = GPs[(nsd + npd + 3)*numOfRows + v];
+    if (isActive != expected[(nsd + npd + 3)*numOfRows + v]) {
+      numOfDifferences++;
+    }
+    else if (isActive == 1.0 && (GPs[(nsd + npd + 4)*numOfRows + v] != expected[(nsd + npd + 4)*numOfRows + v] ||
+                                 GPs[(nsd + 2)*numOfRows + v] != expected[(nsd + 2)*numOfRows + v])) {
+      numOfDifferences++;
+    }
+  }
+  return numOfDifferences;
+}
+
+static void testEngines(int numOfThreads) {
+  Mesh m = makeMesh(60, 50, false, 0.005);
+  std::vector<double> X(m.X);
+  for (int k = 0; k < m.neq; ++k) {
+    X[k] += 1e-3*sin(0.37*k);
+  }
+
+  setNumberOfThreads(1);
+  const std::vector<double> expected = searchContact(m, X, SEARCH_CSR);
+  int numOfActiveGPs = 0;
+  for (int v = 0; v < m.numOfRows(); ++v) {
+    numOfActiveGPs += expected[(m.nsd + m.npd + 3)*m.numOfRows() + v] == 1.0;
+  }
+  check(numOfActiveGPs > 0, "engines", "no active Gauss points");
+
+  struct {
+    const char* name;
+    SearchEngine engine;
+  } engines[] = {
+    {"CSR", SEARCH_CSR},
+    {"linked-list buckets", SEARCH_LINKED_LIST},
+    {"slave-centric", SEARCH_SLAVE_CENTRIC},
+    {"BVH", SEARCH_BVH},
+    {"incremental", SEARCH_INCREMENTAL},
+    {"context", SEARCH_CONTEXT},
+  };
+  setNumberOfThreads(numOfThreads);
+  for (size_t k = 0; k < sizeof(engines) / sizeof(engines[0]); ++k) {
+    const int numOfDifferences = countDifferences(m, searchContact(m, X, engines[k].engine), expected);
+    printf("%-24s threads %d  active %3d  differences %d\n", engines[k].name, numOfThreads, numOfActiveGPs, numOfDifferences);
+    if (numOfDifferences > 0) {
+      printf("FAILED %s (%d threads): %d Gauss points differ from the serial CSR search\n", engines[k].name, numOfThreads, numOfDifferences);
+      numOfFailures++;
+    }
+  }
+  setNumberOfThreads(1);
+}
+
+int main() {
+  testEngines(1);
+  testEngines(3);
+
+  // The threaded CSR search rejects the masters in its broad phase (see searchMasterSegmentsInParallel):
+  testExclusion("exclusion CSR", false, 1);
+  testExclusion("exclusion CSR 3 threads", false, 3);
+  testExclusion("exclusion slave-centric", true, 1);
+
+  if (numOfFailures > 0) {
+    printf("%d checks FAILED\n", numOfFailures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
@@ -0,0 +1,488 @@
+/**
+\file test_contact_tangent.cpp
+Test of the contact tangent (assembleContactResidualAndStiffnessCSR) against central differences
+of the contact residual, and of the BSR tangent and the matrix-free operator
+(applyContactStiffness) against the CSR tangent
+
+A curved upper surface is pressed into a flat lower surface. Both the contact search and the
+residual are evaluated again for each perturbed displacement, so the differences include the
+change of the projections onto the master segments. In particular, it guards the curvature
+terms of curved (6- and 8-node) master segments and the stick and slip branches of friction.
+
+Usage:
+  test_contact_tangent
+
+Returns 0 when all checks pass, 1 otherwise.
+*/
+#include <stdio.h>
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "contactino.h"
+
+/*! Two contact surfaces, the lower one (body 0) followed by the upper one (body 1) */
+struct Surfaces {
+  int nsd;                      // Number of Space Dimensions
+  int npd;                      // Number of Parametric Dimensions
+  int nsn;                      // Number of Segment Nodes
+  int ngp;                      // Number of Gauss Points of a segment
+  int nen;                      // Number of Element Nodes
+  int nes;                      // Number of Element Segments
+  int numOfLowerSegments;
+  std::vector<double> X;        // nodal coords (nnod x nsd)
+  std::vector<int> ISN;
+  std::vector<int> IEN;
+  std::vector<int> elementID;
+  std::vector<int> segmentID;
+  std::vector<double> H;
+  std::vector<double> dH;
+  std::vector<double> gw;
+
+  int numOfNodes() const {
+    return (int)X.size() / nsd;
+  }
+};
+
+static void evaluateGaussRule(Surfaces& m) {
+  const double a = 1 / sqrt(3.0);
+  std::vector<double> r;
+  std::vector<double> s;
+  if (m.nsn == 2) {
+    r.push_back(-a); s.push_back(0.0);
+    r.push_back( a); s.push_back(0.0);
+  }
+  else if (m.nsn == 6) {
+    r.push_back(1.0 / 6); s.push_back(1.0 / 6);
+    r.push_back(2.0 / 3); s.push_back(1.0 / 6);
+    r.push_back(1.0 / 6); s.push_back(2.0 / 3);
+  }
+  else {
+    r.push_back(-a); s.push_back(-a);
+    r.push_back( a); s.push_back(-a);
+    r.push_back( a); s.push_back( a);
+    r.push_back(-a); s.push_back( a);
+  }
+  m.ngp = (int)r.size();
+  m.H.assign(m.nsn*m.ngp, 0.0);
+  m.dH.assign(m.nsn*m.npd*m.ngp, 0.0);
+  m.gw.assign(m.ngp, m.nsn == 6 ? 1.0 / 6 : 1.0);
+
+  for (int g = 0; g < m.ngp; ++g) {
+    double H[8];
+    double dH[16];
+    switch (m.nsn) {
+      case 2: sfd2(H, dH, r[g]); break;
+      case 4: sfd4(H, dH, r[g], s[g]); break;
+      case 6: sfd6(H, dH, r[g], s[g]); break;
+      case 8: sfd8(H, dH, r[g], s[g]); break;
+    }
+    for (int j = 0; j < m.nsn; ++j) {
+      m.H[j*m.ngp + g] = H[j];
+      for (int pdf = 0; pdf < m.npd; ++pdf) {
+        m.dH[j*m.npd*m.ngp + g*m.npd + pdf] = dH[pdf*m.nsn + j];
+      }
+    }
+  }
+}
+
+/*! 2D: flat lower surface y = 0 and wavy upper surface of 2-node segments */
+static Surfaces makeSurfaces2D(int m1, int m2) {
+  Surfaces m;
+  m.nsd = 2;
+  m.npd = 1;
+  m.nsn = 2;
+  m.nen = 2;
+  m.nes = 1;
+  m.numOfLowerSegments = m1;
+  std::vector<double> x;
+  std::vector<double> y;
+  for (int i = 0; i <= m1; ++i) {
+    x.push_back((double)i / m1);
+    y.push_back(0.0);
+  }
+  const int offset = (int)x.size();
+  for (int i = 0; i <= m2; ++i) {
+    const double xi = 0.05 + 0.9*i / m2;
+    x.push_back(xi);
+    y.push_back(-0.002 + 0.01*sin(7*xi));
+  }
+  m.X = x;
+  m.X.insert(m.X.end(), y.begin(), y.end());
+  m.ISN.push_back(1);
+  m.ISN.push_back(2);
+
+  int el = 0;
+  for (int i = 0; i < m1; ++i) {
+    m.IEN.push_back(i + 2);
+    m.IEN.push_back(i + 1);
+    m.elementID.push_back(++el);
+    m.segmentID.push_back(1);
+  }
+  for (int i = 0; i < m2; ++i) {
+    m.IEN.push_back(offset + i + 1);
+    m.IEN.push_back(offset + i + 2);
+    m.elementID.push_back(++el);
+    m.segmentID.push_back(1);
+  }
+  evaluateGaussRule(m);
+  return m;
+}
+
+/*! 3D: flat lower surface z = 0 and curved upper surface of quadrilaterals (nsn 4, 8) or triangles (nsn 6) */
+static Surfaces makeSurfaces3D(int nsn, int m1, int m2) {
+  Surfaces m;
+  m.nsd = 3;
+  m.npd = 2;
+  m.nsn = nsn;
+  m.nen = nsn;
+  m.nes = 1;
+  m.numOfLowerSegments = (nsn == 6 ? 2 : 1)*m1*m1;
+  for (int j = 0; j < nsn; ++j) {
+    m.ISN.push_back(j + 1);
+  }
+  std::vector<double> x;
+  std::vector<double> y;
+  std::vector<double> z;
+  int el = 0;
+  for (int body = 0; body < 2; ++body) {
+    const int mb = body == 0 ? m1 : m2;
+    const int q = 2*mb + 1; // nodes per side (incl. midside nodes)
+    const int offset = (int)x.size();
+    for (int b = 0; b < q; ++b) {
+      for (int a = 0; a < q; ++a) {
+        double xa = (double)a / (q - 1);
+        double yb = (double)b / (q - 1);
+        if (body == 1) {
+          xa = 0.05 + 0.9*xa;
+          yb = 0.07 + 0.85*yb;
+        }
+        x.push_back(xa);
+        y.push_back(yb);
+        z.push_back(body == 0 ? 0.0 : -0.002 + 0.01*sin(3*xa)*sin(2*yb));
+      }
+    }
+
+    for (int jb = 0; jb < mb; ++jb) {
+      for (int ja = 0; ja < mb; ++ja) {
+        const int a = 2*ja;
+        const int b = 2*jb;
+        int id[3][3]; // node IDs of the patch (1-based)
+        for (int k = 0; k < 3; ++k) {
+          for (int l = 0; l < 3; ++l) {
+            id[k][l] = offset + (b + l)*q + a + k + 1;
+          }
+        }
+        // The lower surface faces +z, the upper one -z:
+        if (nsn == 4 || nsn == 8) {
+          const int lower[8] = {id[0][0], id[2][0], id[2][2], id[0][2], id[1][0], id[2][1], id[1][2], id[0][1]};
+          const int upper[8] = {id[0][0], id[0][2], id[2][2], id[2][0], id[0][1], id[1][2], id[2][1], id[1][0]};
+          m.IEN.insert(m.IEN.end(), body == 0 ? lower : upper, (body == 0 ? lower : upper) + nsn);
+          m.elementID.push_back(++el);
+          m.segmentID.push_back(1);
+        }
+        else {
+          const int lower[12] = {id[0][0], id[2][0], id[2][2], id[1][0], id[2][1], id[1][1],
+                                 id[0][0], id[2][2], id[0][2], id[1][1], id[1][2], id[0][1]};
+          const int upper[12] = {id[0][0], id[2][2], id[2][0], id[1][1], id[2][1], id[1][0],
+                                 id[0][0], id[0][2], id[2][2], id[0][1], id[1][2], id[1][1]};
+          m.IEN.insert(m.IEN.end(), body == 0 ? lower : upper, (body == 0 ? lower : upper) + 12);
+          m.elementID.push_back(++el);
+          m.segmentID.push_back(1);
+          m.elementID.push_back(++el);
+          m.segmentID.push_back(1);
+        }
+      }
+    }
+  }
+  m.X = x;
+  m.X.insert(m.X.end(), y.begin(), y.end());
+  m.X.insert(m.X.end(), z.begin(), z.end());
+  evaluateGaussRule(m);
+  return m;
+}
+
+/*! Contact problem of two surfaces with the friction history of a previous state */
+struct ContactProblem {
+  Surfaces m;
+  int n;                        // number of segments
+  int numOfRows;                // rows of the GPs table
+  int numOfCols;                // columns of the GPs table
+  int neq;
+  int nsg;                      // slave Gauss points (numOfRows for the two-pass algorithm)
+  double epsN;
+  double epsT;
+  double mu;
+  std::vector<double> GPs0;     // GPs table of the previous state
+};
+
+static void searchContact(ContactProblem& P, const std::vector<double>& U, std::vector<double>& GPs) {
+  Surfaces& m = P.m;
+  const int nsd = m.nsd;
+  const int npd = m.npd;
+  std::vector<double> x(m.X);
+  for (int i = 0; i < P.neq; ++i) {
+    x[i] += U[i];
+  }
+  double longestEdge;
+  double AABBmin[3] = {0.0, 0.0, 0.0};
+  double AABBmax[3] = {0.0, 0.0, 0.0};
+  prepareContactSurface(&longestEdge, AABBmin, AABBmax, &GPs[0], P.n, nsd, npd, m.ngp, P.neq, m.nsn, m.nes, m.nen, &m.elementID[0], &m.segmentID[0], &m.ISN[0], &m.IEN[0], &m.H[0], &x[0]);
+  int N[3];
+  int numOfCells;
+  getAutoBucketGridSize(N, &numOfCells, AABBmin, AABBmax, nsd, longestEdge, P.numOfRows, 0);
+
+  // Friction history (isStick, t_T, Xi0_m and t_N0) of the previous state:
+  for (int c = nsd + npd + 6; c < P.numOfCols; ++c) {
+    for (int v = 0; v < P.numOfRows; ++v) {
+      GPs[c*P.numOfRows + v] = P.GPs0[c*P.numOfRows + v];
+    }
+  }
+  evaluateContactConstraintsSlaveCentric(&GPs[0], &m.ISN[0], &m.IEN[0], N, AABBmin, AABBmax, &x[0], &m.elementID[0], &m.segmentID[0], P.n, m.nsn, nsd, npd, m.ngp, m.nen, m.nes, P.neq, longestEdge);
+}
+
+/*! Contact residual Gc and, if K is given, the dense contact tangent K (neq x neq, row-major) */
+static void evaluateResidual(ContactProblem& P, const std::vector<double>& U, std::vector<double>& Gc, std::vector<double>* K) {
+  Surfaces& m = P.m;
+  const int nsd = m.nsd;
+  const int npd = m.npd;
+  std::vector<double> GPs(P.GPs0);
+  searchContact(P, U, GPs);
+
+  std::vector<double> activeGPs(GPs.begin() + (nsd + npd + 3)*P.numOfRows, GPs.begin() + (nsd + npd + 4)*P.numOfRows);
+  std::vector<int> rowPtr(P.neq + 1);
+  buildContactSparsityPattern(&rowPtr[0], NULL, &GPs[0], &m.ISN[0], &m.IEN[0], &activeGPs[0], P.neq, nsd, npd, m.ngp, m.nes, m.nsn, m.nen, P.numOfRows, P.nsg);
+  std::vector<int> colInd(rowPtr[P.neq] + 1);
+  buildContactSparsityPattern(&rowPtr[0], &colInd[0], &GPs[0], &m.ISN[0], &m.IEN[0], &activeGPs[0], P.neq, nsd, npd, m.ngp, m.nes, m.nsn, m.nen, P.numOfRows, P.nsg);
+  std::vector<double> vals(rowPtr[P.neq] + 1);
+  Gc.assign(P.neq, 0.0);
+  assembleContactResidualAndStiffnessCSR(&Gc[0], &vals[0], &rowPtr[0], &colInd[0], &GPs[0], &m.ISN[0], &m.IEN[0], &m.X[0], const_cast<double*>(&U[0]), &m.H[0], &m.dH[0], &m.gw[0], &activeGPs[0], P.neq, nsd, npd, m.ngp, m.nes, m.nsn, m.nen, P.numOfRows, P.epsN, P.epsT, P.mu, true, true, false, P.nsg);
+
+  if (K) {
+    K->assign((size_t)P.neq*P.neq, 0.0);
+    for (int row = 0; row < P.neq; ++row) {
+      for (int k = rowPtr[row]; k < rowPtr[row + 1]; ++k) {
+        (*K)[(size_t)row*P.neq + colInd[k]] += vals[k];
+      }
+    }
+  }
+}
+
+/*! Compare the BSR tangent and the matrix-free operator with the CSR tangent K (see evaluateResidual) */
+static int checkAssemblies(ContactProblem& P, const std::vector<double>& U, const std::vector<double>& Gc, const std::vector<double>& K, const char* name) {
+  const double tol = 1e-12;
+  Surfaces& m = P.m;
+  const int nsd = m.nsd;
+  const int npd = m.npd;
+  const int neq = P.neq;
+  std::vector<double> GPs0(P.GPs0);
+  searchContact(P, U, GPs0);
+  std::vector<double> activeGPs(GPs0.begin() + (nsd + npd + 3)*P.numOfRows, GPs0.begin() + (nsd + npd + 4)*P.numOfRows);
+
+  double maxK = 0.0;
+  for (size_t k = 0; k < K.size(); ++k) {
+    maxK = std::max(maxK, fabs(K[k]));
+  }
+  double maxG = 0.0;
+  for (int row = 0; row < neq; ++row) {
+    maxG = std::max(maxG, fabs(Gc[row]));
+  }
+  int failures = 0;
+
+  // BSR: the blocks have to give the same dense tangent
+  const int nnod = neq / nsd;
+  std::vector<int> blockRowPtr(nnod + 1);
+  buildContactBlockSparsityPattern(&blockRowPtr[0], NULL, &GPs0[0], &m.ISN[0], &m.IEN[0], &activeGPs[0], neq, nsd, npd, m.ngp, m.nes, m.nsn, m.nen, P.numOfRows, P.nsg);
+  std::vector<int> blockColInd(blockRowPtr[nnod] + 1);
+  buildContactBlockSparsityPattern(&blockRowPtr[0], &blockColInd[0], &GPs0[0], &m.ISN[0], &m.IEN[0], &activeGPs[0], neq, nsd, npd, m.ngp, m.nes, m.nsn, m.nen, P.numOfRows, P.nsg);
+  std::vector<double> blockVals((size_t)(blockRowPtr[nnod] + 1)*nsd*nsd);
+  std::vector<double> GcB(neq, 0.0);
+  std::vector<double> GPs(GPs0);
+  assembleContactResidualAndStiffnessBSR(&GcB[0], &blockVals[0], &blockRowPtr[0], &blockColInd[0], &GPs[0], &m.ISN[0], &m.IEN[0], &m.X[0], const_cast<double*>(&U[0]), &m.H[0], &m.dH[0], &m.gw[0], &activeGPs[0], neq, nsd, npd, m.ngp, m.nes, m.nsn, m.nen, P.numOfRows, P.epsN, P.epsT, P.mu, true, true, false, P.nsg);
+  std::vector<double> KB((size_t)neq*neq, 0.0);
+  for (int a = 0; a < nnod; ++a) {
+    for (int p = blockRowPtr[a]; p < blockRowPtr[a + 1]; ++p) {
+      for (int kdof = 0; kdof < nsd; ++kdof) {
+        for (int jdof = 0; jdof < nsd; ++jdof) {
+          KB[(size_t)(a*nsd + kdof)*neq + blockColInd[p]*nsd + jdof] += blockVals[((size_t)p*nsd + kdof)*nsd + jdof];
+        }
+      }
+    }
+  }
+  double errorBSR = 0.0;
+  for (size_t k = 0; k < K.size(); ++k) {
+    errorBSR = std::max(errorBSR, fabs(KB[k] - K[k]) / maxK);
+  }
+  for (int row = 0; row < neq; ++row) {
+    errorBSR = std::max(errorBSR, fabs(GcB[row] - Gc[row]) / maxG);
+  }
+  if (errorBSR > tol) {
+    printf("FAILED %s: BSR differs from CSR by %.3g\n", name, errorBSR);
+    failures++;
+  }
+
+  // Operator: Gc and the products with K for a few vectors
+  ContactOperator* op = createContactOperator();
+  std::vector<double> GcO(neq, 0.0);
+  GPs = GPs0;
+  assembleContactResidualAndOperator(&GcO[0], op, &GPs[0], &m.ISN[0], &m.IEN[0], &m.X[0], const_cast<double*>(&U[0]), &m.H[0], &m.dH[0], &m.gw[0], &activeGPs[0], neq, nsd, npd, m.ngp, m.nes, m.nsn, m.nen, P.numOfRows, P.epsN, P.epsT, P.mu, true, false, P.nsg);
+  double errorOperator = 0.0;
+  for (int row = 0; row < neq; ++row) {
+    errorOperator = std::max(errorOperator, fabs(GcO[row] - Gc[row]) / maxG);
+  }
+  for (int k = 0; k < 3; ++k) {
+    std::vector<double> v(neq);
+    double maxV = 0.0;
+    for (int col = 0; col < neq; ++col) {
+      v[col] = k == 0 ? 1.0 : sin(0.71*(k + 1)*col);
+      maxV = std::max(maxV, fabs(v[col]));
+    }
+    std::vector<double> y(neq, 0.0);
+    applyContactStiffness(&y[0], &v[0], op);
+    for (int row = 0; row < neq; ++row) {
+      double Kv = 0.0;
+      for (int col = 0; col < neq; ++col) {
+        Kv += K[(size_t)row*neq + col]*v[col];
+      }
+      errorOperator = std::max(errorOperator, fabs(y[row] - Kv) / (maxK*maxV*neq));
+    }
+  }
+  destroyContactOperator(op);
+  printf("%-24s BSR error %.3g  operator error %.3g\n", "", errorBSR, errorOperator);
+  if (errorOperator > tol) {
+    printf("FAILED %s: applyContactStiffness differs from the CSR tangent by %.3g\n", name, errorOperator);
+    failures++;
+  }
+  return failures;
+}
+
+/*! Test case: surfaces, sliding of the upper surface, algorithm and friction */
+struct TangentCase {
+  const char* name;
+  int nsn;
+  double slide;                 // tangential displacement of the upper surface
+  bool isMasterSlave;           // the lower surface is slave (otherwise two-pass algorithm)
+  double mu;
+  double epsT;
+};
+
+static int numOfFailures = 0;
+
+static void testTangent(const TangentCase& t) {
+  const double h = 1e-7;
+  const double tol = 1e-6;
+
+  ContactProblem P;
+  P.m = t.nsn == 2 ? makeSurfaces2D(6, 5) : makeSurfaces3D(t.nsn, 2, 2);
+  Surfaces& m = P.m;
+  const int nsd = m.nsd;
+  const int npd = m.npd;
+  const int nnod = m.numOfNodes();
+  P.n = (int)m.elementID.size();
+  P.numOfRows = P.n*m.ngp;
+  P.numOfCols = nsd + 3*npd + 8;
+  P.neq = nnod*nsd;
+  P.nsg = t.isMasterSlave ? m.numOfLowerSegments*m.ngp : P.numOfRows;
+  P.epsN = 1e3;
+  P.epsT = t.epsT;
+  P.mu = t.mu;
+
+  // Previous state: the initial configuration with zero tractions
+  P.GPs0.assign((size_t)P.numOfRows*P.numOfCols, 0.0);
+  std::vector<double> U(P.neq, 0.0);
+  searchContact(P, U, P.GPs0);
+  for (int pdf = 0; pdf < npd; ++pdf) {
+    for (int v = 0; v < P.numOfRows; ++v) {
+      P.GPs0[(nsd + 2*npd + 7 + pdf)*P.numOfRows + v] = P.GPs0[(nsd + 3 + pdf)*P.numOfRows + v];
+    }
+  }
+
+  // Current state: a small smooth perturbation of all nodes and the sliding of the upper surface
+  int firstUpperNode = nnod;
+  for (int e = m.numOfLowerSegments; e < P.n; ++e) {
+    for (int j = 0; j < m.nen; ++j) {
+      firstUpperNode = std::min(firstUpperNode, m.IEN[e*m.nen + j] - 1);
+    }
+  }
+  for (int a = 0; a < nnod; ++a) {
+    for (int k = 0; k < nsd; ++k) {
+      U[k*nnod + a] = 1e-4*sin(0.37*(k*nnod + a));
+      if (a >= firstUpperNode && k == 0) {
+        U[k*nnod + a] += t.slide;
+      }
+      if (a >= firstUpperNode && k == 1 && nsd == 3) {
+        U[k*nnod + a] += 0.5*t.slide;
+      }
+    }
+  }
+
+  ContactStats stats = ContactStats();
+  setContactStatsOutput(&stats);
+  std::vector<double> Gc;
+  std::vector<double> K;
+  evaluateResidual(P, U, Gc, &K);
+  setContactStatsOutput(NULL);
+
+  double maxK = 0.0;
+  for (size_t k = 0; k < K.size(); ++k) {
+    maxK = std::max(maxK, fabs(K[k]));
+  }
+
+  // Columns of K are the residual DOFs node*nsd + k, U is stored by coords (k*nnod + node):
+  double maxError = 0.0;
+  for (int col = 0; col < P.neq; ++col) {
+    const int idx = (col % nsd)*nnod + col / nsd;
+    std::vector<double> Up(U);
+    std::vector<double> Um(U);
+    Up[idx] += h;
+    Um[idx] -= h;
+    std::vector<double> Gp;
+    std::vector<double> Gm;
+    evaluateResidual(P, Up, Gp, NULL);
+    evaluateResidual(P, Um, Gm, NULL);
+    for (int row = 0; row < P.neq; ++row) {
+      const double fd = (Gp[row] - Gm[row]) / (2*h);
+      const double error = fabs(fd - K[(size_t)row*P.neq + col]);
+      maxError = std::max(maxError, error);
+      if (error > tol*maxK) {
+        printf("FAILED %s: K(%d, %d) = %.10g, expected %.10g\n", t.name, row, col, K[(size_t)row*P.neq + col], fd);
+        numOfFailures++;
+      }
+    }
+  }
+  printf("%-24s stick %2d slip %2d  max|K| %.4g  max error %.3g\n", t.name, stats.numOfStickGPs, stats.numOfSlipGPs, maxK, maxError / maxK);
+
+  numOfFailures += checkAssemblies(P, U, Gc, K, t.name);
+
+  if (stats.numOfSlipGPs + stats.numOfStickGPs == 0) {
+    printf("FAILED %s: no active Gauss points\n", t.name);
+    numOfFailures++;
+  }
+}
+
+int main() {
+  const TangentCase cases[] = {
+    {"2d frictionless",         2, 0.0,  false, 0.0, 1e3},
+    {"2d friction ms",          2, 0.01, true,  0.3, 1e3},
+    {"3d4 frictionless",        4, 0.0,  false, 0.0, 1e3},
+    {"3d4 friction ms",         4, 0.0,  true,  0.3, 1e3},
+    {"3d6 frictionless",        6, 0.0,  false, 0.0, 1e3},
+    {"3d6 friction",            6, 0.0,  false, 0.3, 1e3},
+    {"3d6 slip ms",             6, 0.01, true,  0.3, 1e3},
+    {"3d8 frictionless",        8, 0.0,  false, 0.0, 1e3},
+    {"3d8 frictionless ms",     8, 0.0,  true,  0.0, 1e3},
+    {"3d8 friction ms",         8, 0.0,  true,  0.3, 1e3},
+    {"3d8 slip ms",             8, 0.01, true,  0.3, 1e3},
+  };
+  for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); ++k) {
+    testTangent(cases[k]);
+  }
+
+  if (numOfFailures > 0) {
+    printf("%d checks FAILED\n", numOfFailures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
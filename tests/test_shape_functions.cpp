@@ -0,0 +1,138 @@
+/**
+\file test_shape_functions.cpp
+Test of the shape functions of contact segments (sfd2, sfd4, sfd6, sfd8 and their batched variants)
+
+The 1st derivatives are compared with central differences of the shape function values and
+the batched variants with the single-point ones. In particular, it guards the r-derivatives
+dH[6] and dH[7] of the 8-node quadrilateral (sfd8).
+
+Usage:
+  test_shape_functions
+
+Returns 0 when all checks pass, 1 otherwise.
+*/
+#include <stdio.h>
+#include <math.h>
+
+#include <vector>
+
+#include "contactino.h"
+
+typedef void (*ShapeFunctions)(double* H, double* dH, double r, double s);
+typedef void (*ShapeFunctionsBatch)(double* H, double* dH, const double* r, const double* s, int np);
+
+static void sfd2Scalar(double* H, double* dH, double r, double) {
+  sfd2(H, dH, r);
+}
+
+static void sfd2BatchScalar(double* H, double* dH, const double* r, const double*, int np) {
+  sfd2Batch(H, dH, r, np);
+}
+
+/*! Shape functions of a segment type under test */
+struct SegmentType {
+  const char* name;
+  int nsn;                      // Number of Segment Nodes
+  int npd;                      // Number of Parametric Dimensions
+  bool isTriangle;              // parametric domain r, s >= 0, r + s <= 1 (otherwise -1 <= r, s <= 1)
+  ShapeFunctions sfd;
+  ShapeFunctionsBatch sfdBatch;
+};
+
+static int numOfFailures = 0;
+
+static void check(bool condition, const char* name, const char* what, int k, double r, double s, double value, double expected) {
+  if (!condition) {
+    printf("FAILED %s: %s[%d] at (%g, %g) = %.15g, expected %.15g\n", name, what, k, r, s, value, expected);
+    numOfFailures++;
+  }
+}
+
+static void testSegmentType(const SegmentType& t) {
+  const int nsn = t.nsn;
+  const int npd = t.npd;
+  const double h = 1e-6;
+  const double tolFD = 1e-8;
+  const double tolBatch = 1e-14;
+
+  // Points of the parametric domain (interior, edges and corners):
+  std::vector<double> r;
+  std::vector<double> s;
+  const int m = 6;
+  for (int b = 0; b <= (npd == 2 ? m : 0); ++b) {
+    for (int a = 0; a <= m; ++a) {
+      if (t.isTriangle) {
+        if (a + b > m) {
+          continue;
+        }
+        r.push_back((double)a / m);
+        s.push_back((double)b / m);
+      }
+      else {
+        r.push_back(-1.0 + 2.0*a / m + 0.01*(b - 3));
+        s.push_back(npd == 2 ? -1.0 + 2.0*b / m + 0.01*(a - 3) : 0.0);
+      }
+    }
+  }
+  const int np = (int)r.size();
+
+  std::vector<double> HBatch(nsn*np);
+  std::vector<double> dHBatch(nsn*npd*np);
+  t.sfdBatch(&HBatch[0], &dHBatch[0], &r[0], &s[0], np);
+
+  for (int p = 0; p < np; ++p) {
+    double H[8];
+    double dH[16];
+    double Hp[8];
+    double Hm[8];
+    double dHtmp[16];
+    t.sfd(H, dH, r[p], s[p]);
+
+    // Partition of unity:
+    double sum = 0.0;
+    for (int j = 0; j < nsn; ++j) {
+      sum += H[j];
+    }
+    check(fabs(sum - 1.0) < tolBatch, t.name, "sum H", 0, r[p], s[p], sum, 1.0);
+
+    // Derivatives against central differences of H:
+    for (int pdf = 0; pdf < npd; ++pdf) {
+      const double dr = pdf == 0 ? h : 0.0;
+      const double ds = pdf == 1 ? h : 0.0;
+      t.sfd(Hp, dHtmp, r[p] + dr, s[p] + ds);
+      t.sfd(Hm, dHtmp, r[p] - dr, s[p] - ds);
+      for (int j = 0; j < nsn; ++j) {
+        const double fd = (Hp[j] - Hm[j]) / (2*h);
+        check(fabs(dH[pdf*nsn + j] - fd) < tolFD, t.name, "dH", pdf*nsn + j, r[p], s[p], dH[pdf*nsn + j], fd);
+      }
+    }
+
+    // Batched variant against the single-point one:
+    for (int j = 0; j < nsn; ++j) {
+      check(fabs(HBatch[j*np + p] - H[j]) < tolBatch, t.name, "HBatch", j, r[p], s[p], HBatch[j*np + p], H[j]);
+    }
+    for (int k = 0; k < nsn*npd; ++k) {
+      check(fabs(dHBatch[k*np + p] - dH[k]) < tolBatch, t.name, "dHBatch", k, r[p], s[p], dHBatch[k*np + p], dH[k]);
+    }
+  }
+  printf("%-6s %3d points checked\n", t.name, np);
+}
+
+int main() {
+  const SegmentType types[] = {
+    {"sfd2", 2, 1, false, sfd2Scalar, sfd2BatchScalar},
+    {"sfd4", 4, 2, false, sfd4, sfd4Batch},
+    {"sfd6", 6, 2, true, sfd6, sfd6Batch},
+    {"sfd8", 8, 2, false, sfd8, sfd8Batch},
+  };
+  for (size_t k = 0; k < sizeof(types) / sizeof(types[0]); ++k) {
+    testSegmentType(types[k]);
+  }
+
+  if (numOfFailures > 0) {
+    printf("%d checks FAILED\n", numOfFailures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}